@@ -0,0 +1,206 @@
+#include "BenchUtil.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>			// for std::atol
+#include <cstring>			// for std::memset
+#include <csignal>			// for kill, SIGTERM, SIGKILL
+#include <ctime>			// for clock_gettime, nanosleep
+#include <unistd.h>			// for close, write, fork, execv, pipe, dup2, sysconf, chdir
+#include <fcntl.h>			// for fcntl, open, O_NONBLOCK
+#include <cerrno>			// for errno
+#include <netinet/in.h>		// for sockaddr_in
+#include <netinet/tcp.h>	// for TCP_NODELAY
+#include <arpa/inet.h>		// for inet_pton
+#include <sys/socket.h>		// for socket, connect
+#include <sys/resource.h>	// for getrlimit, setrlimit
+#include <sys/wait.h>		// for waitpid
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															HELPERS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+uint64_t nowNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void sleepMillis(long ms)
+{
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+void raiseFileLimit(int sockets)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+		return;
+	rlim_t wanted = static_cast<rlim_t>(sockets) * 2 + 64;
+	if (limit.rlim_cur >= wanted)
+		return;
+	limit.rlim_cur = wanted < limit.rlim_max ? wanted : limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+int connectNonBlocking(const std::string &host, int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool waitForServer(const std::string &host, int port, double timeoutSeconds)
+{
+	uint64_t deadline = nowNanos() + static_cast<uint64_t>(timeoutSeconds * 1e9);
+	while (nowNanos() < deadline)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+		bool ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+		close(fd);
+		if (ok)
+			return true;
+		sleepMillis(50);
+	}
+	return false;
+}
+
+ProcessSample sampleProcess(long pid)
+{
+	ProcessSample sample;
+	std::memset(&sample, 0, sizeof(sample));
+	if (pid <= 0)
+		return sample;
+
+	std::ostringstream path;
+	path << "/proc/" << pid << "/stat";
+	std::ifstream stat(path.str().c_str());
+	std::string line;
+	if (!std::getline(stat, line) || line.rfind(')') == std::string::npos)
+		return sample;
+	// fields after the command name start at field 3 (state); utime and stime are fields 14 and 15
+	std::istringstream fields(line.substr(line.rfind(')') + 2));
+	std::string skip;
+	for (int i = 3; i < 14; ++i)
+		fields >> skip;
+	unsigned long utime = 0, stime = 0;
+	fields >> utime >> stime;
+	double ticks = static_cast<double>(sysconf(_SC_CLK_TCK));
+	sample.userSeconds = utime / ticks;
+	sample.systemSeconds = stime / ticks;
+
+	std::ostringstream statusPath;
+	statusPath << "/proc/" << pid << "/status";
+	std::ifstream status(statusPath.str().c_str());
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			sample.rssKb = std::atol(line.c_str() + 6);
+		else if (line.compare(0, 6, "VmHWM:") == 0)
+			sample.peakRssKb = std::atol(line.c_str() + 6);
+	}
+	sample.valid = true;
+	return sample;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															SERVER PROCESS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+ServerProcess::ServerProcess() : _pid(0), _console(-1) {}
+
+ServerProcess::~ServerProcess()
+{
+	stop();
+}
+
+bool ServerProcess::spawn(const std::string &binary, int port, const std::string &password, const std::string &directory)
+{
+	int fds[2];
+	if (pipe(fds) == -1)
+		return false;
+	pid_t child = fork();
+	if (child == -1)
+		return false;
+	if (child == 0)
+	{
+		dup2(fds[0], STDIN_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		int null = open("/dev/null", O_WRONLY);
+		if (null != -1)
+		{
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+			close(null);
+		}
+		if (!directory.empty() && chdir(directory.c_str()) == -1)
+			_exit(127);
+		std::ostringstream portText;
+		portText << port;
+		std::string portArg = portText.str();
+		char *args[] = { const_cast<char *>(binary.c_str()), const_cast<char *>(portArg.c_str()),
+						 const_cast<char *>(password.c_str()), NULL };
+		execv(binary.c_str(), args);
+		_exit(127);
+	}
+	close(fds[0]);
+	_console = fds[1];
+	_pid = child;
+	return true;
+}
+
+bool ServerProcess::command(const std::string &line)
+{
+	std::string text = line + "\n";
+	return _console != -1 && write(_console, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+}
+
+// after an upgrade _pid has exited already and "quit" reaches the process that took over
+void ServerProcess::stop()
+{
+	if (_pid <= 0)
+		return;
+	if (write(_console, "quit\n", 5) != 5)
+		kill(_pid, SIGTERM);
+	close(_console);
+	for (int i = 0; i < 50; ++i)
+	{
+		if (waitpid(_pid, NULL, WNOHANG) == _pid)
+		{
+			_pid = 0;
+			return;
+		}
+		sleepMillis(100);
+	}
+	kill(_pid, SIGKILL);
+	waitpid(_pid, NULL, 0);
+	_pid = 0;
+}
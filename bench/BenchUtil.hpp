@@ -0,0 +1,73 @@
+#ifndef BENCHUTIL_HPP
+#define BENCHUTIL_HPP
+
+#include <string>
+#include <stdint.h>		// for uint64_t
+
+// shared by the benchmark tools (loadgen, replay, sim)
+
+uint64_t	nowNanos();												// CLOCK_MONOTONIC, comparable across the tool's clients
+void		sleepMillis(long ms);
+void		raiseFileLimit(int sockets);							// allow this many sockets (a spawned server inherits it)
+int			connectNonBlocking(const std::string &host, int port);	// TCP socket with connect() in progress, -1 on failure
+bool		waitForServer(const std::string &host, int port, double timeoutSeconds);
+
+// server process CPU time and memory, from /proc/<pid>/stat and /proc/<pid>/status
+struct ProcessSample {
+	double	userSeconds;
+	double	systemSeconds;
+	long	rssKb;
+	long	peakRssKb;
+	bool	valid;
+};
+
+ProcessSample	sampleProcess(long pid);
+
+// xorshift64*, reproducible across runs with the same seed
+class Random {
+
+	private:
+		uint64_t	_state;
+
+		static uint64_t	multiplier() { return (static_cast<uint64_t>(0x2545F491) << 32) | 0x4F6CDD1D; }
+
+	public:
+		explicit Random(unsigned seed) : _state(seed * multiplier() + 1) {}
+
+		uint64_t	next()
+		{
+			_state ^= _state >> 12;
+			_state ^= _state << 25;
+			_state ^= _state >> 27;
+			return _state * multiplier();
+		}
+		unsigned	below(unsigned n) { return static_cast<unsigned>(next() % n); }
+		double		unit() { return static_cast<double>(next() >> 11) / 9007199254740992.0; }
+};
+
+/*
+	The spawned server reads its console from a pipe we hold (the server polls
+	stdin, so /dev/null would keep it spinning on EOF) and is stopped the same
+	way an operator would stop it: by writing "quit".
+*/
+class ServerProcess {
+
+	private:
+		long	_pid;
+		int		_console;											// write end of the server's stdin
+
+		ServerProcess(const ServerProcess &copy);
+		ServerProcess &operator=(const ServerProcess &other);
+
+	public:
+		ServerProcess();
+		~ServerProcess();
+
+		long	pid() const { return _pid; }
+		bool	spawn(const std::string &binary, int port, const std::string &password,
+					const std::string &directory = "");			// directory: its working directory (config/ircserv.conf)
+		bool	command(const std::string &line);				// type a console command ("upgrade", "stats")
+		void	stop();
+};
+
+#endif
@@ -0,0 +1,906 @@
+/*
+	ircserv load generator.
+
+	Opens many simulated clients against a local server, registers them, joins
+	them to a channel topology and then runs a PRIVMSG/JOIN/PART/NICK mix at a
+	fixed total rate. Every PRIVMSG carries its send time, so the receiving
+	clients (all in this process) measure end-to-end delivery latency. Server
+	CPU time and RSS are read from /proc. Results are written as JSON so runs
+	of different builds can be compared.
+
+	./bench/loadgen --port 6667 --password pw [options]       (server already running, add --pid for CPU/RSS)
+	./bench/loadgen --server ./ircserv [options]               (spawn the server, stop it with "quit")
+	./bench/loadgen --server ./ircserv --nodes 3 [options]     (a chain of linked servers on --port, --port + 1, ...)
+
+	With --nodes, client i connects to node i % nodes and the latency is also
+	reported separately for messages that crossed links and those that did not.
+
+	Topologies:
+		single   every client joins one channel
+		uniform  each client joins --joins of --channels channels, picked uniformly
+		zipf     like uniform, but channel i is picked with weight 1/(i+1) (few huge channels)
+		direct   no channels, PRIVMSG goes to a random client's nickname
+*/
+#include "Metrics.hpp"		// for Histogram
+#include "BenchUtil.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>			// for std::atoi, std::strtod, std::strtoull
+#include <cstring>			// for std::memset, std::strerror
+#include <cerrno>			// for errno
+#include <csignal>			// for std::signal, SIGPIPE
+#include <unistd.h>			// for close, unlink, rmdir
+#include <climits>			// for PATH_MAX
+#include <poll.h>			// for poll
+#include <sys/socket.h>		// for send, recv, getsockopt
+#include <sys/resource.h>	// for getrusage
+#include <sys/stat.h>		// for mkdir
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															OPTIONS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+enum OpKind { OP_PRIVMSG, OP_JOIN, OP_PART, OP_NICK, OP_COUNT };
+
+static const char *const OP_NAMES[OP_COUNT] = { "privmsg", "join", "part", "nick" };
+
+struct Options {
+	std::string	host;
+	int			port;
+	std::string	password;
+	std::string	server;										// binary to spawn ("" = use a running server)
+	int			nodes;										// linked servers to spawn (with --server)
+	long		pid;										// running server to sample (0 = unknown)
+	int			clients;
+	std::string	topology;
+	int			channels;
+	int			joins;										// channels per client (uniform, zipf)
+	bool		partGeneral;								// leave the auto-joined #general before measuring
+	double		rate;										// operations per second, all clients together
+	double		duration;									// measured seconds
+	double		warmup;										// seconds of load before measuring
+	double		drain;										// seconds to wait for in-flight messages
+	double		upgradeAfter;								// measured seconds before "upgrade" is typed (0 = never)
+	int			mix[OP_COUNT];								// relative weights
+	int			payload;									// PRIVMSG text size in bytes
+	unsigned	seed;
+	std::string	out;										// JSON file ("" = stdout)
+
+	Options() : host("127.0.0.1"), port(16900), password("bench"), nodes(1), pid(0), clients(500),
+		topology("uniform"), channels(50), joins(3), partGeneral(true), rate(5000), duration(10),
+		warmup(1), drain(2), upgradeAfter(0), payload(64), seed(42)
+	{
+		mix[OP_PRIVMSG] = 90;
+		mix[OP_JOIN] = 4;
+		mix[OP_PART] = 4;
+		mix[OP_NICK] = 2;
+	}
+};
+
+static void usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [options]\n"
+		"  --server <path>        spawn this ircserv binary on --port (stopped with \"quit\")\n"
+		"  --nodes <n>            spawn n linked servers (a chain) on --port and up, spread the clients (1)\n"
+		"  --host <ip>            server address (127.0.0.1)\n"
+		"  --port <n>             server port (16900)\n"
+		"  --password <pass>      connection password (bench)\n"
+		"  --pid <pid>            running server to sample for CPU and RSS\n"
+		"  --clients <n>          simulated clients (500)\n"
+		"  --topology <name>      single | uniform | zipf | direct (uniform)\n"
+		"  --channels <n>         channels for uniform and zipf (50)\n"
+		"  --joins <n>            channels joined per client (3)\n"
+		"  --keep-general         stay in #general after registration\n"
+		"  --rate <ops/s>         total operation rate (5000)\n"
+		"  --duration <s>         measured seconds (10)\n"
+		"  --warmup <s>           unmeasured seconds of load first (1)\n"
+		"  --drain <s>            wait for in-flight messages at the end (2)\n"
+		"  --upgrade-after <s>    hot-upgrade the --server this far into the measurement\n"
+		"                         (no server CPU/RSS in the result: the pid changes)\n"
+		"  --mix <list>           weights, e.g. privmsg:90,join:4,part:4,nick:2\n"
+		"  --payload <bytes>      PRIVMSG text size (64)\n"
+		"  --seed <n>             random seed (42)\n"
+		"  --out <file>           write the JSON result here (stdout)\n";
+}
+
+static bool parseMix(const std::string &list, int *mix)
+{
+	for (int i = 0; i < OP_COUNT; ++i)
+		mix[i] = 0;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		size_t colon = item.find(':');
+		if (colon == std::string::npos)
+			return false;
+		std::string name = item.substr(0, colon);
+		int op = 0;
+		while (op < OP_COUNT && name != OP_NAMES[op])
+			++op;
+		if (op == OP_COUNT)
+			return false;
+		mix[op] = std::atoi(item.c_str() + colon + 1);
+	}
+	return mix[OP_PRIVMSG] + mix[OP_JOIN] + mix[OP_PART] + mix[OP_NICK] > 0;
+}
+
+static bool parseOptions(int argc, char **argv, Options &opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string key = argv[i];
+		if (key == "--keep-general")
+		{
+			opt.partGeneral = false;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+		std::string value = argv[++i];
+		if (key == "--server") opt.server = value;
+		else if (key == "--host") opt.host = value;
+		else if (key == "--port") opt.port = std::atoi(value.c_str());
+		else if (key == "--nodes") opt.nodes = std::atoi(value.c_str());
+		else if (key == "--password") opt.password = value;
+		else if (key == "--pid") opt.pid = std::atol(value.c_str());
+		else if (key == "--clients") opt.clients = std::atoi(value.c_str());
+		else if (key == "--topology") opt.topology = value;
+		else if (key == "--channels") opt.channels = std::atoi(value.c_str());
+		else if (key == "--joins") opt.joins = std::atoi(value.c_str());
+		else if (key == "--rate") opt.rate = std::strtod(value.c_str(), NULL);
+		else if (key == "--duration") opt.duration = std::strtod(value.c_str(), NULL);
+		else if (key == "--warmup") opt.warmup = std::strtod(value.c_str(), NULL);
+		else if (key == "--drain") opt.drain = std::strtod(value.c_str(), NULL);
+		else if (key == "--upgrade-after") opt.upgradeAfter = std::strtod(value.c_str(), NULL);
+		else if (key == "--payload") opt.payload = std::atoi(value.c_str());
+		else if (key == "--seed") opt.seed = static_cast<unsigned>(std::atol(value.c_str()));
+		else if (key == "--out") opt.out = value;
+		else if (key == "--mix") { if (!parseMix(value, opt.mix)) return false; }
+		else
+			return false;
+	}
+	if (opt.topology == "single")
+		opt.channels = opt.joins = 1;
+	else if (opt.topology == "direct")
+		opt.channels = opt.joins = 0;
+	else if (opt.topology != "uniform" && opt.topology != "zipf")
+		return false;
+	if (opt.joins > opt.channels)
+		opt.joins = opt.channels;
+	if (opt.nodes > 1 && opt.server.empty())
+		return false;
+	return opt.port > 0 && opt.port + opt.nodes - 1 <= 65535 && opt.nodes > 0 && opt.clients > 0 && opt.rate > 0 && opt.duration > 0
+		&& opt.payload >= 0 && opt.payload <= 400;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															LOAD GENERATOR:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+enum ClientState { IDLE, CONNECTING, REGISTERING, READY, CLOSED };
+
+struct SimClient {
+	int					fd;
+	ClientState			state;
+	std::string			nick;
+	std::string			input;								// bytes after the last complete line
+	std::string			output;								// bytes the socket did not take yet
+	std::vector<int>	channels;							// channels this client is in (as far as we sent)
+	int					pendingJoins;						// own JOIN echoes still expected
+	unsigned			renames;
+
+	SimClient() : fd(-1), state(IDLE), pendingJoins(0), renames(0) {}
+};
+
+struct Totals {
+	uint64_t	ops[OP_COUNT];								// operations issued while measuring
+	uint64_t	delivered;									// PRIVMSG lines received while measuring
+	uint64_t	bytesIn;
+	uint64_t	bytesOut;
+	uint64_t	errors;										// numeric 4xx/5xx replies
+	uint64_t	disconnects;
+};
+
+class LoadGenerator {
+
+	private:
+		static const int	CONNECT_WINDOW = 8;				// registrations in flight (the server's backlog is small)
+
+		const Options			&_opt;
+		Random					_random;
+		std::vector<SimClient>	_clients;
+		std::vector<double>		_zipf;						// cumulative channel weights
+		std::map<int, size_t>	_byFd;
+		std::vector<pollfd>		_pfds;
+		Histogram				_latency;					// ns, send time to delivery
+		Histogram				_crossNode;					// the part of _latency that crossed server links
+		Histogram				_sameNode;					// and the part that did not (--nodes)
+		Totals					_totals;
+		bool					_measuring;
+		uint64_t				_measureStart;				// PRIVMSG sent before this is not measured
+		std::string				_padding;
+
+		// socket handling
+		bool	startConnect(SimClient &client);
+		void	queue(SimClient &client, const std::string &line);
+		void	flush(SimClient &client);
+		void	receive(SimClient &client);
+		void	handleLine(SimClient &client, const std::string &line);
+		void	close(SimClient &client);
+		void	pollOnce(int timeoutMs);
+
+		// workload
+		int		pickChannel();
+		void	issue(SimClient &client, int op);
+		void	joinChannel(SimClient &client, int channel);
+		void	partChannel(SimClient &client, size_t index);
+
+		LoadGenerator(const LoadGenerator &copy);
+		LoadGenerator &operator=(const LoadGenerator &other);
+
+	public:
+		explicit LoadGenerator(const Options &opt);
+		~LoadGenerator();
+
+		int		registerAll(double timeoutSeconds);			// returns the number of ready clients
+		int		joinTopology(double timeoutSeconds);		// returns the number of joins confirmed
+		void	run(double seconds, bool measure);			// paced operation mix
+		void	drain(double seconds);
+		int		readyCount() const;
+		const Histogram	&latency() const { return _latency; }
+		const Histogram	&crossNode() const { return _crossNode; }
+		const Histogram	&sameNode() const { return _sameNode; }
+		const Totals	&totals() const { return _totals; }
+};
+
+LoadGenerator::LoadGenerator(const Options &opt)
+	: _opt(opt), _random(opt.seed), _clients(opt.clients), _measuring(false), _measureStart(0),
+	  _padding(opt.payload, 'x')
+{
+	std::memset(&_totals, 0, sizeof(_totals));
+	double sum = 0;
+	for (int i = 0; i < opt.channels; ++i)
+	{
+		sum += opt.topology == "zipf" ? 1.0 / (i + 1) : 1.0;
+		_zipf.push_back(sum);
+	}
+	for (size_t i = 0; i < _zipf.size(); ++i)
+		_zipf[i] /= sum;
+	for (int i = 0; i < opt.clients; ++i)
+	{
+		std::ostringstream nick;
+		nick << "b" << i;
+		_clients[i].nick = nick.str();
+	}
+}
+
+LoadGenerator::~LoadGenerator()
+{
+	for (size_t i = 0; i < _clients.size(); ++i)
+		if (_clients[i].fd != -1)
+			::close(_clients[i].fd);
+}
+
+bool LoadGenerator::startConnect(SimClient &client)
+{
+	int fd = connectNonBlocking(_opt.host, _opt.port + static_cast<int>(&client - &_clients[0]) % _opt.nodes);
+	if (fd == -1)
+		return false;
+	client.fd = fd;
+	client.state = CONNECTING;
+	_byFd[fd] = &client - &_clients[0];
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLOUT;
+	pfd.revents = 0;
+	_pfds.push_back(pfd);
+	queue(client, "PASS " + _opt.password);
+	queue(client, "NICK " + client.nick);
+	queue(client, "USER " + client.nick + " 0 * :load generator");
+	return true;
+}
+
+void LoadGenerator::queue(SimClient &client, const std::string &line)
+{
+	client.output += line;
+	client.output += "\r\n";
+}
+
+void LoadGenerator::flush(SimClient &client)
+{
+	if (client.output.empty() || client.fd == -1 || client.state == CONNECTING)
+		return;
+	ssize_t sent = send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+	if (sent > 0)
+	{
+		_totals.bytesOut += sent;
+		client.output.erase(0, sent);
+	}
+	else if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+		close(client);
+}
+
+void LoadGenerator::receive(SimClient &client)
+{
+	char buf[65536];
+	for (;;)
+	{
+		ssize_t bytes = recv(client.fd, buf, sizeof(buf), 0);
+		if (bytes <= 0)
+		{
+			if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				close(client);
+			return;
+		}
+		_totals.bytesIn += bytes;
+		client.input.append(buf, bytes);
+		size_t start = 0, end;
+		while ((end = client.input.find('\n', start)) != std::string::npos)
+		{
+			size_t length = end - start;
+			if (length > 0 && client.input[end - 1] == '\r')
+				--length;
+			handleLine(client, client.input.substr(start, length));
+			start = end + 1;
+		}
+		client.input.erase(0, start);
+		if (bytes < static_cast<ssize_t>(sizeof(buf)))
+			return;
+	}
+}
+
+// ":prefix COMMAND params" - only what the generator needs is looked at
+void LoadGenerator::handleLine(SimClient &client, const std::string &line)
+{
+	if (line.compare(0, 5, "PING ") == 0)
+	{
+		queue(client, "PONG " + line.substr(5));
+		return;
+	}
+	size_t space = line.find(' ');
+	if (line.empty() || line[0] != ':' || space == std::string::npos)
+		return;
+	std::string command = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+
+	if (command == "PRIVMSG")
+	{
+		size_t text = line.find(" :bench ", space);
+		if (text == std::string::npos)
+			return;
+		uint64_t sentAt = std::strtoull(line.c_str() + text + 8, NULL, 10);
+		if (_measuring && sentAt >= _measureStart)
+		{
+			++_totals.delivered;
+			uint64_t latency = nowNanos() - sentAt;
+			_latency.record(latency);
+			// the sender's index is in its nickname (b<index>, b<index>r<renames>)
+			if (_opt.nodes > 1 && line.compare(0, 2, ":b") == 0)
+			{
+				long sender = std::atol(line.c_str() + 2);
+				long receiver = &client - &_clients[0];
+				(sender % _opt.nodes == receiver % _opt.nodes ? _sameNode : _crossNode).record(latency);
+			}
+		}
+	}
+	else if (command == "001")
+		client.state = READY;
+	else if (command == "JOIN")
+	{
+		if (client.pendingJoins > 0 && line.compare(1, client.nick.size() + 1, client.nick + "!") == 0)
+			--client.pendingJoins;
+	}
+	else if (command.size() == 3 && (command[0] == '4' || command[0] == '5'))
+	{
+		if (_measuring)
+			++_totals.errors;
+		if (command == "464")
+			close(client);
+	}
+}
+
+void LoadGenerator::close(SimClient &client)
+{
+	if (client.fd == -1)
+		return;
+	for (size_t i = 0; i < _pfds.size(); ++i)
+		if (_pfds[i].fd == client.fd)
+		{
+			_pfds[i] = _pfds.back();
+			_pfds.pop_back();
+			break;
+		}
+	_byFd.erase(client.fd);
+	::close(client.fd);
+	client.fd = -1;
+	client.state = CLOSED;
+	++_totals.disconnects;
+}
+
+void LoadGenerator::pollOnce(int timeoutMs)
+{
+	for (size_t i = 0; i < _pfds.size(); ++i)
+	{
+		SimClient &client = _clients[_byFd[_pfds[i].fd]];
+		_pfds[i].events = POLLIN;
+		if (client.state == CONNECTING || !client.output.empty())
+			_pfds[i].events |= POLLOUT;
+	}
+	if (poll(_pfds.empty() ? NULL : &_pfds[0], _pfds.size(), timeoutMs) <= 0)
+		return;
+
+	// copy the ready fds first: close() reorders _pfds
+	std::vector<pollfd> ready;
+	for (size_t i = 0; i < _pfds.size(); ++i)
+		if (_pfds[i].revents)
+			ready.push_back(_pfds[i]);
+	for (size_t i = 0; i < ready.size(); ++i)
+	{
+		std::map<int, size_t>::iterator it = _byFd.find(ready[i].fd);
+		if (it == _byFd.end())
+			continue;
+		SimClient &client = _clients[it->second];
+		if (client.state == CONNECTING && (ready[i].revents & (POLLOUT | POLLERR | POLLHUP)))
+		{
+			int error = 0;
+			socklen_t length = sizeof(error);
+			getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+			if (error != 0)
+			{
+				close(client);
+				continue;
+			}
+			client.state = REGISTERING;
+		}
+		if (ready[i].revents & (POLLIN | POLLHUP | POLLERR))
+			receive(client);
+		if (client.fd != -1)
+			flush(client);
+	}
+}
+
+int LoadGenerator::readyCount() const
+{
+	int ready = 0;
+	for (size_t i = 0; i < _clients.size(); ++i)
+		if (_clients[i].state == READY)
+			++ready;
+	return ready;
+}
+
+// connect in a small window so the server's listen backlog never overflows
+int LoadGenerator::registerAll(double timeoutSeconds)
+{
+	uint64_t deadline = nowNanos() + static_cast<uint64_t>(timeoutSeconds * 1e9);
+	size_t next = 0;
+	while (nowNanos() < deadline)
+	{
+		int inFlight = 0;
+		for (size_t i = 0; i < next; ++i)
+			if (_clients[i].state == CONNECTING || _clients[i].state == REGISTERING)
+				++inFlight;
+		while (next < _clients.size() && inFlight < CONNECT_WINDOW)
+		{
+			if (startConnect(_clients[next]))
+				++inFlight;
+			else
+				_clients[next].state = CLOSED;
+			++next;
+		}
+		if (next == _clients.size() && inFlight == 0)
+			break;
+		pollOnce(10);
+	}
+	if (_opt.partGeneral)
+		for (size_t i = 0; i < _clients.size(); ++i)
+			if (_clients[i].state == READY)
+				queue(_clients[i], "PART #general");
+	return readyCount();
+}
+
+int LoadGenerator::pickChannel()
+{
+	double r = _random.unit();
+	size_t low = 0, high = _zipf.size() - 1;
+	while (low < high)
+	{
+		size_t mid = (low + high) / 2;
+		if (_zipf[mid] < r)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return static_cast<int>(low);
+}
+
+void LoadGenerator::joinChannel(SimClient &client, int channel)
+{
+	std::ostringstream line;
+	line << "JOIN #bench" << channel;
+	queue(client, line.str());
+	client.channels.push_back(channel);
+}
+
+void LoadGenerator::partChannel(SimClient &client, size_t index)
+{
+	std::ostringstream line;
+	line << "PART #bench" << client.channels[index];
+	queue(client, line.str());
+	client.channels[index] = client.channels.back();
+	client.channels.pop_back();
+}
+
+int LoadGenerator::joinTopology(double timeoutSeconds)
+{
+	int expected = 0;
+	for (size_t i = 0; i < _clients.size(); ++i)
+	{
+		SimClient &client = _clients[i];
+		if (client.state != READY)
+			continue;
+		for (int tries = 0; static_cast<int>(client.channels.size()) < _opt.joins && tries < _opt.joins * 8; ++tries)
+		{
+			int channel = pickChannel();
+			bool member = false;
+			for (size_t c = 0; c < client.channels.size(); ++c)
+				member = member || client.channels[c] == channel;
+			if (!member)
+				joinChannel(client, channel);
+		}
+		client.pendingJoins = client.channels.size();
+		expected += client.pendingJoins;
+		flush(client);
+	}
+
+	uint64_t deadline = nowNanos() + static_cast<uint64_t>(timeoutSeconds * 1e9);
+	int pending = expected;
+	while (pending > 0 && nowNanos() < deadline)
+	{
+		pollOnce(10);
+		pending = 0;
+		for (size_t i = 0; i < _clients.size(); ++i)
+			pending += _clients[i].pendingJoins;
+	}
+	return expected - pending;
+}
+
+// one operation of the mix; falls back to an operation that makes sense for the client's state
+void LoadGenerator::issue(SimClient &client, int op)
+{
+	if (op == OP_PART && client.channels.empty())
+		op = OP_JOIN;
+	if (op == OP_JOIN && static_cast<int>(client.channels.size()) >= _opt.channels)
+		op = OP_PRIVMSG;
+	if (op == OP_PRIVMSG && client.channels.empty() && _opt.topology != "direct")
+		op = OP_JOIN;
+	if (op == OP_JOIN && _opt.channels == 0)
+		op = OP_PRIVMSG;
+
+	std::ostringstream line;
+	switch (op)
+	{
+		case OP_PRIVMSG:
+		{
+			line << "PRIVMSG ";
+			if (_opt.topology == "direct")
+				line << _clients[_random.below(_clients.size())].nick;
+			else
+				line << "#bench" << client.channels[_random.below(client.channels.size())];
+			line << " :bench " << nowNanos() << " " << _padding;
+			queue(client, line.str());
+			break;
+		}
+		case OP_JOIN:
+		{
+			int channel = pickChannel();
+			for (size_t c = 0; c < client.channels.size(); ++c)
+				if (client.channels[c] == channel)
+					channel = -1;
+			if (channel == -1)
+				for (channel = 0; channel < _opt.channels; ++channel)
+				{
+					size_t c = 0;
+					while (c < client.channels.size() && client.channels[c] != channel)
+						++c;
+					if (c == client.channels.size())
+						break;
+				}
+			joinChannel(client, channel);
+			break;
+		}
+		case OP_PART:
+			partChannel(client, _random.below(client.channels.size()));
+			break;
+		case OP_NICK:
+		{
+			line << "b" << (&client - &_clients[0]) << "r" << ++client.renames;
+			client.nick = line.str();
+			queue(client, "NICK " + client.nick);
+			break;
+		}
+	}
+	if (_measuring)
+		++_totals.ops[op];
+	flush(client);
+}
+
+// open loop: operations are issued on schedule whether or not the server keeps up
+void LoadGenerator::run(double seconds, bool measure)
+{
+	int weightSum = 0;
+	for (int i = 0; i < OP_COUNT; ++i)
+		weightSum += _opt.mix[i];
+
+	uint64_t start = nowNanos();
+	uint64_t end = start + static_cast<uint64_t>(seconds * 1e9);
+	if (measure && !_measuring)
+	{
+		_measuring = true;
+		_measureStart = start;
+	}
+	uint64_t issued = 0;
+	for (uint64_t now = start; now < end; now = nowNanos())
+	{
+		uint64_t due = static_cast<uint64_t>((now - start) / 1e9 * _opt.rate);
+		for (; issued < due; ++issued)
+		{
+			SimClient &client = _clients[_random.below(_clients.size())];
+			if (client.state != READY)
+				continue;
+			int pick = static_cast<int>(_random.below(weightSum));
+			int op = 0;
+			while (pick >= _opt.mix[op])
+				pick -= _opt.mix[op++];
+			issue(client, op);
+		}
+		pollOnce(1);
+	}
+}
+
+// keep receiving (and measuring) what is still in flight
+void LoadGenerator::drain(double seconds)
+{
+	uint64_t end = nowNanos() + static_cast<uint64_t>(seconds * 1e9);
+	while (nowNanos() < end)
+		pollOnce(10);
+	_measuring = false;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															REPORT:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static void writeLatency(std::ostream &out, const char *name, const Histogram &h)
+{
+	out << "  \"" << name << "\": {\"count\": " << h.count()
+		<< ", \"mean\": " << (h.count() ? h.sum() / 1000.0 / h.count() : 0.0)
+		<< ", \"p50\": " << h.percentile(0.50) / 1000.0
+		<< ", \"p90\": " << h.percentile(0.90) / 1000.0
+		<< ", \"p99\": " << h.percentile(0.99) / 1000.0
+		<< ", \"p999\": " << h.percentile(0.999) / 1000.0
+		<< ", \"max\": " << h.max() / 1000.0 << "},\n";
+}
+
+static void writeJson(std::ostream &out, const Options &opt, const LoadGenerator &load, int ready, int joined,
+						double seconds, const ProcessSample &before, const ProcessSample &after)
+{
+	const Totals &t = load.totals();
+	uint64_t ops = 0;
+	for (int i = 0; i < OP_COUNT; ++i)
+		ops += t.ops[i];
+	struct rusage self;
+	getrusage(RUSAGE_SELF, &self);
+
+	out << "{\n"
+		<< "  \"config\": {\"clients\": " << opt.clients << ", \"topology\": \"" << opt.topology
+		<< "\", \"nodes\": " << opt.nodes << ", \"channels\": " << opt.channels << ", \"joins\": " << opt.joins
+		<< ", \"rate\": " << opt.rate << ", \"duration_s\": " << opt.duration << ", \"payload\": " << opt.payload
+		<< ", \"mix\": {";
+	for (int i = 0; i < OP_COUNT; ++i)
+		out << (i ? ", " : "") << "\"" << OP_NAMES[i] << "\": " << opt.mix[i];
+	out << "}},\n"
+		<< "  \"clients_ready\": " << ready << ",\n"
+		<< "  \"joins_confirmed\": " << joined << ",\n"
+		<< "  \"elapsed_s\": " << seconds << ",\n"
+		<< "  \"ops\": {";
+	for (int i = 0; i < OP_COUNT; ++i)
+		out << (i ? ", " : "") << "\"" << OP_NAMES[i] << "\": " << t.ops[i];
+	out << "},\n"
+		<< "  \"ops_per_sec\": " << ops / seconds << ",\n"
+		<< "  \"messages_sent_per_sec\": " << t.ops[OP_PRIVMSG] / seconds << ",\n"
+		<< "  \"messages_delivered\": " << t.delivered << ",\n"
+		<< "  \"messages_delivered_per_sec\": " << t.delivered / seconds << ",\n"
+		<< "  \"errors\": " << t.errors << ",\n"
+		<< "  \"disconnects\": " << t.disconnects << ",\n"
+		<< "  \"bytes_in\": " << t.bytesIn << ",\n"
+		<< "  \"bytes_out\": " << t.bytesOut << ",\n";
+	writeLatency(out, "latency_us", load.latency());
+	if (opt.nodes > 1)
+	{
+		writeLatency(out, "cross_node_latency_us", load.crossNode());
+		writeLatency(out, "same_node_latency_us", load.sameNode());
+	}
+	if (after.valid)
+	{
+		double user = after.userSeconds - before.userSeconds;
+		double system = after.systemSeconds - before.systemSeconds;
+		out << "  \"server\": {\"cpu_user_s\": " << user << ", \"cpu_system_s\": " << system
+			<< ", \"cpu_percent\": " << (user + system) / seconds * 100
+			<< ", \"rss_kb\": " << after.rssKb << ", \"peak_rss_kb\": " << after.peakRssKb << "},\n";
+	}
+	else
+		out << "  \"server\": null,\n";
+	out << "  \"generator\": {\"cpu_user_s\": " << self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6
+		<< ", \"cpu_system_s\": " << self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6 << "}\n"
+		<< "}\n";
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															NODES:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+/*
+	Linked servers for --nodes: the server reads config/ircserv.conf from its
+	working directory, so every node runs in its own temporary directory.
+	Node i dials node i - 1, each is started once its predecessor listens.
+*/
+class NodeCluster {
+
+	private:
+		std::string						_root;				// temporary directory ("" = none)
+		std::vector<ServerProcess *>	_nodes;
+
+		NodeCluster(const NodeCluster &copy);
+		NodeCluster &operator=(const NodeCluster &other);
+
+		std::string	nodeDirectory(int node) const
+		{
+			std::ostringstream path;
+			path << _root << "/node" << node;
+			return path.str();
+		}
+
+	public:
+		NodeCluster() {}
+		~NodeCluster() { stop(); }
+
+		long	pid(int node) const { return _nodes[node]->pid(); }
+
+		bool	start(const Options &opt)
+		{
+			char binary[PATH_MAX];
+			char root[] = "/tmp/ircserv-nodes.XXXXXX";
+			if (!realpath(opt.server.c_str(), binary) || !mkdtemp(root))
+				return false;
+			_root = root;
+			for (int i = 0; i < opt.nodes; ++i)
+			{
+				std::string directory = nodeDirectory(i);
+				if (mkdir(directory.c_str(), 0700) == -1 || mkdir((directory + "/config").c_str(), 0700) == -1)
+					return false;
+				std::ofstream config((directory + "/config/ircserv.conf").c_str());
+				config << "server_name node" << i << "\n";
+				if (i > 0)
+					config << "link node" << i - 1 << " bench-link " << opt.host << " " << opt.port + i - 1 << "\n";
+				if (i + 1 < opt.nodes)
+					config << "link node" << i + 1 << " bench-link\n";
+				config.close();
+
+				_nodes.push_back(new ServerProcess());
+				if (!_nodes.back()->spawn(binary, opt.port + i, opt.password, directory)
+					|| !waitForServer(opt.host, opt.port + i, 5))
+					return false;
+			}
+			// the last node dialled when it started, give the handshakes and bursts a moment
+			sleepMillis(500);
+			return true;
+		}
+
+		void	stop()
+		{
+			for (size_t i = 0; i < _nodes.size(); ++i)
+				delete _nodes[i];
+			_nodes.clear();
+			if (_root.empty())
+				return;
+			for (int i = 0; ; ++i)
+			{
+				std::string directory = nodeDirectory(i);
+				if (unlink((directory + "/config/ircserv.conf").c_str()) == -1)
+					break;
+				rmdir((directory + "/config").c_str());
+				rmdir(directory.c_str());
+			}
+			rmdir(_root.c_str());
+			_root.clear();
+		}
+};
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															MAIN:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	if (!parseOptions(argc, argv, opt))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	std::signal(SIGPIPE, SIG_IGN);
+	raiseFileLimit(opt.clients);
+
+	ServerProcess server;
+	NodeCluster cluster;
+	if (opt.nodes > 1)
+	{
+		if (!cluster.start(opt))
+		{
+			std::cerr << "cannot start " << opt.nodes << " linked servers: " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+		opt.pid = cluster.pid(0);
+	}
+	else if (!opt.server.empty())
+	{
+		if (!server.spawn(opt.server, opt.port, opt.password))
+		{
+			std::cerr << "cannot start " << opt.server << ": " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+		opt.pid = server.pid();
+	}
+	if (!waitForServer(opt.host, opt.port, 5))
+	{
+		std::cerr << "no server on " << opt.host << ":" << opt.port << std::endl;
+		return 1;
+	}
+
+	LoadGenerator load(opt);
+	int ready = load.registerAll(30 + opt.clients / 100.0);
+	std::cerr << "registered " << ready << "/" << opt.clients << " clients" << std::endl;
+	int joined = load.joinTopology(30);
+	std::cerr << "joined " << joined << " channels (" << opt.topology << ")" << std::endl;
+	if (opt.warmup > 0)
+		load.run(opt.warmup, false);
+
+	ProcessSample before = sampleProcess(opt.pid);
+	uint64_t start = nowNanos();
+	if (opt.upgradeAfter > 0 && opt.upgradeAfter < opt.duration && !opt.server.empty())
+	{
+		load.run(opt.upgradeAfter, true);
+		server.command("upgrade");
+		std::cerr << "upgrade requested" << std::endl;
+		load.run(opt.duration - opt.upgradeAfter, true);
+	}
+	else
+		load.run(opt.duration, true);
+	double seconds = (nowNanos() - start) / 1e9;
+	ProcessSample after = sampleProcess(opt.pid);
+	load.drain(opt.drain);
+
+	if (opt.out.empty())
+		writeJson(std::cout, opt, load, ready, joined, seconds, before, after);
+	else
+	{
+		std::ofstream file(opt.out.c_str());
+		writeJson(file, opt, load, ready, joined, seconds, before, after);
+		std::cerr << "results written to " << opt.out << std::endl;
+	}
+	return 0;
+}
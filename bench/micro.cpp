@@ -0,0 +1,616 @@
+/*
+	ircserv microbenchmarks.
+
+	Times single hot paths in isolation, linked against the server objects
+	(so the numbers are for the same code and flags as ./ircserv):
+
+		Client::extractCommand      framing of a received burst, per line
+		Server::ft_split            tokenizing a PRIVMSG line
+		IRCMessage::parse           the prefix/command/params parser
+		Bot::filterMessage          censoring with 100, 1k and 10k banned words
+		Channel::broadcast          queueing one message to 10, 100 and 1000 members
+		findClientByNickname        nickname lookup with 1k, 10k and 100k clients
+		ChannelManager::getChannel  channel lookup with 1k, 10k and 100k channels
+		Tls handshake               full and resumed (session ticket) handshakes, per connection
+		Tls SSL_write               encrypting one 512-byte chunk of output
+
+	The TLS benchmarks run on the server's own SSL_CTX (Tls::configure with a
+	throwaway P-256 certificate) against a client over an in-memory BIO pair,
+	so they time the crypto and OpenSSL's state machine but no socket; kTLS
+	never applies to them. 1e9 / ns/op gives handshakes/s, 512 / ns/op GB/s.
+
+	Every benchmark is calibrated so one sample takes about --sample-ms, then
+	timed for --samples samples. The report gives ns/op as mean, standard
+	deviation, coefficient of variation, min and median over the samples; a
+	CV above a few percent means the machine was noisy and the run should be
+	repeated (pinning with --cpu helps).
+
+	./bench/micro [--samples 20] [--sample-ms 20] [--cpu <n>] [--filter <substring>]
+*/
+#include "Server.hpp"
+#include "Channel.hpp"
+#include "Message.hpp"
+#include "Bot.hpp"
+#include "Arena.hpp"
+#include "Clock.hpp"
+#include "Log.hpp"
+#include "Tls.hpp"
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>			// for std::setw, std::setprecision
+#include <algorithm>		// for std::sort
+#include <vector>
+#include <string>
+#include <cmath>			// for std::sqrt
+#include <cstdlib>			// for std::atoi
+#include <cstdio>			// for std::remove
+#include <unistd.h>			// for close, mkstemp
+#include <sched.h>			// for sched_setaffinity
+
+// fake descriptors for in-memory clients: far above anything the process has open,
+// so flushing their output fails with EBADF instead of writing anywhere
+static const int	FAKE_FD_BASE = 1000000;
+
+static volatile size_t	g_sink;								// results go here so no work is optimized away
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															HARNESS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// one measured operation; run() does n of them and returns the Clock ticks that count
+class Benchmark {
+
+	public:
+		virtual ~Benchmark() {}
+		virtual uint64_t	run(uint64_t n) = 0;
+};
+
+struct BenchOptions {
+	int			samples;
+	int			sampleMillis;
+	int			cpu;										// -1 = not pinned
+	std::string	filter;
+
+	BenchOptions() : samples(20), sampleMillis(20), cpu(-1) {}
+};
+
+static void report(const std::string &name, std::vector<double> &nsPerOp, uint64_t iterations)
+{
+	double sum = 0;
+	for (size_t i = 0; i < nsPerOp.size(); ++i)
+		sum += nsPerOp[i];
+	double mean = sum / nsPerOp.size();
+	double squares = 0;
+	for (size_t i = 0; i < nsPerOp.size(); ++i)
+		squares += (nsPerOp[i] - mean) * (nsPerOp[i] - mean);
+	double stddev = nsPerOp.size() > 1 ? std::sqrt(squares / (nsPerOp.size() - 1)) : 0;
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+
+	std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(12) << mean << std::setw(10) << stddev << std::setw(7) << (mean > 0 ? stddev / mean * 100 : 0) << "%"
+		<< std::setw(12) << nsPerOp.front() << std::setw(12) << nsPerOp[nsPerOp.size() / 2]
+		<< std::setw(10) << iterations << std::endl;
+}
+
+static bool selected(const BenchOptions &opt, const std::string &name)
+{
+	return opt.filter.empty() || name.find(opt.filter) != std::string::npos;
+}
+
+// grow n until one run takes a full sample, then time the samples
+static void measure(const BenchOptions &opt, const std::string &name, Benchmark &bench)
+{
+	uint64_t target = static_cast<uint64_t>(opt.sampleMillis) * 1000000;
+	uint64_t n = 1;
+	for (;;)
+	{
+		uint64_t nanos = Clock::toNanos(bench.run(n));
+		if (nanos >= target || n >= (static_cast<uint64_t>(1) << 40))
+			break;
+		n = nanos < target / 100 ? n * 10 : n * target / nanos + 1;
+	}
+	bench.run(n);												// warm caches with the final size
+
+	std::vector<double> nsPerOp;
+	for (int i = 0; i < opt.samples; ++i)
+		nsPerOp.push_back(static_cast<double>(Clock::toNanos(bench.run(n))) / n);
+	report(name, nsPerOp, n);
+}
+
+static std::string numbered(const std::string &prefix, size_t i)
+{
+	std::ostringstream out;
+	out << prefix << i;
+	return out.str();
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															BENCHMARKS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static const char	*const PRIVMSG_LINE = "PRIVMSG #channel :hello everyone, this is a fairly ordinary chat line";
+
+// access to the server's private members, see the friend declaration in Server.hpp
+class ServerBench {
+
+	public:
+		static ArenaTokens	split(Server &server, const std::string &line) { return server.ft_split(line, ' '); }
+		static void			resetArena(Server &server) { server._arena.reset(); }
+		static Client		*findByNickname(const Server &server, const std::string &nick) { return server.findClientByNickname(nick); }
+		static ClientManager	&clients(Server &server) { return server._clientManager; }
+};
+
+// a burst of 32 lines arrives in one recv(); op = one extracted line
+class ExtractBench : public Benchmark {
+
+	private:
+		ClientManager	_clients;
+		Client			*_client;
+		std::string		_burst;
+		std::string		_command;
+
+	public:
+		static const unsigned	LINES = 32;
+
+		ExtractBench() : _client(_clients.createClient(FAKE_FD_BASE, "bench"))
+		{
+			for (unsigned i = 0; i < LINES; ++i)
+				_burst += std::string(PRIVMSG_LINE) + "\r\n";
+		}
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t start = Clock::now();
+			for (uint64_t done = 0; done < n; )
+			{
+				_client->appendBuffer(_burst.data(), _burst.size());
+				while (_client->extractCommand(_command))
+				{
+					g_sink += _command.size();
+					++done;
+				}
+			}
+			return Clock::now() - start;
+		}
+};
+
+// tokens live in the server's arena; it is reset every 1024 lines, as a busy tick would
+class SplitBench : public Benchmark {
+
+	private:
+		Server		_server;
+		std::string	_line;
+
+	public:
+		SplitBench() : _server(0, ""), _line(PRIVMSG_LINE) {}
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+			{
+				g_sink += ServerBench::split(_server, _line).size();
+				if ((i & 1023) == 1023)
+					ServerBench::resetArena(_server);
+			}
+			uint64_t elapsed = Clock::now() - start;
+			ServerBench::resetArena(_server);
+			return elapsed;
+		}
+};
+
+class ParseBench : public Benchmark {
+
+	private:
+		std::string	_line;
+
+	public:
+		ParseBench() : _line(std::string(":nick!user@host ") + PRIVMSG_LINE) {}
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+			{
+				IRCMessage message(_line);
+				g_sink += message.parameters.size();
+			}
+			return Clock::now() - start;
+		}
+};
+
+// a 100 character line holding one banned word, checked against a generated word list
+class FilterBench : public Benchmark {
+
+	private:
+		Bot			*_bot;
+		Arena		_arena;
+		std::string	_line;
+
+	public:
+		explicit FilterBench(size_t words) : _bot(NULL)
+		{
+			char path[] = "/tmp/ircserv-bench-words-XXXXXX";
+			int fd = mkstemp(path);
+			if (fd != -1)
+				close(fd);
+			std::ofstream file(path);
+			std::string firstWord;
+			unsigned state = 12345;
+			for (size_t i = 0; i < words; ++i)
+			{
+				std::string word;
+				size_t length = 4 + i % 7;
+				for (size_t c = 0; c < length; ++c)
+				{
+					state = state * 1103515245 + 12345;
+					word += static_cast<char>('a' + (state >> 16) % 26);
+				}
+				if (i == words / 2)
+					firstWord = word;
+				file << word << "\n";
+			}
+			file.close();
+			_bot = new Bot(path);
+			std::remove(path);
+			_line = "well, this is a perfectly normal sentence until somebody says " + firstWord
+				+ " in the middle of it";
+		}
+		~FilterBench() { delete _bot; }
+
+		uint64_t run(uint64_t n)
+		{
+			ArenaString line(_line.data(), _line.size(), ArenaAllocator<char>(_arena));
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+			{
+				g_sink += _bot->filterMessage(line).size();
+				if ((i & 1023) == 1023)
+				{
+					_arena.reset();
+					line = ArenaString(_line.data(), _line.size(), ArenaAllocator<char>(_arena));
+				}
+			}
+			uint64_t elapsed = Clock::now() - start;
+			_arena.reset();
+			return elapsed;
+		}
+};
+
+// members queue into their send buffers; the buffers are emptied every 16 broadcasts outside the timing
+class BroadcastBench : public Benchmark {
+
+	private:
+		ClientManager		_clients;
+		ChannelManager		_channels;
+		Channel				*_channel;
+		std::string			_message;
+		std::vector<int>	_blocked;
+		SocketTransport		_sockets;
+
+	public:
+		explicit BroadcastBench(size_t members) : _channel(_channels.createChannel("#bench"))
+		{
+			for (size_t i = 0; i < members; ++i)
+			{
+				Client *client = _clients.createClient(FAKE_FD_BASE + i, "bench");
+				_clients.setNickname(client, numbered("member", i));
+				_channel->addMember(client);
+			}
+			_message = ":member0!user@bench " + std::string(PRIVMSG_LINE) + "\r\n";
+		}
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t elapsed = 0;
+			for (uint64_t done = 0; done < n; )
+			{
+				uint64_t start = Clock::now();
+				for (int i = 0; i < 16 && done < n; ++i, ++done)
+					_channel->broadcast(_message.data(), _message.size());
+				elapsed += Clock::now() - start;
+				_clients.flushOutput(_sockets, _blocked);
+				_blocked.clear();
+			}
+			return elapsed;
+		}
+};
+
+// lookups of existing names in a fixed random order (defeats the branch predictor, not the cache)
+static std::vector<size_t> lookupOrder(size_t entries)
+{
+	std::vector<size_t> order(4096);
+	unsigned state = 777;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		state = state * 1103515245 + 12345;
+		order[i] = ((static_cast<size_t>(state) >> 8) * 2654435761u) % entries;
+	}
+	return order;
+}
+
+class NickLookupBench : public Benchmark {
+
+	private:
+		Server						_server;
+		std::vector<std::string>	_nicks;
+
+	public:
+		explicit NickLookupBench(size_t clients) : _server(0, "")
+		{
+			ClientManager &manager = ServerBench::clients(_server);
+			for (size_t i = 0; i < clients; ++i)
+				manager.setNickname(manager.createClient(FAKE_FD_BASE + i, "bench"), numbered("user", i));
+			std::vector<size_t> order = lookupOrder(clients);
+			for (size_t i = 0; i < order.size(); ++i)
+				_nicks.push_back(numbered("user", order[i]));
+		}
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+				g_sink += ServerBench::findByNickname(_server, _nicks[i & 4095]) != NULL;
+			return Clock::now() - start;
+		}
+};
+
+class ChannelLookupBench : public Benchmark {
+
+	private:
+		ChannelManager				_channels;
+		std::vector<std::string>	_names;
+
+	public:
+		explicit ChannelLookupBench(size_t channels)
+		{
+			for (size_t i = 0; i < channels; ++i)
+				_channels.createChannel(numbered("#channel", i));
+			std::vector<size_t> order = lookupOrder(channels);
+			for (size_t i = 0; i < order.size(); ++i)
+				_names.push_back(numbered("#channel", order[i]));
+		}
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+				g_sink += _channels.getChannel(_names[i & 4095]) != NULL;
+			return Clock::now() - start;
+		}
+};
+
+// a self-signed P-256 certificate and its key in one PEM file, loaded by the server's Tls::configure()
+class TlsFixture {
+
+	private:
+		Tls			_tls;
+		SSL_CTX		*_client;
+
+	public:
+		TlsFixture() : _client(SSL_CTX_new(TLS_client_method()))
+		{
+			EVP_PKEY *key = EVP_EC_gen("P-256");
+			X509 *cert = X509_new();
+			X509_set_version(cert, 2);
+			ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+			X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+			X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+			X509_set_pubkey(cert, key);
+			X509_NAME *subject = X509_get_subject_name(cert);
+			X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("bench"), -1, -1, 0);
+			X509_set_issuer_name(cert, subject);
+			X509_sign(cert, key, EVP_sha256());
+
+			char path[] = "/tmp/ircserv-bench-tls-XXXXXX";
+			int fd = mkstemp(path);
+			FILE *file = fd != -1 ? fdopen(fd, "w") : NULL;
+			if (file)
+			{
+				PEM_write_X509(file, cert);
+				PEM_write_PrivateKey(file, key, NULL, NULL, 0, NULL, NULL);
+				fclose(file);
+			}
+			X509_free(cert);
+			EVP_PKEY_free(key);
+			TlsSettings settings;
+			settings.certificate = settings.privateKey = path;
+			std::string error;
+			if (!_tls.configure(settings, error))
+				std::cerr << "tls: " << error << std::endl;
+			std::remove(path);
+		}
+		~TlsFixture() { SSL_CTX_free(_client); }
+
+		// a connected pair; the client takes session if it is not NULL
+		bool connect(SSL *&server, SSL *&client, SSL_SESSION *session)
+		{
+			BIO *serverSide, *clientSide;
+			BIO_new_bio_pair(&serverSide, 0, &clientSide, 0);
+			server = SSL_new(_tls.context());
+			client = SSL_new(_client);
+			SSL_set_bio(server, serverSide, serverSide);
+			SSL_set_bio(client, clientSide, clientSide);
+			SSL_set_accept_state(server);
+			SSL_set_connect_state(client);
+			if (session)
+				SSL_set_session(client, session);
+			int serverDone = 0, clientDone = 0;
+			for (int round = 0; round < 8 && (serverDone != 1 || clientDone != 1); ++round)
+			{
+				if (clientDone != 1)
+					clientDone = SSL_do_handshake(client);
+				if (serverDone != 1)
+					serverDone = SSL_do_handshake(server);
+			}
+			char byte;
+			SSL_read(client, &byte, 1);								// takes in the session ticket
+			return serverDone == 1 && clientDone == 1;
+		}
+
+		// with close_notify: OpenSSL drops the session of a connection freed without it
+		static void close(SSL *server, SSL *client)
+		{
+			SSL_shutdown(client);
+			SSL_shutdown(server);
+			SSL_free(server);
+			SSL_free(client);
+		}
+};
+
+class TlsHandshakeBench : public Benchmark {
+
+	private:
+		TlsFixture		_fixture;
+		SSL_SESSION		*_session;								// NULL: full handshakes
+
+	public:
+		explicit TlsHandshakeBench(bool resumed) : _session(NULL)
+		{
+			SSL *server, *client;
+			if (resumed && _fixture.connect(server, client, NULL))
+				_session = SSL_get1_session(client);
+			if (resumed)
+				TlsFixture::close(server, client);
+		}
+		~TlsHandshakeBench() { SSL_SESSION_free(_session); }
+
+		uint64_t run(uint64_t n)
+		{
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+			{
+				SSL *server, *client;
+				g_sink += _fixture.connect(server, client, _session);
+				g_sink += SSL_session_reused(server);
+				TlsFixture::close(server, client);
+			}
+			return Clock::now() - start;
+		}
+};
+
+// the client's side of the pair is drained raw: only the encryption is timed
+class TlsWriteBench : public Benchmark {
+
+	private:
+		TlsFixture		_fixture;
+		SSL				*_server;
+		SSL				*_client;
+		std::string		_chunk;
+		char			_drain[1024];
+
+	public:
+		TlsWriteBench() : _chunk(512, 'x')
+		{
+			_fixture.connect(_server, _client, NULL);
+		}
+		~TlsWriteBench() { TlsFixture::close(_server, _client); }
+
+		uint64_t run(uint64_t n)
+		{
+			BIO *wire = SSL_get_rbio(_client);
+			uint64_t start = Clock::now();
+			for (uint64_t i = 0; i < n; ++i)
+			{
+				g_sink += SSL_write(_server, _chunk.data(), static_cast<int>(_chunk.size()));
+				while (BIO_read(wire, _drain, sizeof(_drain)) > 0)
+					;
+			}
+			return Clock::now() - start;
+		}
+};
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															MAIN:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static bool parseOptions(int argc, char **argv, BenchOptions &opt)
+{
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string key = argv[i];
+		if (key == "--samples") opt.samples = std::atoi(argv[i + 1]);
+		else if (key == "--sample-ms") opt.sampleMillis = std::atoi(argv[i + 1]);
+		else if (key == "--cpu") opt.cpu = std::atoi(argv[i + 1]);
+		else if (key == "--filter") opt.filter = argv[i + 1];
+		else
+			return false;
+	}
+	return argc % 2 == 1 && opt.samples > 0 && opt.sampleMillis > 0;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions opt;
+	if (!parseOptions(argc, argv, opt))
+	{
+		std::cerr << "Usage: " << argv[0] << " [--samples <n>] [--sample-ms <ms>] [--cpu <n>] [--filter <substring>]" << std::endl;
+		return 1;
+	}
+	if (opt.cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(opt.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+			std::cerr << "cannot pin to cpu " << opt.cpu << std::endl;
+	}
+	Log::setLevel(LEVEL_OFF);									// the fake descriptors fail every send()
+	Clock::calibrate();
+
+	std::cout << std::left << std::setw(44) << "benchmark" << std::right << std::setw(12) << "ns/op"
+		<< std::setw(10) << "stddev" << std::setw(8) << "cv" << std::setw(12) << "min" << std::setw(12) << "median"
+		<< std::setw(10) << "ops" << std::endl;
+
+	// fixtures are only built for selected benchmarks (the 100k ones take a moment)
+	std::string name = "Client::extractCommand (per line)";
+	if (selected(opt, name)) { ExtractBench b; measure(opt, name, b); }
+	name = "Server::ft_split";
+	if (selected(opt, name)) { SplitBench b; measure(opt, name, b); }
+	name = "IRCMessage::parse";
+	if (selected(opt, name)) { ParseBench b; measure(opt, name, b); }
+
+	static const size_t WORDS[] = { 100, 1000, 10000 };
+	static const size_t MEMBERS[] = { 10, 100, 1000 };
+	static const size_t ENTRIES[] = { 1000, 10000, 100000 };
+	for (size_t i = 0; i < 3; ++i)
+		if (selected(opt, name = numbered("Bot::filterMessage/words=", WORDS[i])))
+		{
+			FilterBench b(WORDS[i]);
+			measure(opt, name, b);
+		}
+	for (size_t i = 0; i < 3; ++i)
+		if (selected(opt, name = numbered("Channel::broadcast/members=", MEMBERS[i])))
+		{
+			BroadcastBench b(MEMBERS[i]);
+			measure(opt, name, b);
+		}
+	for (size_t i = 0; i < 3; ++i)
+		if (selected(opt, name = numbered("Server::findClientByNickname/clients=", ENTRIES[i])))
+		{
+			NickLookupBench b(ENTRIES[i]);
+			measure(opt, name, b);
+		}
+	for (size_t i = 0; i < 3; ++i)
+		if (selected(opt, name = numbered("ChannelManager::getChannel/channels=", ENTRIES[i])))
+		{
+			ChannelLookupBench b(ENTRIES[i]);
+			measure(opt, name, b);
+		}
+	name = "Tls handshake/full";
+	if (selected(opt, name)) { TlsHandshakeBench b(false); measure(opt, name, b); }
+	name = "Tls handshake/resumed";
+	if (selected(opt, name)) { TlsHandshakeBench b(true); measure(opt, name, b); }
+	name = "Tls SSL_write/512 bytes";
+	if (selected(opt, name)) { TlsWriteBench b; measure(opt, name, b); }
+	return 0;
+}
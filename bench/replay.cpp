@@ -0,0 +1,510 @@
+/*
+	ircserv trace replayer.
+
+	Drives a local server from a trace written by the server's capture mode
+	(capture_file in config/ircserv.conf): every traced connection is opened,
+	fed its lines and closed at the traced times, scaled by --speed, so the
+	replay has the same connection concurrency as the original traffic.
+	--speed 0 replays as fast as the server accepts the bytes.
+
+	Latency is measured by a separate probe client that sends PING once every
+	--probe-ms and times the PONG, i.e. how long a reply waits behind the
+	replayed load. Schedule lag (how late the replayer itself sent the lines)
+	is reported too; a large lag means the numbers are limited by the replayer.
+
+	./bench/replay --trace <file> --server ./ircserv [--speed 1] [--out result.json]
+	./bench/replay --trace <file> --port 6667 --pid <server pid>
+*/
+#include "Capture.hpp"		// for the trace layout
+#include "Metrics.hpp"		// for Histogram
+#include "BenchUtil.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>			// for std::atoi, std::strtod, std::strtoull
+#include <cstring>			// for std::memcmp, std::strerror
+#include <cerrno>			// for errno
+#include <csignal>			// for std::signal, SIGPIPE
+#include <unistd.h>			// for close
+#include <poll.h>			// for poll
+#include <sys/socket.h>		// for send, recv, getsockopt
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															TRACE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+struct TraceEvent {
+	uint64_t	nanos;
+	uint32_t	connection;
+	uint8_t		event;
+	size_t		offset;											// payload position in Trace::payload
+	size_t		length;
+};
+
+struct Trace {
+	std::vector<TraceEvent>	events;
+	std::string				payload;
+	uint32_t				connections;
+	uint64_t				lines;
+	uint64_t				duration;							// ns from the first to the last event
+	uint32_t				peakConcurrency;
+
+	Trace() : connections(0), lines(0), duration(0), peakConcurrency(0) {}
+};
+
+static bool loadTrace(const std::string &path, Trace &trace)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	CaptureFileHeader header;
+	if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))
+			|| std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != CAPTURE_VERSION)
+		return false;
+
+	std::map<uint32_t, bool> open;
+	CaptureRecord record;
+	while (in.read(reinterpret_cast<char *>(&record), sizeof(record)))
+	{
+		TraceEvent event;
+		event.nanos = record.nanos;
+		event.connection = record.connection;
+		event.event = record.event;
+		event.offset = trace.payload.size();
+		event.length = record.length;
+		trace.payload.resize(event.offset + record.length);
+		if (record.length > 0 && !in.read(&trace.payload[event.offset], record.length))
+			break;
+		if (record.connection == 0)
+			continue;
+		if (record.event == CAPTURE_OPEN)
+		{
+			open[record.connection] = true;
+			++trace.connections;
+			if (open.size() > trace.peakConcurrency)
+				trace.peakConcurrency = open.size();
+		}
+		else if (record.event == CAPTURE_CLOSE)
+			open.erase(record.connection);
+		else if (record.event == CAPTURE_LINE)
+			++trace.lines;
+		trace.events.push_back(event);
+	}
+	if (!trace.events.empty())
+		trace.duration = trace.events.back().nanos - trace.events.front().nanos;
+	return true;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															REPLAYER:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+struct ReplayOptions {
+	std::string	trace;
+	std::string	host;
+	int			port;
+	std::string	password;										// sent for every PASS: the trace keeps none
+	std::string	server;
+	long		pid;
+	double		speed;											// 0 = as fast as possible
+	int			probeMillis;
+	double		drain;
+	std::string	out;
+
+	ReplayOptions() : host("127.0.0.1"), port(16910), password("replay"), pid(0), speed(1), probeMillis(10), drain(2) {}
+};
+
+struct Connection {
+	int			fd;
+	bool		connecting;
+	bool		closing;										// close once the output is written
+	std::string	output;
+	std::string	input;											// probe only
+	bool		registered;										// probe only
+
+	Connection() : fd(-1), connecting(true), closing(false), registered(false) {}
+};
+
+class Replayer {
+
+	private:
+		static const size_t		MAX_QUEUED = 256 * 1024;		// stop feeding a connection the server does not read
+
+		const ReplayOptions				&_opt;
+		const Trace						&_trace;
+		std::map<uint32_t, Connection>	_connections;			// traced connection id -> socket
+		Connection						_probe;
+		uint64_t						_probeSent;				// 0 = no PING outstanding
+		Histogram						_probeLatency;			// ns
+		Histogram						_lag;					// ns behind schedule
+		uint64_t						_linesSent;
+		uint64_t						_bytesOut;
+		uint64_t						_bytesIn;
+		uint64_t						_connectFailures;
+		size_t							_peakOpen;
+
+		void	open(uint32_t id);
+		void	queue(Connection &connection, const char *data, size_t length);
+		void	flush(Connection &connection);
+		void	receive(Connection &connection, bool probe);
+		void	release(std::map<uint32_t, Connection>::iterator it);
+		bool	backlogged() const;
+		void	pollOnce(int timeoutMs);
+
+		Replayer(const Replayer &copy);
+		Replayer &operator=(const Replayer &other);
+
+	public:
+		Replayer(const ReplayOptions &opt, const Trace &trace);
+		~Replayer();
+
+		bool	startProbe();
+		double	run();											// replay the whole trace, returns seconds
+		void	drain(double seconds);
+		void	writeJson(std::ostream &out, double seconds, const ProcessSample &before, const ProcessSample &after) const;
+};
+
+Replayer::Replayer(const ReplayOptions &opt, const Trace &trace)
+	: _opt(opt), _trace(trace), _probeSent(0), _linesSent(0), _bytesOut(0), _bytesIn(0),
+	  _connectFailures(0), _peakOpen(0) {}
+
+Replayer::~Replayer()
+{
+	for (std::map<uint32_t, Connection>::iterator it = _connections.begin(); it != _connections.end(); ++it)
+		if (it->second.fd != -1)
+			close(it->second.fd);
+	if (_probe.fd != -1)
+		close(_probe.fd);
+}
+
+void Replayer::open(uint32_t id)
+{
+	Connection &connection = _connections[id];
+	connection.fd = connectNonBlocking(_opt.host, _opt.port);
+	if (connection.fd == -1)
+	{
+		++_connectFailures;
+		_connections.erase(id);
+		return;
+	}
+	if (_connections.size() > _peakOpen)
+		_peakOpen = _connections.size();
+}
+
+void Replayer::queue(Connection &connection, const char *data, size_t length)
+{
+	connection.output.append(data, length);
+	connection.output.append("\r\n", 2);
+}
+
+void Replayer::flush(Connection &connection)
+{
+	if (connection.connecting || connection.output.empty())
+		return;
+	ssize_t sent = send(connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+	if (sent > 0)
+	{
+		_bytesOut += sent;
+		connection.output.erase(0, sent);
+	}
+	else if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+		connection.output.clear();
+}
+
+// replies are only counted, except on the probe connection
+void Replayer::receive(Connection &connection, bool probe)
+{
+	char buf[65536];
+	ssize_t bytes = recv(connection.fd, buf, sizeof(buf), 0);
+	if (bytes <= 0)
+	{
+		if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+		{
+			connection.output.clear();
+			connection.closing = true;
+		}
+		return;
+	}
+	_bytesIn += bytes;
+	if (!probe)
+		return;
+	connection.input.append(buf, bytes);
+	size_t end;
+	while ((end = connection.input.find('\n')) != std::string::npos)
+	{
+		std::string line = connection.input.substr(0, end);
+		connection.input.erase(0, end + 1);
+		if (line.find(" 001 ") != std::string::npos)
+			connection.registered = true;
+		else if (line.find("PONG ") != std::string::npos && _probeSent != 0)
+		{
+			_probeLatency.record(nowNanos() - _probeSent);
+			_probeSent = 0;
+		}
+	}
+}
+
+void Replayer::release(std::map<uint32_t, Connection>::iterator it)
+{
+	if (it->second.fd != -1)
+		close(it->second.fd);
+	_connections.erase(it);
+}
+
+// some connection has more queued than the server is reading: wait before feeding more
+bool Replayer::backlogged() const
+{
+	for (std::map<uint32_t, Connection>::const_iterator it = _connections.begin(); it != _connections.end(); ++it)
+		if (it->second.output.size() > MAX_QUEUED)
+			return true;
+	return false;
+}
+
+void Replayer::pollOnce(int timeoutMs)
+{
+	std::vector<pollfd> pfds;
+	std::vector<uint32_t> ids;
+	for (std::map<uint32_t, Connection>::iterator it = _connections.begin(); it != _connections.end(); ++it)
+	{
+		pollfd pfd;
+		pfd.fd = it->second.fd;
+		pfd.events = POLLIN;
+		if (it->second.connecting || !it->second.output.empty())
+			pfd.events |= POLLOUT;
+		pfd.revents = 0;
+		pfds.push_back(pfd);
+		ids.push_back(it->first);
+	}
+	if (_probe.fd != -1)
+	{
+		pollfd pfd;
+		pfd.fd = _probe.fd;
+		pfd.events = POLLIN | (_probe.connecting || !_probe.output.empty() ? POLLOUT : 0);
+		pfd.revents = 0;
+		pfds.push_back(pfd);
+	}
+	if (pfds.empty() || poll(&pfds[0], pfds.size(), timeoutMs) <= 0)
+		return;
+
+	for (size_t i = 0; i < pfds.size(); ++i)
+	{
+		if (!pfds[i].revents)
+			continue;
+		bool probe = i == ids.size();
+		Connection &connection = probe ? _probe : _connections[ids[i]];
+		if (connection.connecting && (pfds[i].revents & (POLLOUT | POLLERR | POLLHUP)))
+		{
+			int error = 0;
+			socklen_t length = sizeof(error);
+			getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+			connection.connecting = false;
+			if (error != 0)
+			{
+				++_connectFailures;
+				connection.output.clear();
+				connection.closing = true;
+			}
+		}
+		if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+			receive(connection, probe);
+		flush(connection);
+		if (!probe && connection.closing && connection.output.empty())
+			release(_connections.find(ids[i]));
+	}
+}
+
+bool Replayer::startProbe()
+{
+	_probe.fd = connectNonBlocking(_opt.host, _opt.port);
+	if (_probe.fd == -1)
+		return false;
+	_probe.output = "PASS " + _opt.password + "\r\nNICK replayprobe\r\nUSER probe 0 * :replay probe\r\n";
+	uint64_t deadline = nowNanos() + static_cast<uint64_t>(5) * 1000000000;
+	while (!_probe.registered && nowNanos() < deadline)
+		pollOnce(10);
+	return _probe.registered;
+}
+
+double Replayer::run()
+{
+	const std::vector<TraceEvent> &events = _trace.events;
+	uint64_t base = events.empty() ? 0 : events.front().nanos;
+	uint64_t start = nowNanos();
+	uint64_t nextProbe = start;
+	size_t next = 0;
+
+	while (next < events.size())
+	{
+		uint64_t now = nowNanos();
+		int budget = 1024;										// poll regularly even when far behind
+		while (next < events.size() && budget-- > 0 && !backlogged())
+		{
+			const TraceEvent &event = events[next];
+			uint64_t due = start + (_opt.speed > 0 ? static_cast<uint64_t>((event.nanos - base) / _opt.speed) : 0);
+			if (due > now)
+				break;
+			if (_opt.speed > 0)
+				_lag.record(now - due);
+			std::map<uint32_t, Connection>::iterator it = _connections.find(event.connection);
+			if (event.event == CAPTURE_OPEN)
+				open(event.connection);
+			else if (it != _connections.end() && event.event == CAPTURE_CLOSE)
+				it->second.closing = true;
+			else if (it != _connections.end() && event.event == CAPTURE_LINE)
+			{
+				const char *line = _trace.payload.data() + event.offset;
+				if (event.length == 4 && std::string(line, 4) == "PASS")
+					queue(it->second, ("PASS " + _opt.password).c_str(), _opt.password.size() + 5);
+				else
+					queue(it->second, line, event.length);
+				flush(it->second);
+				++_linesSent;
+			}
+			++next;
+		}
+		if (_probe.registered && _probeSent == 0 && now >= nextProbe)
+		{
+			std::ostringstream ping;
+			ping << "PING :r" << now << "\r\n";
+			_probe.output += ping.str();
+			_probeSent = now;
+			nextProbe = now + static_cast<uint64_t>(_opt.probeMillis) * 1000000;
+			flush(_probe);
+		}
+		pollOnce(next < events.size() && budget <= 0 ? 0 : 1);
+	}
+	return (nowNanos() - start) / 1e9;
+}
+
+void Replayer::drain(double seconds)
+{
+	uint64_t end = nowNanos() + static_cast<uint64_t>(seconds * 1e9);
+	while (nowNanos() < end)
+		pollOnce(10);
+}
+
+void Replayer::writeJson(std::ostream &out, double seconds, const ProcessSample &before, const ProcessSample &after) const
+{
+	const Histogram &p = _probeLatency;
+	out << "{\n"
+		<< "  \"trace\": {\"file\": \"" << _opt.trace << "\", \"connections\": " << _trace.connections
+		<< ", \"lines\": " << _trace.lines << ", \"duration_s\": " << _trace.duration / 1e9
+		<< ", \"peak_concurrency\": " << _trace.peakConcurrency << "},\n"
+		<< "  \"speed\": " << _opt.speed << ",\n"
+		<< "  \"elapsed_s\": " << seconds << ",\n"
+		<< "  \"lines_sent\": " << _linesSent << ",\n"
+		<< "  \"lines_per_sec\": " << _linesSent / seconds << ",\n"
+		<< "  \"bytes_out\": " << _bytesOut << ",\n"
+		<< "  \"bytes_in\": " << _bytesIn << ",\n"
+		<< "  \"peak_open\": " << _peakOpen << ",\n"
+		<< "  \"connect_failures\": " << _connectFailures << ",\n"
+		<< "  \"probe_latency_us\": {\"count\": " << p.count()
+		<< ", \"p50\": " << p.percentile(0.50) / 1000.0 << ", \"p90\": " << p.percentile(0.90) / 1000.0
+		<< ", \"p99\": " << p.percentile(0.99) / 1000.0 << ", \"p999\": " << p.percentile(0.999) / 1000.0
+		<< ", \"max\": " << p.max() / 1000.0 << "},\n"
+		<< "  \"schedule_lag_us\": {\"p50\": " << _lag.percentile(0.50) / 1000.0
+		<< ", \"p99\": " << _lag.percentile(0.99) / 1000.0 << ", \"max\": " << _lag.max() / 1000.0 << "},\n";
+	if (after.valid)
+	{
+		double user = after.userSeconds - before.userSeconds;
+		double system = after.systemSeconds - before.systemSeconds;
+		out << "  \"server\": {\"cpu_user_s\": " << user << ", \"cpu_system_s\": " << system
+			<< ", \"cpu_percent\": " << (user + system) / seconds * 100
+			<< ", \"rss_kb\": " << after.rssKb << ", \"peak_rss_kb\": " << after.peakRssKb << "}\n";
+	}
+	else
+		out << "  \"server\": null\n";
+	out << "}\n";
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															MAIN:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static bool parseOptions(int argc, char **argv, ReplayOptions &opt)
+{
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string key = argv[i];
+		std::string value = argv[i + 1];
+		if (key == "--trace") opt.trace = value;
+		else if (key == "--server") opt.server = value;
+		else if (key == "--host") opt.host = value;
+		else if (key == "--port") opt.port = std::atoi(value.c_str());
+		else if (key == "--password") opt.password = value;
+		else if (key == "--pid") opt.pid = std::atol(value.c_str());
+		else if (key == "--speed") opt.speed = std::strtod(value.c_str(), NULL);
+		else if (key == "--probe-ms") opt.probeMillis = std::atoi(value.c_str());
+		else if (key == "--drain") opt.drain = std::strtod(value.c_str(), NULL);
+		else if (key == "--out") opt.out = value;
+		else
+			return false;
+	}
+	return argc % 2 == 1 && !opt.trace.empty() && opt.port > 0 && opt.port <= 65535
+		&& opt.speed >= 0 && opt.probeMillis > 0;
+}
+
+int main(int argc, char **argv)
+{
+	ReplayOptions opt;
+	if (!parseOptions(argc, argv, opt))
+	{
+		std::cerr << "Usage: " << argv[0] << " --trace <file> [--server <ircserv> | --port <n> [--pid <pid>]]\n"
+			"       [--host 127.0.0.1] [--password replay] [--speed <factor, 0 = max>] [--probe-ms 10]\n"
+			"       [--drain 2] [--out <json file>]" << std::endl;
+		return 1;
+	}
+	Trace trace;
+	if (!loadTrace(opt.trace, trace))
+	{
+		std::cerr << "cannot read trace " << opt.trace << std::endl;
+		return 1;
+	}
+	std::cerr << "trace: " << trace.connections << " connections, " << trace.lines << " lines, "
+		<< trace.duration / 1e9 << " s, peak concurrency " << trace.peakConcurrency << std::endl;
+
+	std::signal(SIGPIPE, SIG_IGN);
+	raiseFileLimit(trace.peakConcurrency + 1);
+
+	ServerProcess server;
+	if (!opt.server.empty())
+	{
+		if (!server.spawn(opt.server, opt.port, opt.password))
+		{
+			std::cerr << "cannot start " << opt.server << ": " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+		opt.pid = server.pid();
+	}
+	if (!waitForServer(opt.host, opt.port, 5))
+	{
+		std::cerr << "no server on " << opt.host << ":" << opt.port << std::endl;
+		return 1;
+	}
+
+	Replayer replayer(opt, trace);
+	if (!replayer.startProbe())
+		std::cerr << "probe client did not register, no latency will be reported" << std::endl;
+	ProcessSample before = sampleProcess(opt.pid);
+	double seconds = replayer.run();
+	ProcessSample after = sampleProcess(opt.pid);
+	replayer.drain(opt.drain);
+
+	if (opt.out.empty())
+		replayer.writeJson(std::cout, seconds, before, after);
+	else
+	{
+		std::ofstream file(opt.out.c_str());
+		replayer.writeJson(file, seconds, before, after);
+		std::cerr << "results written to " << opt.out << std::endl;
+	}
+	return 0;
+}
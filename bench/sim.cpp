@@ -0,0 +1,375 @@
+/*
+	ircserv deterministic simulator.
+
+	Runs the real Server in this process on a LoopbackTransport: no sockets,
+	no kernel, no sleeping. Simulated clients register, leave #general, join
+	one of --channels channels and then send --messages PRIVMSGs in bursts of
+	--burst per event loop tick. Input is scheduled on the transport's virtual
+	clock (--rate messages per virtual second), so a run with the same options
+	and seed processes the same bytes in the same ticks on any machine; the
+	output_hash field (FNV-1a of everything the clients received) shows it.
+
+	Only the measured phase (first PRIVMSG until every reply is delivered) is
+	timed. Time spent in the simulated clients is measured separately and
+	subtracted, so server_ns_per_message is the cost of recv, parsing,
+	dispatch, the filter, broadcast and the output flush, without syscalls.
+
+	./bench/sim [options]
+*/
+#include "Server.hpp"
+#include "LoopbackTransport.hpp"
+#include "Metrics.hpp"
+#include "Clock.hpp"
+#include "Log.hpp"
+#include "BenchUtil.hpp"	// for Random
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>			// for std::hex, std::setw, std::setfill
+#include <string>
+#include <vector>
+#include <cstdlib>			// for std::atoi, std::atol, std::strtod
+#include <cstring>			// for std::memcpy
+#include <algorithm>		// for std::count
+#include <sys/resource.h>	// for getrusage
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															OPTIONS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+struct Options {
+	int			clients;
+	int			channels;
+	long		messages;									// PRIVMSGs in the measured phase
+	int			burst;										// PRIVMSGs written per event loop tick
+	double		rate;										// PRIVMSGs per virtual second
+	int			payload;									// PRIVMSG text size in bytes
+	size_t		window;										// loopback send window per connection
+	unsigned	seed;
+	LogLevel	logLevel;									// server log level once it is running
+	std::string	out;										// JSON file ("" = stdout)
+
+	Options() : clients(1000), channels(50), messages(1000000), burst(64), rate(100000), payload(64),
+		window(64 * 1024), seed(42), logLevel(LEVEL_WARN) {}
+};
+
+static void usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [options]\n"
+		"  --clients <n>          simulated clients (1000)\n"
+		"  --channels <n>         channels, each client joins one (50)\n"
+		"  --messages <n>         PRIVMSGs to push through the server (1000000)\n"
+		"  --burst <n>            PRIVMSGs written per event loop tick (64)\n"
+		"  --rate <msg/s>         PRIVMSGs per virtual second (100000)\n"
+		"  --payload <bytes>      PRIVMSG text size (64)\n"
+		"  --window <bytes>       per-connection send window (65536)\n"
+		"  --seed <n>             random seed (42)\n"
+		"  --log-level <level>    server log level during the run (warn)\n"
+		"  --out <file>           write the JSON result here (stdout)\n";
+}
+
+static bool parseOptions(int argc, char **argv, Options &opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string key = argv[i];
+		if (i + 1 >= argc)
+			return false;
+		std::string value = argv[++i];
+		if (key == "--clients") opt.clients = std::atoi(value.c_str());
+		else if (key == "--channels") opt.channels = std::atoi(value.c_str());
+		else if (key == "--messages") opt.messages = std::atol(value.c_str());
+		else if (key == "--burst") opt.burst = std::atoi(value.c_str());
+		else if (key == "--rate") opt.rate = std::strtod(value.c_str(), NULL);
+		else if (key == "--payload") opt.payload = std::atoi(value.c_str());
+		else if (key == "--window") opt.window = std::atol(value.c_str());
+		else if (key == "--seed") opt.seed = static_cast<unsigned>(std::atol(value.c_str()));
+		else if (key == "--log-level") { if (!Log::parseLevel(value, opt.logLevel)) return false; }
+		else if (key == "--out") opt.out = value;
+		else
+			return false;
+	}
+	return opt.clients > 0 && opt.channels > 0 && opt.messages > 0 && opt.burst > 0 && opt.rate > 0
+		&& opt.payload >= 0 && opt.payload <= 400 && opt.window > 0;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															SIMULATION:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static const char	*const PASSWORD = "sim";
+static const int	CONNECT_BATCH = 64;							// connections opened per tick during setup
+
+enum Phase { PHASE_CONNECT, PHASE_SETTLE, PHASE_RUN, PHASE_DRAIN, PHASE_DONE };
+
+// FNV-1a constants, 64 bit
+static uint64_t fnvOffset() { return (static_cast<uint64_t>(0xcbf29ce4) << 32) | 0x84222325; }
+static uint64_t fnvPrime() { return (static_cast<uint64_t>(0x00000100) << 32) | 0x000001b3; }
+
+// per-phase totals; the measured ones are copied out when the run starts
+struct Totals {
+	uint64_t	sent;										// PRIVMSGs written
+	uint64_t	delivered;									// lines read by the clients
+	uint64_t	bytesOut;									// bytes read by the clients
+	uint64_t	ticks;										// event loop ticks (driver steps)
+	uint64_t	driverTicks;								// Clock ticks spent in the simulated clients
+	Totals() : sent(0), delivered(0), bytesOut(0), ticks(0), driverTicks(0) {}
+};
+
+class Simulation : public LoopbackDriver {
+
+	private:
+		const Options		&_opt;
+		Random				_random;
+		Phase				_phase;
+		std::vector<int>	_connections;					// loopback connection id per client
+		std::vector<int>	_channelOf;						// channel index per client
+		std::vector<std::string>	_lines;					// ready-made PRIVMSG line per channel
+		std::string			_received;						// scratch for LoopbackTransport::read
+		uint64_t			_hash;
+		Totals				_totals;
+		uint64_t			_runStart;						// Clock::now() at the first PRIVMSG
+		uint64_t			_runEnd;						// Clock::now() once the last reply was read
+		uint64_t			_virtualStart;					// transport.now() at the first PRIVMSG
+		uint64_t			_virtualEnd;
+		MetricsSnapshot		_before;						// server counters at the first PRIVMSG
+
+		size_t	collect(LoopbackTransport &transport);
+		void	connectBatch(LoopbackTransport &transport);
+		void	sendBurst(LoopbackTransport &transport);
+
+		Simulation(const Simulation &copy);
+		Simulation &operator=(const Simulation &other);
+
+	public:
+		explicit Simulation(const Options &opt);
+
+		bool	step(LoopbackTransport &transport);
+		void	writeJson(std::ostream &out) const;
+		bool	finished() const { return _phase == PHASE_DONE; }
+};
+
+Simulation::Simulation(const Options &opt)
+	: _opt(opt), _random(opt.seed), _phase(PHASE_CONNECT), _hash(fnvOffset()),
+	_runStart(0), _runEnd(0), _virtualStart(0), _virtualEnd(0)
+{
+	std::string text;
+	static const char *const WORDS = "lorem ipsum dolor sit amet consectetur adipiscing elit ";
+	while (text.size() < static_cast<size_t>(opt.payload))
+		text += WORDS;
+	text.resize(opt.payload);
+	for (int i = 0; i < opt.channels; ++i)
+	{
+		std::ostringstream line;
+		line << "PRIVMSG #sim" << i << " :" << text << "\r\n";
+		_lines.push_back(line.str());
+	}
+}
+
+// drain every client's socket in a fixed order: count lines and fold the bytes into the hash
+size_t Simulation::collect(LoopbackTransport &transport)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < _connections.size(); ++i)
+	{
+		if (!transport.read(_connections[i], _received))
+			continue;
+		const char *data = _received.data();
+		size_t length = _received.size();
+		bytes += length;
+		_totals.delivered += std::count(data, data + length, '\n');
+		// FNV-1a over 8-byte words (tail zero-padded): same bytes, same hash, at a fraction of the per-byte cost
+		for (size_t j = 0; j < length; j += 8)
+		{
+			uint64_t word = 0;
+			std::memcpy(&word, data + j, length - j < 8 ? length - j : 8);
+			_hash = (_hash ^ word) * fnvPrime();
+		}
+		_hash = (_hash ^ length) * fnvPrime();
+	}
+	_totals.bytesOut += bytes;
+	return bytes;
+}
+
+// register, leave the auto-joined #general (it would hold every client) and join one channel
+void Simulation::connectBatch(LoopbackTransport &transport)
+{
+	for (int n = 0; n < CONNECT_BATCH && _connections.size() < static_cast<size_t>(_opt.clients); ++n)
+	{
+		size_t client = _connections.size();
+		int channel = static_cast<int>(_random.below(_opt.channels));
+		std::ostringstream setup;
+		setup << "PASS " << PASSWORD << "\r\n"
+			<< "NICK sim" << client << "\r\n"
+			<< "USER sim" << client << " 0 * :simulated client\r\n"
+			<< "PART #general\r\n"
+			<< "JOIN #sim" << channel << "\r\n";
+		int connection = transport.connect();
+		transport.write(connection, setup.str());
+		_connections.push_back(connection);
+		_channelOf.push_back(channel);
+	}
+}
+
+// the next burst of PRIVMSGs, from random senders to their channel, spaced on the virtual clock
+void Simulation::sendBurst(LoopbackTransport &transport)
+{
+	for (int n = 0; n < _opt.burst && _totals.sent < static_cast<uint64_t>(_opt.messages); ++n)
+	{
+		unsigned client = _random.below(_opt.clients);
+		transport.write(_connections[client], _lines[_channelOf[client]]);
+		++_totals.sent;
+	}
+	transport.advance(static_cast<uint64_t>(_opt.burst * 1e9 / _opt.rate));
+}
+
+/*
+	One call per server tick. Setup and drain end on the first quiet tick:
+	all input consumed and nothing new delivered. Clients drain their sockets
+	every tick, so a client the server had to wait for is writable again and
+	its output would have shown up.
+*/
+bool Simulation::step(LoopbackTransport &transport)
+{
+	uint64_t start = Clock::now();
+	size_t received = collect(transport);
+	++_totals.ticks;
+
+	switch (_phase)
+	{
+		case PHASE_CONNECT:
+			if (_connections.empty())
+				Log::setLevel(_opt.logLevel);						// the server has set its configured levels by now
+			connectBatch(transport);
+			if (_connections.size() == static_cast<size_t>(_opt.clients))
+				_phase = PHASE_SETTLE;
+			break;
+		case PHASE_SETTLE:
+			if (received == 0 && transport.isIdle())
+			{
+				std::cerr << "setup done: " << _opt.clients << " clients in " << _opt.channels << " channels, "
+					<< _totals.ticks << " ticks" << std::endl;
+				_phase = PHASE_RUN;
+				_totals = Totals();
+				Metrics::snapshot(_before);
+				_virtualStart = transport.now();
+				_runStart = Clock::now();
+				start = _runStart;
+				sendBurst(transport);
+			}
+			break;
+		case PHASE_RUN:
+			sendBurst(transport);
+			if (_totals.sent == static_cast<uint64_t>(_opt.messages))
+				_phase = PHASE_DRAIN;
+			break;
+		case PHASE_DRAIN:
+			if (received == 0 && transport.isIdle())
+			{
+				_runEnd = Clock::now();
+				_virtualEnd = transport.now();
+				_phase = PHASE_DONE;
+			}
+			break;
+		case PHASE_DONE:
+			break;
+	}
+	if (_phase != PHASE_DONE)
+		_totals.driverTicks += Clock::now() - start;
+	return _phase != PHASE_DONE;
+}
+
+void Simulation::writeJson(std::ostream &out) const
+{
+	MetricsSnapshot after;
+	Metrics::snapshot(after);
+	uint64_t messagesIn = after.counters[C_MESSAGES_IN] - _before.counters[C_MESSAGES_IN];
+	uint64_t sendCalls = after.counters[C_SEND_CALLS] - _before.counters[C_SEND_CALLS];
+	uint64_t blocked = after.counters[C_SEND_BLOCKED] - _before.counters[C_SEND_BLOCKED];
+
+	double wall = Clock::toNanos(_runEnd - _runStart) / 1e9;
+	double driver = Clock::toNanos(_totals.driverTicks) / 1e9;
+	double server = wall - driver;
+	struct rusage self;
+	getrusage(RUSAGE_SELF, &self);
+
+	std::ostringstream hash;
+	hash << std::hex << std::setw(16) << std::setfill('0') << _hash;
+
+	out << "{\n"
+		<< "  \"config\": {\"clients\": " << _opt.clients << ", \"channels\": " << _opt.channels
+		<< ", \"messages\": " << _opt.messages << ", \"burst\": " << _opt.burst << ", \"rate\": " << _opt.rate
+		<< ", \"payload\": " << _opt.payload << ", \"window\": " << _opt.window << ", \"seed\": " << _opt.seed << "},\n"
+		<< "  \"messages_sent\": " << _totals.sent << ",\n"
+		<< "  \"commands_processed\": " << messagesIn << ",\n"
+		<< "  \"lines_delivered\": " << _totals.delivered << ",\n"
+		<< "  \"bytes_delivered\": " << _totals.bytesOut << ",\n"
+		<< "  \"ticks\": " << _totals.ticks << ",\n"
+		<< "  \"send_calls\": " << sendCalls << ",\n"
+		<< "  \"send_blocked\": " << blocked << ",\n"
+		<< "  \"virtual_s\": " << (_virtualEnd - _virtualStart) / 1e9 << ",\n"
+		<< "  \"wall_s\": " << wall << ",\n"
+		<< "  \"driver_s\": " << driver << ",\n"
+		<< "  \"server_s\": " << server << ",\n"
+		<< "  \"server_ns_per_message\": " << (_totals.sent ? server * 1e9 / _totals.sent : 0.0) << ",\n"
+		<< "  \"server_ns_per_delivery\": " << (_totals.delivered ? server * 1e9 / _totals.delivered : 0.0) << ",\n"
+		<< "  \"messages_per_server_second\": " << (server > 0 ? _totals.sent / server : 0.0) << ",\n"
+		<< "  \"deliveries_per_server_second\": " << (server > 0 ? _totals.delivered / server : 0.0) << ",\n"
+		<< "  \"output_hash\": \"" << hash.str() << "\",\n"
+		<< "  \"process\": {\"cpu_user_s\": " << self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6
+		<< ", \"cpu_system_s\": " << self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6
+		<< ", \"peak_rss_kb\": " << self.ru_maxrss << "}\n"
+		<< "}\n";
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															MAIN:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	if (!parseOptions(argc, argv, opt))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	LoopbackTransport transport;
+	transport.setSendWindow(opt.window);
+	Simulation simulation(opt);
+	transport.setDriver(&simulation);
+
+	// the server prints its pool statistics on "quit"; keep stdout for the JSON
+	std::streambuf *console = std::cout.rdbuf(NULL);
+	int status = 0;
+	try {
+		Server server(6667, PASSWORD, transport);
+		server.start();
+	}
+	catch (const std::exception &e) {
+		std::cerr << "server failed: " << e.what() << std::endl;
+		status = 1;
+	}
+	std::cout.rdbuf(console);
+	std::cout.clear();
+	Log::stop();
+	if (status != 0 || !simulation.finished())
+		return 1;
+
+	if (opt.out.empty())
+		simulation.writeJson(std::cout);
+	else
+	{
+		std::ofstream file(opt.out.c_str());
+		simulation.writeJson(file);
+		std::cerr << "results written to " << opt.out << std::endl;
+	}
+	return 0;
+}
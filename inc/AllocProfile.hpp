@@ -0,0 +1,69 @@
+#ifndef ALLOCPROFILE_HPP
+#define ALLOCPROFILE_HPP
+
+#include <stdint.h>		// for uint64_t
+#include "Metrics.hpp"	// for CommandId, COMMAND_COUNT
+
+/*
+	Heap traffic per command type. Built with -DALLOC_PROFILE (make allocprof)
+	the global operator new/delete are replaced by counting wrappers: every
+	block carries a small header with its size and the tag that was current
+	when it was allocated, so a free is charged back to the command that made
+	the allocation. The tag is per thread; processSingleCommand sets it with an
+	AllocScope, everything else (event loop, setup, the log and capture
+	threads) lands in ALLOC_TAG_OTHER. Blocks from std::malloc (the arena)
+	are not seen.
+
+	Without ALLOC_PROFILE nothing is replaced, AllocScope compiles to nothing
+	and enabled() is false.
+*/
+static const int	ALLOC_TAG_OTHER = COMMAND_COUNT;			// outside any command
+static const int	ALLOC_TAG_COUNT = COMMAND_COUNT + 1;
+
+struct AllocStats {
+	uint64_t	allocations;									// operator new calls
+	uint64_t	frees;											// operator delete calls on blocks of this tag
+	uint64_t	bytes;											// bytes requested
+	uint64_t	liveBytes;										// allocated by this tag and not yet freed
+	uint64_t	peakLiveBytes;
+};
+
+class AllocProfile {
+
+	private:
+		AllocProfile();											// static only
+
+	public:
+		static bool			enabled();							// compiled with ALLOC_PROFILE
+		static int			tag();								// current tag of this thread
+		static void			setTag(int tag);
+		static void			snapshot(AllocStats *out);			// ALLOC_TAG_COUNT entries
+		static const char	*name(int tag);						// command name or "other"
+};
+
+// charges allocations until the end of the scope to one command (early returns included)
+class AllocScope {
+
+	private:
+#ifdef ALLOC_PROFILE
+		int		_previous;
+#endif
+
+		AllocScope(const AllocScope &copy);
+		AllocScope &operator=(const AllocScope &other);
+
+	public:
+#ifdef ALLOC_PROFILE
+		AllocScope() : _previous(AllocProfile::tag()) { AllocProfile::setTag(CMD_UNKNOWN); }
+		~AllocScope() { AllocProfile::setTag(_previous); }
+
+		void	setCommand(CommandId id) { AllocProfile::setTag(id); }
+#else
+		AllocScope() {}
+		~AllocScope() {}
+
+		void	setCommand(CommandId) {}
+#endif
+};
+
+#endif
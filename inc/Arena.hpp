@@ -0,0 +1,110 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>		// for size_t, ptrdiff_t
+#include <new>			// for placement new, operator new
+#include <string>
+#include <vector>
+
+// counters describing how the arena served command-scoped allocations
+struct ArenaStats {
+	unsigned long	allocations;								// requests served from the arena
+	unsigned long	bytes;										// bytes handed out since start
+	unsigned long	resets;										// number of reset() calls (event loop ticks)
+	unsigned long	largeAllocations;							// requests bigger than a block (own heap block)
+	size_t			blocks;										// blocks currently owned
+	size_t			peakTickBytes;								// most bytes used during a single tick
+};
+
+/*
+	Bump allocator for temporaries that live no longer than one event loop tick
+	(tokens, filtered text, reply lines). Allocation is a pointer increment,
+	deallocation only rewinds when it frees the most recent allocation, and
+	reset() makes all blocks reusable at once. Blocks are kept between ticks,
+	so after warm-up a command does not reach the global allocator at all.
+*/
+class Arena {
+
+	private:
+		static const size_t	BLOCK_SIZE = 64 * 1024;
+		static const size_t	ALIGNMENT = 16;
+
+		std::vector<char*>	_blocks;							// regular blocks, reused after reset()
+		std::vector<char*>	_large;								// oversized allocations, freed on reset()
+		size_t				_current;							// index of the block being filled
+		size_t				_offset;							// first free byte in the current block
+		size_t				_tickBytes;							// bytes handed out since last reset()
+		ArenaStats			_stats;
+
+		// orthodox canonical form:
+		Arena(const Arena &copy);								// copy constructor
+		Arena &operator=(const Arena &other);					// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		Arena();												// constructor
+		~Arena();												// destructor
+
+		void		*allocate(size_t size);						// get aligned memory valid until reset()
+		void		deallocate(void *ptr, size_t size);			// give back memory if it was the last allocation
+		void		reset();									// release everything allocated during the tick
+		ArenaStats	stats() const;
+};
+
+// STL allocator handing out memory from an Arena (falls back to the heap without one)
+template <typename T>
+class ArenaAllocator {
+
+	public:
+		typedef T				value_type;
+		typedef T				*pointer;
+		typedef const T			*const_pointer;
+		typedef T				&reference;
+		typedef const T			&const_reference;
+		typedef size_t			size_type;
+		typedef ptrdiff_t		difference_type;
+
+		template <typename U>
+		struct rebind { typedef ArenaAllocator<U> other; };
+
+		Arena	*arena;
+
+		ArenaAllocator() : arena(NULL) {}
+		explicit ArenaAllocator(Arena &a) : arena(&a) {}
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+		pointer allocate(size_type n, const void * = 0) {
+			if (!arena)
+				return static_cast<pointer>(::operator new(n * sizeof(T)));
+			return static_cast<pointer>(arena->allocate(n * sizeof(T)));
+		}
+		void deallocate(pointer p, size_type n) {
+			if (!arena)
+				::operator delete(p);
+			else
+				arena->deallocate(p, n * sizeof(T));
+		}
+
+		size_type		max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+		void			construct(pointer p, const T &value) { new (static_cast<void*>(p)) T(value); }
+		void			destroy(pointer p) { p->~T(); }
+		pointer			address(reference x) const { return &x; }
+		const_pointer	address(const_reference x) const { return &x; }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+// command-scoped containers (never keep them past the end of the event loop tick)
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> >	ArenaString;
+typedef std::vector<std::string, ArenaAllocator<std::string> >						ArenaTokens;
+
+// append helpers for building reply lines in an ArenaString
+inline ArenaString &operator<<(ArenaString &out, const std::string &str) { return out.append(str.data(), str.size()); }
+inline ArenaString &operator<<(ArenaString &out, const ArenaString &str) { return out.append(str); }
+inline ArenaString &operator<<(ArenaString &out, const char *str) { return out.append(str); }
+
+#endif
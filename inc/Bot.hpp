@@ -3,6 +3,7 @@
 
 #include <string>
 #include <set>
+#include "Arena.hpp"
 
 #define BANNED_PATH "config/banned_words.txt"
 #define CENSOR_STRING "@#$%"
@@ -10,15 +11,20 @@
 class Bot {
 	public:
 		Bot();
+		explicit Bot(const std::string &path);							// word list from another file (one word per line)
 		~Bot();
 
-		std::string filterMessage(std::string original);
+		ArenaString filterMessage(const ArenaString &original) const;	// censored copy, allocated in original's arena
+		std::string filterMessage(const std::string &original) const;	// censored copy on the heap (worker threads have no arena)
 
 	private:
 		std::set<std::string> bannedWords;
 
-		void loadBannedWords();
-		void replaceAll(std::string &message, std::string const &toReplace, std::string const &replacement);
+		void loadBannedWords(const std::string &path);
+		template <typename String>
+		void replaceAll(String &message, std::string const &toReplace, std::string const &replacement) const;
+		template <typename String>
+		String censor(const String &original) const;
 
 		Bot(std::set<std::string>);
 		Bot &operator=(Bot const &rhs);
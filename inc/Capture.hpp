@@ -0,0 +1,102 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>		// for size_t
+#include <stdint.h>		// for uint64_t, uint32_t, uint16_t, uint8_t
+#include <pthread.h>	// for pthread_t, pthread_mutex_t, pthread_cond_t
+
+/*
+	Trace file layout (host byte order, little-endian on the machines we run on):
+
+		CaptureFileHeader                       once
+		CaptureRecord + length payload bytes    per event
+
+	Connection ids count up from 1 for the life of the capture, so a reused
+	fd shows up as a new connection. LINE payloads are the command lines as
+	the dispatcher saw them (trimmed, without \r\n), except that PASS and
+	OPER keep only the command: their parameters are passwords. A process
+	started by an upgrade appends to the trace of the one it replaced, with
+	the same clock and connection ids.
+*/
+#define CAPTURE_MAGIC "IRCTRACE"
+static const uint32_t	CAPTURE_VERSION = 1;
+
+enum CaptureEvent {
+	CAPTURE_OPEN = 1,											// connection accepted (no payload)
+	CAPTURE_LINE = 2,											// one inbound command line
+	CAPTURE_CLOSE = 3											// socket closed by either side (no payload)
+};
+
+struct CaptureFileHeader {
+	char		magic[8];										// CAPTURE_MAGIC, not terminated
+	uint32_t	version;
+	uint32_t	reserved;
+	uint64_t	startMicros;									// wall clock at the start of the capture
+};
+
+struct CaptureRecord {
+	uint64_t	nanos;											// monotonic time since the start of the capture
+	uint32_t	connection;
+	uint8_t		event;											// CaptureEvent
+	uint8_t		reserved;
+	uint16_t	length;											// payload bytes that follow
+};
+
+/*
+	Records inbound traffic for later replay (bench/replay). The event loop
+	only appends records to an in-memory buffer; once per tick flush() hands
+	the buffer to a writer thread (double buffering), so disk I/O never runs
+	on the event loop. If the writer falls behind by more than MAX_BUFFERED
+	bytes, new records are dropped and counted instead of growing memory.
+*/
+class Capture {
+
+	private:
+		static const size_t	MAX_BUFFERED = 64 * 1024 * 1024;
+
+		int						_fd;							// trace file, -1 when disabled
+		uint64_t				_start;							// Clock::now() at start()
+		uint64_t				_offset;						// nanoseconds from the trace's header to _start (resumed trace)
+		std::vector<uint32_t>	_connections;					// connection id per fd (0 = none)
+		uint32_t				_nextConnection;
+		std::string				_active;						// records of the current tick (event loop only)
+		std::string				_writing;						// buffer owned by the writer while _pending
+		bool					_pending;						// _writing holds data for the writer
+		bool					_stopping;
+		pthread_t				_writer;
+		pthread_mutex_t			_mutex;
+		pthread_cond_t			_wake;
+		uint64_t				_records;
+		uint64_t				_dropped;
+
+		void		append(int fd, CaptureEvent event, uint64_t ticks, const char *data, size_t length);
+		void		writerLoop();
+		static void	*writerMain(void *capture);
+
+		// orthodox canonical form:
+		Capture(const Capture &copy);							// copy constructor
+		Capture &operator=(const Capture &other);				// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		Capture();												// constructor (disabled)
+		~Capture();												// destructor (stops and flushes)
+
+		bool		start(const std::string &path, bool resume);	// open the trace (resume: append to it) and start the writer
+		void		stop();										// write what is buffered and join the writer
+		bool		enabled() const { return _fd != -1; }
+
+		void		open(int fd);								// new connection on fd
+		void		line(int fd, uint64_t received, const std::string &line);	// received = Clock::now() at recv()
+		void		close(int fd);								// connection on fd is gone
+		void		flush();									// end of tick: hand the records to the writer
+		uint32_t	nextConnection() const { return _nextConnection; }
+		void		continueConnections(uint32_t next);			// ids an older process had not handed out yet
+
+		uint64_t	records() const { return _records; }
+		uint64_t	dropped() const { return _dropped; }
+};
+
+#endif
@@ -6,21 +6,32 @@
 #include <map>
 #include <set>
 #include <vector>
+#include <ctime>
 #include "Client.hpp"
+#include "Pool.hpp"
+#include "InternTable.hpp"
 
 #define MAX_LIMIT 10000
 
+struct RemoteUser;
+
 class Channel {
 
 	private:
-		std::string					name;		  			// channel name
+		InternId					nameId;					// interned channel name
+		const std::string			*name;		  			// canonical name owned by the ChannelManager's table
+		ChannelHandle				handle;					// own handle, stored in members' channel lists
 		std::string					topic;		 			// channel topic
 		std::map<int, Client*>		members;	   			// map of channel members
 		std::set<int>				operators;	 			// set of channel operators
 		std::string					key;		   			// channel password/key
 		std::set<char>				modes;		 			// channel modes
 		int							userLimit;	 			// user limit
-		std::set<int>				invitations;			// set of users by fd allowed to enter channel in invite mode
+		std::set<ClientHandle>		invitations;			// users allowed to enter channel in invite mode (handles, so a reused fd is not invited)
+		std::set<std::string>		restoredOperators;		// operators saved before a restart (case-mapped), promoted when they join as OPER
+		std::map<RemoteUser*, bool>	remoteMembers;			// members on linked servers -> channel operator
+		std::map<int, size_t>		linkMembers;			// link fd -> remote members behind it (message fan-out)
+		time_t						created;				// creation time, the older version wins when servers link
 
 		// orthodox canonical form:
 		Channel();											// default constructor
@@ -29,11 +40,16 @@ class Channel {
 
 	public:
 		// orthodox canonical form:
-		Channel(const std::string &channelName);									// constructor
+		Channel(InternId channelNameId, const std::string &canonicalName);			// constructor
 		~Channel();																	// destructor
 
-		std::string getName() const;
+		const std::string &getName() const;
+		InternId getNameId() const;
+		const ChannelHandle &getHandle() const;
+		void setHandle(const ChannelHandle &channelHandle);
 		void broadcast(const std::string &message, Client *exclude = NULL) const;	// broadcast
+		void broadcast(const char *data, size_t length, Client *exclude = NULL) const;	// broadcast terminated message
+		void countBroadcast(size_t recipients) const;								// update broadcast metrics (also for shard fan-out)
 		bool isOperator(int clientFd) const;										// check if client is operator
 		void addMember(Client *client);												// add member
 		void removeMember(int clientFd);											// remove member
@@ -41,16 +57,31 @@ class Channel {
 		void removeOperator(int clientFd);											// remove operator
 		bool hasMember(int clientFd) const;											// check if client is member
 		std::vector<std::string> getMemberNicknames() const;						// get all member nicknames
-		size_t getMemberCount() const;												// get member count
+		size_t getMemberCount() const;												// get member count (local and remote)
+		void addRemoteMember(RemoteUser *user);										// add member on a linked server
+		void removeRemoteMember(RemoteUser *user);
+		bool hasRemoteMember(RemoteUser *user) const;
+		bool isRemoteOperator(RemoteUser *user) const;
+		void setRemoteOperator(RemoteUser *user, bool op);
+		const std::map<RemoteUser *, bool> &getRemoteMembers() const;
+		const std::map<int, size_t> &getLinkMembers() const;						// links with members behind them
+		bool hasLocalMembers() const;
+		time_t getCreated() const;
+		void setCreated(time_t when);
 		void setTopic(const std::string& newTopic);									// set topic
 		const std::string& getTopic() const;										// get topic
 		void setKey(const std::string &key);
 		std::string getKey() const;
 		void setUserLimit(int userLimit);
 		size_t getUserLimit() const;
-		void addInvitation(int fd);
-		void removeInvitation(int fd);
-		bool isInvited(int fd) const;
+		void addInvitation(const ClientHandle &client);
+		void removeInvitation(const ClientHandle &client);
+		bool isInvited(const ClientHandle &client) const;
+		void addRestoredOperator(const std::string &nickname);						// give +o to this nickname on join, if it is an IRC operator
+		std::vector<std::string> takeRestoredOperators();							// forget them, returns who they were
+		std::vector<std::string> getOperatorNicknames() const;						// operators present and restored
+		const std::set<std::string> &getRestoredOperators() const;
+		const std::set<ClientHandle> &getInvitations() const;
 
 		// Mode management
 		void setMode(char mode);
@@ -3,13 +3,26 @@
 #define CHANNELMANAGER_HPP
 
 #include "Channel.hpp"
-#include <map>
+#include "Pool.hpp"
+#include "InternTable.hpp"
+#include <vector>
 #include <string>
+#include <stdint.h>		// for uint64_t
 
 class ChannelManager {
 
 	private:
-		std::map<std::string, Channel*> channels;											// map of channels
+		// a removed channel, freed once no reader can hold it (Epoch)
+		struct RetiredChannel {
+			Channel		*channel;
+			uint64_t	epoch;														// Epoch::now() when it was retired
+			RetiredChannel(Channel *c, uint64_t e) : channel(c), epoch(e) {}
+		};
+
+		Pool<Channel>							pool;								// slab storage for channels
+		InternTable								names;								// interned channel names
+		std::vector<ChannelHandle>				channels;							// channel handle indexed by name id
+		std::vector<RetiredChannel>				retired;							// unindexed, not yet reclaimed
 
 		// orthodox canonical form:
 		ChannelManager(const ChannelManager &other);										// copy constructor
@@ -23,10 +36,17 @@ class ChannelManager {
 		Channel*								createChannel(const std::string& name);		// create channel
 		bool									channelExists(const std::string& name);		// check if channel exists
 		Channel*								getChannel(const std::string& name);		// get channel
+		Channel*								getChannel(InternId nameId) const;			// get channel by interned name
+		Channel*								getChannel(const ChannelHandle &handle) const;	// get channel by handle (NULL if stale)
+		ChannelHandle							getHandle(const Channel *channel) const;	// get handle of a channel
 		std::vector<std::string>				getChannelNames() const;					// get channel names
-		const std::map<std::string, Channel*>	&getChannels() const;						// get channels
 		void									removeChannel(const std::string& name);		// remove channel
-		void									removeClientFromAllChannels(int clientFd);	// remove client from all channels
+		void									removeChannel(Channel *channel);			// remove channel (retired, see reclaim)
+		void									reclaim(uint64_t before);					// free channels retired before this epoch
+		void									removeClientFromAllChannels(int clientFd, const ClientHandle &client);	// remove client from all channels
+		size_t									getChannelCount() const;					// number of channels
+		PoolStats								getPoolStats() const;						// slab usage of the channel pool
+		size_t									getNameTableBytes() const;					// memory held by interned names
 
 };
 
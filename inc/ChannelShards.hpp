@@ -0,0 +1,116 @@
+#ifndef CHANNELSHARDS_HPP
+#define CHANNELSHARDS_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>		// for uint64_t
+#include <pthread.h>	// for pthread_t, pthread_mutex_t, pthread_cond_t, pthread_barrier_t
+#include "Mailbox.hpp"
+#include "Metrics.hpp"	// for COUNTER_COUNT
+#include "Transport.hpp"
+
+class Channel;
+class Client;
+
+// a channel message waiting for its fan-out
+struct ShardJob {
+	ShardJob		*next;										// mailbox link
+	const Channel	*channel;
+	Client			*exclude;									// sender, not echoed (NULL: everyone)
+	std::string		line;										// terminated with \r\n, capacity kept for reuse
+
+	ShardJob() : next(NULL), channel(NULL), exclude(NULL) {}
+};
+
+// one recipient of a job
+struct ShardDelivery {
+	Client				*client;
+	const std::string	*line;									// the job's line
+};
+
+// what one shard fanned out to the connections of one owner
+struct ShardBatch {
+	ShardBatch					*next;							// mailbox link
+	std::vector<ShardDelivery>	deliveries;						// in channel order
+
+	ShardBatch() : next(NULL) {}
+};
+
+/*
+	Channel messages fanned out on several threads. Channels are partitioned
+	by name hash and connections by fd over the same N shards; shard 0 is the
+	event loop itself. The loop posts every channel PRIVMSG/NOTICE to the
+	mailbox of the channel's shard and runs the shards at the end of the tick:
+
+		fan-out    each shard walks the members of its channels and posts one
+		           batch per owning shard to that shard's result mailbox
+		delivery   each shard appends the batches to its own connections and
+		           writes them, together with its part of the tick's outbox
+
+	While a run is in progress the event loop is one of the shards and
+	touches nothing else, so in each phase a channel and a connection belong
+	to exactly one thread; between runs the shards sleep and the loop owns
+	everything. Messages of one channel stay in order (one mailbox, one
+	batch per owner); the server runs the shards before anything that could
+	overtake them (another command of any client, a disconnect). A shard
+	reads Client and Channel records inside an Epoch read section, so a
+	record retired meanwhile is not freed under it.
+*/
+class ChannelShards {
+
+	private:
+		struct Shard {
+			ChannelShards			*pool;
+			size_t					index;
+			pthread_t				thread;
+			size_t					reader;						// Epoch reader slot
+			Mailbox<ShardJob>		jobs;						// messages of this shard's channels
+			Mailbox<ShardBatch>		results;					// deliveries to this shard's connections
+			std::vector<ShardBatch>	batches;					// fan-out output, one per owner
+			std::vector<ShardJob*>	done;						// fanned-out jobs, recycled by the loop
+			std::vector<Client*>	flush;						// connections to write in this run
+			std::vector<int>		blocked;					// connections left waiting for POLLOUT
+			uint64_t				counters[COUNTER_COUNT];	// Metrics counters of the thread
+
+			Shard() : pool(NULL), index(0), reader(0) {}
+		};
+
+		std::vector<Shard*>		_shards;						// [0] runs on the event loop thread
+		std::vector<ShardJob*>	_spare;							// recycled jobs (loop only)
+		size_t					_pending;						// jobs posted since the last run
+		Transport				*_transport;
+		pthread_mutex_t			_mutex;
+		pthread_cond_t			_wake;							// a run started (or stop)
+		pthread_cond_t			_idle;							// the last worker finished the run
+		pthread_barrier_t		_phase;							// between fan-out and delivery
+		unsigned				_generation;					// bumped for every run
+		size_t					_busy;							// worker threads still in the run
+		bool					_stopping;
+
+		void		fanOut(Shard &shard);
+		void		deliver(Shard &shard);
+		void		work(Shard &shard);
+		void		serve(Shard &shard);
+		static void	*threadMain(void *shard);
+
+		// orthodox canonical form:
+		ChannelShards(const ChannelShards &copy);				// copy constructor
+		ChannelShards &operator=(const ChannelShards &other);	// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		ChannelShards();										// constructor (disabled)
+		~ChannelShards();										// destructor (joins the threads)
+
+		bool		start(size_t count, Transport &transport);	// count shards, the event loop included
+		void		stop();
+		bool		enabled() const { return !_shards.empty(); }
+		size_t		count() const { return _shards.size(); }
+		bool		pending() const { return _pending != 0; }
+
+		// event loop side:
+		void		post(const Channel *channel, const char *data, size_t length, Client *exclude);
+		void		run(const std::vector<Client*> &flush, std::vector<int> &blocked);	// fan out, deliver, write
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef CHANNELSTORE_HPP
+#define CHANNELSTORE_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <set>
+#include <cstddef>		// for size_t
+#include <stdint.h>		// for uint64_t, uint32_t, uint16_t, uint8_t
+
+class ChannelManager;
+
+/*
+	Channel state files in state_dir (host byte order, like the capture trace):
+
+		channels.snapshot   StateFileHeader + records describing every channel
+		channels.wal        StateFileHeader + records appended since that snapshot
+
+	Both files hold the same records, so a restore maps the snapshot, applies
+	its records, then applies the log tail. Records only ever assign state
+	(a topic, a mode, one operator), which makes replaying a log that is
+	already contained in the snapshot harmless: a crash between writing the
+	snapshot and truncating the log loses nothing. A torn record at the end
+	of the log (checksum mismatch) ends the replay and is cut off.
+
+	Operators are stored by nickname, since fds mean nothing after a restart;
+	a restored operator gets +o back when a client with that nickname (RFC 1459
+	case mapping) joins within the grace period after an OPER login: anyone can
+	take a nickname. Whoever has not come back by then is dropped
+	(STATE_DEOP), so a nickname cannot claim +o on a channel indefinitely.
+*/
+#define STATE_SNAPSHOT_MAGIC "IRCSTATE"
+#define STATE_WAL_MAGIC "IRCSTWAL"
+static const uint32_t	STATE_VERSION = 1;
+static const long		STATE_OPERATOR_GRACE_SECONDS = 600;		// state_operator_grace default
+
+enum StateRecordType {
+	STATE_CREATE = 1,											// channel exists (no argument)
+	STATE_DESTROY = 2,											// channel is gone with all its state
+	STATE_TOPIC = 3,											// argument: topic text
+	STATE_MODE_SET = 4,											// argument: 'i' or 't'
+	STATE_MODE_UNSET = 5,
+	STATE_KEY = 6,												// argument: key, empty to unset
+	STATE_LIMIT = 7,											// argument: decimal user limit, 0 to unset
+	STATE_OP = 8,												// argument: nickname
+	STATE_DEOP = 9
+};
+
+struct StateFileHeader {
+	char		magic[8];										// STATE_SNAPSHOT_MAGIC or STATE_WAL_MAGIC, not terminated
+	uint32_t	version;
+	uint32_t	reserved;
+};
+
+struct StateRecord {
+	uint32_t	checksum;										// FNV-1a of the rest of the record and its payload
+	uint16_t	length;											// payload bytes that follow: name, then argument
+	uint8_t		type;											// StateRecordType
+	uint8_t		nameLength;
+};
+
+enum StateFsync {
+	STATE_FSYNC_ALWAYS,											// fdatasync every tick that logged a change, before replies go out
+	STATE_FSYNC_INTERVAL,										// fdatasync at most once per interval
+	STATE_FSYNC_NEVER											// leave it to kernel writeback
+};
+
+/*
+	Persists channel state (TOPIC, MODE, creation and destruction) across
+	restarts. The event loop appends records to an in-memory buffer; commit()
+	writes the tick's records with one write() and syncs them according to
+	the fsync policy (group commit). Snapshots rewrite the whole state to a
+	temporary file that is renamed over the old one, then empty the log.
+*/
+class ChannelStore {
+
+	private:
+		// one channel as the records describe it while restoring
+		struct ChannelState {
+			std::string				topic;
+			std::string				key;
+			size_t					limit;
+			std::set<char>			modes;
+			std::set<std::string>	operators;					// nicknames
+			ChannelState() : limit(0) {}
+		};
+		typedef std::map<std::string, ChannelState>	StateMap;
+
+		int				_wal;									// log fd, -1 when disabled
+		std::string		_snapshotPath;
+		std::string		_walPath;
+		StateFsync		_fsync;
+		uint64_t		_intervalMicros;						// STATE_FSYNC_INTERVAL period
+		uint64_t		_snapshotMicros;						// snapshot period (0: only at shutdown)
+		uint64_t		_lastSync;
+		uint64_t		_lastSnapshot;
+		uint64_t		_graceMicros;							// how long restored operators wait for their nickname
+		uint64_t		_graceEnd;								// when they are dropped (0: none waiting)
+		std::string		_pending;								// records of the current tick
+		bool			_unsynced;								// written but not yet fdatasync'ed
+		uint64_t		_walRecords;							// records in the log since the last snapshot
+		uint64_t		_records;
+		uint64_t		_syncs;
+		uint64_t		_snapshots;
+
+		static uint32_t	checksum(const StateRecord &record, const char *payload);
+		static void		encode(std::string &out, StateRecordType type, const std::string &channel, const std::string &argument);
+		static size_t	replay(const char *data, size_t size, const char *magic, StateMap &states);
+		static void		apply(StateMap &states, StateRecordType type, const std::string &channel, const std::string &argument);
+		bool			replayFile(const std::string &path, const char *magic, StateMap &states, bool truncateTail);
+		bool			resetLog();								// truncate the log to its header
+
+		// orthodox canonical form:
+		ChannelStore(const ChannelStore &copy);					// copy constructor
+		ChannelStore &operator=(const ChannelStore &other);		// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		ChannelStore();											// constructor (disabled)
+		~ChannelStore();										// destructor (closes the log, no snapshot)
+
+		bool		open(const std::string &directory, StateFsync fsync, long intervalMillis, long snapshotSeconds, long graceSeconds);
+		size_t		restore(ChannelManager &channels);			// recreate the saved channels, returns how many
+		void		close();
+		bool		enabled() const { return _wal != -1; }
+		static bool	parseFsync(const std::string &text, StateFsync &fsync);
+
+		void		append(StateRecordType type, const std::string &channel, const std::string &argument = "");
+		void		commit();									// end of tick: write and sync the tick's records
+		bool		snapshotDue() const;
+		bool		snapshot(ChannelManager &channels);			// write the full state, empty the log
+		void		beginGrace();								// restored operators wait from now on
+		void		resumeGrace(uint32_t millisLeft);			// what an upgrade handed over
+		uint32_t	graceLeftMillis() const;					// 0 when none are waiting
+		bool		graceOver() const;
+		void		expireRestored(ChannelManager &channels);	// drop the restored operators still waiting
+
+		uint64_t	records() const { return _records; }
+		uint64_t	syncs() const { return _syncs; }
+		uint64_t	snapshots() const { return _snapshots; }
+};
+
+#endif
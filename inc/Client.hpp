@@ -2,22 +2,52 @@
 #define CLIENT_HPP
 
 #include <string>
-#include <set>
+#include <vector>
 #include <ctime>
+#include "Pool.hpp"
+#include "InternTable.hpp"
+#include "Transport.hpp"
 
+typedef Handle ClientHandle;							// generation-checked reference to a pooled Client
+typedef Handle ChannelHandle;							// generation-checked reference to a pooled Channel
+
+/*
+	Cold per-client data: identity strings and membership. Only read by
+	registration, WHO and QUIT/disconnect, so it lives in its own pool and
+	stays out of the cache lines walked by broadcast and dispatch.
+*/
+struct ClientIdentity {
+	std::string					username;				// username
+	std::string					realname;				// realname
+	std::string					hostname;				// hostname
+	std::vector<ChannelHandle>	channels;				// joined channels (sorted ids, not name copies)
+	time_t						lastActivity;			// last active time
+
+	explicit ClientIdentity(const std::string &host) : hostname(host), lastActivity(time(NULL)) {}
+};
+
+// hot per-connection state, packed in the client pool and addressed by handle
 class Client {
 
 private:
+	static const size_t		SEND_BUFFER_KEEP = 4096;	// send buffer capacity kept between bursts
+	static const size_t		SEND_BUFFER_LIMIT = 1 << 20;	// queued bytes after which a stalled client is disconnected (SendQ exceeded)
+
 	int						_fd;						// client socket
-	std::string				_nickname;					// nickname
-	std::string				_username;					// username
-	std::string				_realname;					// realname
-	std::string				_hostname;					// hostname
 	bool					_registered;				// flag to check if client is registered
 	bool					_passwordVerified;			// flag to check if password is verified
+	bool					_oper;						// IRC operator (OPER succeeded)
+	bool					_link;						// connection to another server, not a user
+	bool					_suspended;					// a command of it is waiting (CommandTask), later lines stay buffered
+	bool					_sendQExceeded;				// queued past SEND_BUFFER_LIMIT: nothing more is queued or sent, the server drops it
+	InternId				_nickId;					// interned nickname (NONE until NICK)
+	ClientIdentity			*_identity;					// cold data (owned by ClientManager)
+	const std::string		*_nickname;					// canonical nickname owned by the ClientManager's table
+	std::string				_prefix;					// cached ":nick!user@host", rebuilt when nick/user change
 	std::string				_recvBuffer;				// temporary buffer for recv()
-	std::set<std::string>	_channels;					// joined channels
-	time_t					_lastActivity;				// last active time
+	std::string				_sendBuffer;				// replies queued during this tick, flushed by the server
+	std::vector<int>		*_outbox;					// fds with queued output (owned by ClientManager)
+	uint64_t				_lineStart;					// Clock::now() when the buffered partial line began
 
 	// orthodox canonical form:
 	Client();											// default constructor
@@ -26,35 +56,61 @@ private:
 
 public:
 	// orthodox canonical form:
-	Client(int clientFd, const std::string &host);		// constructor
+	Client(int clientFd, ClientIdentity *identity);		// constructor
 	~Client();											// destructor
 
 	// methods:
-	std::string 	getPrefix() const;										// get client prefix
-	void			sendMessage(const std::string &message) const;			// send message
+	const			std::string& getPrefix() const;							// get client prefix
+	void			sendMessage(const std::string &message);				// queue message
+	void			sendMessage(const char *data, size_t length);			// queue already terminated message
+	bool			deliver(const char *data, size_t length);				// queue from a channel shard (no outbox), true if it needs a flush
+	bool			flush(Transport &transport);							// write queued output, false if the socket is full
+	bool			hasPendingOutput() const;								// output left after a short write
+	size_t			getQueuedBytes() const;									// bytes waiting in the send buffer
+	void			setOutbox(std::vector<int> *outbox);					// where to announce queued output
 	int				getFd() const;											// get client socket
 	const			std::string& getNickname() const;						// get nickname
+	InternId		getNickId() const;										// get interned nickname id
 	const			std::string& getUsername() const;						// get username
 	bool			isRegistered() const;									// check if client is registered
-	void 			setNickname(const std::string& nick);					// set nickname
+	void 			setNickname(InternId nickId, const std::string& nick);	// set nickname (use ClientManager::setNickname)
 	void 			setUsername(const std::string& user);					// set username
 	void 			setRegistered(bool val);								// set registered flag
+	bool			isOper() const;											// check if client is an IRC operator
+	void			setOper(bool val);										// set IRC operator flag
+	bool			isLink() const;											// check if this is a server link
+	void			setLink(bool val);										// set server link flag (its output is never dropped)
+	bool			isSuspended() const;									// check if a command is waiting to be resumed
+	void			setSuspended(bool val);									// set by Server::startTask/resumeTask
+	bool			sendQExceeded() const;									// output was lost, the connection must go
 
 	// buffering commands before we find a complete one (\r\n):
-	void			appendBuffer(const std::string& data);					// append data to buffer
+	void			appendBuffer(const char *data, size_t length);			// append data to buffer
 	bool			hasCompleteCommand() const;								// check if buffer contains a complete command
-	std::string 	extractCommand();										// extract complete command
+	bool		 	extractCommand(std::string &command);					// extract complete command (reuses command's storage)
+	size_t			getBufferCapacity() const;								// heap bytes held by the receive buffer
+	bool			hasBufferedInput() const;								// part of a line is waiting for more bytes
+	uint64_t		getLineStart() const;									// arrival of the first byte of the buffered line
+	const			std::string& getReceiveBuffer() const;					// partial line (handed over by an upgrade)
+	const			std::string& getSendBuffer() const;						// output not written yet
+	void			setLineStart(uint64_t time);
 
 	// registration:
 	bool			isPasswordVerified() const;								// check if password is verified
 	void			setPasswordVerified(bool verified);						// set password verification flag
 	void			setRealname(const std::string& realname);				// set realname
 	const			std::string& getRealname() const;						// get realname
-	void			addChannel(const std::string& channelName);				// add channel to client's channel list
-	void			removeChannel(const std::string& channelName);			// remove channel from client's channel list
-	const			std::set<std::string>& getChannels() const;				// get client's channels
+	void			addChannel(const ChannelHandle &channel);				// add channel to client's channel list
+	void			removeChannel(const ChannelHandle &channel);			// remove channel from client's channel list
+	const			std::vector<ChannelHandle>& getChannels() const;		// get client's channels
 	const			std::string& getHostname() const;						// get hostname
-	bool			isInChannel(const std::string &channelName) const;
+	void			setHostname(const std::string& host);					// resolved hostname (replaces the address)
+	bool			isInChannel(const ChannelHandle &channel) const;
+	ClientIdentity	*getIdentity() const;									// cold data block
+
+private:
+	void			updatePrefix();											// rebuild cached prefix
+	bool			exceedsSendQ();											// mark it once the queue is over the limit
 };
 
 #endif
@@ -0,0 +1,76 @@
+// ClientManager.hpp
+#ifndef CLIENTMANAGER_HPP
+#define CLIENTMANAGER_HPP
+
+#include "Client.hpp"
+#include "Pool.hpp"
+#include "InternTable.hpp"
+#include <vector>
+#include <string>
+#include <stdint.h>		// for uint64_t
+
+// memory held by the connected clients, split the same way as the storage
+struct ClientFootprint {
+	size_t	clients;											// connected clients
+	size_t	hotBytes;											// Client records (fd, flags, nick, prefix, recv buffer)
+	size_t	coldBytes;											// ClientIdentity records
+	size_t	heapBytes;											// string/vector storage outside the records
+	size_t	nickTableBytes;										// interned nicknames and their index
+};
+
+class ClientManager {
+
+	private:
+		// a client that left, freed once no reader can hold it (Epoch)
+		struct RetiredClient {
+			Client		*client;
+			uint64_t	epoch;											// Epoch::now() when it was retired
+			RetiredClient(Client *c, uint64_t e) : client(c), epoch(e) {}
+		};
+
+		Pool<Client>				hotPool;										// hot records, array-of-structs walked by dispatch and broadcast
+		Pool<ClientIdentity>		coldPool;										// cold identity and membership data
+		std::vector<Client*>		clients;										// connected clients in connection order
+		std::vector<ClientHandle>	fdIndex;										// client handle indexed by socket fd
+		InternTable					nicks;											// interned nicknames
+		std::vector<ClientHandle>	nickIndex;										// client handle indexed by nickname id
+		std::vector<int>			outbox;											// fds that queued output this tick
+		std::vector<int>			flushing;										// outbox being flushed (swapped, keeps capacity)
+		std::vector<RetiredClient>	retired;										// unindexed, not yet reclaimed
+
+		void						unindex(Client *client);						// drop from the list and the fd and nickname indexes
+
+		// orthodox canonical form:
+		ClientManager(const ClientManager &other);									// copy constructor
+		ClientManager& operator=(const ClientManager &other);						// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		ClientManager();															// default constructor
+		~ClientManager();															// destructor
+
+		Client*						createClient(int clientFd, const std::string &host);	// create client and index its fd
+		void						destroyClient(Client *client);					// destroy client (hot and cold part)
+		void						retireClient(Client *client);					// gone for lookups now, freed by reclaim()
+		void						reclaim(uint64_t before);						// free clients retired before this epoch
+		bool						isAlive(const Client *client) const { return hotPool.isAlive(client); }	// false once retired
+		void						clear();										// destroy all clients
+		Client*						getByFd(int clientFd) const;					// find client by fd
+		Client*						get(const ClientHandle &handle) const;			// get client by handle (NULL if stale)
+		ClientHandle				getHandle(const Client *client) const;			// get handle of a client
+		Client*						getByNickname(const std::string &nickname) const;	// find client by nickname
+		Client*						getByNickId(InternId nickId) const;				// find client by interned nickname
+		bool						setNickname(Client *client, const std::string &nickname);	// rename client, false if taken
+		const std::vector<Client*>	&getClients() const;							// get connected clients
+		size_t						size() const;									// number of clients
+		PoolStats					getHotStats() const;							// slab usage of the hot pool
+		PoolStats					getColdStats() const;							// slab usage of the cold pool
+		ClientFootprint				getFootprint() const;							// bytes used by all clients
+		size_t						getQueuedBytes() const;							// output waiting in all send buffers
+		size_t						pendingFlushes() const { return outbox.size(); }	// clients with output queued this tick
+		void						flushOutput(Transport &transport, std::vector<int> &blocked);	// flush queued output, collect fds with a full socket
+		void						takeOutbox(std::vector<Client*> &out);			// clients that queued output this tick (outbox emptied)
+
+};
+
+#endif
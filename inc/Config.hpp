@@ -0,0 +1,70 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+
+#define CONFIG_PATH "config/ircserv.conf"
+
+/*
+	Server settings read once at startup from CONFIG_PATH.
+	One setting per line: "<key> <value>", '#' starts a comment.
+	"oper <name> <password>" lines define IRC operators (may repeat).
+	"link <server> <password> [<host> <port>]" lines define linked servers
+	(may repeat); with an address this server connects to it.
+	"listen <endpoint> [<option>...]" lines open more listeners (may repeat).
+	A missing file leaves every setting at its default.
+*/
+// one "link" line: a server allowed to link, and where to reach it
+struct LinkConfig {
+	std::string	name;												// the peer's server_name
+	std::string	password;											// sent and expected in the SERVER handshake
+	std::string	host;												// empty: wait for the peer to connect
+	int			port;
+};
+
+// one "listen" line: "<ipv4>:<port>", "[<ipv6>]:<port>", "*:<port>" (dual-stack) or a Unix socket path
+struct ListenConfig {
+	std::string	endpoint;											// as written, identifies the listener across an upgrade
+	std::string	host;												// address, or the path of a Unix socket
+	int			port;												// 0 for a Unix socket
+	int			family;												// AF_INET, AF_INET6 or AF_UNIX
+	int			backlog;											// backlog=<n>
+	bool		v6only;												// v6only: no IPv4-mapped peers on an IPv6 endpoint
+	bool		tls;												// tls: speak TLS (tls_cert, tls_key)
+	bool		noDelay;											// nodelay: TCP_NODELAY, inherited by accepted sockets
+	int			deferAccept;										// defer_accept=<s>: wake up once data arrived (0: off)
+	int			receiveBuffer;										// rcvbuf=<bytes> (0: kernel default)
+	int			sendBuffer;											// sndbuf=<bytes> (0: kernel default)
+	int			mode;												// mode=<octal> of a Unix socket (-1: umask)
+
+	ListenConfig();
+};
+
+class Config {
+	public:
+		Config();
+		~Config();
+
+		bool		load(const std::string &path);											// false if the file cannot be read
+		std::string	get(const std::string &key, const std::string &fallback) const;		// value or fallback
+		long		getInt(const std::string &key, long fallback) const;					// numeric value or fallback
+		bool		checkOperator(const std::string &name, const std::string &password) const;
+		size_t		operatorCount() const;
+		const std::vector<LinkConfig>	&getLinks() const;
+		const std::vector<ListenConfig>	&getListeners() const;
+		const std::vector<std::string>	&getInvalidListeners() const;						// "line <n>: <text>" of each rejected one
+
+	private:
+		std::map<std::string, std::string>	values;						// key -> value
+		std::map<std::string, std::string>	operators;					// oper name -> password
+		std::vector<LinkConfig>				links;						// "link" lines in file order
+		std::vector<ListenConfig>			listeners;					// "listen" lines in file order
+		std::vector<std::string>			invalidListeners;			// "listen" lines parseListen() rejected
+
+		Config(const Config &copy);
+		Config &operator=(const Config &rhs);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <cstddef>		// for size_t
+#include <stdint.h>		// for uint64_t
+
+static const size_t	MAX_EPOCH_READERS = 64;						// reader threads registered at once
+static const uint64_t	RECLAIM_ALL = ~static_cast<uint64_t>(0);	// reclaim bound when no reader is left (shutdown)
+
+/*
+	Epoch-based reclamation of the objects the event loop shares with reader
+	threads (Client and Channel records). The loop is the only writer: it
+	unlinks an object from every registry, retires it with the current epoch
+	(now()) and frees it later, once collect() says that no reader can still
+	hold a pointer to it. Readers never lock; they announce the epoch they
+	started in (enter) and announce nothing while they hold no shared
+	pointer (exit).
+
+	collect() advances the epoch and returns the oldest epoch a reader is
+	still in (or the new epoch if none is): everything retired before it is
+	unreachable for every reader. The loop itself never needs to announce,
+	it only collects between ticks where it holds no pointer either.
+*/
+class Epoch {
+
+	private:
+		struct Reader {
+			uint64_t	announced;								// epoch entered, 0 while quiescent
+			bool		used;									// slot registered (loop only)
+			char		padding[64 - sizeof(uint64_t) - sizeof(bool)];	// one cache line per reader
+		};
+
+		static uint64_t		_epoch;								// global epoch, starts at 1
+		static Reader		_readers[MAX_EPOCH_READERS];
+
+		Epoch();												// static only
+
+	public:
+		// event loop side:
+		static size_t	registerReader();						// slot for a new reader thread, MAX_EPOCH_READERS if full
+		static void		releaseReader(size_t reader);			// the thread has stopped
+		static uint64_t	now() { return __atomic_load_n(&_epoch, __ATOMIC_ACQUIRE); }	// epoch to retire with
+		static uint64_t	collect();								// objects retired before this can be freed
+
+		// reader threads:
+		static void		enter(size_t reader);					// about to read shared objects
+		static void		exit(size_t reader);					// holds no shared pointer any more
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>		// for size_t
+#include <stdint.h>		// for uint32_t, uint8_t
+#include <sys/types.h>	// for pid_t
+
+/*
+	Hot upgrade: the running server fork()s and exec()s the new binary with
+	HANDOFF_ENV naming the child's end of a Unix socketpair. Over it the old
+	process sends
+
+		uint32 state length, uint32 descriptor count, state bytes
+		descriptors as SCM_RIGHTS, at most MAX_FDS_PER_MESSAGE per message
+
+	and the new process answers with one byte once it has rebuilt its state.
+	Only then does the old process exit; until that byte arrives it still
+	owns every socket, so a new binary that fails to start costs nothing.
+	The state itself is whatever the server serializes with HandoffWriter.
+*/
+#define HANDOFF_ENV "IRCSERV_UPGRADE_FD"
+
+class Handoff {
+
+	private:
+		static const size_t	MAX_FDS_PER_MESSAGE = 250;		// below the kernel's SCM_MAX_FD (253)
+
+		Handoff();											// static only
+
+	public:
+		static pid_t	spawn(const std::string &binary, const std::vector<std::string> &args, int &channel);	// -1 on failure
+		static int		inherited();						// channel given by the parent, -1 when not upgrading
+		static bool		send(int channel, const std::string &state, const std::vector<int> &fds);
+		static bool		receive(int channel, std::string &state, std::vector<int> &fds);
+		static bool		acknowledge(int channel);			// new process: state adopted
+		static bool		waitAcknowledged(int channel, int timeoutMs);
+		static std::string	currentBinary();				// path of the running executable (as installed now)
+};
+
+// length-prefixed fields in host byte order (both ends run on the same machine)
+class HandoffWriter {
+
+	private:
+		std::string	&_out;
+
+	public:
+		explicit HandoffWriter(std::string &out) : _out(out) {}
+
+		void	u8(uint8_t value) { _out += static_cast<char>(value); }
+		void	u32(uint32_t value) { _out.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+		void	str(const std::string &value) { u32(static_cast<uint32_t>(value.size())); _out += value; }
+};
+
+// reads what HandoffWriter wrote; after a short read every field is empty and ok() is false
+class HandoffReader {
+
+	private:
+		const std::string	&_in;
+		size_t				_offset;
+		bool				_ok;
+
+		bool	take(size_t length);
+
+	public:
+		explicit HandoffReader(const std::string &in) : _in(in), _offset(0), _ok(true) {}
+
+		uint8_t		u8();
+		uint32_t	u32();
+		std::string	str();
+		bool		ok() const { return _ok; }
+};
+
+#endif
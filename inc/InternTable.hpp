@@ -0,0 +1,59 @@
+#ifndef INTERNTABLE_HPP
+#define INTERNTABLE_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>		// for uint32_t
+
+typedef uint32_t InternId;										// stable id of an interned string (0 = none)
+
+/*
+	Keeps one canonical copy of each distinct name (channel names, nicknames)
+	and hands out a 32-bit id for it. Ids are reference counted: an id and its
+	string stay valid while anyone holds a reference, and the slot is recycled
+	after the last release(). Canonical strings never move, so references
+	returned by str() stay valid for the lifetime of the id.
+	Lookup is an open-addressing hash table (linear probing, FNV-1a).
+*/
+class InternTable {
+
+	private:
+		struct Entry {
+			std::string	text;									// canonical string
+			uint32_t	hash;									// cached hash of text
+			uint32_t	refs;									// references held (0 = free slot)
+		};
+
+		std::deque<Entry>		_entries;						// id -> entry (deque keeps strings in place)
+		std::vector<InternId>	_slots;							// hash table of ids, NONE = empty
+		std::vector<InternId>	_freeIds;						// released ids waiting for reuse
+		size_t					_count;							// live ids
+
+		// orthodox canonical form:
+		InternTable(const InternTable &copy);					// copy constructor
+		InternTable &operator=(const InternTable &other);		// copy assignment operator
+
+		static uint32_t	hashOf(const char *data, size_t length);
+		size_t			probe(const char *data, size_t length, uint32_t hash) const;	// slot holding the string or first empty slot
+		void			rehash(size_t capacity);
+		void			eraseSlot(size_t slot);
+
+	public:
+		static const InternId NONE = 0;
+
+		// orthodox canonical form:
+		InternTable();											// constructor
+		~InternTable();											// destructor
+
+		InternId			find(const std::string &text) const;				// id of text, NONE if not interned
+		InternId			find(const char *data, size_t length) const;
+		InternId			acquire(const std::string &text);					// intern text and take a reference
+		void				retain(InternId id);								// take another reference
+		void				release(InternId id);								// drop a reference, frees the id at zero
+		const std::string	&str(InternId id) const;							// canonical string of id
+		size_t				size() const;										// number of live ids
+		size_t				bytes() const;										// memory held by the table
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <string>
+#include <cstddef>		// for size_t
+#include <stdint.h>		// for uint64_t
+
+enum LogLevel {
+	LEVEL_DEBUG,												// per-command tracing
+	LEVEL_INFO,													// connection and channel lifecycle
+	LEVEL_WARN,													// recoverable problems
+	LEVEL_ERROR,												// failed system calls
+	LEVEL_OFF,													// threshold only: log nothing
+	LEVEL_COUNT
+};
+
+enum LogSubsystem {
+	SUB_SERVER,													// startup, shutdown, configuration
+	SUB_NET,													// sockets: accept, recv/send errors, disconnects
+	SUB_CLIENT,													// registration and client state
+	SUB_CHANNEL,												// channel creation, joins, parts
+	SUB_COMMAND,												// received commands
+	SUB_COUNT
+};
+
+enum { LOG_TEXT_SIZE = 236 };									// record size is 256 bytes
+
+// one log line as stored in the ring (fixed size, never allocates)
+struct LogRecord {
+	uint64_t		sequence;									// ring slot state (see Log::push)
+	uint64_t		micros;										// wall clock time in microseconds
+	unsigned char	level;
+	unsigned char	subsystem;
+	unsigned short	length;
+	char			text[LOG_TEXT_SIZE];						// truncated if longer
+};
+
+/*
+	Asynchronous leveled logger. Producers format into a LogRecord on their own
+	stack and publish it into a bounded lock-free ring (multi-producer, one
+	consumer); a background thread drains the ring to a file or stderr. When
+	the ring is full the record is dropped and counted, so logging never
+	blocks the event loop. A disabled level costs one compare and one branch.
+*/
+class Log {
+
+	private:
+		static unsigned char	_threshold[SUB_COUNT];			// lowest enabled level per subsystem
+
+		Log();													// static only
+
+	public:
+		static bool			enabled(LogLevel level, LogSubsystem subsystem) { return level >= _threshold[subsystem]; }
+		static void			push(LogLevel level, LogSubsystem subsystem, const char *text, size_t length);
+
+		static void			setLevel(LogLevel level);										// all subsystems
+		static void			setLevel(LogSubsystem subsystem, LogLevel level);
+		static bool			parseLevel(const std::string &name, LogLevel &level);
+		static bool			parseSubsystem(const std::string &name, LogSubsystem &subsystem);
+		static const char	*name(LogLevel level);
+		static const char	*name(LogSubsystem subsystem);
+
+		static bool			start(const std::string &path);				// start the writer thread ("" = stderr)
+		static void			stop();										// drain the ring and join the writer
+		static uint64_t		dropped();									// records lost to a full ring
+};
+
+// collects one line on the stack and hands it to the ring when it goes out of scope
+class LogLine {
+
+	private:
+		LogLevel		_level;
+		LogSubsystem	_subsystem;
+		size_t			_length;
+		char			_text[LOG_TEXT_SIZE];
+
+		LogLine(const LogLine &copy);
+		LogLine &operator=(const LogLine &other);
+
+		void	appendUnsigned(unsigned long value, bool negative);
+
+	public:
+		LogLine(LogLevel level, LogSubsystem subsystem) : _level(level), _subsystem(subsystem), _length(0) {}
+		~LogLine() { Log::push(_level, _subsystem, _text, _length); }
+
+		LogLine	&append(const char *data, size_t length);
+		LogLine	&operator<<(const char *str);
+		LogLine	&operator<<(const std::string &str) { return append(str.data(), str.size()); }
+		template <typename A>
+		LogLine	&operator<<(const std::basic_string<char, std::char_traits<char>, A> &str) { return append(str.data(), str.size()); }
+		LogLine	&operator<<(char c) { return append(&c, 1); }
+		LogLine	&operator<<(int value) { appendUnsigned(value < 0 ? -static_cast<long>(value) : value, value < 0); return *this; }
+		LogLine	&operator<<(unsigned value) { appendUnsigned(value, false); return *this; }
+		LogLine	&operator<<(long value) { appendUnsigned(value < 0 ? -static_cast<unsigned long>(value) : value, value < 0); return *this; }
+		LogLine	&operator<<(unsigned long value) { appendUnsigned(value, false); return *this; }
+		LogLine	&operator<<(double value);
+};
+
+// LOG(LEVEL_INFO, SUB_NET) << "text " << value;  (the line is not even built when the level is disabled)
+// a one-shot for instead of an if, so the macro is safe as the body of an unbraced if/else
+#define LOG(level, subsystem) \
+	for (bool log_once = Log::enabled(level, subsystem); log_once; log_once = false) \
+		LogLine(level, subsystem)
+
+#endif
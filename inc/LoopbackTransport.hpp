@@ -0,0 +1,101 @@
+#ifndef LOOPBACKTRANSPORT_HPP
+#define LOOPBACKTRANSPORT_HPP
+
+#include "Transport.hpp"
+#include <vector>
+#include <deque>
+#include <stdint.h>		// for uint64_t
+
+class LoopbackTransport;
+
+/*
+	The world outside the server. poll() calls step() once per event loop
+	tick, before it looks at the connections: the driver reads what the
+	server sent, moves the virtual clock forward and writes the next client
+	input. Returning false ends the run: "quit" is typed on the console.
+*/
+class LoopbackDriver {
+
+	public:
+		virtual ~LoopbackDriver() {}
+		virtual bool	step(LoopbackTransport &transport) = 0;
+};
+
+/*
+	In-memory transport for simulation. Connections are pairs of byte queues,
+	one listener is supported, and time is virtual: a poll() with nothing to
+	report advances the clock by its timeout instead of sleeping, so a run
+	depends only on what the driver does, never on the host.
+
+	Server-side descriptors start at FD_BASE, above anything the process has
+	open, so they never collide with the real descriptors of the metrics
+	endpoint sharing the poll set (those are simply never reported ready).
+	Client-side ids returned by connect() are never reused, unlike server fds.
+	Each connection's server-to-client queue holds at most sendWindow bytes,
+	so slow readers make send() short or EAGAIN like a full socket.
+*/
+class LoopbackTransport : public Transport {
+
+	public:
+		static const int	FD_BASE = 1024;
+		static const int	NONE = -1;
+
+	private:
+		struct Connection {
+			int			fd;								// server side, NONE until accepted and once closed
+			bool		closed;							// the server closed it
+			std::string	inbound;						// client -> server
+			size_t		inboundRead;					// bytes of inbound the server already received
+			std::string	outbound;						// server -> client, not yet read by the driver
+			bool		hungUp;							// client closed its end
+			Connection() : fd(NONE), closed(false), inboundRead(0), hungUp(false) {}
+		};
+
+		std::vector<Connection>	_connections;			// by connection id
+		std::vector<int>		_fds;					// connection id per fd - FD_BASE (NONE = free)
+		std::deque<int>			_backlog;				// connection ids waiting for accept()
+		int						_listenFd;				// NONE until listen()
+		size_t					_unread;				// inbound bytes not yet received, all connections
+		std::string				_console;				// pending operator input
+		LoopbackDriver			*_driver;
+		uint64_t				_now;					// virtual nanoseconds
+		size_t					_sendWindow;
+
+		int			allocateFd(int connection);
+		Connection	*find(int fd);
+
+		// orthodox canonical form:
+		LoopbackTransport(const LoopbackTransport &copy);							// copy constructor (we don't use it)
+		LoopbackTransport &operator=(const LoopbackTransport &other);				// copy assignment operator (we don't use it)
+
+	public:
+		// orthodox canonical form:
+		LoopbackTransport();														// constructor
+		~LoopbackTransport() {}														// destructor
+
+		// Transport (server side):
+		int		listen(int &port, int backlog);
+		int		accept(int listenFd, std::string &host);
+		int		dial(const std::string &host, int port);					// no other servers in a simulation: always -1
+		ssize_t	recv(int fd, char *buf, size_t length);
+		ssize_t	send(int fd, const char *data, size_t length);
+		void	close(int fd);
+		int		poll(pollfd *fds, size_t count, int timeoutMs);
+		ssize_t	readConsole(char *buf, size_t length);
+
+		// driver (client side):
+		void		setDriver(LoopbackDriver *driver) { _driver = driver; }
+		void		setSendWindow(size_t bytes) { _sendWindow = bytes; }
+		uint64_t	now() const { return _now; }
+		void		advance(uint64_t nanos) { _now += nanos; }
+		int			connect();												// queue a connection for accept(), returns its id
+		void		write(int connection, const char *data, size_t length);
+		void		write(int connection, const std::string &data) { write(connection, data.data(), data.size()); }
+		bool		read(int connection, std::string &data);				// swap the server's output into data
+		void		hangUp(int connection);
+		bool		isOpen(int connection) const { return !_connections[connection].closed; }
+		bool		isIdle() const { return _unread == 0 && _backlog.empty(); }	// no input waiting for the server
+		void		typeOnConsole(const std::string &line);
+};
+
+#endif
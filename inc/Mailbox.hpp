@@ -0,0 +1,69 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+#include <cstddef>		// for NULL
+
+/*
+	Lock-free multi-producer single-consumer queue of intrusive nodes (any
+	T with a "T *next" member). push() is one atomic exchange and never
+	waits; pop() belongs to the consumer thread. The queue never allocates:
+	nodes are owned by whoever pushed them until the consumer is done.
+
+	A pop() that races a push() still in progress can return NULL although
+	the queue is not empty; the node shows up on a later pop(). Consumers
+	that drain after a synchronisation point (all producers finished) never
+	see this.
+*/
+template <typename T>
+class Mailbox {
+
+	private:
+		T	*_head;												// last pushed node (producers)
+		T	*_tail;												// next node to pop (consumer)
+		T	_stub;												// keeps the queue non-empty
+
+		// orthodox canonical form:
+		Mailbox(const Mailbox &copy);							// copy constructor
+		Mailbox &operator=(const Mailbox &other);				// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		Mailbox() : _head(&_stub), _tail(&_stub) { _stub.next = NULL; }	// constructor (empty)
+		~Mailbox() {}													// destructor (nodes are not owned)
+
+		void	push(T *node)
+		{
+			__atomic_store_n(&node->next, static_cast<T *>(NULL), __ATOMIC_RELAXED);
+			T *previous = __atomic_exchange_n(&_head, node, __ATOMIC_ACQ_REL);
+			__atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+		}
+
+		T		*pop()
+		{
+			T *tail = _tail;
+			T *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+			if (tail == &_stub)
+			{
+				if (!next)
+					return NULL;
+				_tail = next;
+				tail = next;
+				next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+			}
+			if (next)
+			{
+				_tail = next;
+				return tail;
+			}
+			if (tail != __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+				return NULL;
+			push(&_stub);
+			next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+			if (!next)
+				return NULL;
+			_tail = next;
+			return tail;
+		}
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef MEMORYSTATS_HPP
+#define MEMORYSTATS_HPP
+
+#include <cstddef>
+
+// process-wide memory usage snapshot (values in bytes)
+struct MemoryStats {
+	size_t	rss;					// resident set size (/proc/self/statm)
+	size_t	heapArena;				// bytes obtained by malloc from the system (brk arenas)
+	size_t	heapInUse;				// bytes handed out by malloc and not yet freed
+	size_t	heapFree;				// free bytes kept inside malloc arenas (fragmentation)
+	size_t	heapMmapped;			// bytes in large mmap()-backed allocations
+
+	MemoryStats();
+
+	static MemoryStats	read();		// take a snapshot of the current process
+	double				fragmentation() const;	// heapFree / heapArena in percent
+};
+
+#endif
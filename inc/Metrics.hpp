@@ -0,0 +1,222 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <stdint.h>		// for uint64_t
+#include <cstddef>		// for size_t
+#include <ctime>		// for time_t
+#include <string>
+#include "Clock.hpp"
+
+// monotonically increasing event counts
+enum CounterId {
+	C_CONNECTIONS,												// accepted connections
+	C_DISCONNECTS,												// closed connections (any reason)
+	C_RECV_CALLS,												// recv() calls that returned data
+	C_BYTES_IN,													// bytes received from clients
+	C_MESSAGES_IN,												// complete lines processed
+	C_SEND_CALLS,												// send() calls made by the output flush
+	C_BYTES_OUT,												// bytes written to clients
+	C_SEND_BLOCKED,												// flushes that hit a full socket
+	C_SENDQ_EXCEEDED,											// clients disconnected for not reading their replies
+	C_BROADCASTS,												// channel broadcasts
+	C_BROADCAST_RECIPIENTS,										// messages queued by broadcasts
+	C_TICKS,													// event loop iterations
+	C_STALLS,													// ticks the watchdog caught over its threshold
+	C_LINK_LINES_IN,											// lines received from linked servers
+	C_LINK_LINES_OUT,											// lines queued to linked servers
+	C_SHARD_JOBS,												// channel messages fanned out by the channel shards
+	C_SHARD_RUNS,												// shard delivery runs (end of tick and ordering barriers)
+	C_POOL_JOBS,												// jobs finished by the worker pool
+	C_POOL_STEALS,												// of them, run by a worker that stole them from another
+	C_POOL_BUSY_MICROS,											// time the workers spent running jobs
+	C_DNS_QUERIES,												// DNS queries sent (reverse and confirming forward lookups)
+	C_DNS_CACHE_HITS,											// connections whose hostname came from the resolver cache
+	C_DNS_CACHE_MISSES,											// connections that needed a lookup
+	C_DNS_TIMEOUTS,												// lookups the DNS server did not answer in dns_timeout_ms
+	C_TLS_HANDSHAKES,											// completed TLS handshakes
+	C_TLS_RESUMED,												// of them, resumed sessions (ticket or cache)
+	C_TLS_FAILURES,												// TLS connections that failed or closed before the handshake completed
+	C_TLS_KTLS,													// of the handshakes, connections whose output the kernel encrypts
+	C_TLS_BYTES_ENCRYPTED,										// plaintext bytes sent over TLS
+	COUNTER_COUNT
+};
+
+// current values, refreshed before every report
+enum GaugeId {
+	G_CLIENTS,													// connected clients
+	G_CHANNELS,													// existing channels
+	G_BLOCKED_CLIENTS,											// clients waiting for POLLOUT
+	G_QUEUED_BYTES,												// output waiting in client send buffers
+	G_LINKS,													// established server links
+	G_REMOTE_USERS,												// users on other servers
+	G_POOL_THREADS,												// worker pool threads
+	G_POOL_IN_FLIGHT,											// jobs submitted and not finished yet
+	G_POOL_UTILIZATION,											// % of the worker threads' time spent in jobs since the last report
+	G_DNS_CACHE_ENTRIES,										// addresses in the resolver cache
+	G_DNS_CACHE_HIT_RATE,										// % of the hostname lookups answered by the cache since start
+	GAUGE_COUNT
+};
+
+// value distributions
+enum HistogramId {
+	H_BROADCAST_FANOUT,											// recipients per broadcast
+	H_COMMANDS_PER_TICK,										// lines processed in one tick
+	H_TICK_MICROS,												// event loop lag: work done between two poll() calls
+	H_LINE_LATENCY,												// ns from a line's first byte to the flush of its replies
+	H_STALL_MICROS,												// duration of the ticks counted in C_STALLS
+	H_SHARD_RUN_MICROS,											// duration of the runs counted in C_SHARD_RUNS
+	H_POOL_WAIT_MICROS,											// time a pool job waited for a worker
+	H_POOL_RUN_MICROS,											// time a worker spent on a pool job
+	H_DNS_LOOKUP_MICROS,										// hostname lookup of a connection, confirmation included
+	H_TLS_HANDSHAKE_MICROS,										// accept to completed TLS handshake
+	H_ACCEPT_BATCH,												// connections accepted in one listener wakeup
+	HISTOGRAM_COUNT
+};
+
+// commands known to the dispatcher (per-command counters)
+enum CommandId {
+	CMD_CAP, CMD_PASS, CMD_NICK, CMD_USER, CMD_OPER, CMD_PING, CMD_JOIN, CMD_PART,
+	CMD_MODE, CMD_PRIVMSG, CMD_NOTICE, CMD_INVITE, CMD_KICK, CMD_TOPIC, CMD_WHO,
+	CMD_STATS, CMD_QUIT, CMD_UNKNOWN,
+	COMMAND_COUNT
+};
+
+/*
+	Log-linear histogram (HDR style): every power of two is split into 8 linear
+	sub-buckets, so any recorded value is reported with at most 12.5% error.
+	Values below 8 are exact. Recording is a shift, a bit scan and an increment.
+*/
+class Histogram {
+
+	private:
+		static const unsigned	SUB_BITS = 3;
+		static const unsigned	SUB_COUNT = 1u << SUB_BITS;
+		static const unsigned	BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+		uint64_t	_buckets[BUCKET_COUNT];
+		uint64_t	_count;
+		uint64_t	_sum;
+		uint64_t	_max;
+
+		static unsigned	bucketOf(uint64_t value);
+
+	public:
+		Histogram();
+
+		void		record(uint64_t value);
+		void		reset();
+		uint64_t	count() const;
+		uint64_t	sum() const;
+		uint64_t	max() const;
+		uint64_t	percentile(double fraction) const;			// upper bound of the bucket holding the given rank
+		unsigned	bucketCount() const;
+		uint64_t	bucketValue(unsigned bucket) const;			// samples in one bucket
+		static uint64_t	bucketUpperBound(unsigned bucket);		// largest value that lands in the bucket
+};
+
+inline unsigned Histogram::bucketOf(uint64_t value)
+{
+	if (value < SUB_COUNT)
+		return static_cast<unsigned>(value);
+	unsigned magnitude = 63 - __builtin_clzl(static_cast<unsigned long>(value));
+	unsigned sub = static_cast<unsigned>(value >> (magnitude - SUB_BITS)) & (SUB_COUNT - 1);
+	return (magnitude - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+inline void Histogram::record(uint64_t value)
+{
+	++_buckets[bucketOf(value)];
+	++_count;
+	_sum += value;
+	if (value > _max)
+		_max = value;
+}
+
+// copy of the whole registry, rendered without touching the live values
+struct MetricsSnapshot {
+	uint64_t	counters[COUNTER_COUNT];
+	long		gauges[GAUGE_COUNT];
+	Histogram	histograms[HISTOGRAM_COUNT];
+	uint64_t	commands[COMMAND_COUNT];
+	uint64_t	commandBytes[COMMAND_COUNT];
+	Histogram	commandLatency[COMMAND_COUNT];
+	uint64_t	commandStalls[COMMAND_COUNT];
+	uint64_t	commandStallMax[COMMAND_COUNT];
+	time_t		uptime;
+};
+
+/*
+	Process-wide metrics registry. Every metric is a slot in a static array
+	addressed by enum, so an update is a single add with no lookup and no
+	allocation, cheap enough to stay on in every hot path. Reading is done
+	by the STATS command (and anything else that wants a report).
+
+	Counters are added through a per-thread pointer: the event loop counts
+	into the registry, a worker thread into its own block (countInto) that
+	the loop merges while the worker is idle. Everything else is only
+	updated by the event loop.
+*/
+class Metrics {
+
+	private:
+		static uint64_t		_counters[COUNTER_COUNT];
+		static long			_gauges[GAUGE_COUNT];
+		static Histogram	_histograms[HISTOGRAM_COUNT];
+		static uint64_t		_commands[COMMAND_COUNT];			// lines per command
+		static uint64_t		_commandBytes[COMMAND_COUNT];		// bytes per command
+		static Histogram	_commandLatency[COMMAND_COUNT];		// ns spent in processSingleCommand
+		static uint64_t		_commandStalls[COMMAND_COUNT];		// stalls caught while the command ran
+		static uint64_t		_commandStallMax[COMMAND_COUNT];	// longest of them in microseconds
+		static time_t		_startTime;
+		static __thread uint64_t	*_sink;						// counters of the calling thread
+
+		Metrics();												// static only
+
+	public:
+		static void				add(CounterId id, uint64_t amount = 1) { _sink[id] += amount; }
+		static void				set(GaugeId id, long value) { _gauges[id] = value; }
+		static void				record(HistogramId id, uint64_t value) { _histograms[id].record(value); }
+		static void				countCommand(CommandId id, size_t bytes) { ++_commands[id]; _commandBytes[id] += bytes; }
+		static void				recordCommand(CommandId id, uint64_t nanos) { _commandLatency[id].record(nanos); }
+		static void				countStall(CommandId id, uint64_t micros);
+		static void				countInto(uint64_t *counters) { _sink = counters; }	// calling thread, COUNTER_COUNT slots
+		static void				merge(uint64_t *counters);		// add a worker's block to the registry, zero it
+
+		static uint64_t			counter(CounterId id) { return _counters[id]; }
+		static long				gauge(GaugeId id) { return _gauges[id]; }
+		static const Histogram	&histogram(HistogramId id) { return _histograms[id]; }
+		static uint64_t			commandCount(CommandId id) { return _commands[id]; }
+		static uint64_t			commandBytes(CommandId id) { return _commandBytes[id]; }
+		static const Histogram	&commandLatency(CommandId id) { return _commandLatency[id]; }
+		static uint64_t			commandStalls(CommandId id) { return _commandStalls[id]; }
+		static uint64_t			commandStallMax(CommandId id) { return _commandStallMax[id]; }
+
+		static void				start();						// remember the start time
+		static time_t			uptime();						// seconds since start()
+		static uint64_t			nowMicros();					// monotonic clock for durations
+		static void				snapshot(MetricsSnapshot &out);	// copy every metric
+		static CommandId		commandId(const std::string &command);
+		static const char		*name(CounterId id);
+		static const char		*name(GaugeId id);
+		static const char		*name(HistogramId id);
+		static const char		*name(CommandId id);
+};
+
+// records the time until the end of the scope as the latency of one command (early returns included)
+class CommandTimer {
+
+	private:
+		uint64_t	_start;
+		CommandId	_command;
+
+		CommandTimer(const CommandTimer &copy);
+		CommandTimer &operator=(const CommandTimer &other);
+
+	public:
+		CommandTimer() : _start(Clock::now()), _command(CMD_UNKNOWN) {}
+		~CommandTimer() { Metrics::recordCommand(_command, Clock::toNanos(Clock::now() - _start)); }
+
+		void	setCommand(CommandId id) { _command = id; }
+};
+
+#endif
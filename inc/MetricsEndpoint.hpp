@@ -0,0 +1,64 @@
+#ifndef METRICSENDPOINT_HPP
+#define METRICSENDPOINT_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <poll.h>		// for pollfd
+#include <stdint.h>		// for uint64_t
+#include "Metrics.hpp"
+
+/*
+	Optional HTTP listener for scrapers ("GET /metrics", OpenMetrics text).
+	It only binds to 127.0.0.1 or a Unix socket and runs inside the server's
+	poll() loop: the server adds the returned fds to its poll set, passes their
+	events here and closes them with the rest of the poll set. The body is
+	rendered from a MetricsSnapshot at most once per event loop tick, and
+	responses are written without blocking, so a slow or stuck scraper never
+	delays IRC traffic.
+*/
+class MetricsEndpoint {
+
+	private:
+		static const size_t	MAX_REQUEST = 4096;				// larger requests are rejected
+		static const uint64_t	IDLE_TIMEOUT_MICROS = 5000000;	// connections not done by then are closed
+
+		struct Connection {
+			std::string	request;							// bytes received until the blank line
+			std::string	response;							// full HTTP response
+			size_t		sent;								// bytes of response already written
+			uint64_t	opened;								// Metrics::nowMicros() at accept
+			Connection() : sent(0), opened(0) {}
+		};
+
+		int								_listenFd;			// -1 when disabled
+		std::string						_socketPath;		// unlinked on shutdown (Unix socket only)
+		std::map<int, Connection>		_connections;		// open scrape connections
+		MetricsSnapshot					_snapshot;			// registry copy used for the last rendering
+		std::string						_body;				// last rendered body
+		uint64_t						_renderedTick;		// C_TICKS value of _body
+
+		void	render();									// snapshot the registry and render _body
+		void	respond(Connection &connection);			// build the response for a complete request
+		bool	writeResponse(int fd, Connection &connection);	// false once the response is done
+
+		// orthodox canonical form:
+		MetricsEndpoint(const MetricsEndpoint &copy);		// copy constructor
+		MetricsEndpoint &operator=(const MetricsEndpoint &other);	// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		MetricsEndpoint();									// constructor (disabled)
+		~MetricsEndpoint();									// destructor (removes the Unix socket file)
+
+		int		listenTcp(int port);						// listen on 127.0.0.1:port, returns the fd
+		int		listenUnix(const std::string &path);		// listen on a Unix socket, returns the fd
+		int		getListenFd() const;
+		bool	isConnection(int fd) const;					// fd belongs to a scrape connection
+		int		acceptConnection();							// accept a scraper, -1 on failure
+		bool	handleEvent(struct pollfd &pfd);			// serve a connection, false when it was closed
+		void	closeIdle(uint64_t now, std::vector<int> &closed);	// close the connections older than IDLE_TIMEOUT_MICROS
+		void	close();									// close every socket, keep the socket file (upgrade)
+};
+
+#endif
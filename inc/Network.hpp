@@ -0,0 +1,123 @@
+#ifndef NETWORK_HPP
+#define NETWORK_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>		// for uint64_t
+#include "Client.hpp"	// for ChannelHandle
+#include "Config.hpp"	// for LinkConfig
+
+/*
+	Server-to-server links. Linked servers form a spanning tree: a server
+	that is already known (directly or behind another link) is refused at
+	the handshake, so there is exactly one path between any two of them.
+	Links speak the client protocol with full prefixes, which lets most
+	relayed lines reach local members unchanged:
+
+		SERVER <name> <password>                                handshake (both ends), then the burst
+		:<sender> SERVER <name> <hops>                          a server behind the sender
+		:<sender> SQUIT <name> :<reason>                        that server and its users are gone
+		NICK <nick> <hops> <user> <host> <server> :<realname>   a user on another server
+		:<server> CHANNEL <#chan> <created> <+modes> <key|*> <limit> :<topic>
+		:<server> MODE <#chan> +o <nick>                        operator status given by a server
+		:<nick>!<user>@<host> JOIN|PART|QUIT|NICK|TOPIC|MODE|KICK|PRIVMSG|NOTICE ...
+		ERROR :<reason>
+
+	Every line is flooded to all other links, except channel messages (only
+	links with members of the channel behind them) and private messages
+	(only the link towards the target). A line about a remote user is only
+	taken from the link that user was introduced on.
+
+	Conflicts are settled the same way on every server, without a reply:
+	of two users with the same nickname the one on the server with the
+	smaller name stays, the other is killed by its own server. Of two
+	versions of a channel the older one (CHANNEL <created>) wins, equal
+	ones are merged.
+*/
+
+// a user on another server
+struct RemoteUser {
+	std::string					nickname;
+	std::string					username;
+	std::string					hostname;
+	std::string					realname;
+	std::string					server;						// server the user is connected to
+	std::string					prefix;						// ":nick!user@host", rebuilt on rename
+	int							link;						// fd of the link the user is reached through
+	int							hops;						// links between this server and the user's
+	std::vector<ChannelHandle>	channels;					// joined channels
+
+	RemoteUser() : link(-1), hops(0) {}
+	void	updatePrefix() { prefix = ":" + nickname + "!" + username + "@" + hostname; }
+};
+
+// a server somewhere behind one of the links
+struct RemoteServer {
+	std::string	name;
+	int			link;										// fd of the link it is reached through
+	int			hops;
+
+	RemoteServer() : link(-1), hops(0) {}
+};
+
+// a configured peer: accepted when it connects, dialled when it has an address
+struct LinkBlock {
+	LinkConfig	config;
+	int			fd;											// connection, -1 when down
+	uint64_t	nextAttempt;								// Metrics::nowMicros() of the next dial
+
+	LinkBlock() : fd(-1), nextAttempt(0) {}
+};
+
+class Network {
+
+	private:
+		std::string								_name;				// this server's name
+		std::vector<LinkBlock>					_blocks;			// "link" lines
+		std::map<int, std::string>				_links;				// established link fd -> peer name
+		std::map<std::string, RemoteServer>		_servers;			// every other server, by name
+		std::map<std::string, RemoteUser *>		_users;				// every remote user, by nickname (owned)
+		uint64_t								_retryMicros;		// wait before dialling a lost link again
+
+		// orthodox canonical form:
+		Network(const Network &copy);								// copy constructor
+		Network &operator=(const Network &other);					// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		Network();													// constructor (no links)
+		~Network();													// destructor (frees the remote users)
+
+		void				configure(const std::string &name, const std::vector<LinkConfig> &links, long retrySeconds);
+		const std::string	&name() const { return _name; }
+		bool				enabled() const { return !_blocks.empty(); }
+
+		// links:
+		std::vector<LinkBlock>				&blocks() { return _blocks; }
+		LinkBlock							*findBlock(const std::string &peer);
+		LinkBlock							*blockOf(int fd);
+		void								dialled(LinkBlock &block, int fd, uint64_t now);	// handshake (or next dial) due by now + retry
+		void								established(int fd, const std::string &peer);	// the peer becomes a server at 1 hop
+		bool								isEstablished(int fd) const;
+		const std::string					&peerOf(int fd) const;
+		const std::map<int, std::string>	&links() const { return _links; }
+		void								lost(int fd, uint64_t now);					// forget the link, schedule a new dial
+
+		// servers:
+		bool								knowsServer(const std::string &server) const;	// this one or a remote one
+		void								addServer(const std::string &server, int link, int hops);
+		void								removeServer(const std::string &server);
+		std::vector<std::string>			serversBehind(int link) const;
+		const std::map<std::string, RemoteServer>	&servers() const { return _servers; }
+
+		// users:
+		RemoteUser							*findUser(const std::string &nickname) const;
+		RemoteUser							*addUser(const RemoteUser &user);
+		void								renameUser(RemoteUser *user, const std::string &nickname);
+		void								removeUser(RemoteUser *user);					// deletes it
+		std::vector<RemoteUser *>			usersOn(const std::string &server) const;
+		const std::map<std::string, RemoteUser *>	&users() const { return _users; }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <vector>
+#include <new>			// for placement new
+#include <cstddef>		// for size_t
+#include <stdint.h>		// for uint32_t
+
+// generation-checked reference to an object stored in a Pool
+struct Handle {
+	uint32_t	index;											// slot index inside the pool
+	uint32_t	generation;										// slot generation when the handle was issued (0 = null)
+
+	Handle() : index(0), generation(0) {}
+	Handle(uint32_t i, uint32_t g) : index(i), generation(g) {}
+
+	bool	isNull() const { return generation == 0; }
+	bool	operator==(const Handle &other) const { return index == other.index && generation == other.generation; }
+	bool	operator!=(const Handle &other) const { return !(*this == other); }
+	bool	operator<(const Handle &other) const {
+		return index < other.index || (index == other.index && generation < other.generation);
+	}
+};
+
+// counters describing how a pool uses its slabs
+struct PoolStats {
+	size_t			slabs;										// slabs allocated so far (never released)
+	size_t			capacity;									// total slots in all slabs
+	size_t			live;										// currently constructed objects
+	size_t			peakLive;									// highest value of live
+	unsigned long	created;									// objects constructed since start
+	unsigned long	reused;										// creations served from a previously used slot
+	size_t			bytesReserved;								// bytes held by the slabs
+};
+
+/*
+	Slab allocator for long-lived server objects (clients, channels).
+	Objects are constructed in fixed-size slabs that are never returned to the heap,
+	so connect/disconnect churn reuses the same memory instead of fragmenting it.
+	Freed slots go to a LIFO free list (the most recently used slot is the warmest one)
+	and bump their generation, so a Handle kept after destroy() no longer resolves.
+	retire() and reclaim() split destroy() in two for objects a reader thread may
+	still hold: handles stop resolving at once, the slot is reused after reclaim().
+*/
+template <typename T, size_t SlabSize = 256>
+class Pool {
+
+	private:
+		static const uint32_t NO_SLOT = 0xffffffffu;
+
+		struct Slot {
+			union {
+				char	bytes[sizeof(T)];
+				double	alignDouble;
+				long	alignLong;
+				void	*alignPtr;
+			}			storage;								// object storage (must stay the first member)
+			uint32_t	index;									// own index, lets handleOf() work from a T*
+			uint32_t	generation;								// bumped on every destroy()
+			uint32_t	nextFree;								// free list link
+			bool		alive;									// storage holds a constructed T that handles resolve to
+			bool		retired;								// storage holds a constructed T waiting for reclaim()
+		};
+
+		std::vector<Slot*>	_slabs;
+		uint32_t			_freeHead;
+		size_t				_live;
+		size_t				_peakLive;
+		unsigned long		_created;
+		unsigned long		_reused;
+
+		// orthodox canonical form:
+		Pool(const Pool &copy);									// copy constructor
+		Pool &operator=(const Pool &other);						// copy assignment operator
+
+		Slot *slotAt(uint32_t index) const {
+			return &_slabs[index / SlabSize][index % SlabSize];
+		}
+
+		void grow() {
+			Slot *slab = new Slot[SlabSize];
+			uint32_t base = static_cast<uint32_t>(_slabs.size() * SlabSize);
+			_slabs.push_back(slab);
+			// link new slots so that the lowest index is handed out first
+			for (size_t i = SlabSize; i > 0; --i) {
+				Slot &slot = slab[i - 1];
+				slot.index = base + static_cast<uint32_t>(i - 1);
+				slot.generation = 1;
+				slot.alive = false;
+				slot.retired = false;
+				slot.nextFree = _freeHead;
+				_freeHead = slot.index;
+			}
+		}
+
+		Slot *acquire() {
+			if (_freeHead == NO_SLOT)
+				grow();
+			Slot *slot = slotAt(_freeHead);
+			_freeHead = slot->nextFree;
+			if (slot->generation > 1)
+				++_reused;
+			return slot;
+		}
+
+		void release(Slot *slot) {
+			slot->alive = false;
+			if (++slot->generation == 0)						// skip the null generation on wrap-around
+				slot->generation = 1;
+			slot->nextFree = _freeHead;
+			_freeHead = slot->index;
+		}
+
+		T *commit(Slot *slot) {
+			slot->alive = true;
+			++_created;
+			if (++_live > _peakLive)
+				_peakLive = _live;
+			return reinterpret_cast<T*>(slot->storage.bytes);
+		}
+
+	public:
+		// orthodox canonical form:
+		Pool() : _freeHead(NO_SLOT), _live(0), _peakLive(0), _created(0), _reused(0) {}
+		~Pool() {
+			for (size_t s = 0; s < _slabs.size(); ++s) {
+				for (size_t i = 0; i < SlabSize; ++i)
+					if (_slabs[s][i].alive || _slabs[s][i].retired)
+						reinterpret_cast<T*>(_slabs[s][i].storage.bytes)->~T();
+				delete[] _slabs[s];
+			}
+		}
+
+		// construct an object in a free slot
+		template <typename A1>
+		T *create(const A1 &a1) {
+			Slot *slot = acquire();
+			try { new (slot->storage.bytes) T(a1); }
+			catch (...) { release(slot); throw; }
+			return commit(slot);
+		}
+
+		template <typename A1, typename A2>
+		T *create(const A1 &a1, const A2 &a2) {
+			Slot *slot = acquire();
+			try { new (slot->storage.bytes) T(a1, a2); }
+			catch (...) { release(slot); throw; }
+			return commit(slot);
+		}
+
+		// destroy an object and invalidate every handle pointing to it
+		void destroy(T *object) {
+			if (!object)
+				return;
+			Slot *slot = reinterpret_cast<Slot*>(object);
+			if (!slot->alive)
+				return;
+			object->~T();
+			release(slot);
+			--_live;
+		}
+
+		void destroy(const Handle &handle) {
+			destroy(get(handle));
+		}
+
+		// invalidate every handle but keep the object readable until reclaim() (see Epoch)
+		void retire(T *object) {
+			if (!object)
+				return;
+			Slot *slot = reinterpret_cast<Slot*>(object);
+			if (!slot->alive)
+				return;
+			slot->alive = false;
+			slot->retired = true;
+			if (++slot->generation == 0)
+				slot->generation = 1;
+		}
+
+		// destroy a retired object, its slot can be handed out again
+		void reclaim(T *object) {
+			Slot *slot = reinterpret_cast<Slot*>(object);
+			if (!slot->retired)
+				return;
+			object->~T();
+			slot->retired = false;
+			release(slot);
+			--_live;
+		}
+
+		// false once the object was retired or destroyed (the pointer must not be dangling yet)
+		bool isAlive(const T *object) const {
+			return reinterpret_cast<const Slot*>(object)->alive;
+		}
+
+		// resolve a handle, NULL if the object was destroyed (stale handle) or never existed
+		T *get(const Handle &handle) const {
+			if (handle.isNull() || handle.index >= _slabs.size() * SlabSize)
+				return NULL;
+			Slot *slot = slotAt(handle.index);
+			if (!slot->alive || slot->generation != handle.generation)
+				return NULL;
+			return reinterpret_cast<T*>(slot->storage.bytes);
+		}
+
+		// handle of an object created by this pool
+		Handle handleOf(const T *object) const {
+			if (!object)
+				return Handle();
+			const Slot *slot = reinterpret_cast<const Slot*>(object);
+			return Handle(slot->index, slot->generation);
+		}
+
+		size_t size() const { return _live; }
+
+		PoolStats stats() const {
+			PoolStats s;
+			s.slabs = _slabs.size();
+			s.capacity = _slabs.size() * SlabSize;
+			s.live = _live;
+			s.peakLive = _peakLive;
+			s.created = _created;
+			s.reused = _reused;
+			s.bytesReserved = _slabs.size() * SlabSize * sizeof(Slot);
+			return s;
+		}
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <ctime>		// for time_t
+#include <stdint.h>		// for uint16_t, uint32_t
+
+// one answer datagram, as far as the resolver understands it
+struct DnsAnswer {
+	uint16_t					id;								// query it answers
+	std::string					question;						// name in the question section, empty if not exactly one
+	uint16_t					type;							// type asked in the question section
+	bool						ok;								// NOERROR with a record of the asked type
+	std::vector<std::string>	names;							// PTR targets, without the trailing dot
+	std::vector<uint32_t>		addresses;						// A records (network byte order)
+	uint32_t					ttl;							// smallest TTL of those records, seconds
+
+	DnsAnswer() : id(0), type(0), ok(false), ttl(0) {}
+};
+
+/*
+	Non-blocking DNS client for the hostnames of new connections. Queries go
+	as single UDP datagrams to one configured server (dns_server), so it can
+	be pointed at a local stub; receive() hands back every answer that has
+	arrived on getFd(), which the event loop polls. The resolver does not
+	wait or retry: timeouts and the PTR-then-A forward confirmation are the
+	caller's (Server::HostLookupTask). Query ids come from /dev/urandom and
+	answers carry their question back, so the caller can drop one that does
+	not match what it asked: a spoofer has to guess the id, not count on.
+
+	Results are kept in an LRU cache keyed by address, each entry expiring
+	after its record TTL; a failed lookup is cached as an empty name for
+	NEGATIVE_TTL seconds, so a host without a PTR record is not asked again
+	on every reconnect.
+*/
+class Resolver {
+
+	private:
+		struct CacheEntry {
+			uint32_t	address;								// network byte order
+			std::string	hostname;								// empty: no confirmed name
+			time_t		expires;
+		};
+		typedef std::list<CacheEntry>	CacheList;
+
+		int										_fd;			// UDP socket connected to the server, -1 if off
+		int										_random;		// /dev/urandom, one read per query id
+		size_t									_capacity;		// cache entries kept at most
+		CacheList								_lru;			// most recently used first
+		std::map<uint32_t, CacheList::iterator>	_cache;			// address -> entry in _lru
+
+		uint16_t	send(const std::string &name, uint16_t type);	// query id, 0 if it could not be sent
+		static bool	readName(const unsigned char *data, size_t size, size_t &pos, std::string *name);
+
+		// orthodox canonical form:
+		Resolver(const Resolver &copy);							// copy constructor
+		Resolver &operator=(const Resolver &other);				// copy assignment operator
+
+	public:
+		static const uint16_t	TYPE_A = 1;
+		static const uint16_t	TYPE_PTR = 12;
+		static const uint32_t	NEGATIVE_TTL = 60;				// seconds a failed lookup is remembered
+		static const uint32_t	MAX_TTL = 86400;				// longer record TTLs are cut to this
+
+		// orthodox canonical form:
+		Resolver();												// constructor (off)
+		~Resolver();											// destructor
+
+		bool		start(const std::string &server, size_t cacheSize);	// "ipv4[:port]" (port 53 by default)
+		void		stop();
+		bool		enabled() const { return _fd != -1; }
+		int			getFd() const { return _fd; }				// readable when receive() has something
+
+		uint16_t	queryPtr(uint32_t address);					// reverse lookup of an IPv4 address
+		uint16_t	queryA(const std::string &hostname);		// forward lookup (confirmation)
+		bool		receive(DnsAnswer &answer);					// next answer that has arrived, false if none
+
+		bool		cached(uint32_t address, std::string &hostname);	// fresh entry, counted as hit or miss
+		void		store(uint32_t address, const std::string &hostname, uint32_t ttl);
+		size_t		cacheSize() const { return _cache.size(); }
+
+		static bool	isValidHostname(const std::string &name);	// fit for a user prefix
+		static bool	sameName(const std::string &a, const std::string &b);	// DNS names compare without case
+		static std::string	reverseName(uint32_t address);		// the PTR question for an address
+};
+
+#endif
@@ -10,53 +10,155 @@
 #include <sys/socket.h> 	// for socket, setsockopt, bind, listen, accept, recv, send
 #include <sstream>			// for std::stringstream
 #include <map>
+#include <set>
 #include <deque>
 #include "ChannelMenager.hpp"
+#include "ClientManager.hpp"
 #include "Bot.hpp"
+#include "Pool.hpp"
+#include "Arena.hpp"
+#include "Config.hpp"
+#include "MetricsEndpoint.hpp"
+#include "Capture.hpp"
+#include "Watchdog.hpp"
+#include "ChannelStore.hpp"
+#include "SocketTransport.hpp"
+#include "Network.hpp"
+#include "ChannelShards.hpp"
+#include "WorkerPool.hpp"
+#include "Task.hpp"
+#include "Resolver.hpp"
 
 class Server {
 
+	friend class ServerBench;									// bench/micro.cpp times private hot paths
+
 	private:
+		// a processed line waiting for its replies to leave the send buffer
+		struct PendingLine {
+			ClientHandle	sender;								// stale once it disconnects, even if its fd is reused
+			uint64_t		start;								// Clock::now() at the line's first byte
+			PendingLine(const ClientHandle &c, uint64_t s) : sender(c), start(s) {}
+		};
+
+		// a channel message censored on a worker thread, relayed in channel order (relayFiltered)
+		struct FilterJob : public WorkItem {
+			Server			*server;
+			ChannelHandle	channel;
+			ClientHandle	sender;								// not echoed to (may be gone by the relay)
+			std::string		line;								// relay line up to the text, completed by run()
+			std::string		text;								// message text as sent
+			bool			done;								// finished, waiting for the ones before it
+
+			FilterJob() : server(NULL), done(false) {}
+			void	run();
+			void	finish();
+		};
+
+		// a failed PASS or OPER answered only after auth_failure_delay_ms, so guessing passwords is slow
+		struct AuthFailureTask : public CommandTask {
+			Server		*server;
+			bool		oper;									// OPER: 464 and stay, PASS: 464 and disconnect
+
+			AuthFailureTask(Server *s, bool o) : server(s), oper(o) {}
+			TaskState	resume();
+		};
+
+		// reverse lookup of a new connection, confirmed by a forward lookup; registration waits for it
+		struct HostLookupTask : public CommandTask {
+			Server		*server;
+			uint32_t	address;								// peer address (network byte order)
+			uint16_t	pending;								// query id in _lookups, 0 once answered or timed out
+			std::string	question;								// name the pending query asked for
+			uint16_t	questionType;							// and its type (Resolver::TYPE_*)
+			uint64_t	started;								// Metrics::nowMicros() of the first query
+			uint64_t	deadline;								// dns_timeout_ms after started, for both queries
+			DnsAnswer	answer;									// filled in by handleDnsAnswers
+			std::string	hostname;								// PTR name waiting for its confirmation
+			uint32_t	ttl;									// of the PTR record
+
+			HostLookupTask(Server *s, uint32_t a)
+				: server(s), address(a), pending(0), questionType(0), started(0), deadline(0), ttl(0) {}
+			~HostLookupTask();
+			TaskState	resume();
+			bool		ask(uint16_t id, const std::string &name, uint16_t type);	// wait for the answer (false: not sent)
+		};
+
+		SocketTransport				_sockets;					// default transport (kernel sockets)
+		Transport					*_transport;				// network and console I/O: _sockets or the one given to the constructor
 		int							_port;						// port
 		std::string					_realname;					// realname
 		std::string 				_password;					// password
 		int							_listenFd;					// listening socket (to detect that someone is trying to connect)
+		std::map<int, ListenConfig>	_listeners;					// "listen" lines and tls_port by descriptor (besides _listenFd)
+		std::vector<std::string>	_socketPaths;				// Unix sockets bound here, removed at exit unless handed on
 		std::vector<pollfd>			_pfds;						// poll file descriptors (list of all sockets we want to monitor using poll())
 		bool						_running;					// flag to check if server is running
-		std::vector<Client*>		_clients;					// list of connected clients
+		ClientManager				_clientManager;				// connected clients (hot/cold pools, fd index)
 		std::vector<std::string>	_channels;					// list of channels
 		ChannelManager				_channelManager;
-		std::vector<int>			_clientsToRemove;			// list of clients that need to be removed
 		Bot							_bot;
+		Arena						_arena;						// command-scoped temporaries, reset after every loop tick
+		std::string					_line;						// reused storage for the command being processed
+		std::vector<int>			_blocked;					// clients whose socket was full at the last flush
+		std::vector<int>			_sendQExceeded;				// clients that lost output, disconnected at the end of the tick
+		Config						_config;					// settings from CONFIG_PATH (operators, ...)
+		std::vector<PendingLine>	_pendingLines;				// lines of this tick (and of blocked senders) not yet flushed
+		MetricsEndpoint				_metrics;					// optional local /metrics listener
+		Capture						_capture;					// optional inbound traffic trace (capture_file)
+		Watchdog					_watchdog;					// stall detector thread (watchdog_ms)
+		ChannelStore				_channelStore;				// optional channel state log and snapshot (state_dir)
+		bool						_upgradeRequested;			// console "upgrade", done at the end of the tick
+		bool						_adopting;					// started by an upgrade and not acknowledged yet: the files are the old process's
+		Network						_network;					// linked servers and their users (link lines)
+		ChannelShards				_shards;					// channel message fan-out threads (channel_shards)
+		std::vector<Client*>		_flushing;					// outbox handed to the shards (capacity kept)
+		WorkerPool					_workers;					// message filter threads (worker_threads)
+		size_t						_offloadBytes;				// channel text from this size on is filtered by _workers
+		std::map<ChannelHandle, std::deque<FilterJob*> >	_offloaded;	// jobs per channel, in message order
+		std::set<CommandTask*>		_tasks;						// suspended command handlers (owned)
+		std::multimap<uint64_t, CommandTask*>	_timers;		// sleeping tasks by Metrics::nowMicros() deadline
+		long						_authFailureDelayMs;		// wait before a wrong password is answered (0: none)
+		Resolver					_resolver;					// hostnames of new connections (dns_server)
+		long						_dnsTimeoutMs;				// how long registration waits for a hostname
+		std::map<uint16_t, HostLookupTask*>	_lookups;			// queries in flight by id
 
 		// client event handling:    -----------------------------------------------------------------------------------------------------
 		void 	handleClientEvent(int i);													// handle existing connection - main function
+		void	handleClientWritable(int i);												// socket drained, continue a short write
+		void	sendToClient(int clientFd, const std::string &message);						// queue reply for the end of the tick
+		void	flushOutput();																// one write per client with queued output
+		void	runShards(bool endOfTick);													// deliver posted channel messages (and the outbox)
+		void	broadcastMessage(Channel *channel, const char *data, size_t length, Client *sender);	// channel text, sharded if enabled
+		void	recordLineLatencies();														// end-to-end latency of flushed lines
+		void	waitWritable(int clientFd);													// poll for POLLOUT until the queue drains
+		void	dropSendQExceeded();														// disconnect the clients that did not read their replies
 		void	handleClientDisconnect(int index, int clientFd, int bytes);
 		void	cleanupDisconnectedClients() ;
-		void	removeClientFromVector(int clientFd);
+		void	retireClient(Client *client);												// unindex now, free once no reader can hold it
+		ClientHandle getClientHandle(const Client *client) const;
 		void	processClientMessage(int clientFd, char* buf, int bytes);
+		void	processBufferedLines(Client *client, uint64_t received, uint64_t lineStart);	// until empty or suspended
 		void	processSingleCommand(Client* client, int clientFd, const std::string& command);
-		bool	handleCapabilityCommands(int clientFd, const std::vector<std::string>& tokens, const std::string& cmd);
-		bool	handleAuthenticationCommands(int clientFd, const std::vector<std::string>& tokens, const std::string& cmd);
-		void	handleRegisteredCommands(int clientFd, const std::vector<std::string>& tokens, const std::string& cmd, 
+		bool	handleCapabilityCommands(int clientFd, const ArenaTokens &tokens, const std::string& cmd);
+		bool	handleAuthenticationCommands(int clientFd, const ArenaTokens &tokens, const std::string& cmd);
+		void	handleRegisteredCommands(int clientFd, const ArenaTokens &tokens, const std::string& cmd, 
 					const std::string& fullCommand);
-		void	handlePingCommand(int clientFd, const std::vector<std::string>& tokens);
+		void	handlePingCommand(int clientFd, const ArenaTokens &tokens);
 		void	sendNotRegisteredError(int clientFd);
 		void	sendUnknownCommandError(int clientFd, const std::string& command);
 		void	handleQuitCommand(int clientFd, const std::string &message);
-		std::string trimCommand(const std::string& command);
-		std::string joinTokens(const std::vector<std::string>& tokens);
+		void	trimCommand(std::string& command);
+		std::string joinTokens(const ArenaTokens &tokens);
 		// --------------------------------------------------------------------------------------------------------------------------------
 
 
-		void 	createSocket();									// create the listening socket
-		void 	setNonBlocking(int fd);							// set socket to non-blocking mode
-		void 	setSocketOptions();								// set socket options
-		void 	bindSocket();									// bind the listening socket
 		void 	startListening();								// start listening for connections
+		void	watchListener();								// poll the listening socket and the console
 		void 	setupSocket();									// configure the listening socket
-		void 	handleNewConnection();							// handle new connection
+		void 	handleNewConnection(int listenFd);				// accept what is waiting on a listener (batched)
 		void 	handleStdinInput();								// handle input from stdin
+		void	printStats() const;								// print pool and memory statistics
 		void 	eventLoop();									// handle events (main loop)
 		
 		void	handleModeCommand(int clientFd, const std::string &message);			// handle mode command
@@ -64,19 +166,107 @@ class Server {
 		void	handleInviteCommand(int clientFd, const std::string &message);			// handle invite command
 		void	handleTopicCommand(int clientFd, const std::string &message);			// handle topic command
 		void	handleMsgCommand(int clientFd, const std::string &message);				// handle msg command
-		void 	handleChannelMessage(int clientFd, const std::string &channelName, const std::string &msgContent);
-		void	handlePrivateMessage(int clientFd, const std::string &target, const std::string &msgContent);
+		void 	handleChannelMessage(int clientFd, const std::string &channelName, const ArenaString &msgContent);
+		void	handlePrivateMessage(int clientFd, const std::string &target, const ArenaString &msgContent);
 		void	handleNoticeCommand(int clientFd, const std::string &message);				// handle msg command
-		void 	handleChannelNotice(int clientFd, const std::string &channelName, const std::string &msgContent);
-		void	handlePrivateNotice(int clientFd, const std::string &target, const std::string &msgContent);
+		void 	handleChannelNotice(int clientFd, const std::string &channelName, const ArenaString &msgContent);
+		void	handlePrivateNotice(int clientFd, const std::string &target, const ArenaString &msgContent);
+		ArenaString	extractMessageText(const std::string &message, const std::string &target);	// text after the target
+		ArenaString	buildRelayLine(const Client *sender, const char *command, const std::string &target, const ArenaString &text);
+		bool	offloadFilter(Channel *channel, Client *sender, const char *command, const std::string &target,
+					const ArenaString &text);												// false: filter inline
+		void	handleWorkerCompletions();													// wake fd readable: take back finished jobs
+		void	relayFiltered(const ChannelHandle &channel);								// relay the finished jobs at the head of the queue
+		void	awaitWorkers();																// one wait for finished jobs, then take them back
+		void	finishOffloaded();															// wait for every job and relay it (upgrade)
+		void	settleOffloaded(const ChannelHandle &channel);								// relay its queued text before the members change
+		void	settleOffloaded(const std::vector<ChannelHandle> &channels);				// the same for every channel of a (remote) user
+		void	dropOffloaded();															// shutdown: free the jobs, relay nothing
 		void	addClient(Client *client, int clientFd);
 		void	handleNickCommand(int clientFd, const std::string &message);			// handle nick command
 		void	handleUserCommand(int clientFd, const std::string &message);			// handle user command
 		void	handlePassCommand(int clientFd, const std::string &message);			// handle password command
+		void	rejectPassword(Client *client);											// wrong PASS: 464 and disconnect
 		void	completeRegistration(Client *client);
 		void	joindefaultChannel(int clientFd);
 		void	handlePartCommand(int clientFd, const std::string &message);
 		void	handleWhoCommand(int clientFd, const std::string &message);
+		void	handleOperCommand(int clientFd, const ArenaTokens &tokens);				// become IRC operator
+		void	handleStatsCommand(int clientFd, const ArenaTokens &tokens);			// operator-only metrics report
+		void	updateGauges();															// refresh gauges before a report
+		void	setupLogging();															// level filters and log sink from the config
+		void	setupMetricsEndpoint();													// start the /metrics listener if configured
+		void	setupCapture(bool resume);												// start the traffic trace if configured
+		void	setupWatchdog();														// start the stall detector unless disabled
+		void	setupShards();															// start the channel shard threads if configured
+		void	setupWorkers();															// start the message filter threads if configured
+		void	setupAuthDelay();														// auth_failure_delay_ms
+		void	setupResolver();														// start the hostname resolver if configured
+		bool	setupTls();																// TLS settings for the tls listeners (false: unusable)
+		void	setupListeners();														// open (or keep the handed over) "listen" endpoints
+		void	removeSockets();														// exit: unlink the Unix sockets bound here
+		void	closeResolver();														// shutdown: stop polling and close it
+		void	setupChannelStore(bool restoreChannels);								// (restore saved channels and) start logging changes
+		void	journalLeave(Channel *channel, const Client *client);					// log what a member leaving changes
+		void	journalDeparture(const Client *client);								// journalLeave for every channel of a client
+		void	saveChannels();															// final snapshot before the clients are dropped
+
+		// command tasks (Task.cpp):    --------------------------------------------------------------------------------------------------
+		void	startTask(CommandTask *task, Client *client);								// run to the first await, keep it if suspended
+		void	resumeTask(CommandTask *task);												// the awaited operation completed
+		void	sleepTask(CommandTask *task, long ms);										// resume it after ms (then TASK_AWAIT)
+		void	runTimers();																// resume the tasks whose sleep ended
+		int		pollTimeout(int ms) const;													// ms, or less if a sleep ends sooner
+		void	dropTasks();																// shutdown: free them, resume nothing
+		void	lookupHostname(Client *client);												// new connection: resolve before its first line
+		void	handleDnsAnswers();															// resolver fd readable: resume the waiting lookups
+		void	finishLookup(HostLookupTask *task, const std::string &hostname, bool cached);
+		// --------------------------------------------------------------------------------------------------------------------------------
+
+		// hot upgrade (Upgrade.cpp):    --------------------------------------------------------------------------------------------------
+		void	upgrade();																	// hand every socket to a new process
+		void	serializeState(std::string &state, std::vector<int> &fds);				// clients and channels, fds in state order
+		void	adoptState(int channel);													// new process: rebuild from the old one
+		void	closeMetricsEndpoint();														// release the scrape listener for the new process
+		// --------------------------------------------------------------------------------------------------------------------------------
+
+		// server links (Link.cpp):    ----------------------------------------------------------------------------------------------------
+		void	setupLinks();																// server_name and "link" lines, first dials
+		void	maintainLinks();															// end of tick: redial, drop stalled links
+		void	dialLink(LinkBlock &block);
+		void	handleServerCommand(Client *client, const std::string &line);				// SERVER from a new connection
+		void	handleLinkLine(Client *link, const std::string &line);						// everything a link sends
+		void	acceptServer(Client *link, const std::string &peer, const std::string &password);
+		void	sendBurst(int linkFd);														// users and channels the peer does not know
+		void	dropLink(Client *link, const std::string &reason);							// ERROR, close, split
+		void	splitLink(int linkFd, const std::string &reason);							// forget everything behind a link
+		void	closeConnection(Client *client);											// close now, free at the end of the tick
+		void	disconnectClient(Client *client, const std::string &reason);				// local user killed by the network
+		void	propagate(const std::string &line, int exceptLink = -1);					// every other link
+		void	propagateToChannel(const Channel *channel, const char *data, size_t length, int exceptLink = -1);
+		void	sendToLink(int linkFd, const std::string &line);
+		void	announceJoin(Client *client, Channel *channel);								// JOIN (and channel state, +o) to the links
+		std::string	introduction(const std::string &nickname, int hops, const std::string &username,
+					const std::string &hostname, const std::string &server, const std::string &realname) const;
+		std::string	channelState(const Channel *channel) const;								// CHANNEL line
+		RemoteUser	*linkSource(int linkFd, const std::string &source);					// remote user behind this link, or NULL
+		void	linkServer(int linkFd, const std::string &line, const ArenaTokens &params);
+		void	linkSquit(int linkFd, const std::string &line, const ArenaTokens &params);
+		void	linkNick(int linkFd, const std::string &line, const std::string &source, const ArenaTokens &params);
+		void	linkChannel(int linkFd, const std::string &line, const std::string &source, const ArenaTokens &params);
+		void	linkJoin(int linkFd, const std::string &line, RemoteUser *user, const ArenaTokens &params);
+		void	linkPart(int linkFd, const std::string &line, RemoteUser *user, const ArenaTokens &params);
+		void	linkQuit(int linkFd, const std::string &line, RemoteUser *user);
+		void	linkKick(int linkFd, const std::string &line, const ArenaTokens &params);
+		void	linkTopic(int linkFd, const std::string &line, const ArenaTokens &params);
+		void	linkMode(int linkFd, const std::string &line, const RemoteUser *user, const ArenaTokens &params);
+		void	linkMessage(int linkFd, const std::string &line, const ArenaTokens &params);
+		void	quitRemoteUser(RemoteUser *user, const std::string &quitLine);				// tell local members, forget the user
+		bool	resolveCollision(const std::string &nickname, const std::string &server);	// true if the newcomer keeps the nick
+		void	removeIfEmpty(Channel *channel);
+		// --------------------------------------------------------------------------------------------------------------------------------
+		void	handleMetricsEvent(int i);												// accept or serve a scraper
+		void	closeIdleScrapers();														// drop scrape connections past their deadline
 		void	handleSendCommand(int clientFd, const std::string &message);
 		void	handleFileCommand(Server *server, int clientFd, const std::string &message);
 		
@@ -86,7 +276,7 @@ class Server {
 		// handle join command:    --------------------------------------------------------------------------------------------------------
 		void 	handleJoinCommand(int clientFd, const std::string &message);						// handle join command - main function
 		bool	isValidChannelName(const std::string &channelName);
-		bool	validateJoinConditions(Client *client, Channel *channel, const std::vector<std::string> &tokens);
+		bool	validateJoinConditions(Client *client, Channel *channel, const ArenaTokens &tokens);
 		void	joinClientToChannel(Client *client, Channel *channel, const std::string &channelName);
 		void	sendTopicInfo(Client *client, Channel *channel, const std::string &channelName);
 		void	sendNamesList(Client *client, Channel *channel, const std::string &channelName);
@@ -94,12 +284,12 @@ class Server {
 		Channel* getOrCreateChannel(const std::string &channelName);
 		// --------------------------------------------------------------------------------------------------------------------------------
 
-		void	handleChannelMode(int clientFd, const std::string &target, const std::vector<std::string> &tokens);
+		void	handleChannelMode(int clientFd, const std::string &target, const ArenaTokens &tokens);
 
 		bool	setChannelMode(char mode, Client *client, Channel *channel, std::deque<std::string> &parameters);
 		bool	unsetChannelMode(char mode, Client *client, Channel *channel, std::deque<std::string> &parameters);
 		
-		std::vector<std::string> ft_split(const std::string &str, char delimiter);	// split string
+		ArenaTokens ft_split(const std::string &str, char delimiter);				// split string (tokens live until end of tick)
 
 		// orthodox canonical form:
 		/* 	
@@ -115,6 +305,7 @@ class Server {
 	public:
 		// orthodox canonical form:
 		Server(int port, const std::string& password);		// constructor
+		Server(int port, const std::string& password, Transport &transport);	// constructor (transport outlives the server)
 		~Server();											// destructor
 
 		bool			is_valid_port_string(const char* str);								// check if port is valid
@@ -0,0 +1,41 @@
+#ifndef SOCKETTRANSPORT_HPP
+#define SOCKETTRANSPORT_HPP
+
+#include "Transport.hpp"
+#include "Tls.hpp"
+#include "Config.hpp"
+#include <sys/un.h>		// for sockaddr_un
+
+// the kernel: TCP and Unix sockets, poll(2) and the process's stdin; TLS on the listeners given to tls()
+class SocketTransport : public Transport {
+
+	private:
+		Tls		_tls;														// sessions of the connections from secure listeners
+
+		void	setNonBlocking(int fd);												// set socket to non-blocking mode
+
+		// orthodox canonical form:
+		SocketTransport(const SocketTransport &copy);								// copy constructor (we don't use it)
+		SocketTransport &operator=(const SocketTransport &other);					// copy assignment operator (we don't use it)
+
+	public:
+		// orthodox canonical form:
+		SocketTransport() {}														// constructor
+		~SocketTransport() {}														// destructor
+
+		int		listen(int &port, int backlog);
+		int		listen(const ListenConfig &endpoint);								// a "listen" line; throws std::runtime_error
+		int		accept(int listenFd, std::string &host);
+		int		dial(const std::string &host, int port);
+		ssize_t	recv(int fd, char *buf, size_t length);
+		ssize_t	send(int fd, const char *data, size_t length);
+		void	close(int fd);
+		int		poll(pollfd *fds, size_t count, int timeoutMs);
+		ssize_t	readConsole(char *buf, size_t length);
+
+		Tls		&tls() { return _tls; }										// configure, secure(listener)
+
+		static void	removeStaleSocket(const struct sockaddr_un &address);			// before binding a Unix socket path
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <stdint.h>		// for uint64_t
+#include "Client.hpp"
+
+// what resume() returned
+enum TaskState {
+	TASK_DONE,													// finished: the server deletes it
+	TASK_SUSPENDED												// waiting: whatever it waits for resumes it
+};
+
+/*
+	A command handler that can wait without holding up the event loop: a
+	stackless coroutine in the protothread style. resume() is one switch on
+	step, so a TASK_AWAIT() returns to the loop and the next resume() jumps
+	back right behind it. Nothing on the stack survives an await; what the
+	handler needs afterwards lives in members.
+
+	Server::startTask() runs it up to the first await and keeps it; the
+	operation it waits for (a timer from sleepTask(), later an answer from
+	elsewhere) calls Server::resumeTask() on the event loop. While a task is
+	suspended its client's later lines stay in the receive buffer, so they
+	still run in the order they were sent and every other client is served
+	as usual. A client that disconnects meanwhile is noticed at the resume,
+	through the handle, and the task is deleted without running on.
+*/
+class CommandTask {
+
+	public:
+		ClientHandle	client;									// whose command this is (may be gone at a resume)
+		int				fd;										// its connection
+		int				step;									// resume point (TASK_* macros), 0 before the first resume()
+		uint64_t		wakeAt;									// Metrics::nowMicros() a sleepTask() ends at, 0 if not sleeping
+
+		CommandTask() : fd(-1), step(0), wakeAt(0) {}
+		virtual ~CommandTask() {}
+
+		virtual TaskState	resume() = 0;						// on the event loop, only while the client is alive
+};
+
+// the body of resume(): TASK_BEGIN(); ... TASK_AWAIT(); ... TASK_END();
+#define TASK_BEGIN()	switch (step) { case 0:
+#define TASK_AWAIT()	do { step = __LINE__; return TASK_SUSPENDED; case __LINE__:; } while (0)
+#define TASK_END()		} return TASK_DONE
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <stdint.h>		// for uint64_t
+#include <sys/types.h>	// for ssize_t
+#include <poll.h>		// for pollfd
+#include <openssl/ssl.h>
+
+// tls_* settings from the config
+struct TlsSettings {
+	std::string	certificate;									// PEM chain file (tls_cert)
+	std::string	privateKey;										// PEM key file (tls_key)
+	bool		tickets;										// stateless session tickets (tls_tickets)
+	long		sessionCache;									// server-side sessions kept (tls_session_cache)
+	bool		kernel;											// try kTLS (tls_ktls)
+
+	TlsSettings() : tickets(true), sessionCache(20000), kernel(true) {}
+};
+
+/*
+	OpenSSL under SocketTransport, so the server sees a TLS connection as
+	plain bytes on an ordinary descriptor. Connections accepted on a secure()
+	listener get an SSL object in _connections (indexed by descriptor); the
+	handshake is driven by recv(), which returns EAGAIN until it is done.
+
+	poll() would not know about TLS: adjustPoll() (before) asks for the
+	socket direction the handshake or a read actually needs, and gives up
+	waiting when a connection already holds decrypted bytes; settlePoll()
+	(after) reports all of that as POLLIN and puts the server's own events
+	back. Writes that would block are reported as EAGAIN like send(); a
+	retry passes the same (possibly moved and grown) buffer, which
+	SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER allows.
+
+	Reconnects resume their session (tickets, or the server-side cache when
+	tickets are off) instead of a full handshake. With kTLS the kernel
+	encrypts the output after the handshake, so send() writes plaintext with
+	a plain ::send(); channel shards then write TLS clients like any other.
+	A connection is only touched by one thread at a time (shards own whole
+	descriptors); the table itself only changes on the event loop.
+*/
+class Tls {
+
+	private:
+		struct Connection {
+			SSL			*ssl;
+			bool		handshaking;
+			bool		wantWrite;								// the last call needs a writable socket
+			bool		kernelSend;								// kTLS: output goes out with ::send()
+			bool		fatal;									// failed: no close_notify
+			uint64_t	accepted;								// Metrics::nowMicros() at attach()
+		};
+		struct Adjusted {										// a pollfd changed by adjustPoll()
+			size_t		index;
+			short		events;									// the server's own events
+			bool		handshaking;
+			bool		buffered;								// decrypted bytes were waiting
+		};
+
+		SSL_CTX						*_context;
+		std::set<int>				_listeners;					// secure() listening sockets
+		std::vector<Connection*>	_connections;				// by descriptor, NULL for plain ones
+		size_t						_open;						// TLS connections (0: poll is left alone)
+		std::vector<Adjusted>		_adjusted;					// between adjustPoll() and settlePoll()
+
+		Connection	*find(int fd) const;
+		ssize_t		handshake(Connection &connection);			// 1 when done, else a recv() result
+		ssize_t		failed(Connection &connection, int result);	// map an SSL error to recv()/send() results
+
+		// orthodox canonical form:
+		Tls(const Tls &copy);									// copy constructor
+		Tls &operator=(const Tls &other);						// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		Tls();													// constructor (off)
+		~Tls();													// destructor
+
+		bool		configure(const TlsSettings &settings, std::string &error);
+		bool		enabled() const { return _context != NULL; }
+		SSL_CTX		*context() const { return _context; }		// bench/micro.cpp handshakes on it
+		void		secure(int listenFd);						// connections accepted here speak TLS
+		bool		isSecure(int listenFd) const { return _listeners.count(listenFd) != 0; }
+		bool		isConnection(int fd) const { return find(fd) != NULL; }
+
+		bool		attach(int fd);								// accepted on a secure listener
+		ssize_t		recv(int fd, char *buf, size_t length);
+		ssize_t		send(int fd, const char *data, size_t length);
+		void		close(int fd);								// close_notify (best effort) and free
+		int			adjustPoll(pollfd *fds, size_t count, int timeoutMs);	// timeout to poll with
+		int			settlePoll(pollfd *fds, int ready);			// ready count including the adjusted ones
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <string>
+#include <cstddef>		// for size_t
+#include <sys/types.h>	// for ssize_t
+#include <poll.h>		// for pollfd
+
+/*
+	Everything the IRC side of the server does with the network goes through
+	a Transport: the listening endpoint, accepted connections, connections to
+	linked servers, the operator console and the poll() that waits for them.
+	SocketTransport is the real kernel implementation; LoopbackTransport keeps
+	connections in memory so a simulator can drive the full command path
+	without sockets.
+
+	Calls follow the system calls they replace: descriptors are small ints
+	chosen by the transport, recv()/send() return -1 with errno = EAGAIN when
+	they would block, recv() returns 0 once the peer is gone, and send() never
+	raises SIGPIPE. The metrics endpoint is not routed through here; it always
+	uses real sockets.
+*/
+class Transport {
+
+	public:
+		virtual ~Transport() {}
+
+		virtual int		listen(int &port, int backlog) = 0;						// non-blocking listener, port updated when 0; throws std::runtime_error
+		virtual int		accept(int listenFd, std::string &host) = 0;			// non-blocking connection, -1 if none
+		virtual int		dial(const std::string &host, int port) = 0;			// outgoing non-blocking connection (in progress), -1 on failure
+		virtual ssize_t	recv(int fd, char *buf, size_t length) = 0;
+		virtual ssize_t	send(int fd, const char *data, size_t length) = 0;
+		virtual void	close(int fd) = 0;
+		virtual int		poll(pollfd *fds, size_t count, int timeoutMs) = 0;	// -1 with errno on failure
+		virtual ssize_t	readConsole(char *buf, size_t length) = 0;				// operator input (STDIN_FILENO in the poll set)
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef WATCHDOG_HPP
+#define WATCHDOG_HPP
+
+#include <string>
+#include <stdint.h>		// for uint64_t, uint32_t
+#include <pthread.h>	// for pthread_t, pthread_mutex_t, pthread_cond_t
+#include "Metrics.hpp"	// for CommandId
+
+// what the event loop was doing, copied out of the loop by the watchdog
+struct StallReport {
+	uint64_t	tick;											// C_TICKS value of the stalled tick
+	uint64_t	micros;											// busy time when seen (final duration once the tick ends)
+	int			command;										// CommandId, or -1 outside a command
+	const char	*phase;											// "command", "events", "flush" or "cleanup"
+	int			fd;												// client whose command was running (-1 if none)
+	char		nickname[32];
+	char		target[64];										// first parameter (channel or nickname)
+	uint32_t	ready;											// descriptors poll() reported for the tick
+	uint32_t	lines;											// lines processed so far in the tick
+	uint32_t	outbox;											// clients with queued output
+	uint32_t	connections;									// entries in the poll set
+};
+
+/*
+	Detects event loop stalls from a second thread. The loop marks the start
+	and end of every tick (busy between poll() calls) and publishes what it
+	is executing through a sequence lock; the watchdog wakes every quarter
+	threshold and, when a tick has been busy for longer than the threshold,
+	copies the current activity into a stall log line (stall_log file, or the
+	server log at WARN). When the stalled tick ends, the loop records the
+	final duration: C_STALLS, H_STALL_MICROS, the per-command stall counters
+	and the worst stall seen so far.
+
+	The loop side is a few stores per command and never takes a lock.
+*/
+class Watchdog {
+
+	private:
+		// written by the loop, read by the watchdog (sequence lock)
+		uint32_t				_sequence;						// odd while _activity or _busySince is being written
+		StallReport				_activity;						// tick is the tick _busySince belongs to
+		uint64_t				_busySince;						// Metrics::nowMicros() at tick start, 0 while in poll()
+
+		// tick heartbeat
+		uint64_t				_tick;							// loop only
+		uint64_t				_reportedTick;					// last tick flagged by the watchdog (handed to the loop)
+		StallReport				_detected;						// activity when the flagged tick was seen
+
+		// loop only
+		StallReport				_worst;
+		uint32_t				_lines;
+
+		uint64_t				_thresholdMicros;				// 0 = disabled
+		int						_logFd;							// stall_log file, -1 = server log
+		bool					_stopping;
+		pthread_t				_thread;
+		pthread_mutex_t			_mutex;
+		pthread_cond_t			_wake;
+
+		void		beginWrite();
+		void		endWrite();
+		void		publish(const char *phase, int command, int fd, const std::string *nickname,
+						const std::string *target, uint32_t outbox);
+		bool		readActivity(StallReport &out, uint64_t &busySince) const;
+		void		report(const char *what, const StallReport &stall);
+		void		watch();
+		static void	*threadMain(void *watchdog);
+
+		// orthodox canonical form:
+		Watchdog(const Watchdog &copy);							// copy constructor
+		Watchdog &operator=(const Watchdog &other);				// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		Watchdog();												// constructor (disabled)
+		~Watchdog();											// destructor (joins the thread)
+
+		bool		start(uint64_t thresholdMillis, const std::string &logPath);	// logPath "" = server log
+		void		stop();
+		bool		enabled() const { return _thresholdMicros != 0; }
+
+		// event loop side:
+		void		tickStarted(uint64_t nowMicros, uint32_t ready, uint32_t connections);
+		void		tickFinished(uint64_t nowMicros);
+		void		commandStarted(CommandId command, int fd, const std::string &nickname, const std::string &target,
+						uint32_t outbox);
+		void		commandFinished();
+		void		phase(const char *name, uint32_t outbox);		// "flush", "cleanup"
+
+		const StallReport	&worst() const { return _worst; }		// micros == 0 until the first stall
+		uint64_t	thresholdMillis() const { return _thresholdMicros / 1000; }
+};
+
+// marks one command for the watchdog until the end of the scope (early returns included)
+class WatchdogScope {
+
+	private:
+		Watchdog	&_watchdog;
+
+		WatchdogScope(const WatchdogScope &copy);
+		WatchdogScope &operator=(const WatchdogScope &other);
+
+	public:
+		explicit WatchdogScope(Watchdog &watchdog) : _watchdog(watchdog) {}
+		~WatchdogScope() { _watchdog.commandFinished(); }
+};
+
+#endif
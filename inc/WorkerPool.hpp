@@ -0,0 +1,100 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <deque>
+#include <vector>
+#include <stdint.h>		// for uint64_t
+#include <pthread.h>	// for pthread_t, pthread_mutex_t, pthread_cond_t
+#include "Mailbox.hpp"
+
+// completion mailbox link (the mailbox needs a concrete node type for its stub)
+struct WorkLink {
+	WorkLink	*next;
+
+	WorkLink() : next(NULL) {}
+};
+
+// a unit of work the event loop hands to the pool; owned by whoever submitted it
+class WorkItem : public WorkLink {
+
+	public:
+		uint64_t	queued;										// Metrics::nowMicros() at submit()
+		uint64_t	started;									// when a worker picked it up
+		uint64_t	ended;										// when run() returned
+		bool		stolen;										// run by a worker it was not queued on
+
+		WorkItem() : queued(0), started(0), ended(0), stolen(false) {}
+		virtual ~WorkItem() {}
+
+		virtual void	run() = 0;								// on a worker thread: touch nothing the loop owns
+		virtual void	finish() = 0;							// back on the event loop, after finished() returned it
+};
+
+/*
+	Worker threads for CPU-heavy per-message work (word filtering), so a long
+	message does not hold up every other client on the event loop. submit()
+	spreads items round-robin over per-worker deques; a worker takes the
+	oldest item of its own deque and, when that is empty, steals the newest
+	one of another worker. Finished items come back through a lock-free
+	mailbox and a byte on wakeFd(), which the event loop polls; finished()
+	hands them over one by one and meters queue wait and run time.
+
+	Items complete in any order. Whoever needs an order (channel messages)
+	keeps its own sequence and holds back the items that finished early.
+*/
+class WorkerPool {
+
+	private:
+		struct Worker {
+			WorkerPool				*pool;
+			size_t					index;
+			pthread_t				thread;
+			pthread_mutex_t			lock;						// guards queue (owner and thieves)
+			std::deque<WorkItem*>	queue;
+
+			Worker() : pool(NULL), index(0) { pthread_mutex_init(&lock, NULL); }
+			~Worker() { pthread_mutex_destroy(&lock); }
+		};
+
+		std::vector<Worker*>	_workers;
+		Mailbox<WorkLink>		_finished;						// run() returned, waiting for the loop
+		int						_wake[2];						// pipe: workers write, the loop polls [0]
+		int						_signalled;						// a wake byte is unread (atomic)
+		size_t					_queued;						// items in the deques (atomic)
+		size_t					_next;							// round-robin submit position (loop only)
+		size_t					_inFlight;						// submitted and not handed back (loop only)
+		uint64_t				_busyMicros;					// run time of the finished items (loop only)
+		uint64_t				_reportedBusy;					// _busyMicros at the last utilization()
+		uint64_t				_reportedAt;					// time of the last utilization()
+		pthread_mutex_t			_mutex;
+		pthread_cond_t			_work;							// items were queued (or stop)
+		bool					_stopping;
+
+		WorkItem	*take(Worker &worker);						// own oldest item, else steal one
+		void		serve(Worker &worker);
+		static void	*threadMain(void *worker);
+
+		// orthodox canonical form:
+		WorkerPool(const WorkerPool &copy);						// copy constructor
+		WorkerPool &operator=(const WorkerPool &other);			// copy assignment operator
+
+	public:
+		// orthodox canonical form:
+		WorkerPool();											// constructor (no threads)
+		~WorkerPool();											// destructor (joins the threads)
+
+		bool		start(size_t threads);
+		void		stop();										// queued items are left to their owners
+		bool		enabled() const { return !_workers.empty(); }
+		size_t		threads() const { return _workers.size(); }
+		size_t		inFlight() const { return _inFlight; }
+		int			wakeFd() const { return _wake[0]; }			// readable when finished() has something
+
+		// event loop side:
+		void		submit(WorkItem *item);
+		void		clearWake();								// consume the wake byte before draining
+		WorkItem	*finished();								// next item back from a worker, NULL if none yet
+		long		utilization();								// % of worker time spent in jobs since the last call
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "AllocProfile.hpp"
+#include <cstring>		// for std::memset
+#ifdef ALLOC_PROFILE
+# include <new>			// for std::bad_alloc, std::nothrow_t, std::new_handler
+# include <cstdlib>		// for std::malloc, std::free
+#endif
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+#ifdef ALLOC_PROFILE
+
+// zero-initialized before any constructor runs, so allocations from static initializers are counted too
+static AllocStats	g_stats[ALLOC_TAG_COUNT];
+static __thread int	g_tag = ALLOC_TAG_OTHER;
+
+// in front of every block; 16 bytes keep the user pointer aligned like malloc's
+union BlockHeader {
+	struct {
+		size_t	size;
+		int		tag;
+	}			block;
+	char		align[16];
+};
+
+// the log and capture threads allocate too, so every update is atomic
+static void *track(void *memory, size_t size)
+{
+	BlockHeader *header = static_cast<BlockHeader *>(memory);
+	header->block.size = size;
+	header->block.tag = g_tag;
+	AllocStats &stats = g_stats[g_tag];
+	__atomic_add_fetch(&stats.allocations, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.bytes, size, __ATOMIC_RELAXED);
+	uint64_t live = __atomic_add_fetch(&stats.liveBytes, size, __ATOMIC_RELAXED);
+	uint64_t peak = __atomic_load_n(&stats.peakLiveBytes, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&stats.peakLiveBytes, &peak, live, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return header + 1;
+}
+
+static void release(void *pointer)
+{
+	if (!pointer)
+		return;
+	BlockHeader *header = static_cast<BlockHeader *>(pointer) - 1;
+	AllocStats &stats = g_stats[header->block.tag];
+	__atomic_add_fetch(&stats.frees, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&stats.liveBytes, header->block.size, __ATOMIC_RELAXED);
+	std::free(header);
+}
+
+// same contract as the standard operator new: retry through the new handler, throw without one
+static void *allocate(size_t size)
+{
+	for (;;)
+	{
+		void *memory = std::malloc(sizeof(BlockHeader) + size);
+		if (memory)
+			return track(memory, size);
+		std::new_handler handler = std::set_new_handler(0);
+		std::set_new_handler(handler);
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+#endif
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+#ifdef ALLOC_PROFILE
+
+void *operator new(size_t size) throw(std::bad_alloc) { return allocate(size); }
+void *operator new[](size_t size) throw(std::bad_alloc) { return allocate(size); }
+void operator delete(void *pointer) throw() { release(pointer); }
+void operator delete[](void *pointer) throw() { release(pointer); }
+
+void *operator new(size_t size, const std::nothrow_t &) throw()
+{
+	try { return allocate(size); }
+	catch (...) { return NULL; }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) throw()
+{
+	try { return allocate(size); }
+	catch (...) { return NULL; }
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) throw() { release(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) throw() { release(pointer); }
+
+bool AllocProfile::enabled() { return true; }
+int AllocProfile::tag() { return g_tag; }
+void AllocProfile::setTag(int tag) { g_tag = tag; }
+
+void AllocProfile::snapshot(AllocStats *out)
+{
+	for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+	{
+		out[i].allocations = __atomic_load_n(&g_stats[i].allocations, __ATOMIC_RELAXED);
+		out[i].frees = __atomic_load_n(&g_stats[i].frees, __ATOMIC_RELAXED);
+		out[i].bytes = __atomic_load_n(&g_stats[i].bytes, __ATOMIC_RELAXED);
+		out[i].liveBytes = __atomic_load_n(&g_stats[i].liveBytes, __ATOMIC_RELAXED);
+		out[i].peakLiveBytes = __atomic_load_n(&g_stats[i].peakLiveBytes, __ATOMIC_RELAXED);
+	}
+}
+
+#else
+
+bool AllocProfile::enabled() { return false; }
+int AllocProfile::tag() { return ALLOC_TAG_OTHER; }
+void AllocProfile::setTag(int) {}
+
+void AllocProfile::snapshot(AllocStats *out)
+{
+	std::memset(out, 0, sizeof(AllocStats) * ALLOC_TAG_COUNT);
+}
+
+#endif
+
+const char *AllocProfile::name(int tag)
+{
+	if (tag >= 0 && tag < COMMAND_COUNT)
+		return Metrics::name(static_cast<CommandId>(tag));
+	return "other";
+}
@@ -0,0 +1,103 @@
+#include "Arena.hpp"
+#include <cstdlib>		// for std::malloc, std::free
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor (first block is allocated lazily)
+Arena::Arena() : _current(0), _offset(0), _tickBytes(0)
+{
+	_stats.allocations = 0;
+	_stats.bytes = 0;
+	_stats.resets = 0;
+	_stats.largeAllocations = 0;
+	_stats.blocks = 0;
+	_stats.peakTickBytes = 0;
+}
+
+// destructor
+Arena::~Arena()
+{
+	reset();
+	for (size_t i = 0; i < _blocks.size(); ++i)
+		std::free(_blocks[i]);
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+// get aligned memory from the current block, moving on to the next block when it is full
+void *Arena::allocate(size_t size)
+{
+	size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	++_stats.allocations;
+	_stats.bytes += size;
+	_tickBytes += size;
+
+	if (size > BLOCK_SIZE)
+	{
+		char *block = static_cast<char*>(std::malloc(size));
+		if (!block)
+			throw std::bad_alloc();
+		_large.push_back(block);
+		++_stats.largeAllocations;
+		return block;
+	}
+
+	if (_blocks.empty() || _offset + size > BLOCK_SIZE)
+	{
+		if (!_blocks.empty())
+			++_current;
+		if (_current == _blocks.size())
+		{
+			char *block = static_cast<char*>(std::malloc(BLOCK_SIZE));
+			if (!block)
+				throw std::bad_alloc();
+			_blocks.push_back(block);
+		}
+		_offset = 0;
+	}
+
+	void *ptr = _blocks[_current] + _offset;
+	_offset += size;
+	return ptr;
+}
+
+// rewind if ptr is the most recent allocation (typical for a growing string), otherwise wait for reset()
+void Arena::deallocate(void *ptr, size_t size)
+{
+	size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if (_blocks.empty() || size > _offset)
+		return;
+	if (static_cast<char*>(ptr) == _blocks[_current] + _offset - size)
+		_offset -= size;
+}
+
+// make the whole arena reusable; oversized blocks go back to the heap
+void Arena::reset()
+{
+	for (size_t i = 0; i < _large.size(); ++i)
+		std::free(_large[i]);
+	_large.clear();
+	_current = 0;
+	_offset = 0;
+	if (_tickBytes > _stats.peakTickBytes)
+		_stats.peakTickBytes = _tickBytes;
+	_tickBytes = 0;
+	++_stats.resets;
+}
+
+ArenaStats Arena::stats() const
+{
+	ArenaStats s = _stats;
+	s.blocks = _blocks.size();
+	return s;
+}
@@ -3,33 +3,49 @@
 #include <iostream>
 
 Bot::Bot() {
-	this->loadBannedWords();
+	this->loadBannedWords(BANNED_PATH);
+}
+
+Bot::Bot(const std::string &path) {
+	this->loadBannedWords(path);
 }
 
 Bot::~Bot() {}
 
-std::string Bot::filterMessage(std::string original) {
-	std::set<std::string>::iterator it = this->bannedWords.begin();
-	std::set<std::string>::iterator ite = this->bannedWords.end();
+// the word list is never changed after loading, so worker threads may filter concurrently
+template <typename String>
+String Bot::censor(const String &original) const {
+	String filtered(original);
+	std::set<std::string>::const_iterator it = this->bannedWords.begin();
+	std::set<std::string>::const_iterator ite = this->bannedWords.end();
 	while (it != ite) {
-		replaceAll(original, *it, CENSOR_STRING);
+		replaceAll(filtered, *it, CENSOR_STRING);
 		++it;
 	}
-	return original;
+	return filtered;
+}
+
+ArenaString Bot::filterMessage(const ArenaString &original) const {
+	return censor(original);
+}
+
+std::string Bot::filterMessage(const std::string &original) const {
+	return censor(original);
 }
 
-void Bot::replaceAll(std::string &message, std::string const &toReplace, std::string const &replacement) {
+template <typename String>
+void Bot::replaceAll(String &message, std::string const &toReplace, std::string const &replacement) const {
 	if (toReplace.empty()) return;
 	std::size_t pos = 0;
 
-	while ((pos = message.find(toReplace, pos)) != std::string::npos) {
-		message.replace(pos, toReplace.length(), replacement);
+	while ((pos = message.find(toReplace.data(), pos, toReplace.size())) != String::npos) {
+		message.replace(pos, toReplace.length(), replacement.data(), replacement.size());
 		pos += replacement.size();
 	}
 }
 
-void Bot::loadBannedWords() {
-	std::ifstream ifs(BANNED_PATH);
+void Bot::loadBannedWords(const std::string &path) {
+	std::ifstream ifs(path.c_str());
 	std::string buf;
 	while (getline(ifs, buf))
 		this->bannedWords.insert(buf);
@@ -0,0 +1,235 @@
+#include "Capture.hpp"
+#include "Clock.hpp"
+#include <cstring>		// for std::memcpy, std::memset, std::memcmp
+#include <cctype>		// for std::toupper
+#include <ctime>		// for clock_gettime
+#include <fcntl.h>		// for open
+#include <unistd.h>		// for write, pread, close
+#include <sys/stat.h>	// for fchmod
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(fd, data, length);
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+static uint64_t wallMicros()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+// the part of a line the trace may keep: passwords stay out of it
+static size_t recordedLength(const std::string &line)
+{
+	size_t word = line.find(' ');
+	if (word == std::string::npos)
+		return line.size();
+	std::string command = line.substr(0, word);
+	for (size_t i = 0; i < command.size(); ++i)
+		command[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(command[i])));
+	return (command == "PASS" || command == "OPER") ? word : line.size();
+}
+
+void Capture::append(int fd, CaptureEvent event, uint64_t ticks, const char *data, size_t length)
+{
+	if (_active.size() > MAX_BUFFERED)
+	{
+		++_dropped;
+		return;
+	}
+	if (length > 0xFFFF)
+		length = 0xFFFF;
+
+	CaptureRecord record;
+	record.nanos = _offset + Clock::toNanos(ticks - _start);
+	record.connection = (fd >= 0 && static_cast<size_t>(fd) < _connections.size()) ? _connections[fd] : 0;
+	record.event = static_cast<uint8_t>(event);
+	record.reserved = 0;
+	record.length = static_cast<uint16_t>(length);
+	_active.append(reinterpret_cast<const char *>(&record), sizeof(record));
+	_active.append(data, length);
+	++_records;
+}
+
+void *Capture::writerMain(void *capture)
+{
+	static_cast<Capture *>(capture)->writerLoop();
+	return NULL;
+}
+
+// wait for a full buffer, write it without holding the lock, hand it back empty (capacity kept)
+void Capture::writerLoop()
+{
+	pthread_mutex_lock(&_mutex);
+	for (;;)
+	{
+		while (!_pending && !_stopping)
+			pthread_cond_wait(&_wake, &_mutex);
+		if (!_pending)
+			break;
+		pthread_mutex_unlock(&_mutex);
+		writeAll(_fd, _writing.data(), _writing.size());
+		_writing.clear();
+		pthread_mutex_lock(&_mutex);
+		_pending = false;
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+Capture::Capture()
+	: _fd(-1), _start(0), _offset(0), _nextConnection(1), _pending(false), _stopping(false), _records(0), _dropped(0)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_wake, NULL);
+}
+
+// destructor
+Capture::~Capture()
+{
+	stop();
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_mutex);
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+// the trace holds every line clients sent, so only its owner may read it
+bool Capture::start(const std::string &path, bool resume)
+{
+	if (_fd != -1)
+		return true;
+	CaptureFileHeader header;
+	int fd = -1;
+	_offset = 0;
+	if (resume)
+	{
+		fd = ::open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+		if (fd != -1 && (pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+			|| std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.version != CAPTURE_VERSION))
+		{
+			::close(fd);
+			fd = -1;
+		}
+		if (fd != -1 && wallMicros() > header.startMicros)
+			_offset = (wallMicros() - header.startMicros) * 1000;
+	}
+	if (fd == -1)
+	{
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (fd == -1)
+			return false;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+		header.version = CAPTURE_VERSION;
+		header.startMicros = wallMicros();
+		if (!writeAll(fd, reinterpret_cast<const char *>(&header), sizeof(header)))
+		{
+			::close(fd);
+			return false;
+		}
+	}
+	fchmod(fd, 0600);
+
+	_fd = fd;
+	_stopping = false;
+	if (pthread_create(&_writer, NULL, writerMain, this) != 0)
+	{
+		::close(fd);
+		_fd = -1;
+		return false;
+	}
+	_start = Clock::now();
+	return true;
+}
+
+void Capture::stop()
+{
+	if (_fd == -1)
+		return;
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_signal(&_wake);
+	pthread_mutex_unlock(&_mutex);
+	pthread_join(_writer, NULL);
+
+	// the writer is gone, write the last tick from here
+	writeAll(_fd, _active.data(), _active.size());
+	_active.clear();
+	::close(_fd);
+	_fd = -1;
+}
+
+void Capture::open(int fd)
+{
+	if (_fd == -1 || fd < 0)
+		return;
+	if (static_cast<size_t>(fd) >= _connections.size())
+		_connections.resize(fd + 1, 0);
+	_connections[fd] = _nextConnection++;
+	append(fd, CAPTURE_OPEN, Clock::now(), NULL, 0);
+}
+
+void Capture::line(int fd, uint64_t received, const std::string &line)
+{
+	if (_fd == -1)
+		return;
+	append(fd, CAPTURE_LINE, received, line.data(), recordedLength(line));
+}
+
+void Capture::close(int fd)
+{
+	if (_fd == -1 || fd < 0 || static_cast<size_t>(fd) >= _connections.size() || _connections[fd] == 0)
+		return;
+	append(fd, CAPTURE_CLOSE, Clock::now(), NULL, 0);
+	_connections[fd] = 0;
+}
+
+void Capture::continueConnections(uint32_t next)
+{
+	if (next > _nextConnection)
+		_nextConnection = next;
+}
+
+// swap buffers if the writer is idle; otherwise keep collecting until the next tick
+void Capture::flush()
+{
+	if (_fd == -1 || _active.empty())
+		return;
+	if (pthread_mutex_trylock(&_mutex) != 0)
+		return;
+	if (!_pending)
+	{
+		_active.swap(_writing);
+		_pending = true;
+		pthread_cond_signal(&_wake);
+	}
+	pthread_mutex_unlock(&_mutex);
+}
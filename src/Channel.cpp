@@ -1,27 +1,77 @@
 // Channel.cpp - zaktualizuj:
 #include "Channel.hpp"
 #include "Client.hpp"
+#include "Metrics.hpp"
+#include "Network.hpp"
 #include <algorithm>
 #include <sstream>
 
-Channel::Channel(const std::string &channelName)
-	: name(channelName), topic(""), userLimit(0) {}
+// RFC 1459 case mapping: nicknames that differ only in case (and [\]^ against {|}~) are the same
+static std::string ircLower(const std::string &nickname) {
+	std::string lower(nickname);
+	for (size_t i = 0; i < lower.size(); ++i)
+	{
+		if (lower[i] >= 'A' && lower[i] <= '^')
+			lower[i] = static_cast<char>(lower[i] + ('a' - 'A'));
+	}
+	return lower;
+}
+
+Channel::Channel(InternId channelNameId, const std::string &canonicalName)
+	: nameId(channelNameId), name(&canonicalName), topic(""), userLimit(0), created(time(NULL)) {}
 
 Channel::~Channel() {}
 
-std::string Channel::getName() const {
-	return this->name;
+const std::string &Channel::getName() const {
+	return *this->name;
+}
+
+InternId Channel::getNameId() const {
+	return this->nameId;
+}
+
+const ChannelHandle &Channel::getHandle() const {
+	return this->handle;
+}
+
+void Channel::setHandle(const ChannelHandle &channelHandle) {
+	this->handle = channelHandle;
 }
 
 void Channel::broadcast(const std::string &message, Client *exclude) const
 {
+	size_t recipients = 0;
 	for (std::map<int, Client *>::const_iterator it = members.begin(); it != members.end(); ++it)
 	{
 		if (!exclude || it->second != exclude)
 		{
 			it->second->sendMessage(message);
+			++recipients;
+		}
+	}
+	countBroadcast(recipients);
+}
+
+// broadcast a message that already ends with \r\n (no per-member copy)
+void Channel::broadcast(const char *data, size_t length, Client *exclude) const
+{
+	size_t recipients = 0;
+	for (std::map<int, Client *>::const_iterator it = members.begin(); it != members.end(); ++it)
+	{
+		if (!exclude || it->second != exclude)
+		{
+			it->second->sendMessage(data, length);
+			++recipients;
 		}
 	}
+	countBroadcast(recipients);
+}
+
+void Channel::countBroadcast(size_t recipients) const
+{
+	Metrics::add(C_BROADCASTS);
+	Metrics::add(C_BROADCAST_RECIPIENTS, recipients);
+	Metrics::record(H_BROADCAST_FANOUT, recipients);
 }
 
 bool Channel::isOperator(int clientFd) const
@@ -34,10 +84,12 @@ void Channel::addMember(Client *client)
 	if (!client)
 		return;
 	members[client->getFd()] = client;
-	client->addChannel(name);
+	client->addChannel(handle);
 
-	// First member becomes operator
-	if (members.size() == 1)
+	// First member becomes operator, unless the channel was restored with its operators. A nickname
+	// proves nothing, so a restored operator gets +o back only when it joins as an IRC operator (OPER)
+	bool restored = client->isOper() && restoredOperators.erase(ircLower(client->getNickname()));
+	if (restored || (getMemberCount() == 1 && restoredOperators.empty()))
 	{
 		addOperator(client->getFd());
 	}
@@ -48,7 +100,7 @@ void Channel::removeMember(int clientFd)
 	Client *client = members[clientFd];
 	if (client)
 	{
-		client->removeChannel(name);
+		client->removeChannel(handle);
 	}
 	members.erase(clientFd);
 	operators.erase(clientFd);
@@ -76,12 +128,76 @@ std::vector<std::string> Channel::getMemberNicknames() const
 	{
 		nicknames.push_back(it->second->getNickname());
 	}
+	for (std::map<RemoteUser *, bool>::const_iterator it = remoteMembers.begin(); it != remoteMembers.end(); ++it)
+		nicknames.push_back(it->first->nickname);
 	return nicknames;
 }
 
 size_t Channel::getMemberCount() const
 {
-	return members.size();
+	return members.size() + remoteMembers.size();
+}
+
+void Channel::addRemoteMember(RemoteUser *user)
+{
+	if (!remoteMembers.insert(std::make_pair(user, false)).second)
+		return;
+	++linkMembers[user->link];
+	user->channels.push_back(handle);
+}
+
+void Channel::removeRemoteMember(RemoteUser *user)
+{
+	if (!remoteMembers.erase(user))
+		return;
+	if (--linkMembers[user->link] == 0)
+		linkMembers.erase(user->link);
+	std::vector<ChannelHandle>::iterator it = std::find(user->channels.begin(), user->channels.end(), handle);
+	if (it != user->channels.end())
+		user->channels.erase(it);
+}
+
+bool Channel::hasRemoteMember(RemoteUser *user) const
+{
+	return remoteMembers.find(user) != remoteMembers.end();
+}
+
+bool Channel::isRemoteOperator(RemoteUser *user) const
+{
+	std::map<RemoteUser *, bool>::const_iterator it = remoteMembers.find(user);
+	return it != remoteMembers.end() && it->second;
+}
+
+void Channel::setRemoteOperator(RemoteUser *user, bool op)
+{
+	std::map<RemoteUser *, bool>::iterator it = remoteMembers.find(user);
+	if (it != remoteMembers.end())
+		it->second = op;
+}
+
+const std::map<RemoteUser *, bool> &Channel::getRemoteMembers() const
+{
+	return remoteMembers;
+}
+
+const std::map<int, size_t> &Channel::getLinkMembers() const
+{
+	return linkMembers;
+}
+
+bool Channel::hasLocalMembers() const
+{
+	return !members.empty();
+}
+
+time_t Channel::getCreated() const
+{
+	return created;
+}
+
+void Channel::setCreated(time_t when)
+{
+	created = when;
 }
 
 void Channel::setTopic(const std::string &newTopic)
@@ -111,16 +227,45 @@ size_t Channel::getUserLimit() const {
 }
 
 
-void Channel::addInvitation(int fd) {
-	invitations.insert(fd);
+void Channel::addInvitation(const ClientHandle &client) {
+	invitations.insert(client);
+}
+
+void Channel::removeInvitation(const ClientHandle &client) {
+	invitations.erase(client);
 }
 
-void Channel::removeInvitation(int fd) {
-	invitations.erase(fd);
+bool Channel::isInvited(const ClientHandle &client) const {
+	return invitations.find(client) != invitations.end();
 }
 
-bool Channel::isInvited(int fd) const {
-	return invitations.find(fd) != invitations.end();
+void Channel::addRestoredOperator(const std::string &nickname) {
+	restoredOperators.insert(ircLower(nickname));
+}
+
+std::vector<std::string> Channel::takeRestoredOperators() {
+	std::vector<std::string> nicknames(restoredOperators.begin(), restoredOperators.end());
+	restoredOperators.clear();
+	return nicknames;
+}
+
+const std::set<std::string> &Channel::getRestoredOperators() const {
+	return restoredOperators;
+}
+
+const std::set<ClientHandle> &Channel::getInvitations() const {
+	return invitations;
+}
+
+std::vector<std::string> Channel::getOperatorNicknames() const {
+	std::vector<std::string> nicknames(restoredOperators.begin(), restoredOperators.end());
+	for (std::set<int>::const_iterator it = operators.begin(); it != operators.end(); ++it)
+	{
+		std::map<int, Client *>::const_iterator member = members.find(*it);
+		if (member != members.end())
+			nicknames.push_back(member->second->getNickname());
+	}
+	return nicknames;
 }
 
 void Channel::setMode(char mode)
@@ -1,61 +1,94 @@
 // ChannelManager.cpp
 #include "ChannelMenager.hpp"
+#include "Epoch.hpp"
 #include <algorithm>
 
 ChannelManager::ChannelManager() {}
 
+// channels still alive are destroyed by the pool
 ChannelManager::~ChannelManager() {
-	for (std::map<std::string, Channel*>::iterator it = channels.begin(); it != channels.end(); ++it) {
-		delete it->second;
-	}
-	channels.clear();
+	reclaim(RECLAIM_ALL);
 }
 
 Channel* ChannelManager::createChannel(const std::string& name) {
-	if (channelExists(name))
-		return getChannel(name);
-	Channel* channel = new Channel(name);
-	channels[name] = channel;
+	Channel *existing = getChannel(name);
+	if (existing)
+		return existing;
+	InternId id = names.acquire(name);
+	Channel* channel = pool.create(id, names.str(id));
+	channel->setHandle(pool.handleOf(channel));
+	if (id >= channels.size())
+		channels.resize(id + 1);
+	channels[id] = channel->getHandle();
 	return channel;
 }
 
 Channel* ChannelManager::getChannel(const std::string& name) {
-	std::map<std::string, Channel*>::iterator it = channels.find(name);
-	if (it != channels.end()) {
-		return it->second;
-	}
-	return NULL;
+	return getChannel(names.find(name));
+}
+
+Channel* ChannelManager::getChannel(InternId nameId) const {
+	if (nameId == InternTable::NONE || nameId >= channels.size())
+		return NULL;
+	return pool.get(channels[nameId]);
+}
+
+Channel* ChannelManager::getChannel(const ChannelHandle &handle) const {
+	return pool.get(handle);
+}
+
+ChannelHandle ChannelManager::getHandle(const Channel *channel) const {
+	return pool.handleOf(channel);
 }
 
 bool ChannelManager::channelExists(const std::string& name) {
-	return channels.find(name) != channels.end();
+	return getChannel(name) != NULL;
 }
 
 void ChannelManager::removeChannel(const std::string& name) {
-	std::map<std::string, Channel*>::iterator it = channels.find(name);
-	if (it != channels.end()) {
-		delete it->second;
-		channels.erase(it);
-	}
+	removeChannel(getChannel(name));
 }
 
-void ChannelManager::removeClientFromAllChannels(int clientFd) {
-	std::vector<std::string> toRemove;
-	
-	// collect all channels the client is in
-	for (std::map<std::string, Channel*>::iterator it = channels.begin(); it != channels.end(); ++it) {
-		if (it->second->hasMember(clientFd)) {
-			it->second->removeMember(clientFd);
+void ChannelManager::removeChannel(Channel *channel) {
+	if (!channel)
+		return;
+	InternId id = channel->getNameId();
+	if (channels[id] != channel->getHandle())
+		return;
+	channels[id] = ChannelHandle();
+	pool.retire(channel);
+	retired.push_back(RetiredChannel(channel, Epoch::now()));
+}
+
+// the name stays interned until here: the channel still points to it
+void ChannelManager::reclaim(uint64_t before) {
+	size_t kept = 0;
+	for (size_t i = 0; i < retired.size(); ++i) {
+		if (retired[i].epoch >= before) {
+			retired[kept++] = retired[i];
+			continue;
 		}
+		InternId id = retired[i].channel->getNameId();
+		pool.reclaim(retired[i].channel);
+		names.release(id);
 	}
+	retired.resize(kept, RetiredChannel(NULL, 0));
+}
+
+void ChannelManager::removeClientFromAllChannels(int clientFd, const ClientHandle &client) {
+	std::vector<Channel*> toRemove;
 	
-	// find empty channels
-	for (std::map<std::string, Channel*>::iterator it = channels.begin(); it != channels.end(); ) {
-		if (it->second->getMemberCount() == 0) {
-			toRemove.push_back(it->first);
-			++it;
-		} else {
-			++it;
+	for (size_t id = 0; id < channels.size(); ++id) {
+		Channel *channel = pool.get(channels[id]);
+		if (!channel)
+			continue;
+		// drop pending invitations, the handle can never be used again
+		channel->removeInvitation(client);
+		// channels the client leaves empty (restored channels wait empty for their members)
+		if (channel->hasMember(clientFd)) {
+			channel->removeMember(clientFd);
+			if (channel->getMemberCount() == 0)
+				toRemove.push_back(channel);
 		}
 	}
 	
@@ -66,13 +99,24 @@ void ChannelManager::removeClientFromAllChannels(int clientFd) {
 }
 
 std::vector<std::string> ChannelManager::getChannelNames() const {
-	std::vector<std::string> names;
-	for (std::map<std::string, Channel*>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
-		names.push_back(it->first);
+	std::vector<std::string> result;
+	for (size_t id = 0; id < channels.size(); ++id) {
+		if (pool.get(channels[id]))
+			result.push_back(names.str(id));
 	}
-	return names;
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+// retired channels still hold their slot until reclaim()
+size_t ChannelManager::getChannelCount() const {
+	return pool.size() - retired.size();
+}
+
+PoolStats ChannelManager::getPoolStats() const {
+	return pool.stats();
 }
 
-const std::map<std::string, Channel*> &ChannelManager::getChannels() const {
-	return channels;
+size_t ChannelManager::getNameTableBytes() const {
+	return names.bytes() + channels.capacity() * sizeof(ChannelHandle);
 }
@@ -0,0 +1,261 @@
+#include "ChannelShards.hpp"
+#include "Channel.hpp"
+#include "Client.hpp"
+#include "Epoch.hpp"
+#include <cstring>		// for std::memset
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// FNV-1a, so a channel keeps its shard for as long as the server runs
+static size_t hashName(const std::string &name)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < name.size(); ++i)
+	{
+		hash ^= static_cast<unsigned char>(name[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// members of this shard's channels, sorted by the shard that owns their connection
+void ChannelShards::fanOut(Shard &shard)
+{
+	size_t count = _shards.size();
+	for (size_t i = 0; i < count; ++i)
+		shard.batches[i].deliveries.clear();
+	ShardJob *job;
+	while ((job = shard.jobs.pop()) != NULL)
+	{
+		const std::map<int, Client *> &members = job->channel->getMembers();
+		for (std::map<int, Client *>::const_iterator it = members.begin(); it != members.end(); ++it)
+			if (it->second != job->exclude)
+			{
+				ShardDelivery delivery = { it->second, &job->line };
+				shard.batches[it->first % count].deliveries.push_back(delivery);
+			}
+		shard.done.push_back(job);
+	}
+	for (size_t i = 0; i < count; ++i)
+		if (!shard.batches[i].deliveries.empty())
+			_shards[i]->results.push(&shard.batches[i]);
+}
+
+// append to the own connections, then write them (one send() each, like ClientManager::flushOutput)
+void ChannelShards::deliver(Shard &shard)
+{
+	ShardBatch *batch;
+	while ((batch = shard.results.pop()) != NULL)
+		for (size_t i = 0; i < batch->deliveries.size(); ++i)
+		{
+			const ShardDelivery &delivery = batch->deliveries[i];
+			if (delivery.client->deliver(delivery.line->data(), delivery.line->size()))
+				shard.flush.push_back(delivery.client);
+		}
+	for (size_t i = 0; i < shard.flush.size(); ++i)
+		if (!shard.flush[i]->flush(*_transport))
+			shard.blocked.push_back(shard.flush[i]->getFd());
+	shard.flush.clear();
+}
+
+// every batch is pushed before any shard drains its results, so pop() never races a push()
+void ChannelShards::work(Shard &shard)
+{
+	Epoch::enter(shard.reader);
+	fanOut(shard);
+	pthread_barrier_wait(&_phase);
+	deliver(shard);
+	Epoch::exit(shard.reader);
+}
+
+void ChannelShards::serve(Shard &shard)
+{
+	Metrics::countInto(shard.counters);
+	unsigned seen = 0;
+	pthread_mutex_lock(&_mutex);
+	for (;;)
+	{
+		while (_generation == seen && !_stopping)
+			pthread_cond_wait(&_wake, &_mutex);
+		if (_stopping)
+			break;
+		seen = _generation;
+		pthread_mutex_unlock(&_mutex);
+		work(shard);
+		pthread_mutex_lock(&_mutex);
+		if (--_busy == 0)
+			pthread_cond_signal(&_idle);
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+void *ChannelShards::threadMain(void *shard)
+{
+	Shard *self = static_cast<Shard *>(shard);
+	self->pool->serve(*self);
+	return NULL;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+ChannelShards::ChannelShards()
+	: _pending(0), _transport(NULL), _generation(0), _busy(0), _stopping(false)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_wake, NULL);
+	pthread_cond_init(&_idle, NULL);
+}
+
+// destructor
+ChannelShards::~ChannelShards()
+{
+	stop();
+	pthread_cond_destroy(&_idle);
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_mutex);
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+bool ChannelShards::start(size_t count, Transport &transport)
+{
+	if (enabled() || count == 0)
+		return true;
+	_transport = &transport;
+	_stopping = false;
+	pthread_barrier_init(&_phase, NULL, static_cast<unsigned>(count));
+	for (size_t i = 0; i < count; ++i)
+	{
+		Shard *shard = new Shard;
+		shard->pool = this;
+		shard->index = i;
+		shard->batches.resize(count);
+		std::memset(shard->counters, 0, sizeof(shard->counters));
+		_shards.push_back(shard);
+		shard->reader = Epoch::registerReader();
+		if (shard->reader == MAX_EPOCH_READERS)
+		{
+			for (size_t j = 1; j <= i; ++j)
+			{
+				Epoch::releaseReader(_shards[j]->reader);
+				delete _shards[j];
+			}
+			_shards.resize(1);									// no thread to join yet
+			stop();
+			return false;
+		}
+	}
+	for (size_t i = 1; i < count; ++i)
+		if (pthread_create(&_shards[i]->thread, NULL, threadMain, _shards[i]) != 0)
+		{
+			for (size_t j = i; j < count; ++j)
+				delete _shards[j];
+			_shards.resize(i);
+			stop();
+			return false;
+		}
+	return true;
+}
+
+// only called between runs, so nothing is posted and no worker is busy
+void ChannelShards::stop()
+{
+	if (!enabled())
+		return;
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_mutex);
+	for (size_t i = 1; i < _shards.size(); ++i)
+		pthread_join(_shards[i]->thread, NULL);
+	for (size_t i = 0; i < _shards.size(); ++i)
+	{
+		Metrics::merge(_shards[i]->counters);
+		Epoch::releaseReader(_shards[i]->reader);
+		delete _shards[i];
+	}
+	_shards.clear();
+	for (size_t i = 0; i < _spare.size(); ++i)
+		delete _spare[i];
+	_spare.clear();
+	pthread_barrier_destroy(&_phase);
+	_pending = 0;
+}
+
+// the line is copied: the caller's buffer (arena, reply string) is gone by the end of the tick
+void ChannelShards::post(const Channel *channel, const char *data, size_t length, Client *exclude)
+{
+	ShardJob *job;
+	if (_spare.empty())
+		job = new ShardJob;
+	else
+	{
+		job = _spare.back();
+		_spare.pop_back();
+	}
+	job->channel = channel;
+	job->exclude = exclude;
+	job->line.assign(data, length);
+	_shards[hashName(channel->getName()) % _shards.size()]->jobs.push(job);
+	++_pending;
+
+	size_t recipients = channel->getMembers().size();
+	if (exclude && channel->hasMember(exclude->getFd()))
+		--recipients;
+	channel->countBroadcast(recipients);
+	Metrics::add(C_SHARD_JOBS);
+}
+
+/*
+	One fork-join round: the loop wakes the workers, does the work of shard 0
+	and waits for the others. Afterwards every worker is asleep again, so
+	their counters, blocked connections and finished jobs are collected here
+	without locks.
+*/
+void ChannelShards::run(const std::vector<Client*> &flush, std::vector<int> &blocked)
+{
+	uint64_t started = Metrics::nowMicros();
+	size_t count = _shards.size();
+	for (size_t i = 0; i < flush.size(); ++i)
+		_shards[flush[i]->getFd() % count]->flush.push_back(flush[i]);
+
+	pthread_mutex_lock(&_mutex);
+	++_generation;
+	_busy = count - 1;
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_mutex);
+	work(*_shards[0]);
+	pthread_mutex_lock(&_mutex);
+	while (_busy != 0)
+		pthread_cond_wait(&_idle, &_mutex);
+	pthread_mutex_unlock(&_mutex);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		Shard &shard = *_shards[i];
+		if (i != 0)
+			Metrics::merge(shard.counters);
+		blocked.insert(blocked.end(), shard.blocked.begin(), shard.blocked.end());
+		shard.blocked.clear();
+		_spare.insert(_spare.end(), shard.done.begin(), shard.done.end());
+		shard.done.clear();
+	}
+	_pending = 0;
+	Metrics::add(C_SHARD_RUNS);
+	Metrics::record(H_SHARD_RUN_MICROS, Metrics::nowMicros() - started);
+}
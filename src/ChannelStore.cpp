@@ -0,0 +1,392 @@
+#include "ChannelStore.hpp"
+#include "ChannelMenager.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+#include <cstring>		// for std::memcpy, std::memset, std::memcmp
+#include <cstdlib>		// for std::strtoul
+#include <sstream>		// for std::ostringstream
+#include <cstdio>		// for std::rename
+#include <fcntl.h>		// for open
+#include <unistd.h>		// for write, close, fdatasync, ftruncate, lseek
+#include <sys/mman.h>	// for mmap, munmap
+#include <sys/stat.h>	// for fstat
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(fd, data, length);
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+static void writeHeader(std::string &out, const char *magic)
+{
+	StateFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, magic, sizeof(header.magic));
+	header.version = STATE_VERSION;
+	out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+uint32_t ChannelStore::checksum(const StateRecord &record, const char *payload)
+{
+	const unsigned char *fields = reinterpret_cast<const unsigned char *>(&record) + sizeof(record.checksum);
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < sizeof(record) - sizeof(record.checksum); ++i)
+		hash = (hash ^ fields[i]) * 16777619u;
+	for (size_t i = 0; i < record.length; ++i)
+		hash = (hash ^ static_cast<unsigned char>(payload[i])) * 16777619u;
+	return hash;
+}
+
+void ChannelStore::encode(std::string &out, StateRecordType type, const std::string &channel, const std::string &argument)
+{
+	StateRecord record;
+	record.type = static_cast<uint8_t>(type);
+	record.nameLength = static_cast<uint8_t>(channel.size());
+	size_t argumentLength = argument.size();
+	if (channel.size() + argumentLength > 0xFFFF)
+		argumentLength = 0xFFFF - channel.size();
+	record.length = static_cast<uint16_t>(channel.size() + argumentLength);
+
+	size_t start = out.size();
+	out.append(reinterpret_cast<const char *>(&record), sizeof(record));
+	out.append(channel);
+	out.append(argument, 0, argumentLength);
+	record.checksum = checksum(record, out.data() + start + sizeof(record));
+	std::memcpy(&out[start], &record.checksum, sizeof(record.checksum));
+}
+
+// apply the records in data to states, returns the bytes that held valid records (header included)
+size_t ChannelStore::replay(const char *data, size_t size, const char *magic, StateMap &states)
+{
+	StateFileHeader header;
+	if (size < sizeof(header))
+		return 0;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version != STATE_VERSION)
+		return 0;
+
+	size_t offset = sizeof(header);
+	while (offset + sizeof(StateRecord) <= size)
+	{
+		StateRecord record;
+		std::memcpy(&record, data + offset, sizeof(record));
+		const char *payload = data + offset + sizeof(record);
+		if (offset + sizeof(record) + record.length > size || record.nameLength > record.length
+			|| checksum(record, payload) != record.checksum)
+			break;
+		apply(states, static_cast<StateRecordType>(record.type), std::string(payload, record.nameLength),
+			std::string(payload + record.nameLength, record.length - record.nameLength));
+		offset += sizeof(record) + record.length;
+	}
+	return offset;
+}
+
+void ChannelStore::apply(StateMap &states, StateRecordType type, const std::string &channel, const std::string &argument)
+{
+	if (type == STATE_DESTROY)
+	{
+		states.erase(channel);
+		return;
+	}
+	ChannelState &state = states[channel];
+	switch (type)
+	{
+		case STATE_TOPIC:		state.topic = argument; break;
+		case STATE_MODE_SET:	if (!argument.empty()) state.modes.insert(argument[0]); break;
+		case STATE_MODE_UNSET:	if (!argument.empty()) state.modes.erase(argument[0]); break;
+		case STATE_KEY:			state.key = argument; break;
+		case STATE_LIMIT:		state.limit = std::strtoul(argument.c_str(), NULL, 10); break;
+		case STATE_OP:			state.operators.insert(argument); break;
+		case STATE_DEOP:		state.operators.erase(argument); break;
+		default:				break;
+	}
+}
+
+// map a state file and apply its records; a missing file is an empty state
+bool ChannelStore::replayFile(const std::string &path, const char *magic, StateMap &states, bool truncateTail)
+{
+	int fd = ::open(path.c_str(), truncateTail ? O_RDWR : O_RDONLY);
+	if (fd == -1)
+		return true;
+	struct stat info;
+	if (fstat(fd, &info) == -1 || info.st_size == 0)
+	{
+		::close(fd);
+		return true;
+	}
+	size_t size = static_cast<size_t>(info.st_size);
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+	size_t valid = replay(static_cast<const char *>(data), size, magic, states);
+	munmap(data, size);
+	if (valid == 0)
+		LOG(LEVEL_WARN, SUB_SERVER) << path << " is not a channel state file, ignored";
+	else if (valid < size)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << path << ": " << size - valid << " bytes of torn records after offset " << valid << " dropped";
+		if (truncateTail && ftruncate(fd, valid) == -1)
+			LOG(LEVEL_WARN, SUB_SERVER) << "cannot truncate " << path;
+	}
+	::close(fd);
+	return valid > 0;
+}
+
+bool ChannelStore::resetLog()
+{
+	std::string header;
+	writeHeader(header, STATE_WAL_MAGIC);
+	if (ftruncate(_wal, 0) == -1 || !writeAll(_wal, header.data(), header.size()))
+		return false;
+	_walRecords = 0;
+	return true;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+ChannelStore::ChannelStore()
+	: _wal(-1), _fsync(STATE_FSYNC_INTERVAL), _intervalMicros(0), _snapshotMicros(0), _lastSync(0),
+	  _lastSnapshot(0), _graceMicros(static_cast<uint64_t>(STATE_OPERATOR_GRACE_SECONDS) * 1000000), _graceEnd(0), _unsynced(false), _walRecords(0), _records(0), _syncs(0), _snapshots(0) {}
+
+// destructor
+ChannelStore::~ChannelStore()
+{
+	close();
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+bool ChannelStore::parseFsync(const std::string &text, StateFsync &fsync)
+{
+	if (text == "always")
+		fsync = STATE_FSYNC_ALWAYS;
+	else if (text == "interval")
+		fsync = STATE_FSYNC_INTERVAL;
+	else if (text == "never")
+		fsync = STATE_FSYNC_NEVER;
+	else
+		return false;
+	return true;
+}
+
+bool ChannelStore::open(const std::string &directory, StateFsync fsync, long intervalMillis, long snapshotSeconds, long graceSeconds)
+{
+	if (_wal != -1)
+		return true;
+	_graceMicros = graceSeconds > 0 ? static_cast<uint64_t>(graceSeconds) * 1000000 : 0;
+	_snapshotPath = directory + "/channels.snapshot";
+	_walPath = directory + "/channels.wal";
+	_fsync = fsync;
+	_intervalMicros = intervalMillis > 0 ? static_cast<uint64_t>(intervalMillis) * 1000 : 0;
+	_snapshotMicros = snapshotSeconds > 0 ? static_cast<uint64_t>(snapshotSeconds) * 1000000 : 0;
+	_lastSync = _lastSnapshot = Metrics::nowMicros();
+	_wal = ::open(_walPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	return _wal != -1;
+}
+
+// snapshot first, then the log tail; the log keeps its records until the next snapshot
+size_t ChannelStore::restore(ChannelManager &channels)
+{
+	if (_wal == -1)
+		return 0;
+	StateMap states;
+	if (!replayFile(_snapshotPath, STATE_SNAPSHOT_MAGIC, states, false))
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot read " << _snapshotPath << ", restoring from the log only";
+	bool logValid = replayFile(_walPath, STATE_WAL_MAGIC, states, true);
+	if ((!logValid || lseek(_wal, 0, SEEK_END) == 0) && !resetLog())
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot initialize " << _walPath;
+
+	for (StateMap::const_iterator it = states.begin(); it != states.end(); ++it)
+	{
+		Channel *channel = channels.createChannel(it->first);
+		const ChannelState &state = it->second;
+		channel->setTopic(state.topic);
+		channel->setKey(state.key);
+		channel->setUserLimit(static_cast<int>(state.limit));
+		for (std::set<char>::const_iterator mode = state.modes.begin(); mode != state.modes.end(); ++mode)
+			channel->setMode(*mode);
+		for (std::set<std::string>::const_iterator op = state.operators.begin(); op != state.operators.end(); ++op)
+			channel->addRestoredOperator(*op);
+	}
+	beginGrace();
+	return states.size();
+}
+
+void ChannelStore::close()
+{
+	if (_wal == -1)
+		return;
+	commit();
+	if (_unsynced && _fsync != STATE_FSYNC_NEVER)
+		fdatasync(_wal);
+	::close(_wal);
+	_wal = -1;
+}
+
+// names longer than a record can describe are not persisted (IRC caps them at 50)
+void ChannelStore::append(StateRecordType type, const std::string &channel, const std::string &argument)
+{
+	if (_wal == -1 || channel.size() > 0xFF)
+		return;
+	encode(_pending, type, channel, argument);
+	++_records;
+	++_walRecords;
+}
+
+void ChannelStore::commit()
+{
+	if (_wal == -1)
+		return;
+	if (!_pending.empty())
+	{
+		if (!writeAll(_wal, _pending.data(), _pending.size()))
+			LOG(LEVEL_ERROR, SUB_SERVER) << "cannot append to " << _walPath << ", " << _pending.size() << " bytes of channel state lost";
+		_pending.clear();
+		_unsynced = true;
+	}
+	if (!_unsynced || _fsync == STATE_FSYNC_NEVER)
+		return;
+	uint64_t now = Metrics::nowMicros();
+	if (_fsync == STATE_FSYNC_INTERVAL && now - _lastSync < _intervalMicros)
+		return;
+	fdatasync(_wal);
+	_unsynced = false;
+	_lastSync = now;
+	++_syncs;
+}
+
+bool ChannelStore::snapshotDue() const
+{
+	return _wal != -1 && _snapshotMicros > 0 && _walRecords > 0 && Metrics::nowMicros() - _lastSnapshot >= _snapshotMicros;
+}
+
+void ChannelStore::beginGrace()
+{
+	_graceEnd = Metrics::nowMicros() + _graceMicros;
+}
+
+// an upgrade keeps the deadline, so upgrading does not extend it
+void ChannelStore::resumeGrace(uint32_t millisLeft)
+{
+	_graceEnd = Metrics::nowMicros() + static_cast<uint64_t>(millisLeft) * 1000;
+}
+
+uint32_t ChannelStore::graceLeftMillis() const
+{
+	uint64_t now = Metrics::nowMicros();
+	if (_graceEnd == 0 || now >= _graceEnd)
+		return 0;
+	return static_cast<uint32_t>((_graceEnd - now) / 1000);
+}
+
+bool ChannelStore::graceOver() const
+{
+	return _graceEnd != 0 && Metrics::nowMicros() >= _graceEnd;
+}
+
+// the log learns about it too, so a restart does not bring them back
+void ChannelStore::expireRestored(ChannelManager &channels)
+{
+	_graceEnd = 0;
+	size_t expired = 0;
+	std::vector<std::string> names = channels.getChannelNames();
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		Channel *channel = channels.getChannel(names[i]);
+		if (!channel)
+			continue;
+		std::vector<std::string> operators = channel->takeRestoredOperators();
+		for (size_t op = 0; op < operators.size(); ++op)
+			append(STATE_DEOP, names[i], operators[op]);
+		expired += operators.size();
+	}
+	if (expired > 0)
+		LOG(LEVEL_INFO, SUB_SERVER) << "Dropped " << expired << " restored operators that did not come back";
+}
+
+// write to a temporary file and rename it over the snapshot, so a crash leaves the old or the new one
+bool ChannelStore::snapshot(ChannelManager &channels)
+{
+	if (_wal == -1)
+		return false;
+	_lastSnapshot = Metrics::nowMicros();
+
+	std::string out;
+	writeHeader(out, STATE_SNAPSHOT_MAGIC);
+	std::vector<std::string> names = channels.getChannelNames();
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		const Channel *channel = channels.getChannel(names[i]);
+		if (!channel || names[i].size() > 0xFF)
+			continue;
+		encode(out, STATE_CREATE, names[i], "");
+		if (!channel->getTopic().empty())
+			encode(out, STATE_TOPIC, names[i], channel->getTopic());
+		if (channel->hasMode('i'))
+			encode(out, STATE_MODE_SET, names[i], "i");
+		if (channel->hasMode('t'))
+			encode(out, STATE_MODE_SET, names[i], "t");
+		if (!channel->getKey().empty())
+			encode(out, STATE_KEY, names[i], channel->getKey());
+		if (channel->getUserLimit() > 0)
+		{
+			std::ostringstream limit;
+			limit << channel->getUserLimit();
+			encode(out, STATE_LIMIT, names[i], limit.str());
+		}
+		std::vector<std::string> operators = channel->getOperatorNicknames();
+		for (size_t op = 0; op < operators.size(); ++op)
+			encode(out, STATE_OP, names[i], operators[op]);
+	}
+
+	std::string temporary = _snapshotPath + ".tmp";
+	int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+	{
+		LOG(LEVEL_ERROR, SUB_SERVER) << "cannot write " << temporary;
+		return false;
+	}
+	bool written = writeAll(fd, out.data(), out.size()) && (_fsync == STATE_FSYNC_NEVER || fdatasync(fd) == 0);
+	::close(fd);
+	if (!written || std::rename(temporary.c_str(), _snapshotPath.c_str()) != 0)
+	{
+		LOG(LEVEL_ERROR, SUB_SERVER) << "cannot write " << _snapshotPath;
+		return false;
+	}
+
+	// the tick's records are in the snapshot now
+	_pending.clear();
+	if (!resetLog())
+		LOG(LEVEL_ERROR, SUB_SERVER) << "cannot truncate " << _walPath;
+	_unsynced = false;
+	++_snapshots;
+	LOG(LEVEL_DEBUG, SUB_SERVER) << "Channel snapshot: " << names.size() << " channels, " << out.size() << " bytes";
+	return true;
+}
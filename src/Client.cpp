@@ -1,8 +1,10 @@
 #include "Client.hpp"
-#include <sys/socket.h>
+#include "Metrics.hpp"
+#include "Log.hpp"
 #include <ctime>
 #include <iostream>
 #include <cerrno>
+#include <algorithm>	// for std::lower_bound
 
 // |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
 // |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
@@ -14,9 +16,16 @@
 // Orthodox Canonical Form elements:
 // ====================================================================
 
+// nickname of clients that did not send NICK yet
+static const std::string NO_NICKNAME;
+
 // constructor
-Client::Client(int clientFd, const std::string &host) : _fd(clientFd), _hostname(host),
-														_registered(false), _passwordVerified(false), _lastActivity(time(NULL)) {}
+Client::Client(int clientFd, ClientIdentity *identity) : _fd(clientFd), _registered(false),
+														_passwordVerified(false), _oper(false), _link(false), _suspended(false), _sendQExceeded(false), _nickId(InternTable::NONE),
+														_identity(identity), _nickname(&NO_NICKNAME), _outbox(NULL), _lineStart(0)
+{
+	updatePrefix();
+}
 
 // destructor
 Client::~Client() {}
@@ -27,19 +36,27 @@ Client::~Client() {}
 
 // getters
 int Client::getFd() const { return _fd; }							 // get client socket
-const std::string &Client::getNickname() const { return _nickname; } // get nickname
-const std::string &Client::getUsername() const { return _username; } // get username
+const std::string &Client::getNickname() const { return *_nickname; } // get nickname
+InternId Client::getNickId() const { return _nickId; }				 // get interned nickname id
+const std::string &Client::getUsername() const { return _identity->username; } // get username
 bool Client::isRegistered() const { return _registered; }			 // check if client is registered
 
 // setters
-void Client::setNickname(const std::string &nick) { _nickname = nick; } // set nickname
-void Client::setUsername(const std::string &user) { _username = user; } // set username
+void Client::setNickname(InternId nickId, const std::string &nick) { _nickId = nickId; _nickname = &nick; updatePrefix(); } // set nickname
+void Client::setUsername(const std::string &user) { _identity->username = user; updatePrefix(); } // set username
 void Client::setRegistered(bool val) { _registered = val; }				// set registred flag
+bool Client::isOper() const { return _oper; }							// check if client is an IRC operator
+void Client::setOper(bool val) { _oper = val; }							// set IRC operator flag
+bool Client::isLink() const { return _link; }							// check if this is a server link
+void Client::setLink(bool val) { _link = val; }							// set server link flag
+bool Client::isSuspended() const { return _suspended; }					// check if a command is waiting
+void Client::setSuspended(bool val) { _suspended = val; }				// set suspended flag
+bool Client::sendQExceeded() const { return _sendQExceeded; }			// check if output was lost
 
 // methods
-void Client::appendBuffer(const std::string &data)
+void Client::appendBuffer(const char *data, size_t length)
 {
-	_recvBuffer += data;
+	_recvBuffer.append(data, length);
 }
 
 // check if buffer contains a complete command
@@ -48,35 +65,172 @@ bool Client::hasCompleteCommand() const
 	return _recvBuffer.find("\r\n") != std::string::npos;
 }
 
-// extract complete command
-std::string Client::extractCommand()
+// extract complete command (assign keeps the capacity of the caller's buffer)
+bool Client::extractCommand(std::string &command)
 {
 	size_t pos = _recvBuffer.find("\r\n");
 	if (pos == std::string::npos)
-		return "";
-	std::string cmd = _recvBuffer.substr(0, pos);
+		return false;
+	command.assign(_recvBuffer, 0, pos);
 	_recvBuffer.erase(0, pos + 2);
-	return cmd;
+	return true;
+}
+
+// heap bytes held by the receive and send buffers (0 while they fit the inline buffer)
+size_t Client::getBufferCapacity() const
+{
+	return (_recvBuffer.capacity() > 15 ? _recvBuffer.capacity() + 1 : 0)
+		+ (_sendBuffer.capacity() > 15 ? _sendBuffer.capacity() + 1 : 0);
+}
+
+// part of a line is waiting for more bytes
+bool Client::hasBufferedInput() const
+{
+	return !_recvBuffer.empty();
+}
+
+// arrival of the first byte of the buffered line
+uint64_t Client::getLineStart() const
+{
+	return _lineStart;
+}
+
+void Client::setLineStart(uint64_t time)
+{
+	_lineStart = time;
+}
+
+const std::string &Client::getReceiveBuffer() const
+{
+	return _recvBuffer;
+}
+
+const std::string &Client::getSendBuffer() const
+{
+	return _sendBuffer;
 }
 
 // get client prefix
-std::string Client::getPrefix() const
+const std::string &Client::getPrefix() const
+{
+	return _prefix;
+}
+
+// rebuild cached prefix
+void Client::updatePrefix()
 {
-	return ":" + _nickname + "!" + _username + "@" + _hostname;
+	_prefix = ":" + *_nickname + "!" + _identity->username + "@" + _identity->hostname;
+}
+
+// queue message
+void Client::sendMessage(const std::string &message)
+{
+	size_t size = message.size();
+	if (size >= 2 && message[size - 2] == '\r' && message[size - 1] == '\n')
+	{
+		sendMessage(message.data(), size);
+		return;
+	}
+	std::string formatted = message + "\r\n";
+	sendMessage(formatted.data(), formatted.size());
 }
 
-// send message
-void Client::sendMessage(const std::string &message) const
+/*
+	A client that does not read its replies must not hold the server's memory,
+	and one that lost a reply gets a stream with holes in it: past
+	SEND_BUFFER_LIMIT it is marked instead (like ircd's "SendQ exceeded") and
+	queued once more for flushing, where the server finds and disconnects it.
+	Links are dropped by the link code when they stall, not here.
+*/
+bool Client::exceedsSendQ()
 {
-	std::string formatted = message;
-	if (formatted.size() < 2 || formatted.substr(formatted.size() - 2) != "\r\n")
-		formatted += "\r\n";
-	int bytes_sent = send(_fd, formatted.c_str(), formatted.length(), 0);
+	if (_sendQExceeded)
+		return true;
+	if (_sendBuffer.size() <= SEND_BUFFER_LIMIT || _link)
+		return false;
+	_sendQExceeded = true;
+	Metrics::add(C_SENDQ_EXCEEDED);
+	return true;
+}
+
+// queue message that already ends with \r\n (the first one in a tick registers the fd for flushing)
+void Client::sendMessage(const char *data, size_t length)
+{
+	if (_sendQExceeded)
+		return;
+	if (exceedsSendQ())
+	{
+		if (_outbox)
+			_outbox->push_back(_fd);
+		return;
+	}
+	if (_sendBuffer.empty() && _outbox)
+		_outbox->push_back(_fd);
+	_sendBuffer.append(data, length);
+}
+
+// the shard that owns this connection flushes it itself, so the outbox (event loop only) is left alone
+bool Client::deliver(const char *data, size_t length)
+{
+	if (_sendQExceeded)
+		return false;
+	if (exceedsSendQ())
+		return true;
+	bool idle = _sendBuffer.empty();
+	_sendBuffer.append(data, length);
+	return idle;
+}
+
+// write everything queued since the last flush in one call; keep the rest if the socket is full
+bool Client::flush(Transport &transport)
+{
+	if (_sendQExceeded)
+		return false;
+	if (_sendBuffer.empty())
+		return true;
+	ssize_t bytes_sent = transport.send(_fd, _sendBuffer.data(), _sendBuffer.size());
+	Metrics::add(C_SEND_CALLS);
 	if (bytes_sent == -1)
 	{
-		std::cerr << "send() error for client " << _fd << " (" << _nickname
-				  << ") - error code: " << errno << std::endl;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			Metrics::add(C_SEND_BLOCKED);
+			return false;
+		}
+		LOG(LEVEL_WARN, SUB_NET) << "send() error for client " << _fd << " (" << *_nickname
+				  << ") - error code: " << errno;
+		bytes_sent = _sendBuffer.size();
 	}
+	else
+		Metrics::add(C_BYTES_OUT, bytes_sent);
+	_sendBuffer.erase(0, bytes_sent);
+	if (!_sendBuffer.empty())
+	{
+		Metrics::add(C_SEND_BLOCKED);
+		return false;
+	}
+	// do not keep a large burst (NAMES, WHO) allocated for an idle client
+	if (_sendBuffer.capacity() > SEND_BUFFER_KEEP)
+		std::string().swap(_sendBuffer);
+	return true;
+}
+
+// output left after a short write
+bool Client::hasPendingOutput() const
+{
+	return !_sendBuffer.empty();
+}
+
+// bytes waiting in the send buffer
+size_t Client::getQueuedBytes() const
+{
+	return _sendBuffer.size();
+}
+
+// where to announce queued output
+void Client::setOutbox(std::vector<int> *outbox)
+{
+	_outbox = outbox;
 }
 
 // -------------------------------------------------------registration
@@ -96,38 +250,56 @@ void Client::setPasswordVerified(bool verified)
 // set realname
 void Client::setRealname(const std::string &realname)
 {
-	_realname = realname;
+	_identity->realname = realname;
 }
 
 // get realname
 const std::string &Client::getRealname() const
 {
-	return _realname;
+	return _identity->realname;
 }
 
-void Client::addChannel(const std::string &channelName)
+// add channel to client's channel list (kept sorted for binary search)
+void Client::addChannel(const ChannelHandle &channel)
 {
-	_channels.insert(channelName);
+	std::vector<ChannelHandle> &channels = _identity->channels;
+	std::vector<ChannelHandle>::iterator it = std::lower_bound(channels.begin(), channels.end(), channel);
+	if (it == channels.end() || *it != channel)
+		channels.insert(it, channel);
 }
 
 // remove channel from client's channel list
-void Client::removeChannel(const std::string &channelName)
+void Client::removeChannel(const ChannelHandle &channel)
 {
-	_channels.erase(channelName);
+	std::vector<ChannelHandle> &channels = _identity->channels;
+	std::vector<ChannelHandle>::iterator it = std::lower_bound(channels.begin(), channels.end(), channel);
+	if (it != channels.end() && *it == channel)
+		channels.erase(it);
 }
 
 // get client's channels
-const std::set<std::string> &Client::getChannels() const
+const std::vector<ChannelHandle> &Client::getChannels() const
 {
-	return _channels;
+	return _identity->channels;
 }
 
 const std::string &Client::getHostname() const
 {
-	return _hostname;
+	return _identity->hostname;
+}
+
+void Client::setHostname(const std::string &host)
+{
+	_identity->hostname = host;
+	updatePrefix();
+}
+
+bool Client::isInChannel(const ChannelHandle &channel) const
+{
+	return std::binary_search(_identity->channels.begin(), _identity->channels.end(), channel);
 }
 
-bool Client::isInChannel(const std::string &channelName) const
+ClientIdentity *Client::getIdentity() const
 {
-	return _channels.find(channelName) != _channels.end();
+	return _identity;
 }
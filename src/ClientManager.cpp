@@ -0,0 +1,206 @@
+// ClientManager.cpp
+#include "ClientManager.hpp"
+#include "Metrics.hpp"
+#include "Epoch.hpp"
+
+ClientManager::ClientManager() {}
+
+ClientManager::~ClientManager() {
+	clear();
+}
+
+Client* ClientManager::createClient(int clientFd, const std::string &host) {
+	ClientIdentity *identity = coldPool.create(host);
+	Client *client;
+	try {
+		client = hotPool.create(clientFd, identity);
+	}
+	catch (...) {
+		coldPool.destroy(identity);
+		throw;
+	}
+	client->setOutbox(&outbox);
+	clients.push_back(client);
+	Metrics::add(C_CONNECTIONS);
+	if (static_cast<size_t>(clientFd) >= fdIndex.size())
+		fdIndex.resize(clientFd + 1);
+	fdIndex[clientFd] = hotPool.handleOf(client);
+	return client;
+}
+
+// no longer found by fd, nickname or in the client list
+void ClientManager::unindex(Client *client) {
+	// search from the back: clear() destroys the last client first
+	for (size_t i = clients.size(); i-- > 0; ) {
+		if (clients[i] == client) {
+			clients.erase(clients.begin() + i);
+			break;
+		}
+	}
+	// the fd may already belong to a connection accepted in the same poll round
+	if (fdIndex[client->getFd()] == hotPool.handleOf(client))
+		fdIndex[client->getFd()] = ClientHandle();
+	if (client->getNickId() != InternTable::NONE && nickIndex[client->getNickId()] == hotPool.handleOf(client))
+		nickIndex[client->getNickId()] = ClientHandle();
+	Metrics::add(C_DISCONNECTS);
+}
+
+// both parts go now, for clients no reader thread can see (shutdown)
+void ClientManager::destroyClient(Client *client) {
+	if (!client)
+		return;
+	unindex(client);
+	if (client->getNickId() != InternTable::NONE)
+		nicks.release(client->getNickId());
+	ClientIdentity *identity = client->getIdentity();
+	hotPool.destroy(client);
+	coldPool.destroy(identity);
+}
+
+// lines still buffered for it are not processed and its queued output is never written
+void ClientManager::retireClient(Client *client) {
+	if (!client || !hotPool.isAlive(client))
+		return;
+	unindex(client);
+	hotPool.retire(client);
+	retired.push_back(RetiredClient(client, Epoch::now()));
+}
+
+// the nickname stays interned until here: a reader may still print it
+void ClientManager::reclaim(uint64_t before) {
+	size_t kept = 0;
+	for (size_t i = 0; i < retired.size(); ++i) {
+		Client *client = retired[i].client;
+		if (retired[i].epoch >= before) {
+			retired[kept++] = retired[i];
+			continue;
+		}
+		if (client->getNickId() != InternTable::NONE)
+			nicks.release(client->getNickId());
+		ClientIdentity *identity = client->getIdentity();
+		hotPool.reclaim(client);
+		coldPool.destroy(identity);
+	}
+	retired.resize(kept, RetiredClient(NULL, 0));
+}
+
+void ClientManager::clear() {
+	while (!clients.empty())
+		destroyClient(clients.back());
+	reclaim(RECLAIM_ALL);
+	fdIndex.clear();
+}
+
+Client* ClientManager::getByFd(int clientFd) const {
+	if (clientFd < 0 || static_cast<size_t>(clientFd) >= fdIndex.size())
+		return NULL;
+	return hotPool.get(fdIndex[clientFd]);
+}
+
+Client* ClientManager::get(const ClientHandle &handle) const {
+	return hotPool.get(handle);
+}
+
+ClientHandle ClientManager::getHandle(const Client *client) const {
+	return hotPool.handleOf(client);
+}
+
+Client* ClientManager::getByNickname(const std::string &nickname) const {
+	return getByNickId(nicks.find(nickname));
+}
+
+Client* ClientManager::getByNickId(InternId nickId) const {
+	if (nickId == InternTable::NONE || nickId >= nickIndex.size())
+		return NULL;
+	return hotPool.get(nickIndex[nickId]);
+}
+
+bool ClientManager::setNickname(Client *client, const std::string &nickname) {
+	Client *owner = getByNickname(nickname);
+	if (owner == client)
+		return true;
+	if (owner)
+		return false;
+
+	InternId id = nicks.acquire(nickname);
+	if (id >= nickIndex.size())
+		nickIndex.resize(id + 1);
+	nickIndex[id] = hotPool.handleOf(client);
+
+	InternId oldId = client->getNickId();
+	client->setNickname(id, nicks.str(id));
+	if (oldId != InternTable::NONE) {
+		nickIndex[oldId] = ClientHandle();
+		nicks.release(oldId);
+	}
+	return true;
+}
+
+const std::vector<Client*> &ClientManager::getClients() const {
+	return clients;
+}
+
+size_t ClientManager::size() const {
+	return clients.size();
+}
+
+PoolStats ClientManager::getHotStats() const {
+	return hotPool.stats();
+}
+
+PoolStats ClientManager::getColdStats() const {
+	return coldPool.stats();
+}
+
+// heap usage of a string that no longer fits the inline (SSO) buffer
+static size_t stringHeap(const std::string &str) {
+	return str.capacity() > 15 ? str.capacity() + 1 : 0;
+}
+
+ClientFootprint ClientManager::getFootprint() const {
+	ClientFootprint footprint;
+	footprint.clients = clients.size();
+	footprint.hotBytes = clients.size() * sizeof(Client);
+	footprint.coldBytes = clients.size() * sizeof(ClientIdentity);
+	footprint.heapBytes = 0;
+	footprint.nickTableBytes = nicks.bytes() + nickIndex.capacity() * sizeof(ClientHandle);
+	for (size_t i = 0; i < clients.size(); ++i) {
+		const Client *client = clients[i];
+		const ClientIdentity *identity = client->getIdentity();
+		footprint.heapBytes += stringHeap(client->getPrefix())
+			+ client->getBufferCapacity()
+			+ stringHeap(identity->username) + stringHeap(identity->realname) + stringHeap(identity->hostname)
+			+ identity->channels.capacity() * sizeof(ChannelHandle);
+	}
+	return footprint;
+}
+
+size_t ClientManager::getQueuedBytes() const {
+	size_t queued = 0;
+	for (size_t i = 0; i < clients.size(); ++i)
+		queued += clients[i]->getQueuedBytes();
+	return queued;
+}
+
+// one write per client that produced output this tick; clients whose socket is full are
+// returned so the server can wait for POLLOUT (they are not announced again until drained)
+void ClientManager::flushOutput(Transport &transport, std::vector<int> &blocked) {
+	flushing.swap(outbox);
+	for (size_t i = 0; i < flushing.size(); ++i) {
+		Client *client = getByFd(flushing[i]);
+		if (client && !client->flush(transport))
+			blocked.push_back(client->getFd());
+	}
+	flushing.clear();
+}
+
+// for writers that flush elsewhere (channel shards); clients gone since they queued are skipped
+void ClientManager::takeOutbox(std::vector<Client*> &out) {
+	out.clear();
+	for (size_t i = 0; i < outbox.size(); ++i) {
+		Client *client = getByFd(outbox[i]);
+		if (client)
+			out.push_back(client);
+	}
+	outbox.clear();
+}
@@ -0,0 +1,28 @@
+#include "Clock.hpp"
+#include <ctime>		// for clock_gettime
+
+// 1 ns per tick until calibrate() runs (exact for the CLOCK_MONOTONIC fallback)
+uint64_t Clock::_nanosPerTick = static_cast<uint64_t>(1) << 32;
+
+static uint64_t monotonicNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// compare the tick counter with CLOCK_MONOTONIC over a short busy wait
+void Clock::calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t startNanos = monotonicNanos();
+	uint64_t startTicks = now();
+	uint64_t elapsed;
+	do
+		elapsed = monotonicNanos() - startNanos;
+	while (elapsed < 10000000);
+	uint64_t ticks = now() - startTicks;
+	if (ticks > 0)
+		_nanosPerTick = (elapsed << 32) / ticks;
+#endif
+}
@@ -2,63 +2,219 @@
 #include "Client.hpp"
 #include <iostream>
 #include <ostream>
+#include <cstring>
+#include <cerrno>		// for errno, EAGAIN
 #include "Channel.hpp"
 #include "ChannelMenager.hpp"
+#include "Metrics.hpp"
+#include "AllocProfile.hpp"
+#include "Log.hpp"
+#include "Epoch.hpp"
 
-void Server::handleChannelNotice(int clientFd, const std::string &channelName, const std::string &msgContent)
+// build ":<prefix> <COMMAND> <target> :<text>\r\n" in the arena
+ArenaString Server::buildRelayLine(const Client *sender, const char *command, const std::string &target, const ArenaString &text)
 {
-	const std::map<std::string, Channel *> &channels = _channelManager.getChannels();
+	ArenaString line((ArenaAllocator<char>(_arena)));
+	line.reserve(sender->getPrefix().size() + std::strlen(command) + target.size() + text.size() + 6);
+	line << sender->getPrefix() << " " << command << " " << target << " :" << text << "\r\n";
+	return line;
+}
+
+// ====================================================================
+// filtering on the worker pool:
+// ====================================================================
+
+/*
+	Long channel text is censored on a worker thread. Jobs are queued per
+	channel and relayed strictly in that order: a job that finishes early
+	waits for the ones before it, and once a channel has jobs in flight
+	even short messages join the queue. A change of membership (join, part,
+	kick, quit) waits for the channel's queue first, see settleOffloaded();
+	everything else (private messages, modes) does not.
+*/
+bool Server::offloadFilter(Channel *channel, Client *sender, const char *command, const std::string &target,
+							const ArenaString &text)
+{
+	if (!_workers.enabled())
+		return false;
+	std::map<ChannelHandle, std::deque<FilterJob*> >::iterator queue = _offloaded.find(channel->getHandle());
+	if (text.size() < _offloadBytes && queue == _offloaded.end())
+		return false;
+
+	FilterJob *job = new FilterJob;
+	job->server = this;
+	job->channel = channel->getHandle();
+	job->sender = getClientHandle(sender);
+	job->line.reserve(sender->getPrefix().size() + std::strlen(command) + target.size() + text.size() + 6);
+	job->line.append(sender->getPrefix()).append(" ").append(command).append(" ").append(target).append(" :");
+	job->text.assign(text.data(), text.size());
+	if (queue == _offloaded.end())
+		queue = _offloaded.insert(std::make_pair(job->channel, std::deque<FilterJob*>())).first;
+	queue->second.push_back(job);
+	_workers.submit(job);
+	return true;
+}
+
+// worker thread: the word list is read-only, the job is not shared with anyone
+void Server::FilterJob::run()
+{
+	line.append(server->_bot.filterMessage(text)).append("\r\n");
+	std::string().swap(text);
+}
+
+void Server::FilterJob::finish()
+{
+	done = true;
+	server->relayFiltered(channel);
+}
+
+void Server::handleWorkerCompletions()
+{
+	_workers.clearWake();
+	WorkItem *item;
+	while ((item = _workers.finished()) != NULL)
+		item->finish();
+}
+
+// a channel destroyed meanwhile gets nothing; a sender gone meanwhile is no member to skip
+void Server::relayFiltered(const ChannelHandle &handle)
+{
+	std::map<ChannelHandle, std::deque<FilterJob*> >::iterator queue = _offloaded.find(handle);
+	if (queue == _offloaded.end())
+		return;
+	Channel *channel = _channelManager.getChannel(handle);
+	std::deque<FilterJob*> &jobs = queue->second;
+	while (!jobs.empty() && jobs.front()->done)
+	{
+		FilterJob *job = jobs.front();
+		jobs.pop_front();
+		if (channel)
+		{
+			broadcastMessage(channel, job->line.data(), job->line.size(), _clientManager.get(job->sender));
+			propagateToChannel(channel, job->line.data(), job->line.size());
+		}
+		delete job;
+	}
+	if (jobs.empty())
+		_offloaded.erase(queue);
+}
+
+// the workers keep running, only the loop waits for them
+void Server::awaitWorkers()
+{
+	struct pollfd pfd;
+	pfd.fd = _workers.wakeFd();
+	pfd.events = POLLIN;
+	::poll(&pfd, 1, 100);
+	handleWorkerCompletions();
+}
+
+void Server::finishOffloaded()
+{
+	while (_workers.inFlight() > 0)
+		awaitWorkers();
+}
+
+/*
+	Text goes to the members of the channel when it is relayed, so they must
+	not change while some is queued: a joiner would get what was said before
+	it was let in, a kicked member would miss it, and a sender's PART or
+	QUIT would overtake its own message. The loop waits for that channel's
+	jobs (nothing at all when none are queued) and delivers them, shards
+	included, before the membership changes.
+*/
+void Server::settleOffloaded(const ChannelHandle &channel)
+{
+	if (_offloaded.find(channel) == _offloaded.end())
+		return;
+	while (_offloaded.find(channel) != _offloaded.end())
+		awaitWorkers();
+	runShards(false);
+}
+
+void Server::settleOffloaded(const std::vector<ChannelHandle> &channels)
+{
+	for (size_t i = 0; i < channels.size() && !_offloaded.empty(); ++i)
+		settleOffloaded(channels[i]);
+}
+
+void Server::dropOffloaded()
+{
+	for (size_t i = _pfds.size(); _workers.enabled() && i-- > 0; )
+		if (_pfds[i].fd == _workers.wakeFd())
+			_pfds.erase(_pfds.begin() + i);
+	_workers.stop();
+	for (std::map<ChannelHandle, std::deque<FilterJob*> >::iterator it = _offloaded.begin(); it != _offloaded.end(); ++it)
+		for (size_t i = 0; i < it->second.size(); ++i)
+			delete it->second[i];
+	_offloaded.clear();
+}
 
+// text after the target parameter, without the leading ':'
+ArenaString Server::extractMessageText(const std::string &message, const std::string &target)
+{
+	size_t start = message.find(target) + target.length() + 1;
+	if (start < message.size() && message[start] == ':')
+		++start;
+	if (start > message.size())
+		start = message.size();
+	return ArenaString(message.data() + start, message.size() - start, ArenaAllocator<char>(_arena));
+}
+
+void Server::handleChannelNotice(int clientFd, const std::string &channelName, const ArenaString &msgContent)
+{
 	Client *sender = findClientByFd(clientFd);
 	if (!sender)
 		return;
 
-	// check if channel exists - use const_iterator
-	std::map<std::string, Channel *>::const_iterator it = channels.find(channelName);
-	if (it == channels.end())
+	// check if channel exists
+	Channel *channel = _channelManager.getChannel(channelName);
+	if (!channel)
 		return;
 
-	Channel *channel = it->second;
-
 	// check if client is in channel
 	const std::map<int, Client *> &members = channel->getMembers();
 	if (members.find(clientFd) == members.end())
 		return;
 
-	std::string filtered = _bot.filterMessage(msgContent);
+	if (offloadFilter(channel, sender, "NOTICE", channelName, msgContent))
+		return;
+	ArenaString filtered = _bot.filterMessage(msgContent);
 	// create full message (NOTICE)
-	std::string fullMessage = sender->getPrefix() + " NOTICE " + channelName + " :" + filtered + "\r\n";
+	ArenaString fullMessage = buildRelayLine(sender, "NOTICE", channelName, filtered);
 
 	// send to all clients in channel except sender
-	channel->broadcast(fullMessage, sender);
+	broadcastMessage(channel, fullMessage.data(), fullMessage.size(), sender);
+	propagateToChannel(channel, fullMessage.data(), fullMessage.size());
 }
 
-void Server::handlePrivateNotice(int clientFd, const std::string &target, const std::string &msgContent)
+void Server::handlePrivateNotice(int clientFd, const std::string &target, const ArenaString &msgContent)
 {
-	// Find the target client by nickname
+	// Find the target client by nickname, here or on a linked server
 	Client *targetClient = findClientByNickname(target);
-	if (!targetClient)
+	RemoteUser *remoteTarget = targetClient ? NULL : _network.findUser(target);
+	if (!targetClient && !remoteTarget)
 		return;
 
 	Client *sender = findClientByFd(clientFd);
 	if (!sender)
 		return;
-	std::string senderPrefix = sender->getPrefix();
 
-	std::string fullMessage = senderPrefix + " NOTICE " + target + " :" + msgContent + "\r\n";
-	targetClient->sendMessage(fullMessage);
+	ArenaString fullMessage = buildRelayLine(sender, "NOTICE", target, msgContent);
+	if (remoteTarget)
+		sendToLink(remoteTarget->link, std::string(fullMessage.data(), fullMessage.size()));
+	else
+		targetClient->sendMessage(fullMessage.data(), fullMessage.size());
 }
 
 void Server::handleNoticeCommand(int clientFd, const std::string &message)
 {
-	std::vector<std::string> tokens = Server::ft_split(message, ' ');
+	ArenaTokens tokens = Server::ft_split(message, ' ');
 	if (tokens.size() < 3)
 		return;
 
-	std::string target = tokens[1];
-	std::string msgContent = message.substr(message.find(target) + target.length() + 1);
-	if(msgContent[0]==':')
-		msgContent = msgContent.substr(1);
+	const std::string &target = tokens[1];
+	ArenaString msgContent = extractMessageText(message, target);
 
 	if (target.length() > 512)
 		return;
@@ -68,80 +224,80 @@ void Server::handleNoticeCommand(int clientFd, const std::string &message)
 		handlePrivateNotice(clientFd, target, msgContent);
 }
 
-void Server::handleChannelMessage(int clientFd, const std::string &channelName, const std::string &msgContent)
+void Server::handleChannelMessage(int clientFd, const std::string &channelName, const ArenaString &msgContent)
 {
-	const std::map<std::string, Channel *> &channels = _channelManager.getChannels();
-
 	Client *sender = findClientByFd(clientFd);
 	if (!sender)
 		return;
 
-	// check if channel exists - use const_iterator
-	std::map<std::string, Channel *>::const_iterator it = channels.find(channelName);
-	if (it == channels.end())
+	// check if channel exists
+	Channel *channel = _channelManager.getChannel(channelName);
+	if (!channel)
 	{
 		std::string response = ":server 403 " + sender->getNickname() + " " + channelName + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	Channel *channel = it->second;
-
 	// check if client is in channel
 	const std::map<int, Client *> &members = channel->getMembers();
 	if (members.find(clientFd) == members.end())
 	{
 		std::string response = ":server 442 " + sender->getNickname() + " " + channelName + " :You're not on that channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	std::string filtered = _bot.filterMessage(msgContent);
+	if (offloadFilter(channel, sender, "PRIVMSG", channelName, msgContent))
+		return;
+	ArenaString filtered = _bot.filterMessage(msgContent);
 	// create full message (PRIVMSG)
-	std::string fullMessage = sender->getPrefix() + " PRIVMSG " + channelName + " :" + filtered + "\r\n";
+	ArenaString fullMessage = buildRelayLine(sender, "PRIVMSG", channelName, filtered);
 
 	// send to all clients in channel except sender
-	channel->broadcast(fullMessage, sender);
+	broadcastMessage(channel, fullMessage.data(), fullMessage.size(), sender);
+	propagateToChannel(channel, fullMessage.data(), fullMessage.size());
 }
 
-void Server::handlePrivateMessage(int clientFd, const std::string &target, const std::string &msgContent)
+void Server::handlePrivateMessage(int clientFd, const std::string &target, const ArenaString &msgContent)
 {
-	// Find the target client by nickname
+	// Find the target client by nickname, here or on a linked server
 	Client *targetClient = findClientByNickname(target);
-	if (!targetClient)
+	RemoteUser *remoteTarget = targetClient ? NULL : _network.findUser(target);
+	if (!targetClient && !remoteTarget)
 	{
 		std::string response = ":server 401 " + target + " :No such nick/channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	Client *sender = findClientByFd(clientFd);
 	if (!sender)
 		return;
-	std::string senderPrefix = sender->getPrefix();
 
-	std::string fullMessage = senderPrefix + " PRIVMSG " + target + " :" + msgContent + "\r\n";
-	targetClient->sendMessage(fullMessage);
+	ArenaString fullMessage = buildRelayLine(sender, "PRIVMSG", target, msgContent);
+	if (remoteTarget)
+		sendToLink(remoteTarget->link, std::string(fullMessage.data(), fullMessage.size()));
+	else
+		targetClient->sendMessage(fullMessage.data(), fullMessage.size());
 }
 
 void Server::handleMsgCommand(int clientFd, const std::string &message)
 {
-	std::vector<std::string> tokens = Server::ft_split(message, ' ');
+	ArenaTokens tokens = Server::ft_split(message, ' ');
 	if (tokens.size() < 3)
 	{
 		std::string response = ":server 461 MSG :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	std::string target = tokens[1];
-	std::string msgContent = message.substr(message.find(target) + target.length() + 1);
-	if(msgContent[0]==':')
-		msgContent = msgContent.substr(1);
+	const std::string &target = tokens[1];
+	ArenaString msgContent = extractMessageText(message, target);
 	if (target.length() > 512)
 	{
 		std::string response = ":server 412 :Target too long\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	if (target[0] == '#' || target[0] == '&')
@@ -156,11 +312,11 @@ void Server::handlePartCommand(int clientFd, const std::string &message)
 	if (!client || !client->isRegistered())
 		return;
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 2)
 	{
 		std::string response = ":server 461 PART :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -171,22 +327,26 @@ void Server::handlePartCommand(int clientFd, const std::string &message)
 	if (!channel)
 	{
 		std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	if (!channel->hasMember(clientFd))
 	{
 		std::string response = ":server 442 " + client->getNickname() + " " + channelName + " :You're not on that channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
+	settleOffloaded(channel->getHandle());
+
 	// Send PART message to channel
 	std::string partMsg = client->getPrefix() + " PART " + channelName + " :" + partMessage + "\r\n";
 	channel->broadcast(partMsg);
+	propagate(partMsg);
 
 	// Remove client from channel
+	journalLeave(channel, client);
 	channel->removeMember(clientFd);
 
 	// Remove channel if empty
@@ -195,10 +355,32 @@ void Server::handlePartCommand(int clientFd, const std::string &message)
 		_channelManager.removeChannel(channelName);
 	}
 
-	std::cout << "Client " << client->getNickname() << " left channel " << channelName << std::endl;
+	LOG(LEVEL_DEBUG, SUB_CHANNEL) << "Client " << client->getNickname() << " left channel " << channelName;
+}
+
+// the last member leaving destroys the channel, an operator leaving loses +o
+void Server::journalLeave(Channel *channel, const Client *client)
+{
+	if (!_channelStore.enabled())
+		return;
+	if (channel->getMemberCount() == 1)
+		_channelStore.append(STATE_DESTROY, channel->getName());
+	else if (channel->isOperator(client->getFd()))
+		_channelStore.append(STATE_DEOP, channel->getName(), client->getNickname());
+}
+
+void Server::journalDeparture(const Client *client)
+{
+	const std::vector<ChannelHandle> &channels = client->getChannels();
+	for (size_t i = 0; i < channels.size() && _channelStore.enabled(); ++i)
+	{
+		Channel *channel = _channelManager.getChannel(channels[i]);
+		if (channel)
+			journalLeave(channel, client);
+	}
 }
 
-static std::deque<std::string> readParameters(const std::vector<std::string> &tokens) {
+static std::deque<std::string> readParameters(const ArenaTokens &tokens) {
 	std::deque<std::string> parameters;
 	for (size_t i = 3; i < tokens.size(); i++)
 		parameters.push_back(tokens[i]);
@@ -215,20 +397,24 @@ static int convertLimitString(std::string const &str) {
 }
 
 bool Server::setChannelMode(char mode, Client *client, Channel *channel, std::deque<std::string> &parameters) {
-	if (mode == 'i' || mode == 't') channel->setMode(mode);
+	if (mode == 'i' || mode == 't') {
+		channel->setMode(mode);
+		_channelStore.append(STATE_MODE_SET, channel->getName(), std::string(1, mode));
+	}
 	if (mode == 'k') {
 		if (parameters.size() <= 0) {
 			std::string response = ":server 461 " + client->getNickname() + " k :Not enough parameters\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		channel->setKey(parameters.front());
+		_channelStore.append(STATE_KEY, channel->getName(), parameters.front());
 		parameters.pop_front();
 	}
 	if (mode == 'o') {
 		if (parameters.size() <= 0) {
 			std::string response = ":server 461 " + client->getNickname() + " o :Not enough parameters\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		
@@ -237,24 +423,30 @@ bool Server::setChannelMode(char mode, Client *client, Channel *channel, std::de
 		parameters.pop_front();
 
 		Client *targetClient = findClientByNickname(targetNick);
+		RemoteUser *remoteTarget = targetClient ? NULL : _network.findUser(targetNick);
+		if (remoteTarget && channel->hasRemoteMember(remoteTarget)) {
+			channel->setRemoteOperator(remoteTarget, true);
+			return true;
+		}
 		if (targetClient == NULL) {
 			std::string response = ":server 401 " + client->getNickname() + " " + targetNick + " :No such nick\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		if (!channel->hasMember(targetClient->getFd())) {
 			// FIX: Add channel name to error response
 			std::string response = ":server 441 " + client->getNickname() + " " + targetNick + " " + channel->getName() + " :User not on channel\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		int targetFd = targetClient->getFd();
 		channel->addOperator(targetFd);
+		_channelStore.append(STATE_OP, channel->getName(), targetClient->getNickname());
 	}
 	if (mode == 'l') {
 		if (parameters.size() <= 0) {
 			std::string response = ":server 461 " + client->getNickname() + " l :Not enough parameters\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		std::string limitStr = parameters.front();
@@ -262,23 +454,30 @@ bool Server::setChannelMode(char mode, Client *client, Channel *channel, std::de
 		int limit = convertLimitString(limitStr);
 		if(limit <= 0) {
 			std::string err = ":server 467 " + client->getNickname() + " " + channel->getName() + " :Invalid channel limit\r\n";
-			send(client->getFd(), err.c_str(), err.length(), 0);
+			client->sendMessage(err);
 			return false;
 		}
 		channel->setUserLimit(limit);
+		std::ostringstream saved;
+		saved << limit;
+		_channelStore.append(STATE_LIMIT, channel->getName(), saved.str());
 	}
 	return true;
 }
 
 bool Server::unsetChannelMode(char mode, Client *client, Channel *channel, std::deque<std::string> &parameters) {
-	if (mode == 'i' || mode == 't') channel->unsetMode(mode);
+	if (mode == 'i' || mode == 't') {
+		channel->unsetMode(mode);
+		_channelStore.append(STATE_MODE_UNSET, channel->getName(), std::string(1, mode));
+	}
 	if (mode == 'k') {
 		channel->setKey("");
+		_channelStore.append(STATE_KEY, channel->getName());
 	}
 	if (mode == 'o') {
 		if (parameters.size() <= 0) {
 			std::string response = ":server 461 " + client->getNickname() + " o :Not enough parameters\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		
@@ -287,57 +486,64 @@ bool Server::unsetChannelMode(char mode, Client *client, Channel *channel, std::
 		parameters.pop_front();
 
 		Client *targetClient = findClientByNickname(targetNick);
+		RemoteUser *remoteTarget = targetClient ? NULL : _network.findUser(targetNick);
+		if (remoteTarget && channel->hasRemoteMember(remoteTarget)) {
+			channel->setRemoteOperator(remoteTarget, false);
+			return true;
+		}
 		if (targetClient == NULL) {
 			std::string response = ":server 401 " + client->getNickname() + " " + targetNick + " :No such nick\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		if (!channel->hasMember(targetClient->getFd())) {
 			// FIX: Add channel name to error response
 			std::string response = ":server 441 " + client->getNickname() + " " + targetNick + " " + channel->getName() + " :User not on channel\r\n";
-			send(client->getFd(), response.c_str(), response.length(), 0);
+			client->sendMessage(response);
 			return false;
 		}
 		int targetFd = targetClient->getFd();
 		channel->removeOperator(targetFd);
+		_channelStore.append(STATE_DEOP, channel->getName(), targetClient->getNickname());
 	}
 	if (mode == 'l') {
 		channel->setUserLimit(0);
+		_channelStore.append(STATE_LIMIT, channel->getName(), "0");
 	}
 	return true;
 }
 
-void Server::handleChannelMode(int clientFd, const std::string &target, const std::vector<std::string> &tokens) {
+void Server::handleChannelMode(int clientFd, const std::string &target, const ArenaTokens &tokens) {
 	Client *client = findClientByFd(clientFd);
 	if (!client) return;
 	if (!client->isRegistered()) {
 		std::string response = ":server 451 " + client->getNickname() + " :You have not registered\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	if (!_channelManager.channelExists(target)) {
 		std::string response = ":server 403 " + client->getNickname() + " " + target + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	Channel *channel = _channelManager.getChannel(target);
 
 	if (!channel->hasMember(clientFd)) {
 		std::string response = ":server 442 " + client->getNickname() + " " + target + " :You're not on that channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	if (!channel->isOperator(clientFd)) {
 		std::string response = ":server 482 " + client->getNickname() + " " + target + " :You're not channel operator\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	if (tokens.size() < 3) {
 		std::string currentModes = channel->getModeString();
 		std::string response = ":server 324 " + client->getNickname() + " " + target + " " + currentModes + "\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -346,7 +552,7 @@ void Server::handleChannelMode(int clientFd, const std::string &target, const st
 	std::string modes = tokens[2];
 	if (modes[0] != '-' && modes[0] != '+') {
 		std::string response = ":server 472 " + client->getNickname() + " " + modes + " :is unknown mode char to me\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	
@@ -387,21 +593,22 @@ void Server::handleChannelMode(int clientFd, const std::string &target, const st
 			}
 		} else {
 			std::string response = ":server 472 " + client->getNickname() + " " + std::string(1, modes[i]) + " :is unknown mode char to me\r\n";
-			send(clientFd, response.c_str(), response.length(), 0);
+			sendToClient(clientFd, response);
 		}
 	}
 	
 	std::string modeChangeMsg = client->getPrefix() + " MODE " + target + " " + currentModes + modeParams + "\r\n";
 	channel->broadcast(modeChangeMsg);
+	propagate(modeChangeMsg);
 }
 
 void Server::handleModeCommand(int clientFd, const std::string &message)
 {
-	std::vector<std::string> tokens = Server::ft_split(message, ' ');
+	ArenaTokens tokens = Server::ft_split(message, ' ');
 	if (tokens.size() < 2)
 	{
 		std::string response = ":server 461 MODE :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -414,7 +621,7 @@ void Server::handleModeCommand(int clientFd, const std::string &message)
 	else
 	{
 		std::string response = ":server 502 :User modes are not supported\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 	}
 }
 
@@ -424,7 +631,8 @@ void Server::joindefaultChannel(int clientFd)
 	Client *client = findClientByFd(clientFd);
 	if (!client)
 		return;
-	if (!client->isInChannel(defaultChannel))
+	Channel *channel = _channelManager.getChannel(defaultChannel);
+	if (!channel || !client->isInChannel(channel->getHandle()))
 	{
 		if (client->isRegistered())
 		{
@@ -441,60 +649,168 @@ void Server::handleClientEvent(int i)
 {
 	char buf[512];
 	int clientFd = _pfds[i].fd;
-	int bytes = recv(clientFd, buf, sizeof(buf) - 1, 0);
+	int bytes = _transport->recv(clientFd, buf, sizeof(buf) - 1);
 
+	// nothing after all (a TLS handshake step, a record still incomplete)
+	if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
 	if (bytes <= 0)
 	{
 		handleClientDisconnect(i, clientFd, bytes);
 		return;
 	}
+	Metrics::add(C_RECV_CALLS);
+	Metrics::add(C_BYTES_IN, bytes);
 
 	processClientMessage(clientFd, buf, bytes);
 }
 
-void Server::removeClientFromVector(int clientFd)
+// a socket that was full at the last flush can take more data
+void Server::handleClientWritable(int i)
 {
-	for (size_t j = 0; j < _clients.size(); ++j)
+	Client *client = findClientByFd(_pfds[i].fd);
+	if (!client || client->flush(*_transport))
 	{
-		if (_clients[j]->getFd() == clientFd)
-		{
-			delete _clients[j];
-			_clients.erase(_clients.begin() + j);
-			break;
+		_pfds[i].events &= ~POLLOUT;
+		recordLineLatencies();
+	}
+}
+
+// queue a reply; everything a client gets during one tick leaves in a single write
+void Server::sendToClient(int clientFd, const std::string &message)
+{
+	Client *client = findClientByFd(clientFd);
+	if (client)
+		client->sendMessage(message);
+}
+
+// channel text to local members: posted to the channel's shard when they run, queued right away otherwise
+void Server::broadcastMessage(Channel *channel, const char *data, size_t length, Client *sender)
+{
+	if (_shards.enabled())
+		_shards.post(channel, data, length, sender);
+	else
+		channel->broadcast(data, length, sender);
+}
+
+// end of tick: one send() per client that produced output, POLLOUT for the ones that could not take it all
+void Server::flushOutput()
+{
+	if (_shards.enabled())
+	{
+		runShards(true);
+		return;
+	}
+	_clientManager.flushOutput(*_transport, _blocked);
+	for (size_t i = 0; i < _blocked.size(); ++i)
+		waitWritable(_blocked[i]);
+	_blocked.clear();
+	recordLineLatencies();
+}
+
+/*
+	Posted channel messages must reach their members before anything that
+	could overtake them or change who they go to: any command other than
+	channel text, a disconnect, a dropped link. Such a barrier only delivers
+	the posted messages; the end of the tick also hands the shards the
+	outbox, so every connection is written by exactly one thread.
+*/
+void Server::runShards(bool endOfTick)
+{
+	if (endOfTick)
+		_clientManager.takeOutbox(_flushing);
+	else if (!_shards.pending())
+		return;
+	if (!_shards.pending() && _flushing.empty())
+		return;
+	_shards.run(_flushing, _blocked);
+	_flushing.clear();
+	for (size_t i = 0; i < _blocked.size(); ++i)
+		waitWritable(_blocked[i]);
+	_blocked.clear();
+	recordLineLatencies();
+}
+
+// a client over its send queue has nothing to wait for
+void Server::waitWritable(int clientFd)
+{
+	Client *client = findClientByFd(clientFd);
+	if (client && client->sendQExceeded())
+	{
+		_sendQExceeded.push_back(clientFd);
+		return;
+	}
+	for (size_t i = 0; i < _pfds.size(); ++i) {
+		if (_pfds[i].fd == clientFd) {
+			_pfds[i].events |= POLLOUT;
+			return;
 		}
 	}
 }
 
+// their QUIT goes out with the tick that found them
+void Server::dropSendQExceeded()
+{
+	std::vector<int> exceeded;
+	exceeded.swap(_sendQExceeded);
+	for (size_t i = 0; i < exceeded.size(); ++i)
+	{
+		Client *client = findClientByFd(exceeded[i]);
+		if (client && client->sendQExceeded())
+			disconnectClient(client, "SendQ exceeded");
+	}
+}
+
+// gone for every lookup now; the record stays readable until the end of the tick (cleanupDisconnectedClients)
+void Server::retireClient(Client *client)
+{
+	_clientManager.retireClient(client);
+}
+
 void Server::handleClientDisconnect(int index, int clientFd, int bytes) {
+	runShards(false);
 	if (bytes == 0)
-		std::cout << "Client disconnected (fd=" << clientFd << ")" << std::endl;
+		LOG(LEVEL_INFO, SUB_NET) << "Client disconnected (fd=" << clientFd << ")";
 	else
-		std::cerr << "recv() error on fd " << clientFd << std::endl;
+		LOG(LEVEL_WARN, SUB_NET) << "recv() error on fd " << clientFd;
 
 	Client* disconnectedClient = findClientByFd(clientFd);
+	if (disconnectedClient && disconnectedClient->isLink())
+	{
+		splitLink(clientFd, bytes == 0 ? "Connection closed" : "Read error");
+		closeConnection(disconnectedClient);
+		return;
+	}
 	
 	if (disconnectedClient) {
+		settleOffloaded(disconnectedClient->getChannels());
+
 		// 1. Remove client from all channels
-		_channelManager.removeClientFromAllChannels(clientFd);
+		journalDeparture(disconnectedClient);
+		_channelManager.removeClientFromAllChannels(clientFd, getClientHandle(disconnectedClient));
 		
 		// 2. Send QUIT message to all channels the client was in
 		std::string quitMsg = disconnectedClient->getPrefix() + " QUIT :Client disconnected\r\n";
-		const std::set<std::string>& channels = disconnectedClient->getChannels();
-		for (std::set<std::string>::const_iterator it = channels.begin(); 
+		const std::vector<ChannelHandle>& channels = disconnectedClient->getChannels();
+		for (std::vector<ChannelHandle>::const_iterator it = channels.begin(); 
 			it != channels.end(); ++it) {
 			Channel* channel = _channelManager.getChannel(*it);
 			if (channel) {
 				channel->broadcast(quitMsg);
 			}
 		}
+		if (disconnectedClient->isRegistered())
+			propagate(quitMsg);
 	}
 	
 	// 3. Close socket
-	close(clientFd);
+	_transport->close(clientFd);
+	_capture.close(clientFd);
 	
-	// 4. Safe removal - mark for later cleanup
+	// 4. Safe removal - the pollfd goes at the end of the tick, the record once no reader can hold it
 	_pfds[index].fd = -1;
-	_clientsToRemove.push_back(clientFd);
+	if (disconnectedClient)
+		retireClient(disconnectedClient);
 }
 
 // In the main loop, after processing all events:
@@ -507,66 +823,152 @@ void Server::cleanupDisconnectedClients() {
 			++it;
 		}
 	}
-	
-	// Remove from _clients and free memory
-	for (std::vector<int>::iterator it = _clientsToRemove.begin(); 
-		it != _clientsToRemove.end(); ++it) {
-		removeClientFromVector(*it);
-	}
-	_clientsToRemove.clear();
+
+	// free the clients and channels retired so far that no reader thread can still see
+	uint64_t before = Epoch::collect();
+	_clientManager.reclaim(before);
+	_channelManager.reclaim(before);
 }
 
 void Server::processClientMessage(int clientFd, char* buf, int bytes)
 {
-	buf[bytes] = '\0';
-	std::string message(buf);
 	Client *client = findClientByFd(clientFd);
 	
 	if (!client)
 		return;
 
-	client->appendBuffer(message);
-	
-	while (client->hasCompleteCommand())
+	// a line continued from an earlier recv() started when its first part arrived
+	uint64_t received = Clock::now();
+	uint64_t lineStart = client->hasBufferedInput() ? client->getLineStart() : received;
+	client->appendBuffer(buf, bytes);
+	// a command of it is waiting: the new lines run once it is done (resumeTask)
+	if (client->isSuspended())
+	{
+		client->setLineStart(lineStart);
+		return;
+	}
+	processBufferedLines(client, received, lineStart);
+}
+
+void Server::processBufferedLines(Client *client, uint64_t received, uint64_t lineStart)
+{
+	int clientFd = client->getFd();
+	ClientHandle handle = getClientHandle(client);
+	bool extracted = false;
+	while (client->extractCommand(_line))
 	{
-		std::string command = client->extractCommand();
-		std::string trimmed = trimCommand(command);
+		extracted = true;
+		trimCommand(_line);
 		
-		if (trimmed.empty())
+		if (_line.empty())
 			continue;
 			
-		processSingleCommand(client, clientFd, trimmed);
+		_capture.line(clientFd, received, _line);
+		processSingleCommand(client, clientFd, _line);
+		_pendingLines.push_back(PendingLine(handle, lineStart));
+		lineStart = received;
 		
-		// Check if client still exists after command processing
-		if (findClientByFd(clientFd) == NULL)
+		// QUIT or a failed PASS retired it; the record itself is still valid until the end of the tick
+		if (!_clientManager.isAlive(client))
 			return;
+		if (client->isSuspended())
+			break;
+	}
+	// what is left began in this read, unless no line ended: then it is still the line that began at lineStart
+	client->setLineStart(extracted ? received : lineStart);
+}
+
+// end-to-end latency of the lines whose sender has nothing left in its send buffer; a sender that is gone has none
+void Server::recordLineLatencies()
+{
+	uint64_t now = Clock::now();
+	size_t kept = 0;
+	for (size_t i = 0; i < _pendingLines.size(); ++i)
+	{
+		Client *client = _clientManager.get(_pendingLines[i].sender);
+		if (!client)
+			continue;
+		if (client->hasPendingOutput())
+			_pendingLines[kept++] = _pendingLines[i];
+		else
+			Metrics::record(H_LINE_LATENCY, Clock::toNanos(now - _pendingLines[i].start));
 	}
+	_pendingLines.erase(_pendingLines.begin() + kept, _pendingLines.end());
 }
 
-std::string Server::trimCommand(const std::string& command)
+// trim whitespace in place (keeps the buffer's capacity)
+void Server::trimCommand(std::string& command)
 {
-	std::string trimmed = command;
-	trimmed.erase(0, trimmed.find_first_not_of(" \t\r\n"));
-	trimmed.erase(trimmed.find_last_not_of(" \t\r\n") + 1);
-	return trimmed;
+	command.erase(0, command.find_first_not_of(" \t\r\n"));
+	command.erase(command.find_last_not_of(" \t\r\n") + 1);
+}
+
+// watchdog target of commands without parameters
+static const std::string NO_TARGET;
+
+// PRIVMSG/NOTICE to a channel, with or without a source prefix (link lines)
+static bool isChannelMessage(const std::string &command)
+{
+	size_t start = 0;
+	if (!command.empty() && command[0] == ':')
+	{
+		start = command.find(' ');
+		if (start == std::string::npos)
+			return false;
+		++start;
+	}
+	size_t target;
+	if (command.compare(start, 8, "PRIVMSG ") == 0)
+		target = start + 8;
+	else if (command.compare(start, 7, "NOTICE ") == 0)
+		target = start + 7;
+	else
+		return false;
+	return target < command.size() && (command[target] == '#' || command[target] == '&');
 }
 
 void Server::processSingleCommand(Client* client, int clientFd, const std::string& command)
 {
+	CommandTimer timer;
+	AllocScope allocations;
+
+	if (_shards.enabled() && !isChannelMessage(command))
+		runShards(false);
+
+	if (client->isLink())
+	{
+		handleLinkLine(client, command);
+		return;
+	}
+
 	// ignore server messages starting with ':'
 	if (!command.empty() && command[0] == ':') {
-		std::cout << "Ignoring server message: " << command << std::endl;
+		LOG(LEVEL_DEBUG, SUB_COMMAND) << "Ignoring server message: " << command;
 		return;
 	}
 	
-	std::cout << "Received command from " << (client->getNickname().empty() ? "unknown" : client->getNickname()) << ": " << command << std::endl;
+	LOG(LEVEL_DEBUG, SUB_COMMAND) << "Received command from " << (client->getNickname().empty() ? "unknown" : client->getNickname()) << ": " << command;
 
-	std::vector<std::string> tokens = ft_split(command, ' ');
+	ArenaTokens tokens = ft_split(command, ' ');
 	std::string cmd = tokens.empty() ? "" : tokens[0];
+	CommandId commandId = Metrics::commandId(cmd);
+	timer.setCommand(commandId);
+	allocations.setCommand(commandId);
+	Metrics::add(C_MESSAGES_IN);
+	Metrics::countCommand(commandId, command.size() + 2);
+	WatchdogScope watched(_watchdog);
+	_watchdog.commandStarted(commandId, clientFd, client->getNickname(), tokens.size() > 1 ? tokens[1] : NO_TARGET,
+		_clientManager.pendingFlushes());
 
 	// add logging for MODE commands
 	if (cmd == "MODE") {
-		std::cout << "Processing MODE command for channel: " << (tokens.size() > 1 ? tokens[1] : "none") << std::endl;
+		LOG(LEVEL_DEBUG, SUB_COMMAND) << "Processing MODE command for channel: " << (tokens.size() > 1 ? tokens[1] : "none");
+	}
+
+	if (cmd == "SERVER" && !client->isRegistered() && _network.enabled())
+	{
+		handleServerCommand(client, command);
+		return;
 	}
 
 	if (handleCapabilityCommands(clientFd, tokens, cmd))
@@ -584,34 +986,34 @@ void Server::processSingleCommand(Client* client, int clientFd, const std::strin
 	handleRegisteredCommands(clientFd, tokens, cmd, command);
 }
 
-bool Server::handleCapabilityCommands(int clientFd, const std::vector<std::string>& tokens, const std::string& cmd)
+bool Server::handleCapabilityCommands(int clientFd, const ArenaTokens &tokens, const std::string& cmd)
 {
 	if (cmd != "CAP")
 		return false;
 
-	std::cout << "Handling CAP command" << std::endl;
+	LOG(LEVEL_DEBUG, SUB_COMMAND) << "Handling CAP command";
 	
 	if (tokens.size() >= 2)
 	{
 		if (tokens[1] == "LS")
 		{
 			std::string response = "CAP * LS :\r\n";
-			send(clientFd, response.c_str(), response.length(), 0);
+			sendToClient(clientFd, response);
 		}
 		else if (tokens[1] == "END")
 		{
-			std::cout << "CAP negotiation ended for client " << clientFd << std::endl;
+			LOG(LEVEL_DEBUG, SUB_CLIENT) << "CAP negotiation ended for client " << clientFd;
 		}
 		else if (tokens[1] == "REQ")
 		{
 			std::string response = "CAP * NAK :\r\n";
-			send(clientFd, response.c_str(), response.length(), 0);
+			sendToClient(clientFd, response);
 		}
 	}
 	return true;
 }
 
-std::string Server::joinTokens(const std::vector<std::string>& tokens)
+std::string Server::joinTokens(const ArenaTokens &tokens)
 {
 	if (tokens.empty()) return "";
 	
@@ -624,7 +1026,7 @@ std::string Server::joinTokens(const std::vector<std::string>& tokens)
 	return result;
 }
 
-bool Server::handleAuthenticationCommands(int clientFd, const std::vector<std::string>& tokens, const std::string& cmd)
+bool Server::handleAuthenticationCommands(int clientFd, const ArenaTokens &tokens, const std::string& cmd)
 {
 	if (cmd == "PASS")
 	{
@@ -734,7 +1136,7 @@ bool Server::handleAuthenticationCommands(int clientFd, const std::vector<std::s
 // 	if (tokens.size() < 2)
 // 	{
 // 		std::string response = ":server 461 SEND :Not enough parameters\r\n";
-// 		send(clientFd, response.c_str(), response.length(), 0);
+// 		sendToClient(clientFd, response);
 // 		return ;
 // 	}
 // 	std::string filePath = message.substr(message.find(' ') + 1);
@@ -743,7 +1145,7 @@ bool Server::handleAuthenticationCommands(int clientFd, const std::vector<std::s
 // 	if (!ifs.is_open())
 // 	{
 // 		std::string response = ":server 404 " + client->getNickname() + " " + filePath + " :No such file\r\n";
-// 		send(clientFd, response.c_str(), response.length(), 0);
+// 		sendToClient(clientFd, response);
 // 		return;
 // 	}
 
@@ -818,7 +1220,7 @@ bool Server::handleAuthenticationCommands(int clientFd, const std::vector<std::s
 // 	}
 // }
 
-void Server::handleRegisteredCommands(int clientFd, const std::vector<std::string>& tokens, const std::string& cmd, 
+void Server::handleRegisteredCommands(int clientFd, const ArenaTokens &tokens, const std::string& cmd, 
 				const std::string& fullCommand)
 {
 	// Proste if/else zamiast mapy - bardziej niezawodne
@@ -861,6 +1263,12 @@ void Server::handleRegisteredCommands(int clientFd, const std::vector<std::strin
 	else if (cmd == "QUIT") {
 		handleQuitCommand(clientFd, fullCommand);
 	}
+	else if (cmd == "OPER") {
+		handleOperCommand(clientFd, tokens);
+	}
+	else if (cmd == "STATS") {
+		handleStatsCommand(clientFd, tokens);
+	}
 	else {
 		sendUnknownCommandError(clientFd, cmd);
 	}
@@ -872,7 +1280,7 @@ void Server::handleQuitCommand(int clientFd, const std::string &message)
 	if (!client) return;
 
 	std::string quitMessage = "Client quit";
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	
 	// Extract quit message if provided
 	if (tokens.size() >= 2) {
@@ -883,8 +1291,9 @@ void Server::handleQuitCommand(int clientFd, const std::string &message)
 	}
 
 	// Broadcast quit message to all channels the client is in
-	const std::set<std::string>& clientChannels = client->getChannels();
-	for (std::set<std::string>::const_iterator it = clientChannels.begin(); it != clientChannels.end(); ++it) {
+	settleOffloaded(client->getChannels());
+	const std::vector<ChannelHandle>& clientChannels = client->getChannels();
+	for (std::vector<ChannelHandle>::const_iterator it = clientChannels.begin(); it != clientChannels.end(); ++it) {
 		Channel *channel = _channelManager.getChannel(*it);
 		if (channel) {
 			std::string quitMsg = client->getPrefix() + " QUIT :" + quitMessage + "\r\n";
@@ -893,39 +1302,44 @@ void Server::handleQuitCommand(int clientFd, const std::string &message)
 	}
 
 	// Remove client from all channels
-	_channelManager.removeClientFromAllChannels(clientFd);
+	journalDeparture(client);
+	_channelManager.removeClientFromAllChannels(clientFd, getClientHandle(client));
+	if (client->isRegistered())
+		propagate(client->getPrefix() + " QUIT :" + quitMessage + "\r\n");
 
 	// Send error response to client (optional)
 	std::string response = "ERROR :Closing link: " + client->getNickname() + " [Quit: " + quitMessage + "]\r\n";
-	send(clientFd, response.c_str(), response.length(), 0);
+	client->sendMessage(response);
+	client->flush(*_transport);
 
 	// Close connection and remove client
-	std::cout << "Client " << client->getNickname() << " quit: " << quitMessage << std::endl;
+	LOG(LEVEL_INFO, SUB_CLIENT) << "Client " << client->getNickname() << " quit: " << quitMessage;
 	
 	// Find and remove from pfds
 	for (size_t i = 0; i < _pfds.size(); ++i) {
 		if (_pfds[i].fd == clientFd) {
-			close(clientFd);
+			_transport->close(clientFd);
+			_capture.close(clientFd);
 			_pfds.erase(_pfds.begin() + i);
 			break;
 		}
 	}
 	
 	// Remove from clients vector
-	removeClientFromVector(clientFd);
+	retireClient(client);
 }
 
-void Server::handlePingCommand(int clientFd, const std::vector<std::string>& tokens)
+void Server::handlePingCommand(int clientFd, const ArenaTokens &tokens)
 {
 	std::string token = (tokens.size() > 1) ? tokens[1] : "";
 	std::string response = "PONG :" + token + "\r\n";
-	send(clientFd, response.c_str(), response.length(), 0);
+	sendToClient(clientFd, response);
 }
 
 void Server::sendNotRegisteredError(int clientFd)
 {
 	std::string response = "451 :You have not registered\r\n";
-	send(clientFd, response.c_str(), response.length(), 0);
+	sendToClient(clientFd, response);
 }
 
 void Server::sendUnknownCommandError(int clientFd, const std::string& command)
@@ -933,6 +1347,6 @@ void Server::sendUnknownCommandError(int clientFd, const std::string& command)
 	if (!command.empty() && command[0] != ':')
 	{
 		std::string response = "421 " + command + " :Unknown command\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 	}
 }
@@ -0,0 +1,175 @@
+#include "Config.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>		// for std::strtol
+#include <sys/socket.h>	// for AF_INET, AF_INET6, AF_UNIX, SOMAXCONN
+
+ListenConfig::ListenConfig()
+	: port(0), family(AF_INET), backlog(SOMAXCONN), v6only(false), tls(false), noDelay(false), deferAccept(0),
+	  receiveBuffer(0), sendBuffer(0), mode(-1) {}
+
+// whole string as a number in base (8 for modes), at least min
+static bool parseNumber(const std::string &text, int base, long min, int &value) {
+	if (text.empty())
+		return false;
+	char *end;
+	long number = std::strtol(text.c_str(), &end, base);
+	if (*end != '\0' || number < min || number > 0x7fffffff)
+		return false;
+	value = static_cast<int>(number);
+	return true;
+}
+
+// endpoint and options of a "listen" line; anything with a '/' is a path, addresses are checked at bind time
+static bool parseListen(std::istream &in, ListenConfig &listen) {
+	if (!(in >> listen.endpoint))
+		return false;
+	const std::string &endpoint = listen.endpoint;
+	std::string::size_type colon = endpoint.rfind(':');
+	if (endpoint.find('/') != std::string::npos) {
+		listen.family = AF_UNIX;
+		listen.host = endpoint;
+	}
+	else if (colon == std::string::npos || !parseNumber(endpoint.substr(colon + 1), 10, 1, listen.port)
+		|| listen.port > 65535)
+		return false;
+	else if (endpoint[0] == '[' && colon > 1 && endpoint[colon - 1] == ']') {
+		listen.family = AF_INET6;
+		listen.host = endpoint.substr(1, colon - 2);
+	}
+	else if (endpoint.compare(0, colon, "*") == 0) {
+		listen.family = AF_INET6;
+		listen.host = "::";
+	}
+	else
+		listen.host = endpoint.substr(0, colon);
+
+	std::string option;
+	while (in >> option) {
+		std::string::size_type equals = option.find('=');
+		std::string name = option.substr(0, equals);
+		std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+		bool flag = equals == std::string::npos;
+		if (name == "backlog" && !flag) {
+			if (!parseNumber(value, 10, 1, listen.backlog))
+				return false;
+		}
+		else if (name == "defer_accept" && !flag && listen.family != AF_UNIX) {
+			if (!parseNumber(value, 10, 0, listen.deferAccept))
+				return false;
+		}
+		else if (name == "rcvbuf" && !flag) {
+			if (!parseNumber(value, 10, 0, listen.receiveBuffer))
+				return false;
+		}
+		else if (name == "sndbuf" && !flag) {
+			if (!parseNumber(value, 10, 0, listen.sendBuffer))
+				return false;
+		}
+		else if (name == "mode" && !flag && listen.family == AF_UNIX) {
+			if (!parseNumber(value, 8, 0, listen.mode) || listen.mode > 0777)
+				return false;
+		}
+		else if (name == "v6only" && flag && listen.family == AF_INET6)
+			listen.v6only = true;
+		else if (name == "nodelay" && flag && listen.family != AF_UNIX)
+			listen.noDelay = true;
+		else if (name == "tls" && flag)
+			listen.tls = true;
+		else
+			return false;
+	}
+	return true;
+}
+
+Config::Config() {}
+
+Config::~Config() {}
+
+bool Config::load(const std::string &path) {
+	std::ifstream ifs(path.c_str());
+	if (!ifs)
+		return false;
+
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(ifs, line)) {
+		++lineNumber;
+		std::string::size_type hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+
+		std::istringstream iss(line);
+		std::string key;
+		if (!(iss >> key))
+			continue;
+		if (key == "oper") {
+			std::string name, password;
+			if (iss >> name >> password)
+				this->operators[name] = password;
+			continue;
+		}
+		if (key == "link") {
+			LinkConfig link;
+			link.port = 0;
+			if (iss >> link.name >> link.password) {
+				iss >> link.host >> link.port;
+				if (!link.host.empty() && (link.port < 1 || link.port > 65535))
+					continue;
+				this->links.push_back(link);
+			}
+			continue;
+		}
+		if (key == "listen") {
+			ListenConfig listen;
+			if (parseListen(iss, listen))
+				this->listeners.push_back(listen);
+			else {
+				std::ostringstream invalid;
+				invalid << "line " << lineNumber << ": " << line.substr(0, line.find_last_not_of(" \t\r") + 1);
+				this->invalidListeners.push_back(invalid.str());
+			}
+			continue;
+		}
+		std::string value;
+		std::getline(iss >> std::ws, value);
+		value.erase(value.find_last_not_of(" \t\r") + 1);
+		this->values[key] = value;
+	}
+	return true;
+}
+
+std::string Config::get(const std::string &key, const std::string &fallback) const {
+	std::map<std::string, std::string>::const_iterator it = this->values.find(key);
+	return it == this->values.end() ? fallback : it->second;
+}
+
+long Config::getInt(const std::string &key, long fallback) const {
+	std::map<std::string, std::string>::const_iterator it = this->values.find(key);
+	if (it == this->values.end() || it->second.empty())
+		return fallback;
+	char *end;
+	long value = std::strtol(it->second.c_str(), &end, 10);
+	return *end == '\0' ? value : fallback;
+}
+
+bool Config::checkOperator(const std::string &name, const std::string &password) const {
+	std::map<std::string, std::string>::const_iterator it = this->operators.find(name);
+	return it != this->operators.end() && it->second == password;
+}
+
+size_t Config::operatorCount() const {
+	return this->operators.size();
+}
+
+const std::vector<LinkConfig> &Config::getLinks() const {
+	return this->links;
+}
+
+const std::vector<ListenConfig> &Config::getListeners() const {
+	return this->listeners;
+}
+
+const std::vector<std::string> &Config::getInvalidListeners() const {
+	return this->invalidListeners;
+}
@@ -0,0 +1,59 @@
+#include "Epoch.hpp"
+
+uint64_t		Epoch::_epoch = 1;
+Epoch::Reader	Epoch::_readers[MAX_EPOCH_READERS];
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+size_t Epoch::registerReader()
+{
+	for (size_t i = 0; i < MAX_EPOCH_READERS; ++i)
+		if (!_readers[i].used)
+		{
+			_readers[i].used = true;
+			__atomic_store_n(&_readers[i].announced, 0, __ATOMIC_RELEASE);
+			return i;
+		}
+	return MAX_EPOCH_READERS;
+}
+
+void Epoch::releaseReader(size_t reader)
+{
+	if (reader >= MAX_EPOCH_READERS)
+		return;
+	__atomic_store_n(&_readers[reader].announced, 0, __ATOMIC_RELEASE);
+	_readers[reader].used = false;
+}
+
+/*
+	The fence pairs with the one in enter(): either the reader's announcement
+	is seen here, or the reader sees every unlink done before this call and
+	cannot reach the objects retired so far.
+*/
+uint64_t Epoch::collect()
+{
+	uint64_t oldest = __atomic_add_fetch(&_epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (size_t i = 0; i < MAX_EPOCH_READERS; ++i)
+	{
+		uint64_t announced = __atomic_load_n(&_readers[i].announced, __ATOMIC_ACQUIRE);
+		if (announced != 0 && announced < oldest)
+			oldest = announced;
+	}
+	return oldest;
+}
+
+void Epoch::enter(size_t reader)
+{
+	__atomic_store_n(&_readers[reader].announced, now(), __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void Epoch::exit(size_t reader)
+{
+	__atomic_store_n(&_readers[reader].announced, 0, __ATOMIC_RELEASE);
+}
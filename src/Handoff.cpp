@@ -0,0 +1,270 @@
+#include "Handoff.hpp"
+#include <cstring>		// for std::memcpy, std::memset
+#include <cstdlib>		// for std::getenv, std::atoi
+#include <cerrno>		// for errno
+#include <sstream>		// for std::ostringstream
+#include <unistd.h>		// for fork, execve, close, read, write, readlink
+#include <fcntl.h>		// for fcntl, FD_CLOEXEC
+#include <poll.h>		// for poll
+#include <sys/socket.h>	// for socketpair, sendmsg, recvmsg, SCM_RIGHTS
+#include <sys/resource.h>	// for getrlimit
+
+extern char **environ;
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(fd, data, length);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t n = read(fd, data, length);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+bool HandoffReader::take(size_t length)
+{
+	if (!_ok || _in.size() - _offset < length)
+		_ok = false;
+	return _ok;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+/*
+	Everything the child needs is built before fork(): the old process runs
+	logging and watchdog threads, so between fork() and execve() only
+	async-signal-safe calls are allowed. The child keeps stdin/stdout/stderr
+	(the operator console carries over) and the channel, nothing else.
+*/
+pid_t Handoff::spawn(const std::string &binary, const std::vector<std::string> &args, int &channel)
+{
+	int ends[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) == -1)
+		return -1;
+	fcntl(ends[0], F_SETFD, FD_CLOEXEC);
+
+	std::ostringstream assignment;
+	assignment << HANDOFF_ENV "=" << ends[1];
+	std::string variable = assignment.str();
+	std::vector<char *> env;
+	for (char **e = environ; *e; ++e)
+		if (std::strncmp(*e, HANDOFF_ENV "=", sizeof(HANDOFF_ENV)) != 0)
+			env.push_back(*e);
+	env.push_back(const_cast<char *>(variable.c_str()));
+	env.push_back(NULL);
+	std::vector<char *> argv;
+	argv.push_back(const_cast<char *>(binary.c_str()));
+	for (size_t i = 0; i < args.size(); ++i)
+		argv.push_back(const_cast<char *>(args[i].c_str()));
+	argv.push_back(NULL);
+	struct rlimit limit;
+	int maxFd = (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+		? static_cast<int>(limit.rlim_cur) : 65536;
+
+	pid_t child = fork();
+	if (child == -1)
+	{
+		::close(ends[0]);
+		::close(ends[1]);
+		return -1;
+	}
+	if (child == 0)
+	{
+		for (int fd = 3; fd < maxFd; ++fd)
+			if (fd != ends[1])
+				::close(fd);
+		execve(binary.c_str(), &argv[0], &env[0]);
+		_exit(127);
+	}
+	::close(ends[1]);
+	channel = ends[0];
+	return child;
+}
+
+// the variable is removed so a later upgrade of this process starts clean
+int Handoff::inherited()
+{
+	const char *value = std::getenv(HANDOFF_ENV);
+	if (!value)
+		return -1;
+	int channel = std::atoi(value);
+	unsetenv(HANDOFF_ENV);
+	if (channel <= STDERR_FILENO || fcntl(channel, F_GETFD) == -1)
+		return -1;
+	fcntl(channel, F_SETFD, FD_CLOEXEC);
+	return channel;
+}
+
+bool Handoff::send(int channel, const std::string &state, const std::vector<int> &fds)
+{
+	uint32_t header[2];
+	header[0] = static_cast<uint32_t>(state.size());
+	header[1] = static_cast<uint32_t>(fds.size());
+	if (!writeAll(channel, reinterpret_cast<const char *>(header), sizeof(header))
+		|| !writeAll(channel, state.data(), state.size()))
+		return false;
+
+	// one data byte per message keeps every batch attached to its own byte on the stream
+	union {
+		char			buf[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE)];
+		struct cmsghdr	align;									// CMSG_FIRSTHDR needs cmsghdr alignment
+	} control;
+	for (size_t sent = 0; sent < fds.size(); )
+	{
+		size_t batch = fds.size() - sent < MAX_FDS_PER_MESSAGE ? fds.size() - sent : MAX_FDS_PER_MESSAGE;
+		char byte = 'F';
+		struct iovec iov;
+		iov.iov_base = &byte;
+		iov.iov_len = 1;
+		struct msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		std::memset(control.buf, 0, sizeof(control.buf));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control.buf;
+		message.msg_controllen = CMSG_SPACE(sizeof(int) * batch);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * batch);
+		std::memcpy(CMSG_DATA(cmsg), &fds[sent], sizeof(int) * batch);
+		ssize_t n = sendmsg(channel, &message, 0);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n != 1)
+			return false;
+		sent += batch;
+	}
+	return true;
+}
+
+bool Handoff::receive(int channel, std::string &state, std::vector<int> &fds)
+{
+	uint32_t header[2];
+	if (!readAll(channel, reinterpret_cast<char *>(header), sizeof(header)))
+		return false;
+	state.resize(header[0]);
+	if (header[0] > 0 && !readAll(channel, &state[0], header[0]))
+		return false;
+
+	union {
+		char			buf[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE)];
+		struct cmsghdr	align;
+	} control;
+	while (fds.size() < header[1])
+	{
+		char byte;
+		struct iovec iov;
+		iov.iov_base = &byte;
+		iov.iov_len = 1;
+		struct msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control.buf;
+		message.msg_controllen = sizeof(control.buf);
+		ssize_t n = recvmsg(channel, &message, MSG_CMSG_CLOEXEC);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n != 1 || (message.msg_flags & MSG_CTRUNC))
+			return false;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int *received = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+			fds.insert(fds.end(), received, received + count);
+		}
+	}
+	return true;
+}
+
+bool Handoff::acknowledge(int channel)
+{
+	char byte = 'R';
+	return writeAll(channel, &byte, 1);
+}
+
+bool Handoff::waitAcknowledged(int channel, int timeoutMs)
+{
+	struct pollfd pfd;
+	pfd.fd = channel;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeoutMs) != 1)
+		return false;
+	char byte;
+	return read(channel, &byte, 1) == 1 && byte == 'R';
+}
+
+// a deploy replaces the file under the running process, /proc then reports "<path> (deleted)"
+std::string Handoff::currentBinary()
+{
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (length <= 0)
+		return "";
+	std::string binary(path, length);
+	const std::string deleted = " (deleted)";
+	if (binary.size() > deleted.size() && binary.compare(binary.size() - deleted.size(), deleted.size(), deleted) == 0)
+		binary.erase(binary.size() - deleted.size());
+	return binary;
+}
+
+uint8_t HandoffReader::u8()
+{
+	if (!take(1))
+		return 0;
+	return static_cast<uint8_t>(_in[_offset++]);
+}
+
+uint32_t HandoffReader::u32()
+{
+	uint32_t value = 0;
+	if (!take(sizeof(value)))
+		return 0;
+	std::memcpy(&value, _in.data() + _offset, sizeof(value));
+	_offset += sizeof(value);
+	return value;
+}
+
+std::string HandoffReader::str()
+{
+	uint32_t length = u32();
+	if (!take(length))
+		return "";
+	std::string value(_in, _offset, length);
+	_offset += length;
+	return value;
+}
@@ -0,0 +1,190 @@
+#include "InternTable.hpp"
+#include <cstring>		// for std::memcmp
+
+const InternId InternTable::NONE;
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// FNV-1a, good enough for short identifiers
+uint32_t InternTable::hashOf(const char *data, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i)
+	{
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// linear probing: returns the slot that holds the string or the empty slot where it would go
+size_t InternTable::probe(const char *data, size_t length, uint32_t hash) const
+{
+	size_t mask = _slots.size() - 1;
+	size_t slot = hash & mask;
+	while (_slots[slot] != NONE)
+	{
+		const Entry &entry = _entries[_slots[slot]];
+		if (entry.hash == hash && entry.text.size() == length
+				&& std::memcmp(entry.text.data(), data, length) == 0)
+			return slot;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+void InternTable::rehash(size_t capacity)
+{
+	std::vector<InternId> old;
+	old.swap(_slots);
+	_slots.assign(capacity, NONE);
+	size_t mask = capacity - 1;
+	for (size_t i = 0; i < old.size(); ++i)
+	{
+		if (old[i] == NONE)
+			continue;
+		size_t slot = _entries[old[i]].hash & mask;
+		while (_slots[slot] != NONE)
+			slot = (slot + 1) & mask;
+		_slots[slot] = old[i];
+	}
+}
+
+// backward-shift deletion keeps probe chains intact without tombstones
+void InternTable::eraseSlot(size_t slot)
+{
+	size_t mask = _slots.size() - 1;
+	size_t hole = slot;
+	size_t next = (slot + 1) & mask;
+	while (_slots[next] != NONE)
+	{
+		size_t home = _entries[_slots[next]].hash & mask;
+		// move the entry back if its home position is not between the hole and its current slot
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			_slots[hole] = _slots[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+	_slots[hole] = NONE;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor (id 0 is the empty string and is never freed)
+InternTable::InternTable() : _slots(16, NONE), _count(0)
+{
+	Entry none;
+	none.hash = 0;
+	none.refs = 1;
+	_entries.push_back(none);
+}
+
+// destructor
+InternTable::~InternTable() {}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+InternId InternTable::find(const std::string &text) const
+{
+	return find(text.data(), text.size());
+}
+
+InternId InternTable::find(const char *data, size_t length) const
+{
+	if (length == 0)
+		return NONE;
+	return _slots[probe(data, length, hashOf(data, length))];
+}
+
+InternId InternTable::acquire(const std::string &text)
+{
+	if (text.empty())
+		return NONE;
+	uint32_t hash = hashOf(text.data(), text.size());
+	size_t slot = probe(text.data(), text.size(), hash);
+	if (_slots[slot] != NONE)
+	{
+		++_entries[_slots[slot]].refs;
+		return _slots[slot];
+	}
+
+	InternId id;
+	if (!_freeIds.empty())
+	{
+		id = _freeIds.back();
+		_freeIds.pop_back();
+	}
+	else
+	{
+		id = static_cast<InternId>(_entries.size());
+		_entries.push_back(Entry());
+	}
+	Entry &entry = _entries[id];
+	entry.text = text;
+	entry.hash = hash;
+	entry.refs = 1;
+	_slots[slot] = id;
+	++_count;
+
+	// keep the load factor under 1/2
+	if (_count * 2 > _slots.size())
+		rehash(_slots.size() * 2);
+	return id;
+}
+
+void InternTable::retain(InternId id)
+{
+	if (id != NONE)
+		++_entries[id].refs;
+}
+
+void InternTable::release(InternId id)
+{
+	if (id == NONE || id >= _entries.size() || _entries[id].refs == 0)
+		return;
+	Entry &entry = _entries[id];
+	if (--entry.refs > 0)
+		return;
+	eraseSlot(probe(entry.text.data(), entry.text.size(), entry.hash));
+	std::string().swap(entry.text);
+	_freeIds.push_back(id);
+	--_count;
+}
+
+const std::string &InternTable::str(InternId id) const
+{
+	if (id >= _entries.size())
+		return _entries[NONE].text;
+	return _entries[id].text;
+}
+
+size_t InternTable::size() const
+{
+	return _count;
+}
+
+size_t InternTable::bytes() const
+{
+	size_t total = _entries.size() * sizeof(Entry) + _slots.capacity() * sizeof(InternId)
+		+ _freeIds.capacity() * sizeof(InternId);
+	for (size_t i = 0; i < _entries.size(); ++i)
+		if (_entries[i].text.capacity() > 15)
+			total += _entries[i].text.capacity() + 1;
+	return total;
+}
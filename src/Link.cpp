@@ -0,0 +1,827 @@
+#include "Server.hpp"
+#include "Channel.hpp"
+#include "Metrics.hpp"
+#include "Log.hpp"
+#include <sstream>		// for std::ostringstream
+#include <cstdlib>		// for std::atoi, std::strtol
+
+static const long		LINK_RETRY_SECONDS = 5;					// default link_retry_seconds
+static const size_t		LINK_SENDQ_LIMIT = 16 << 20;			// queued bytes after which a stalled link is dropped
+static const char		SPLIT_REASON[] = "*.net *.split";		// QUIT text of users lost with a link
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ":source COMMAND a b :trailing text" -> source, [COMMAND, a, b, trailing text]
+static void parseLinkLine(const std::string &line, std::string &source, ArenaTokens &params)
+{
+	size_t pos = 0;
+	if (!line.empty() && line[0] == ':')
+	{
+		pos = line.find(' ');
+		if (pos == std::string::npos)
+			return;
+		source.assign(line, 1, pos - 1);
+	}
+	while (pos < line.size())
+	{
+		if (line[pos] == ' ')
+		{
+			++pos;
+			continue;
+		}
+		if (line[pos] == ':' && !params.empty())
+		{
+			params.push_back(std::string());
+			params.back().assign(line, pos + 1, std::string::npos);
+			return;
+		}
+		size_t end = line.find(' ', pos);
+		if (end == std::string::npos)
+			end = line.size();
+		params.push_back(std::string());
+		params.back().assign(line, pos, end - pos);
+		pos = end;
+	}
+}
+
+// "nick!user@host" -> "nick"
+static std::string nicknameOf(const std::string &source)
+{
+	return source.substr(0, source.find('!'));
+}
+
+static bool isChannelName(const std::string &name)
+{
+	return !name.empty() && (name[0] == '#' || name[0] == '&');
+}
+
+// ====================================================================
+// link management:
+// ====================================================================
+
+// server_name <name>, link <server> <password> [<host> <port>], link_retry_seconds <n>
+void Server::setupLinks()
+{
+	_network.configure(_config.get("server_name", "ft_irc"), _config.getLinks(),
+		_config.getInt("link_retry_seconds", LINK_RETRY_SECONDS));
+	if (!_network.enabled())
+		return;
+	LOG(LEVEL_INFO, SUB_SERVER) << "Server name " << _network.name() << ", " << _network.blocks().size() << " link blocks";
+	maintainLinks();
+}
+
+// dial configured peers that are down, give up on handshakes and links that stopped moving
+void Server::maintainLinks()
+{
+	if (!_network.enabled())
+		return;
+	uint64_t now = Metrics::nowMicros();
+	std::vector<Client *> stalled;
+	std::vector<LinkBlock> &blocks = _network.blocks();
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		LinkBlock &block = blocks[i];
+		if (block.fd == -1)
+		{
+			if (!block.config.host.empty() && now >= block.nextAttempt)
+				dialLink(block);
+			continue;
+		}
+		Client *link = findClientByFd(block.fd);
+		if (!link)
+			continue;
+		if (!_network.isEstablished(block.fd) && now >= block.nextAttempt)
+			stalled.push_back(link);
+		else if (link->getQueuedBytes() > LINK_SENDQ_LIMIT)
+			stalled.push_back(link);
+	}
+	for (size_t i = 0; i < stalled.size(); ++i)
+		dropLink(stalled[i], _network.isEstablished(stalled[i]->getFd()) ? "SendQ exceeded" : "Handshake timeout");
+}
+
+// the SERVER line waits in the send buffer until the connection completes (POLLOUT)
+void Server::dialLink(LinkBlock &block)
+{
+	int fd = _transport->dial(block.config.host, block.config.port);
+	_network.dialled(block, fd, Metrics::nowMicros());
+	if (fd == -1)
+	{
+		LOG(LEVEL_WARN, SUB_NET) << "Link " << block.config.name << ": cannot connect to "
+			<< block.config.host << ":" << block.config.port;
+		return;
+	}
+	Client *link = _clientManager.createClient(fd, block.config.host);
+	link->setLink(true);
+	addClient(link, fd);
+	sendToLink(fd, "SERVER " + _network.name() + " " + block.config.password + "\r\n");
+	waitWritable(fd);
+	LOG(LEVEL_INFO, SUB_NET) << "Connecting to " << block.config.name << " at " << block.config.host << ":"
+		<< block.config.port << " (fd=" << fd << ")";
+}
+
+// SERVER as the first line of an accepted connection: it is a server, not a user
+void Server::handleServerCommand(Client *client, const std::string &line)
+{
+	std::string source;
+	ArenaTokens params((ArenaAllocator<std::string>(_arena)));
+	parseLinkLine(line, source, params);
+	if (params.size() < 3)
+	{
+		dropLink(client, "SERVER needs a name and a password");
+		return;
+	}
+	acceptServer(client, params[1], params[2]);
+}
+
+/*
+	Both ends check the other's SERVER line against their link block. The
+	accepting end answers with its own; each end sends its burst once it
+	has accepted the peer. If both ends dialled at the same time, the
+	connection dialled by the server with the smaller name is kept.
+*/
+void Server::acceptServer(Client *link, const std::string &peer, const std::string &password)
+{
+	int fd = link->getFd();
+	bool incoming = !link->isLink();
+	LinkBlock *block = _network.findBlock(peer);
+	if (!block || block->config.password != password || (!incoming && _network.blockOf(fd) != block))
+	{
+		LOG(LEVEL_WARN, SUB_NET) << "Refused link from " << peer << " (fd=" << fd << "): no matching link block";
+		dropLink(link, "No link block for " + peer);
+		return;
+	}
+	if (block->fd != -1 && block->fd != fd)
+	{
+		Client *dialling = findClientByFd(block->fd);
+		if (!incoming || !dialling || _network.isEstablished(block->fd) || peer > _network.name())
+		{
+			dropLink(link, "Server " + peer + " is already linked");
+			return;
+		}
+		dropLink(dialling, "Simultaneous connect");
+	}
+	if (_network.knowsServer(peer))
+	{
+		dropLink(link, "Server " + peer + " is already known");
+		return;
+	}
+
+	if (incoming)
+	{
+		link->setLink(true);
+		sendToLink(fd, "SERVER " + _network.name() + " " + block->config.password + "\r\n");
+	}
+	block->fd = fd;
+	_network.established(fd, peer);
+	propagate(":" + _network.name() + " SERVER " + peer + " 1\r\n", fd);
+	sendBurst(fd);
+	LOG(LEVEL_INFO, SUB_NET) << "Linked with " << peer << " (fd=" << fd << ", " << (incoming ? "accepted" : "dialled") << ")";
+}
+
+/*
+	Everything on this side of the link: servers, users, then every channel
+	that has members here with its state, members and operators.
+*/
+void Server::sendBurst(int linkFd)
+{
+	const std::string &me = _network.name();
+	const std::map<std::string, RemoteServer> &servers = _network.servers();
+	for (std::map<std::string, RemoteServer>::const_iterator it = servers.begin(); it != servers.end(); ++it)
+	{
+		if (it->second.link == linkFd)
+			continue;
+		std::ostringstream line;
+		line << ":" << me << " SERVER " << it->first << " " << it->second.hops << "\r\n";
+		sendToLink(linkFd, line.str());
+	}
+
+	const std::vector<Client*> &clients = _clientManager.getClients();
+	for (size_t i = 0; i < clients.size(); ++i)
+		if (clients[i] && !clients[i]->isLink() && clients[i]->isRegistered())
+			sendToLink(linkFd, introduction(clients[i]->getNickname(), 0, clients[i]->getUsername(),
+				clients[i]->getHostname(), me, clients[i]->getRealname()));
+	const std::map<std::string, RemoteUser *> &users = _network.users();
+	for (std::map<std::string, RemoteUser *>::const_iterator it = users.begin(); it != users.end(); ++it)
+	{
+		const RemoteUser *user = it->second;
+		if (user->link != linkFd)
+			sendToLink(linkFd, introduction(user->nickname, user->hops, user->username, user->hostname,
+				user->server, user->realname));
+	}
+
+	std::vector<std::string> names = _channelManager.getChannelNames();
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		Channel *channel = _channelManager.getChannel(names[i]);
+		const std::map<RemoteUser *, bool> &remote = channel->getRemoteMembers();
+		std::map<int, size_t>::const_iterator behind = channel->getLinkMembers().find(linkFd);
+		size_t peerMembers = behind == channel->getLinkMembers().end() ? 0 : behind->second;
+		if (!channel->hasLocalMembers() && remote.size() == peerMembers)
+			continue;
+
+		std::string operators;
+		sendToLink(linkFd, channelState(channel));
+		const std::map<int, Client *> &members = channel->getMembers();
+		for (std::map<int, Client *>::const_iterator it = members.begin(); it != members.end(); ++it)
+		{
+			sendToLink(linkFd, it->second->getPrefix() + " JOIN " + names[i] + "\r\n");
+			if (channel->isOperator(it->first))
+				operators += ":" + me + " MODE " + names[i] + " +o " + it->second->getNickname() + "\r\n";
+		}
+		for (std::map<RemoteUser *, bool>::const_iterator it = remote.begin(); it != remote.end(); ++it)
+		{
+			if (it->first->link == linkFd)
+				continue;
+			sendToLink(linkFd, it->first->prefix + " JOIN " + names[i] + "\r\n");
+			if (it->second)
+				operators += ":" + me + " MODE " + names[i] + " +o " + it->first->nickname + "\r\n";
+		}
+		if (!operators.empty())
+			sendToLink(linkFd, operators);
+	}
+}
+
+void Server::dropLink(Client *link, const std::string &reason)
+{
+	runShards(false);
+	link->sendMessage("ERROR :Closing link: " + reason + "\r\n");
+	link->flush(*_transport);
+	splitLink(link->getFd(), reason);
+	closeConnection(link);
+}
+
+// users behind the link quit for local members; the other links hear SQUIT for every server behind it
+void Server::splitLink(int linkFd, const std::string &reason)
+{
+	if (_network.isEstablished(linkFd))
+	{
+		LOG(LEVEL_WARN, SUB_NET) << "Link with " << _network.peerOf(linkFd) << " lost: " << reason;
+		std::vector<std::string> servers = _network.serversBehind(linkFd);
+		for (size_t i = 0; i < servers.size(); ++i)
+		{
+			std::vector<RemoteUser *> users = _network.usersOn(servers[i]);
+			for (size_t j = 0; j < users.size(); ++j)
+				quitRemoteUser(users[j], users[j]->prefix + " QUIT :" + SPLIT_REASON + "\r\n");
+			_network.removeServer(servers[i]);
+			propagate(":" + _network.name() + " SQUIT " + servers[i] + " :" + reason + "\r\n", linkFd);
+		}
+		// users of servers never introduced on this link
+		std::vector<RemoteUser *> strays;
+		for (std::map<std::string, RemoteUser *>::const_iterator it = _network.users().begin(); it != _network.users().end(); ++it)
+			if (it->second->link == linkFd)
+				strays.push_back(it->second);
+		for (size_t i = 0; i < strays.size(); ++i)
+		{
+			std::string quitLine = strays[i]->prefix + " QUIT :" + SPLIT_REASON + "\r\n";
+			quitRemoteUser(strays[i], quitLine);
+			propagate(quitLine, linkFd);
+		}
+	}
+	_network.lost(linkFd, Metrics::nowMicros());
+}
+
+// like a disconnect detected by recv(): the pollfd goes at the end of the tick, the client with it
+void Server::closeConnection(Client *client)
+{
+	int fd = client->getFd();
+	_transport->close(fd);
+	_capture.close(fd);
+	for (size_t i = 0; i < _pfds.size(); ++i)
+		if (_pfds[i].fd == fd)
+			_pfds[i].fd = -1;
+	retireClient(client);
+}
+
+// a local user lost a nickname collision
+void Server::disconnectClient(Client *client, const std::string &reason)
+{
+	settleOffloaded(client->getChannels());
+	std::string quitLine = client->getPrefix() + " QUIT :" + reason + "\r\n";
+	const std::vector<ChannelHandle> &channels = client->getChannels();
+	for (size_t i = 0; i < channels.size(); ++i)
+	{
+		Channel *channel = _channelManager.getChannel(channels[i]);
+		if (channel)
+			channel->broadcast(quitLine, client);
+	}
+	journalDeparture(client);
+	_channelManager.removeClientFromAllChannels(client->getFd(), getClientHandle(client));
+	if (client->isRegistered())
+		propagate(quitLine);
+
+	client->sendMessage("ERROR :Closing link: " + client->getNickname() + " [" + reason + "]\r\n");
+	client->flush(*_transport);
+	LOG(LEVEL_WARN, SUB_CLIENT) << "Client " << client->getNickname() << " disconnected: " << reason;
+	closeConnection(client);
+}
+
+// ====================================================================
+// sending:
+// ====================================================================
+
+void Server::propagate(const std::string &line, int exceptLink)
+{
+	const std::map<int, std::string> &links = _network.links();
+	for (std::map<int, std::string>::const_iterator it = links.begin(); it != links.end(); ++it)
+		if (it->first != exceptLink)
+			sendToLink(it->first, line);
+}
+
+// channel messages only cross links that have members of the channel behind them
+void Server::propagateToChannel(const Channel *channel, const char *data, size_t length, int exceptLink)
+{
+	const std::map<int, size_t> &links = channel->getLinkMembers();
+	for (std::map<int, size_t>::const_iterator it = links.begin(); it != links.end(); ++it)
+	{
+		if (it->first == exceptLink)
+			continue;
+		Client *link = findClientByFd(it->first);
+		if (link)
+		{
+			link->sendMessage(data, length);
+			Metrics::add(C_LINK_LINES_OUT);
+		}
+	}
+}
+
+void Server::sendToLink(int linkFd, const std::string &line)
+{
+	Client *link = findClientByFd(linkFd);
+	if (!link)
+		return;
+	link->sendMessage(line);
+	Metrics::add(C_LINK_LINES_OUT);
+}
+
+// a new channel carries its state first, so every server has the same creation time
+void Server::announceJoin(Client *client, Channel *channel)
+{
+	if (_network.links().empty())
+		return;
+	if (channel->getMemberCount() == 1)
+		propagate(channelState(channel));
+	propagate(client->getPrefix() + " JOIN " + channel->getName() + "\r\n");
+	if (channel->isOperator(client->getFd()))
+		propagate(":" + _network.name() + " MODE " + channel->getName() + " +o " + client->getNickname() + "\r\n");
+}
+
+std::string Server::introduction(const std::string &nickname, int hops, const std::string &username,
+	const std::string &hostname, const std::string &server, const std::string &realname) const
+{
+	std::ostringstream line;
+	line << "NICK " << nickname << " " << hops << " " << username << " " << hostname << " " << server
+		<< " :" << realname << "\r\n";
+	return line.str();
+}
+
+std::string Server::channelState(const Channel *channel) const
+{
+	std::ostringstream line;
+	line << ":" << _network.name() << " CHANNEL " << channel->getName() << " " << channel->getCreated() << " +"
+		<< (channel->hasMode('i') ? "i" : "") << (channel->hasMode('t') ? "t" : "") << " "
+		<< (channel->getKey().empty() ? "*" : channel->getKey()) << " " << channel->getUserLimit()
+		<< " :" << channel->getTopic() << "\r\n";
+	return line.str();
+}
+
+// ====================================================================
+// receiving:
+// ====================================================================
+
+RemoteUser *Server::linkSource(int linkFd, const std::string &source)
+{
+	RemoteUser *user = _network.findUser(nicknameOf(source));
+	return user && user->link == linkFd ? user : NULL;
+}
+
+/*
+	Lines from another server. Except the handshake and user introductions
+	every line has a source, which must be a server or a user reached
+	through this link; anything else is a stale line crossing a change
+	(a user that was just killed or renamed here) and is dropped.
+*/
+void Server::handleLinkLine(Client *link, const std::string &line)
+{
+	Metrics::add(C_LINK_LINES_IN);
+	int fd = link->getFd();
+	std::string source;
+	ArenaTokens params((ArenaAllocator<std::string>(_arena)));
+	parseLinkLine(line, source, params);
+	if (params.empty())
+		return;
+	const std::string &command = params[0];
+
+	if (command == "ERROR")
+	{
+		LOG(LEVEL_WARN, SUB_NET) << "Link fd=" << fd << " closed by the peer: " << (params.size() > 1 ? params[1] : "");
+		splitLink(fd, "Closed by the peer");
+		closeConnection(link);
+		return;
+	}
+	if (!_network.isEstablished(fd))
+	{
+		if (command == "SERVER" && params.size() >= 3)
+			acceptServer(link, params[1], params[2]);
+		return;
+	}
+	if (source.empty())
+	{
+		if (command == "NICK")
+			linkNick(fd, line, source, params);
+		return;
+	}
+
+	RemoteUser *user = NULL;
+	if (source.find('!') != std::string::npos)
+		user = linkSource(fd, source);
+	else
+	{
+		std::map<std::string, RemoteServer>::const_iterator server = _network.servers().find(source);
+		if (server == _network.servers().end() || server->second.link != fd)
+			return;
+	}
+	if (source.find('!') != std::string::npos && !user)
+	{
+		LOG(LEVEL_DEBUG, SUB_NET) << "Dropped link line from unknown " << source << ": " << command;
+		return;
+	}
+
+	if (command == "PRIVMSG" || command == "NOTICE")
+		linkMessage(fd, line, params);
+	else if (command == "JOIN" && user)
+		linkJoin(fd, line, user, params);
+	else if (command == "PART" && user)
+		linkPart(fd, line, user, params);
+	else if (command == "QUIT" && user)
+		linkQuit(fd, line, user);
+	else if (command == "NICK" && user)
+		linkNick(fd, line, source, params);
+	else if (command == "MODE")
+		linkMode(fd, line, user, params);
+	else if (command == "TOPIC")
+		linkTopic(fd, line, params);
+	else if (command == "KICK")
+		linkKick(fd, line, params);
+	else if (command == "CHANNEL")
+		linkChannel(fd, line, source, params);
+	else if (command == "SERVER")
+		linkServer(fd, line, params);
+	else if (command == "SQUIT")
+		linkSquit(fd, line, params);
+	else
+		LOG(LEVEL_DEBUG, SUB_NET) << "Unknown link command " << command << " from " << _network.peerOf(fd);
+}
+
+// a server that is known already would close a loop: the link that brought it goes
+void Server::linkServer(int linkFd, const std::string &, const ArenaTokens &params)
+{
+	if (params.size() < 3)
+		return;
+	const std::string &name = params[1];
+	if (_network.knowsServer(name))
+	{
+		dropLink(findClientByFd(linkFd), "Server " + name + " is already known (loop)");
+		return;
+	}
+	int hops = std::atoi(params[2].c_str()) + 1;
+	_network.addServer(name, linkFd, hops);
+	std::ostringstream relay;
+	relay << ":" << _network.name() << " SERVER " << name << " " << hops << "\r\n";
+	propagate(relay.str(), linkFd);
+}
+
+void Server::linkSquit(int linkFd, const std::string &, const ArenaTokens &params)
+{
+	if (params.size() < 2)
+		return;
+	const std::string &name = params[1];
+	std::map<std::string, RemoteServer>::const_iterator server = _network.servers().find(name);
+	if (server == _network.servers().end() || server->second.link != linkFd)
+		return;
+	std::vector<RemoteUser *> users = _network.usersOn(name);
+	for (size_t i = 0; i < users.size(); ++i)
+		quitRemoteUser(users[i], users[i]->prefix + " QUIT :" + SPLIT_REASON + "\r\n");
+	_network.removeServer(name);
+	propagate(":" + _network.name() + " SQUIT " + name + " :" + (params.size() > 2 ? params[2] : SPLIT_REASON) + "\r\n",
+		linkFd);
+}
+
+// NICK <nick> <hops> <user> <host> <server> :<realname> introduces, :<old> NICK <new> renames
+void Server::linkNick(int linkFd, const std::string &line, const std::string &source, const ArenaTokens &params)
+{
+	if (source.empty())
+	{
+		if (params.size() < 7)
+			return;
+		RemoteUser user;
+		user.nickname = params[1];
+		user.hops = std::atoi(params[2].c_str()) + 1;
+		user.username = params[3];
+		user.hostname = params[4];
+		user.server = params[5];
+		user.realname = params[6];
+		user.link = linkFd;
+		if (!resolveCollision(user.nickname, user.server))
+			return;
+		_network.addUser(user);
+		propagate(introduction(user.nickname, user.hops, user.username, user.hostname, user.server, user.realname), linkFd);
+		return;
+	}
+
+	RemoteUser *user = linkSource(linkFd, source);
+	if (!user || params.size() < 2 || params[1] == user->nickname)
+		return;
+	const std::string newNick = params[1];
+	if (!resolveCollision(newNick, user->server))
+	{
+		// the rename loses: the user is gone here and for the servers that never see the rename
+		std::string quitLine = user->prefix + " QUIT :Nick collision\r\n";
+		quitRemoteUser(user, quitLine);
+		propagate(quitLine, linkFd);
+		return;
+	}
+	_network.renameUser(user, newNick);
+	propagate(line + "\r\n", linkFd);
+}
+
+/*
+	Nickname collision: the user on the server with the smaller name keeps
+	the nickname. A local loser is disconnected (its QUIT tells the other
+	servers), a remote loser is dropped here and killed by its own server
+	when the winner reaches it.
+*/
+bool Server::resolveCollision(const std::string &nickname, const std::string &server)
+{
+	Client *local = findClientByNickname(nickname);
+	if (local && !local->isLink())
+	{
+		if (_network.name() < server)
+			return false;
+		disconnectClient(local, "Nick collision with " + server);
+		return true;
+	}
+	RemoteUser *existing = _network.findUser(nickname);
+	if (!existing)
+		return true;
+	if (existing->server < server)
+		return false;
+	quitRemoteUser(existing, existing->prefix + " QUIT :Nick collision\r\n");
+	return true;
+}
+
+/*
+	:<server> CHANNEL <#chan> <created> <+modes> <key|*> <limit> :<topic>
+	The older channel's state replaces ours, ours stays if it is older
+	(the peer adopts it from our burst), the same age merges both.
+*/
+void Server::linkChannel(int linkFd, const std::string &line, const std::string &, const ArenaTokens &params)
+{
+	if (params.size() < 7 || !isChannelName(params[1]))
+		return;
+	time_t created = static_cast<time_t>(std::strtol(params[2].c_str(), NULL, 10));
+	Channel *channel = _channelManager.getChannel(params[1]);
+	bool merge = false;
+	if (!channel)
+		channel = getOrCreateChannel(params[1]);
+	else if (created > channel->getCreated())
+		return;
+	else if (created == channel->getCreated())
+		merge = true;
+
+	const std::string &name = channel->getName();
+	const std::string &modes = params[3];
+	const char flags[] = { 'i', 't' };
+	for (size_t i = 0; i < sizeof(flags); ++i)
+	{
+		bool set = modes.find(flags[i]) != std::string::npos || (merge && channel->hasMode(flags[i]));
+		if (set == channel->hasMode(flags[i]))
+			continue;
+		if (set)
+			channel->setMode(flags[i]);
+		else
+			channel->unsetMode(flags[i]);
+		_channelStore.append(set ? STATE_MODE_SET : STATE_MODE_UNSET, name, std::string(1, flags[i]));
+	}
+	std::string key = params[4] == "*" ? "" : params[4];
+	int limit = std::atoi(params[5].c_str());
+	std::string topic = params[6];
+	if (merge)
+	{
+		key = std::max(key, channel->getKey());
+		limit = std::max(limit, static_cast<int>(channel->getUserLimit()));
+		topic = std::max(topic, channel->getTopic());
+	}
+	if (key != channel->getKey())
+	{
+		channel->setKey(key);
+		_channelStore.append(STATE_KEY, name, key);
+	}
+	if (limit != static_cast<int>(channel->getUserLimit()))
+	{
+		channel->setUserLimit(limit);
+		std::ostringstream saved;
+		saved << limit;
+		_channelStore.append(STATE_LIMIT, name, saved.str());
+	}
+	if (topic != channel->getTopic())
+	{
+		channel->setTopic(topic);
+		_channelStore.append(STATE_TOPIC, name, topic);
+	}
+	channel->setCreated(created);
+	propagate(line + "\r\n", linkFd);
+}
+
+void Server::linkJoin(int linkFd, const std::string &line, RemoteUser *user, const ArenaTokens &params)
+{
+	if (params.size() < 2 || !isChannelName(params[1]))
+		return;
+	Channel *channel = getOrCreateChannel(params[1]);
+	if (channel->hasRemoteMember(user))
+		return;
+	settleOffloaded(channel->getHandle());
+	channel->addRemoteMember(user);
+	std::string relay = line + "\r\n";
+	channel->broadcast(relay);
+	propagate(relay, linkFd);
+}
+
+void Server::linkPart(int linkFd, const std::string &line, RemoteUser *user, const ArenaTokens &params)
+{
+	Channel *channel = params.size() < 2 ? NULL : _channelManager.getChannel(params[1]);
+	if (!channel || !channel->hasRemoteMember(user))
+		return;
+	settleOffloaded(channel->getHandle());
+	std::string relay = line + "\r\n";
+	channel->broadcast(relay);
+	channel->removeRemoteMember(user);
+	removeIfEmpty(channel);
+	propagate(relay, linkFd);
+}
+
+void Server::linkQuit(int linkFd, const std::string &line, RemoteUser *user)
+{
+	std::string relay = line + "\r\n";
+	quitRemoteUser(user, relay);
+	propagate(relay, linkFd);
+}
+
+// :<kicker> KICK <#chan> <nick> :<reason>, the nick may be local or remote
+void Server::linkKick(int linkFd, const std::string &line, const ArenaTokens &params)
+{
+	Channel *channel = params.size() < 3 ? NULL : _channelManager.getChannel(params[1]);
+	if (!channel)
+		return;
+	settleOffloaded(channel->getHandle());
+	std::string relay = line + "\r\n";
+	Client *local = findClientByNickname(params[2]);
+	RemoteUser *remote = _network.findUser(params[2]);
+	if (local && channel->hasMember(local->getFd()))
+	{
+		channel->broadcast(relay);
+		journalLeave(channel, local);
+		channel->removeMember(local->getFd());
+	}
+	else if (remote && channel->hasRemoteMember(remote))
+	{
+		channel->broadcast(relay);
+		channel->removeRemoteMember(remote);
+	}
+	else
+		return;
+	removeIfEmpty(channel);
+	propagate(relay, linkFd);
+}
+
+void Server::linkTopic(int linkFd, const std::string &line, const ArenaTokens &params)
+{
+	Channel *channel = params.size() < 3 ? NULL : _channelManager.getChannel(params[1]);
+	if (!channel)
+		return;
+	channel->setTopic(params[2]);
+	_channelStore.append(STATE_TOPIC, channel->getName(), params[2]);
+	std::string relay = line + "\r\n";
+	channel->broadcast(relay);
+	propagate(relay, linkFd);
+}
+
+/*
+	The originating server checked the permissions, the changes are applied
+	as they come. Operator status given by a server (burst) only applies to
+	users behind the same link, otherwise the line is dropped: the nickname
+	may have changed hands in a collision while it was on its way.
+*/
+void Server::linkMode(int linkFd, const std::string &line, const RemoteUser *user, const ArenaTokens &params)
+{
+	Channel *channel = params.size() < 3 ? NULL : _channelManager.getChannel(params[1]);
+	if (!channel)
+		return;
+	const std::string &name = channel->getName();
+	const std::string &modes = params[2];
+	size_t next = 3;
+	bool adding = true;
+	for (size_t i = 0; i < modes.size(); ++i)
+	{
+		char mode = modes[i];
+		if (mode == '+' || mode == '-')
+			adding = mode == '+';
+		else if (mode == 'i' || mode == 't')
+		{
+			if (adding)
+				channel->setMode(mode);
+			else
+				channel->unsetMode(mode);
+			_channelStore.append(adding ? STATE_MODE_SET : STATE_MODE_UNSET, name, std::string(1, mode));
+		}
+		else if (mode == 'k')
+		{
+			std::string key = adding && next < params.size() ? params[next++] : "";
+			channel->setKey(key);
+			_channelStore.append(STATE_KEY, name, key);
+		}
+		else if (mode == 'l')
+		{
+			int limit = adding && next < params.size() ? std::atoi(params[next++].c_str()) : 0;
+			channel->setUserLimit(limit);
+			std::ostringstream saved;
+			saved << limit;
+			_channelStore.append(STATE_LIMIT, name, saved.str());
+		}
+		else if (mode == 'o' && next < params.size())
+		{
+			const std::string &nickname = params[next++];
+			Client *local = user ? findClientByNickname(nickname) : NULL;
+			RemoteUser *remote = _network.findUser(nickname);
+			if (!user && (!remote || remote->link != linkFd))
+				return;
+			if (local && channel->hasMember(local->getFd()))
+			{
+				if (adding)
+					channel->addOperator(local->getFd());
+				else
+					channel->removeOperator(local->getFd());
+				_channelStore.append(adding ? STATE_OP : STATE_DEOP, name, nickname);
+			}
+			else if (remote)
+				channel->setRemoteOperator(remote, adding);
+		}
+	}
+	std::string relay = line + "\r\n";
+	channel->broadcast(relay);
+	propagate(relay, linkFd);
+}
+
+// channel text goes on towards links with members, private text towards its target
+void Server::linkMessage(int linkFd, const std::string &line, const ArenaTokens &params)
+{
+	if (params.size() < 3)
+		return;
+	const std::string &target = params[1];
+	std::string relay = line + "\r\n";
+	if (isChannelName(target))
+	{
+		Channel *channel = _channelManager.getChannel(target);
+		if (!channel)
+			return;
+		broadcastMessage(channel, relay.data(), relay.size(), NULL);
+		propagateToChannel(channel, relay.data(), relay.size(), linkFd);
+		return;
+	}
+	Client *local = findClientByNickname(target);
+	if (local && !local->isLink())
+	{
+		local->sendMessage(relay.data(), relay.size());
+		return;
+	}
+	RemoteUser *remote = _network.findUser(target);
+	if (remote && remote->link != linkFd)
+		sendToLink(remote->link, relay);
+}
+
+void Server::quitRemoteUser(RemoteUser *user, const std::string &quitLine)
+{
+	std::vector<ChannelHandle> channels = user->channels;
+	settleOffloaded(channels);
+	for (size_t i = 0; i < channels.size(); ++i)
+	{
+		Channel *channel = _channelManager.getChannel(channels[i]);
+		if (!channel)
+			continue;
+		channel->broadcast(quitLine);
+		channel->removeRemoteMember(user);
+		removeIfEmpty(channel);
+	}
+	_network.removeUser(user);
+}
+
+void Server::removeIfEmpty(Channel *channel)
+{
+	if (channel->getMemberCount() > 0)
+		return;
+	_channelStore.append(STATE_DESTROY, channel->getName());
+	_channelManager.removeChannel(channel);
+}
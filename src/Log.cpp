@@ -0,0 +1,276 @@
+#include "Log.hpp"
+#include <cstdio>		// for snprintf
+#include <cstring>		// for std::memcpy, std::strlen
+#include <ctime>		// for clock_gettime, localtime_r, nanosleep
+#include <fcntl.h>		// for open
+#include <unistd.h>		// for write, close, STDERR_FILENO
+#include <pthread.h>	// for pthread_create, pthread_join
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															RING:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+/*
+	Bounded queue with a sequence number per slot (Vyukov). A slot whose
+	sequence equals the producer position is free; producers claim positions
+	with a CAS on the head and publish by storing position + 1; the consumer
+	frees a slot by storing position + RING_SIZE.
+*/
+static const uint64_t	RING_SIZE = 4096;						// records (1 MB), power of two
+static const size_t		WRITE_BUFFER = 64 * 1024;				// writer batches lines into one write()
+static const long		IDLE_SLEEP_NS = 2000000;				// writer sleep when the ring is empty
+
+static LogRecord		g_ring[RING_SIZE];
+static uint64_t			g_head = 0;								// next position for producers
+static uint64_t			g_tail = 0;								// next position for the consumer (writer only)
+static uint64_t			g_dropped = 0;							// records lost to a full ring
+static int				g_running = 0;							// writer should keep polling
+static int				g_fd = STDERR_FILENO;
+static pthread_t		g_writer;
+static bool				g_started = false;
+
+// mark every slot free before anything can log
+static struct RingInit {
+	RingInit() {
+		for (uint64_t i = 0; i < RING_SIZE; ++i)
+			g_ring[i].sequence = i;
+	}
+} g_ringInit;
+
+static const char *const LEVEL_NAMES[LEVEL_COUNT] = { "DEBUG", "INFO", "WARN", "ERROR", "OFF" };
+static const char *const SUBSYSTEM_NAMES[SUB_COUNT] = { "server", "net", "client", "channel", "command" };
+
+// "2026-01-31 12:00:00.123456 INFO  net     | text\n"
+static size_t formatRecord(const LogRecord &record, char *out)
+{
+	time_t seconds = static_cast<time_t>(record.micros / 1000000);
+	struct tm tm;
+	localtime_r(&seconds, &tm);
+	size_t length = strftime(out, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	length += snprintf(out + length, 64, ".%06lu %-5s %-7s | ", static_cast<unsigned long>(record.micros % 1000000),
+						LEVEL_NAMES[record.level], SUBSYSTEM_NAMES[record.subsystem]);
+	std::memcpy(out + length, record.text, record.length);
+	length += record.length;
+	out[length++] = '\n';
+	return length;
+}
+
+static void writeAll(const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(g_fd, data, length);
+		if (n <= 0)
+			return;
+		data += n;
+		length -= n;
+	}
+}
+
+// move every published record into the write buffer, false if the ring was empty
+static bool drain()
+{
+	static char buffer[WRITE_BUFFER];
+	size_t used = 0;
+	bool any = false;
+
+	for (;;)
+	{
+		LogRecord &record = g_ring[g_tail & (RING_SIZE - 1)];
+		if (__atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE) != g_tail + 1)
+			break;
+		if (used + sizeof(LogRecord) + 128 > WRITE_BUFFER)
+		{
+			writeAll(buffer, used);
+			used = 0;
+		}
+		used += formatRecord(record, buffer + used);
+		__atomic_store_n(&record.sequence, g_tail + RING_SIZE, __ATOMIC_RELEASE);
+		++g_tail;
+		any = true;
+	}
+	if (used > 0)
+		writeAll(buffer, used);
+	return any;
+}
+
+static void *writerMain(void *)
+{
+	struct timespec idle;
+	idle.tv_sec = 0;
+	idle.tv_nsec = IDLE_SLEEP_NS;
+
+	while (__atomic_load_n(&g_running, __ATOMIC_ACQUIRE))
+		if (!drain())
+			nanosleep(&idle, NULL);
+	drain();
+	return NULL;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															LOG:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+unsigned char Log::_threshold[SUB_COUNT] = { LEVEL_INFO, LEVEL_INFO, LEVEL_INFO, LEVEL_INFO, LEVEL_INFO };
+
+// claim a slot, copy the line, publish it; drop the line instead of waiting when the ring is full
+void Log::push(LogLevel level, LogSubsystem subsystem, const char *text, size_t length)
+{
+	uint64_t position = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+	LogRecord *record;
+	for (;;)
+	{
+		record = &g_ring[position & (RING_SIZE - 1)];
+		uint64_t sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+		if (sequence == position)
+		{
+			if (__atomic_compare_exchange_n(&g_head, &position, position + 1, true,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (sequence < position)
+		{
+			__atomic_add_fetch(&g_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+			position = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	record->micros = static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+	record->level = static_cast<unsigned char>(level);
+	record->subsystem = static_cast<unsigned char>(subsystem);
+	record->length = static_cast<unsigned short>(length);
+	std::memcpy(record->text, text, length);
+	__atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+void Log::setLevel(LogLevel level)
+{
+	for (int i = 0; i < SUB_COUNT; ++i)
+		_threshold[i] = static_cast<unsigned char>(level);
+}
+
+void Log::setLevel(LogSubsystem subsystem, LogLevel level)
+{
+	_threshold[subsystem] = static_cast<unsigned char>(level);
+}
+
+bool Log::parseLevel(const std::string &name, LogLevel &level)
+{
+	static const char *const lower[LEVEL_COUNT] = { "debug", "info", "warn", "error", "off" };
+	for (int i = 0; i < LEVEL_COUNT; ++i)
+		if (name == lower[i])
+		{
+			level = static_cast<LogLevel>(i);
+			return true;
+		}
+	return false;
+}
+
+bool Log::parseSubsystem(const std::string &name, LogSubsystem &subsystem)
+{
+	for (int i = 0; i < SUB_COUNT; ++i)
+		if (name == SUBSYSTEM_NAMES[i])
+		{
+			subsystem = static_cast<LogSubsystem>(i);
+			return true;
+		}
+	return false;
+}
+
+const char *Log::name(LogLevel level) { return LEVEL_NAMES[level]; }
+const char *Log::name(LogSubsystem subsystem) { return SUBSYSTEM_NAMES[subsystem]; }
+
+// records pushed before start() are kept and written once the writer runs
+bool Log::start(const std::string &path)
+{
+	if (g_started)
+		return true;
+	if (!path.empty())
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd == -1)
+			return false;
+		g_fd = fd;
+	}
+	g_running = 1;
+	if (pthread_create(&g_writer, NULL, writerMain, NULL) != 0)
+	{
+		g_running = 0;
+		return false;
+	}
+	g_started = true;
+	return true;
+}
+
+void Log::stop()
+{
+	if (!g_started)
+	{
+		drain();
+		return;
+	}
+	__atomic_store_n(&g_running, 0, __ATOMIC_RELEASE);
+	pthread_join(g_writer, NULL);
+	g_started = false;
+	if (g_fd != STDERR_FILENO)
+	{
+		close(g_fd);
+		g_fd = STDERR_FILENO;
+	}
+}
+
+uint64_t Log::dropped()
+{
+	return __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															LOGLINE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// copy as much as still fits, the rest of the line is cut off
+LogLine &LogLine::append(const char *data, size_t length)
+{
+	if (length > LOG_TEXT_SIZE - _length)
+		length = LOG_TEXT_SIZE - _length;
+	std::memcpy(_text + _length, data, length);
+	_length += length;
+	return *this;
+}
+
+LogLine &LogLine::operator<<(const char *str)
+{
+	return append(str, std::strlen(str));
+}
+
+LogLine &LogLine::operator<<(double value)
+{
+	char buffer[32];
+	int length = snprintf(buffer, sizeof(buffer), "%.2f", value);
+	return append(buffer, length > 0 ? length : 0);
+}
+
+void LogLine::appendUnsigned(unsigned long value, bool negative)
+{
+	char buffer[24];
+	size_t i = sizeof(buffer);
+	do
+	{
+		buffer[--i] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	}
+	while (value > 0);
+	if (negative)
+		buffer[--i] = '-';
+	append(buffer + i, sizeof(buffer) - i);
+}
@@ -0,0 +1,243 @@
+#include "LoopbackTransport.hpp"
+#include <stdexcept>	// for std::runtime_error
+#include <cstring>		// for std::memcpy
+#include <cerrno>		// for errno, EAGAIN, EBADF, EPIPE, ECONNREFUSED
+#include <unistd.h>		// for STDIN_FILENO
+
+const int	LoopbackTransport::FD_BASE;
+const int	LoopbackTransport::NONE;
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// lowest free descriptor, like the kernel, so fd reuse follows the same pattern as with sockets
+int LoopbackTransport::allocateFd(int connection)
+{
+	size_t slot = 0;
+	while (slot < _fds.size() && _fds[slot] != NONE)
+		++slot;
+	if (slot == _fds.size())
+		_fds.push_back(NONE);
+	_fds[slot] = connection;
+	return FD_BASE + static_cast<int>(slot);
+}
+
+LoopbackTransport::Connection *LoopbackTransport::find(int fd)
+{
+	if (fd < FD_BASE || static_cast<size_t>(fd - FD_BASE) >= _fds.size() || _fds[fd - FD_BASE] == NONE)
+		return NULL;
+	return &_connections[_fds[fd - FD_BASE]];
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor (64 KB per connection, about what a loopback socket buffers)
+LoopbackTransport::LoopbackTransport()
+	: _listenFd(NONE), _unread(0), _driver(NULL), _now(0), _sendWindow(64 * 1024) {}
+
+// ====================================================================
+// Transport (server side):
+// ====================================================================
+
+// the listener lives just below the connection range; the port is only a label here
+int LoopbackTransport::listen(int &port, int backlog)
+{
+	(void)port;
+	(void)backlog;
+	if (_listenFd != NONE)
+		throw std::runtime_error("listen() failed: loopback supports one listener");
+	_listenFd = FD_BASE - 1;
+	return _listenFd;
+}
+
+int LoopbackTransport::accept(int listenFd, std::string &host)
+{
+	if (listenFd != _listenFd || _backlog.empty())
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	int connection = _backlog.front();
+	_backlog.pop_front();
+	int fd = allocateFd(connection);
+	_connections[connection].fd = fd;
+	host = "127.0.0.1";
+	return fd;
+}
+
+int LoopbackTransport::dial(const std::string &, int)
+{
+	errno = ECONNREFUSED;
+	return -1;
+}
+
+// buffered input first, then end of file once the client hung up
+ssize_t LoopbackTransport::recv(int fd, char *buf, size_t length)
+{
+	Connection *connection = find(fd);
+	if (!connection)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	size_t available = connection->inbound.size() - connection->inboundRead;
+	if (available == 0)
+	{
+		if (connection->hungUp)
+			return 0;
+		errno = EAGAIN;
+		return -1;
+	}
+	size_t n = available < length ? available : length;
+	std::memcpy(buf, connection->inbound.data() + connection->inboundRead, n);
+	connection->inboundRead += n;
+	_unread -= n;
+	if (connection->inboundRead == connection->inbound.size())
+	{
+		connection->inbound.clear();
+		connection->inboundRead = 0;
+	}
+	return n;
+}
+
+// accept what fits in the send window
+ssize_t LoopbackTransport::send(int fd, const char *data, size_t length)
+{
+	Connection *connection = find(fd);
+	if (!connection)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if (connection->hungUp)
+	{
+		errno = EPIPE;
+		return -1;
+	}
+	if (connection->outbound.size() >= _sendWindow)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	size_t room = _sendWindow - connection->outbound.size();
+	size_t n = length < room ? length : room;
+	connection->outbound.append(data, n);
+	return n;
+}
+
+// unread input is dropped; output already sent stays readable by the driver
+void LoopbackTransport::close(int fd)
+{
+	if (fd == _listenFd)
+	{
+		_listenFd = NONE;
+		return;
+	}
+	Connection *connection = find(fd);
+	if (!connection)
+		return;
+	_unread -= connection->inbound.size() - connection->inboundRead;
+	connection->inbound.clear();
+	connection->inboundRead = 0;
+	connection->fd = NONE;
+	connection->closed = true;
+	_fds[fd - FD_BASE] = NONE;
+}
+
+// one driver step per call; with nothing to report the timeout passes on the virtual clock
+int LoopbackTransport::poll(pollfd *fds, size_t count, int timeoutMs)
+{
+	if (_driver && !_driver->step(*this))
+	{
+		_driver = NULL;
+		typeOnConsole("quit\n");
+	}
+
+	int ready = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		fds[i].revents = 0;
+		if (fds[i].fd == STDIN_FILENO)
+		{
+			if (!_console.empty())
+				fds[i].revents = POLLIN;
+		}
+		else if (fds[i].fd == _listenFd)
+		{
+			if (!_backlog.empty())
+				fds[i].revents = POLLIN;
+		}
+		else if (Connection *connection = find(fds[i].fd))
+		{
+			if ((fds[i].events & POLLIN)
+				&& (connection->hungUp || connection->inboundRead < connection->inbound.size()))
+				fds[i].revents |= POLLIN;
+			if ((fds[i].events & POLLOUT)
+				&& (connection->hungUp || connection->outbound.size() < _sendWindow))
+				fds[i].revents |= POLLOUT;
+		}
+		if (fds[i].revents)
+			++ready;
+	}
+	if (ready == 0 && timeoutMs > 0)
+		_now += static_cast<uint64_t>(timeoutMs) * 1000000;
+	return ready;
+}
+
+ssize_t LoopbackTransport::readConsole(char *buf, size_t length)
+{
+	size_t n = _console.size() < length ? _console.size() : length;
+	std::memcpy(buf, _console.data(), n);
+	_console.erase(0, n);
+	return n;
+}
+
+// ====================================================================
+// driver (client side):
+// ====================================================================
+
+int LoopbackTransport::connect()
+{
+	_connections.push_back(Connection());
+	int connection = static_cast<int>(_connections.size()) - 1;
+	_backlog.push_back(connection);
+	return connection;
+}
+
+// input for a connection the server closed, or one we hung up, is lost like on a real socket
+void LoopbackTransport::write(int connection, const char *data, size_t length)
+{
+	Connection &target = _connections[connection];
+	if (target.hungUp || target.closed)
+		return;
+	target.inbound.append(data, length);
+	_unread += length;
+}
+
+bool LoopbackTransport::read(int connection, std::string &data)
+{
+	data.clear();
+	data.swap(_connections[connection].outbound);
+	return !data.empty();
+}
+
+void LoopbackTransport::hangUp(int connection)
+{
+	_connections[connection].hungUp = true;
+}
+
+void LoopbackTransport::typeOnConsole(const std::string &line)
+{
+	_console += line;
+}
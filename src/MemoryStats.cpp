@@ -0,0 +1,36 @@
+#include "MemoryStats.hpp"
+#include <fstream>
+#include <unistd.h>		// for sysconf
+#ifdef __GLIBC__
+# include <malloc.h>	// for mallinfo2
+#endif
+
+MemoryStats::MemoryStats() : rss(0), heapArena(0), heapInUse(0), heapFree(0), heapMmapped(0) {}
+
+// read resident memory from procfs and heap usage from the glibc allocator
+MemoryStats MemoryStats::read()
+{
+	MemoryStats stats;
+
+	std::ifstream statm("/proc/self/statm");
+	size_t totalPages = 0;
+	size_t residentPages = 0;
+	if (statm >> totalPages >> residentPages)
+		stats.rss = residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+	stats.heapArena = info.arena;
+	stats.heapInUse = info.uordblks;
+	stats.heapFree = info.fordblks;
+	stats.heapMmapped = info.hblkhd;
+#endif
+	return stats;
+}
+
+double MemoryStats::fragmentation() const
+{
+	if (heapArena == 0)
+		return 0.0;
+	return 100.0 * static_cast<double>(heapFree) / static_cast<double>(heapArena);
+}
@@ -0,0 +1,161 @@
+#include "Metrics.hpp"
+#include <cstring>		// for std::memset, std::memcpy, std::strcmp
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															HISTOGRAM:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+Histogram::Histogram()
+{
+	reset();
+}
+
+void Histogram::reset()
+{
+	std::memset(_buckets, 0, sizeof(_buckets));
+	_count = 0;
+	_sum = 0;
+	_max = 0;
+}
+
+uint64_t Histogram::count() const { return _count; }
+uint64_t Histogram::sum() const { return _sum; }
+uint64_t Histogram::max() const { return _max; }
+unsigned Histogram::bucketCount() const { return BUCKET_COUNT; }
+uint64_t Histogram::bucketValue(unsigned bucket) const { return _buckets[bucket]; }
+
+uint64_t Histogram::bucketUpperBound(unsigned bucket)
+{
+	if (bucket < SUB_COUNT)
+		return bucket;
+	unsigned magnitude = bucket / SUB_COUNT + SUB_BITS - 1;
+	uint64_t width = static_cast<uint64_t>(1) << (magnitude - SUB_BITS);
+	uint64_t lower = static_cast<uint64_t>(SUB_COUNT + bucket % SUB_COUNT) << (magnitude - SUB_BITS);
+	return lower + width - 1;
+}
+
+// walk the buckets until the requested rank is reached (never reports more than the real maximum)
+uint64_t Histogram::percentile(double fraction) const
+{
+	if (_count == 0)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(fraction * _count + 0.5);
+	if (rank == 0)
+		rank = 1;
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < BUCKET_COUNT; ++i)
+	{
+		seen += _buckets[i];
+		if (seen >= rank)
+		{
+			uint64_t bound = bucketUpperBound(i);
+			return bound < _max ? bound : _max;
+		}
+	}
+	return _max;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															METRICS:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+uint64_t	Metrics::_counters[COUNTER_COUNT];
+long		Metrics::_gauges[GAUGE_COUNT];
+Histogram	Metrics::_histograms[HISTOGRAM_COUNT];
+uint64_t	Metrics::_commands[COMMAND_COUNT];
+uint64_t	Metrics::_commandBytes[COMMAND_COUNT];
+Histogram	Metrics::_commandLatency[COMMAND_COUNT];
+uint64_t	Metrics::_commandStalls[COMMAND_COUNT];
+uint64_t	Metrics::_commandStallMax[COMMAND_COUNT];
+time_t		Metrics::_startTime = 0;
+__thread uint64_t	*Metrics::_sink = Metrics::_counters;
+
+// names used in reports, in enum order
+static const char *const COUNTER_NAMES[COUNTER_COUNT] = {
+	"connections", "disconnects", "recv_calls", "bytes_in", "messages_in", "send_calls",
+	"bytes_out", "send_blocked", "sendq_exceeded", "broadcasts", "broadcast_recipients", "ticks", "stalls",
+	"link_lines_in", "link_lines_out", "shard_jobs", "shard_runs", "pool_jobs", "pool_steals", "pool_busy_us",
+	"dns_queries", "dns_cache_hits", "dns_cache_misses", "dns_timeouts", "tls_handshakes", "tls_resumed",
+	"tls_failures", "tls_ktls", "tls_bytes_encrypted"
+};
+static const char *const GAUGE_NAMES[GAUGE_COUNT] = {
+	"clients", "channels", "blocked_clients", "queued_bytes", "links", "remote_users", "pool_threads",
+	"pool_in_flight", "pool_utilization_pct", "dns_cache_entries", "dns_cache_hit_pct"
+};
+static const char *const HISTOGRAM_NAMES[HISTOGRAM_COUNT] = {
+	"broadcast_fanout", "commands_per_tick", "tick_duration_us", "line_latency_ns", "stall_duration_us",
+	"shard_run_us", "pool_queue_wait_us", "pool_run_us", "dns_lookup_us", "tls_handshake_us",
+	"accept_batch"
+};
+static const char *const COMMAND_NAMES[COMMAND_COUNT] = {
+	"CAP", "PASS", "NICK", "USER", "OPER", "PING", "JOIN", "PART",
+	"MODE", "PRIVMSG", "NOTICE", "INVITE", "KICK", "TOPIC", "WHO",
+	"STATS", "QUIT", "UNKNOWN"
+};
+
+void Metrics::start()
+{
+	_startTime = time(NULL);
+	Clock::calibrate();
+}
+
+time_t Metrics::uptime()
+{
+	return time(NULL) - _startTime;
+}
+
+uint64_t Metrics::nowMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void Metrics::merge(uint64_t *counters)
+{
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+		_counters[i] += counters[i];
+	std::memset(counters, 0, sizeof(uint64_t) * COUNTER_COUNT);
+}
+
+void Metrics::snapshot(MetricsSnapshot &out)
+{
+	std::memcpy(out.counters, _counters, sizeof(_counters));
+	std::memcpy(out.gauges, _gauges, sizeof(_gauges));
+	for (int i = 0; i < HISTOGRAM_COUNT; ++i)
+		out.histograms[i] = _histograms[i];
+	std::memcpy(out.commands, _commands, sizeof(_commands));
+	std::memcpy(out.commandBytes, _commandBytes, sizeof(_commandBytes));
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+		out.commandLatency[i] = _commandLatency[i];
+	std::memcpy(out.commandStalls, _commandStalls, sizeof(_commandStalls));
+	std::memcpy(out.commandStallMax, _commandStallMax, sizeof(_commandStallMax));
+	out.uptime = uptime();
+}
+
+void Metrics::countStall(CommandId id, uint64_t micros)
+{
+	++_commandStalls[id];
+	if (micros > _commandStallMax[id])
+		_commandStallMax[id] = micros;
+}
+
+// map a command word to its counter slot (MSG is an alias of PRIVMSG)
+CommandId Metrics::commandId(const std::string &command)
+{
+	if (command == "MSG")
+		return CMD_PRIVMSG;
+	for (int i = 0; i < CMD_UNKNOWN; ++i)
+		if (std::strcmp(command.c_str(), COMMAND_NAMES[i]) == 0)
+			return static_cast<CommandId>(i);
+	return CMD_UNKNOWN;
+}
+
+const char *Metrics::name(CounterId id) { return COUNTER_NAMES[id]; }
+const char *Metrics::name(GaugeId id) { return GAUGE_NAMES[id]; }
+const char *Metrics::name(HistogramId id) { return HISTOGRAM_NAMES[id]; }
+const char *Metrics::name(CommandId id) { return COMMAND_NAMES[id]; }
@@ -0,0 +1,341 @@
+#include "MetricsEndpoint.hpp"
+#include "AllocProfile.hpp"
+#include "SocketTransport.hpp"
+#include <sstream>		// for std::ostringstream
+#include <stdexcept>	// for std::runtime_error
+#include <cstring>		// for std::memset, std::strncpy, std::strerror
+#include <cerrno>		// for errno
+#include <unistd.h>		// for close, unlink
+#include <fcntl.h>		// for fcntl, O_NONBLOCK
+#include <sys/socket.h>	// for socket, bind, listen, accept, recv, send
+#include <sys/un.h>		// for sockaddr_un
+#include <netinet/in.h>	// for sockaddr_in, htons, htonl
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// "# TYPE" line for one metric family
+static void family(std::ostringstream &out, const std::string &name, const char *type, const char *help)
+{
+	out << "# TYPE ircserv_" << name << " " << type << "\n"
+		<< "# HELP ircserv_" << name << " " << help << "\n";
+}
+
+// OpenMetrics histogram: cumulative counts of every bucket (the same le series on every scrape), then +Inf,
+// count and sum (labels, if any, are given as 'key="value",')
+static void histogram(std::ostringstream &out, const std::string &name, const Histogram &h,
+						const std::string &labels = "")
+{
+	uint64_t cumulative = 0;
+	for (unsigned i = 0; i < h.bucketCount(); ++i)
+	{
+		cumulative += h.bucketValue(i);
+		out << "ircserv_" << name << "_bucket{" << labels << "le=\"" << Histogram::bucketUpperBound(i) << "\"} "
+			<< cumulative << "\n";
+	}
+	std::string suffix = labels.empty() ? "" : "{" + labels.substr(0, labels.size() - 1) + "}";
+	out << "ircserv_" << name << "_bucket{" << labels << "le=\"+Inf\"} " << h.count() << "\n"
+		<< "ircserv_" << name << "_count" << suffix << " " << h.count() << "\n"
+		<< "ircserv_" << name << "_sum" << suffix << " " << h.sum() << "\n";
+}
+
+// per-command heap traffic (allocation profiling builds)
+static void allocations(std::ostringstream &out)
+{
+	AllocStats stats[ALLOC_TAG_COUNT];
+	AllocProfile::snapshot(stats);
+	family(out, "command_allocations", "counter", "operator new calls per command");
+	for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+		out << "ircserv_command_allocations_total{command=\"" << AllocProfile::name(i) << "\"} " << stats[i].allocations << "\n";
+	family(out, "command_allocated_bytes", "counter", "bytes requested from operator new per command");
+	for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+		out << "ircserv_command_allocated_bytes_total{command=\"" << AllocProfile::name(i) << "\"} " << stats[i].bytes << "\n";
+	family(out, "command_live_bytes", "gauge", "bytes allocated per command and not yet freed");
+	for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+		out << "ircserv_command_live_bytes{command=\"" << AllocProfile::name(i) << "\"} " << stats[i].liveBytes << "\n";
+	family(out, "command_peak_live_bytes", "gauge", "highest live bytes per command");
+	for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+		out << "ircserv_command_peak_live_bytes{command=\"" << AllocProfile::name(i) << "\"} " << stats[i].peakLiveBytes << "\n";
+}
+
+// copy the registry and render it (skipped when nothing could have changed since the last scrape)
+void MetricsEndpoint::render()
+{
+	if (!_body.empty() && _renderedTick == Metrics::counter(C_TICKS))
+		return;
+	Metrics::snapshot(_snapshot);
+	_renderedTick = _snapshot.counters[C_TICKS];
+
+	std::ostringstream out;
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+	{
+		std::string name = Metrics::name(static_cast<CounterId>(i));
+		family(out, name, "counter", name.c_str());
+		out << "ircserv_" << name << "_total " << _snapshot.counters[i] << "\n";
+	}
+	for (int i = 0; i < GAUGE_COUNT; ++i)
+	{
+		std::string name = Metrics::name(static_cast<GaugeId>(i));
+		family(out, name, "gauge", name.c_str());
+		out << "ircserv_" << name << " " << _snapshot.gauges[i] << "\n";
+	}
+	family(out, "uptime_seconds", "gauge", "seconds since start");
+	out << "ircserv_uptime_seconds " << _snapshot.uptime << "\n";
+
+	family(out, "commands", "counter", "lines received per command");
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+		out << "ircserv_commands_total{command=\"" << Metrics::name(static_cast<CommandId>(i)) << "\"} "
+			<< _snapshot.commands[i] << "\n";
+	family(out, "command_bytes", "counter", "bytes received per command");
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+		out << "ircserv_command_bytes_total{command=\"" << Metrics::name(static_cast<CommandId>(i)) << "\"} "
+			<< _snapshot.commandBytes[i] << "\n";
+
+	for (int i = 0; i < HISTOGRAM_COUNT; ++i)
+	{
+		std::string name = Metrics::name(static_cast<HistogramId>(i));
+		family(out, name, "histogram", name.c_str());
+		histogram(out, name, _snapshot.histograms[i]);
+	}
+	family(out, "command_latency_ns", "histogram", "time spent in processSingleCommand per command");
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+		if (_snapshot.commandLatency[i].count() > 0)
+			histogram(out, "command_latency_ns", _snapshot.commandLatency[i],
+				std::string("command=\"") + Metrics::name(static_cast<CommandId>(i)) + "\",");
+	family(out, "command_stalls", "counter", "watchdog stalls caught while the command ran");
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+		if (_snapshot.commandStalls[i] > 0)
+			out << "ircserv_command_stalls_total{command=\"" << Metrics::name(static_cast<CommandId>(i)) << "\"} "
+				<< _snapshot.commandStalls[i] << "\n";
+	family(out, "command_stall_max_us", "gauge", "longest stall caught while the command ran");
+	for (int i = 0; i < COMMAND_COUNT; ++i)
+		if (_snapshot.commandStalls[i] > 0)
+			out << "ircserv_command_stall_max_us{command=\"" << Metrics::name(static_cast<CommandId>(i)) << "\"} "
+				<< _snapshot.commandStallMax[i] << "\n";
+	if (AllocProfile::enabled())
+		allocations(out);
+	out << "# EOF\n";
+	_body = out.str();
+}
+
+// answer the request line, the rest of the request is ignored
+void MetricsEndpoint::respond(Connection &connection)
+{
+	std::string line = connection.request.substr(0, connection.request.find("\r\n"));
+	std::string status = "200 OK";
+	std::string type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+	std::string body;
+
+	if (line.compare(0, 4, "GET ") != 0)
+	{
+		status = "405 Method Not Allowed";
+		type = "text/plain";
+		body = "method not allowed\n";
+	}
+	else if (line.compare(4, 9, "/metrics ") != 0 && line != "GET /metrics")
+	{
+		status = "404 Not Found";
+		type = "text/plain";
+		body = "try /metrics\n";
+	}
+	else
+	{
+		render();
+		body = _body;
+	}
+
+	std::ostringstream out;
+	out << "HTTP/1.1 " << status << "\r\n"
+		<< "Content-Type: " << type << "\r\n"
+		<< "Content-Length: " << body.size() << "\r\n"
+		<< "Connection: close\r\n\r\n"
+		<< body;
+	connection.response = out.str();
+	connection.request.clear();
+}
+
+// write as much as the socket takes, false when the whole response is out (or the peer is gone)
+bool MetricsEndpoint::writeResponse(int fd, Connection &connection)
+{
+	while (connection.sent < connection.response.size())
+	{
+		ssize_t n = send(fd, connection.response.data() + connection.sent,
+						connection.response.size() - connection.sent, MSG_NOSIGNAL);
+		if (n == -1)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		connection.sent += n;
+	}
+	return false;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+MetricsEndpoint::MetricsEndpoint() : _listenFd(-1), _renderedTick(0) {}
+
+// destructor (sockets are closed by the server together with its poll set)
+MetricsEndpoint::~MetricsEndpoint()
+{
+	if (!_socketPath.empty())
+		unlink(_socketPath.c_str());
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+// listen on 127.0.0.1:port (never on a public address)
+int MetricsEndpoint::listenTcp(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		throw std::runtime_error("metrics socket() failed");
+
+	int opt = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+	struct sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1
+		|| fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+	{
+		int err = errno;
+		::close(fd);
+		throw std::runtime_error(std::string("metrics listener failed: ") + std::strerror(err));
+	}
+	_listenFd = fd;
+	return fd;
+}
+
+// listen on a Unix socket (a stale socket file from a previous run is replaced, a live one or any other file is not)
+int MetricsEndpoint::listenUnix(const std::string &path)
+{
+	struct sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("metrics socket path too long: " + path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		throw std::runtime_error("metrics socket() failed");
+
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	SocketTransport::removeStaleSocket(addr);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1
+		|| fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+	{
+		int err = errno;
+		::close(fd);
+		throw std::runtime_error(std::string("metrics listener failed: ") + std::strerror(err));
+	}
+	_listenFd = fd;
+	_socketPath = path;
+	return fd;
+}
+
+int MetricsEndpoint::getListenFd() const
+{
+	return _listenFd;
+}
+
+bool MetricsEndpoint::isConnection(int fd) const
+{
+	return _connections.find(fd) != _connections.end();
+}
+
+int MetricsEndpoint::acceptConnection()
+{
+	int fd = accept(_listenFd, NULL, NULL);
+	if (fd == -1)
+		return -1;
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+	{
+		::close(fd);
+		return -1;
+	}
+	_connections[fd] = Connection();
+	_connections[fd].opened = Metrics::nowMicros();
+	return fd;
+}
+
+// a scraper that connects and never sends a request (or never reads the answer) must not keep its slot
+void MetricsEndpoint::closeIdle(uint64_t now, std::vector<int> &closed)
+{
+	std::map<int, Connection>::iterator it = _connections.begin();
+	while (it != _connections.end())
+	{
+		if (now - it->second.opened < IDLE_TIMEOUT_MICROS)
+		{
+			++it;
+			continue;
+		}
+		::close(it->first);
+		closed.push_back(it->first);
+		_connections.erase(it++);
+	}
+}
+
+// read the request, then write the response (POLLOUT while the socket is full); closes the fd when done
+bool MetricsEndpoint::handleEvent(struct pollfd &pfd)
+{
+	std::map<int, Connection>::iterator it = _connections.find(pfd.fd);
+	if (it == _connections.end())
+		return false;
+	Connection &connection = it->second;
+	bool open = true;
+
+	if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && connection.response.empty())
+	{
+		char buf[1024];
+		ssize_t n = recv(pfd.fd, buf, sizeof(buf), 0);
+		if (n <= 0)
+			open = false;
+		else
+		{
+			connection.request.append(buf, n);
+			if (connection.request.find("\r\n\r\n") != std::string::npos)
+				respond(connection);
+			else if (connection.request.size() > MAX_REQUEST)
+				open = false;
+		}
+	}
+	if (open && !connection.response.empty())
+	{
+		open = writeResponse(pfd.fd, connection);
+		pfd.events = POLLOUT;
+	}
+	if (!open)
+	{
+		::close(pfd.fd);
+		_connections.erase(it);
+		pfd.fd = -1;
+	}
+	return open;
+}
+
+// a hot upgrade rebinds the same address in the new process, which then owns the socket file
+void MetricsEndpoint::close()
+{
+	for (std::map<int, Connection>::iterator it = _connections.begin(); it != _connections.end(); ++it)
+		::close(it->first);
+	_connections.clear();
+	if (_listenFd != -1)
+		::close(_listenFd);
+	_listenFd = -1;
+	_socketPath.clear();
+}
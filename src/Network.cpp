@@ -0,0 +1,162 @@
+#include "Network.hpp"
+
+static const std::string NO_PEER;
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+Network::Network() : _retryMicros(0) {}
+
+Network::~Network()
+{
+	for (std::map<std::string, RemoteUser *>::iterator it = _users.begin(); it != _users.end(); ++it)
+		delete it->second;
+}
+
+void Network::configure(const std::string &name, const std::vector<LinkConfig> &links, long retrySeconds)
+{
+	_name = name;
+	_retryMicros = static_cast<uint64_t>(retrySeconds > 0 ? retrySeconds : 1) * 1000000;
+	_blocks.clear();
+	for (size_t i = 0; i < links.size(); ++i)
+	{
+		if (links[i].name == name || findBlock(links[i].name))
+			continue;
+		LinkBlock block;
+		block.config = links[i];
+		_blocks.push_back(block);
+	}
+}
+
+// ====================================================================
+// links:
+// ====================================================================
+
+LinkBlock *Network::findBlock(const std::string &peer)
+{
+	for (size_t i = 0; i < _blocks.size(); ++i)
+		if (_blocks[i].config.name == peer)
+			return &_blocks[i];
+	return NULL;
+}
+
+LinkBlock *Network::blockOf(int fd)
+{
+	for (size_t i = 0; i < _blocks.size(); ++i)
+		if (_blocks[i].fd == fd)
+			return &_blocks[i];
+	return NULL;
+}
+
+void Network::dialled(LinkBlock &block, int fd, uint64_t now)
+{
+	block.fd = fd;
+	block.nextAttempt = now + _retryMicros;
+}
+
+void Network::established(int fd, const std::string &peer)
+{
+	_links[fd] = peer;
+	addServer(peer, fd, 1);
+}
+
+bool Network::isEstablished(int fd) const
+{
+	return _links.find(fd) != _links.end();
+}
+
+const std::string &Network::peerOf(int fd) const
+{
+	std::map<int, std::string>::const_iterator it = _links.find(fd);
+	return it == _links.end() ? NO_PEER : it->second;
+}
+
+// servers and users behind the link are removed by the server as it announces their loss
+void Network::lost(int fd, uint64_t now)
+{
+	_links.erase(fd);
+	LinkBlock *block = blockOf(fd);
+	if (block)
+	{
+		block->fd = -1;
+		block->nextAttempt = now + _retryMicros;
+	}
+}
+
+// ====================================================================
+// servers:
+// ====================================================================
+
+bool Network::knowsServer(const std::string &server) const
+{
+	return server == _name || _servers.find(server) != _servers.end();
+}
+
+void Network::addServer(const std::string &server, int link, int hops)
+{
+	RemoteServer &entry = _servers[server];
+	entry.name = server;
+	entry.link = link;
+	entry.hops = hops;
+}
+
+void Network::removeServer(const std::string &server)
+{
+	_servers.erase(server);
+}
+
+std::vector<std::string> Network::serversBehind(int link) const
+{
+	std::vector<std::string> names;
+	for (std::map<std::string, RemoteServer>::const_iterator it = _servers.begin(); it != _servers.end(); ++it)
+		if (it->second.link == link)
+			names.push_back(it->first);
+	return names;
+}
+
+// ====================================================================
+// users:
+// ====================================================================
+
+RemoteUser *Network::findUser(const std::string &nickname) const
+{
+	std::map<std::string, RemoteUser *>::const_iterator it = _users.find(nickname);
+	return it == _users.end() ? NULL : it->second;
+}
+
+RemoteUser *Network::addUser(const RemoteUser &user)
+{
+	RemoteUser *&slot = _users[user.nickname];
+	delete slot;
+	slot = new RemoteUser(user);
+	slot->updatePrefix();
+	return slot;
+}
+
+void Network::renameUser(RemoteUser *user, const std::string &nickname)
+{
+	_users.erase(user->nickname);
+	user->nickname = nickname;
+	user->updatePrefix();
+	_users[nickname] = user;
+}
+
+void Network::removeUser(RemoteUser *user)
+{
+	std::map<std::string, RemoteUser *>::iterator it = _users.find(user->nickname);
+	if (it != _users.end() && it->second == user)
+		_users.erase(it);
+	delete user;
+}
+
+std::vector<RemoteUser *> Network::usersOn(const std::string &server) const
+{
+	std::vector<RemoteUser *> users;
+	for (std::map<std::string, RemoteUser *>::const_iterator it = _users.begin(); it != _users.end(); ++it)
+		if (it->second->server == server)
+			users.push_back(it->second);
+	return users;
+}
@@ -0,0 +1,359 @@
+#include "Resolver.hpp"
+#include "Metrics.hpp"
+#include <sys/socket.h>	// for socket, connect, send, recv
+#include <netinet/in.h>	// for sockaddr_in, htons
+#include <arpa/inet.h>	// for inet_pton
+#include <fcntl.h>		// for open, fcntl, O_NONBLOCK, O_CLOEXEC, FD_CLOEXEC
+#include <unistd.h>		// for close, read
+#include <cstdlib>		// for std::strtol
+#include <sstream>		// for std::ostringstream
+#include <cstring>		// for std::memcpy
+#include <cctype>		// for std::tolower
+
+static const size_t		DNS_HEADER = 12;
+static const size_t		DNS_MAX_DATAGRAM = 512;					// plain DNS over UDP, no EDNS
+static const size_t		HOSTNAME_MAX = 63;						// longest hostname put in a prefix
+static const int		MAX_POINTERS = 16;						// compression jumps followed in one name
+
+static uint16_t readShort(const unsigned char *data)
+{
+	return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+static uint32_t readLong(const unsigned char *data)
+{
+	return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16)
+		| (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+static void appendShort(std::string &packet, uint16_t value)
+{
+	packet += static_cast<char>(value >> 8);
+	packet += static_cast<char>(value & 0xff);
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// header (recursion desired), one question of class IN
+uint16_t Resolver::send(const std::string &name, uint16_t type)
+{
+	uint16_t id = 0;
+	while (id == 0)
+		if (read(_random, &id, sizeof(id)) != static_cast<ssize_t>(sizeof(id)))
+			return 0;
+	std::string packet;
+	packet.reserve(DNS_HEADER + name.size() + 6);
+	appendShort(packet, id);
+	appendShort(packet, 0x0100);
+	appendShort(packet, 1);
+	packet.append(6, '\0');
+	size_t start = 0;
+	while (start < name.size())
+	{
+		size_t dot = name.find('.', start);
+		if (dot == std::string::npos)
+			dot = name.size();
+		if (dot == start || dot - start > 63)
+			return 0;
+		packet += static_cast<char>(dot - start);
+		packet.append(name, start, dot - start);
+		start = dot + 1;
+	}
+	packet += '\0';
+	appendShort(packet, type);
+	appendShort(packet, 1);
+	if (::send(_fd, packet.data(), packet.size(), 0) != static_cast<ssize_t>(packet.size()))
+		return 0;
+	Metrics::add(C_DNS_QUERIES);
+	return id;
+}
+
+// a (possibly compressed) name at pos, which is left behind it; name may be NULL to skip it
+bool Resolver::readName(const unsigned char *data, size_t size, size_t &pos, std::string *name)
+{
+	size_t at = pos;
+	bool jumped = false;
+	int jumps = 0;
+	if (name)
+		name->clear();
+	for (;;)
+	{
+		if (at >= size)
+			return false;
+		unsigned length = data[at];
+		if ((length & 0xc0) == 0xc0)
+		{
+			if (at + 1 >= size || ++jumps > MAX_POINTERS)
+				return false;
+			if (!jumped)
+				pos = at + 2;
+			jumped = true;
+			at = ((length & 0x3f) << 8) | data[at + 1];
+			continue;
+		}
+		if (length & 0xc0)
+			return false;
+		if (length == 0)
+		{
+			if (!jumped)
+				pos = at + 1;
+			return true;
+		}
+		if (at + 1 + length > size)
+			return false;
+		if (name)
+		{
+			if (!name->empty())
+				*name += '.';
+			name->append(reinterpret_cast<const char *>(data + at + 1), length);
+			if (name->size() > 255)
+				return false;
+		}
+		at += 1 + length;
+	}
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+Resolver::Resolver()
+	: _fd(-1), _random(-1), _capacity(0) {}
+
+// destructor
+Resolver::~Resolver()
+{
+	stop();
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+// connected, so the kernel drops datagrams from anywhere but the server
+bool Resolver::start(const std::string &server, size_t cacheSize)
+{
+	std::string host = server;
+	long port = 53;
+	size_t colon = server.find(':');
+	if (colon != std::string::npos)
+	{
+		host = server.substr(0, colon);
+		port = std::strtol(server.c_str() + colon + 1, NULL, 10);
+	}
+	struct sockaddr_in address;
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<uint16_t>(port));
+	if (port < 1 || port > 65535 || inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+		return false;
+
+	_random = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (_random == -1 || _fd == -1)
+	{
+		stop();
+		return false;
+	}
+	if (fcntl(_fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(_fd, F_SETFD, FD_CLOEXEC) == -1
+		|| connect(_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1)
+	{
+		stop();
+		return false;
+	}
+	_capacity = cacheSize;
+	return true;
+}
+
+void Resolver::stop()
+{
+	if (_fd != -1)
+		close(_fd);
+	if (_random != -1)
+		close(_random);
+	_fd = -1;
+	_random = -1;
+	_cache.clear();
+	_lru.clear();
+}
+
+uint16_t Resolver::queryPtr(uint32_t address)
+{
+	return send(reverseName(address), TYPE_PTR);
+}
+
+uint16_t Resolver::queryA(const std::string &hostname)
+{
+	return send(hostname, TYPE_A);
+}
+
+// datagrams that are no answer are skipped, a malformed answer comes back as not ok
+bool Resolver::receive(DnsAnswer &answer)
+{
+	unsigned char data[DNS_MAX_DATAGRAM];
+	for (;;)
+	{
+		ssize_t received = recv(_fd, data, sizeof(data), 0);
+		if (received < 0)
+			return false;
+		size_t size = static_cast<size_t>(received);
+		if (size < DNS_HEADER || !(data[2] & 0x80))
+			continue;
+
+		answer = DnsAnswer();
+		answer.id = readShort(data);
+		unsigned rcode = data[3] & 0x0f;
+		unsigned questions = readShort(data + 4);
+		unsigned records = readShort(data + 6);
+		size_t pos = DNS_HEADER;
+		bool valid = true;
+		for (unsigned i = 0; valid && i < questions; ++i)
+		{
+			std::string name;
+			valid = readName(data, size, pos, &name) && pos + 4 <= size;
+			if (valid && questions == 1)
+			{
+				answer.question = name;
+				answer.type = readShort(data + pos);
+			}
+			pos += 4;
+		}
+		for (unsigned i = 0; valid && rcode == 0 && i < records; ++i)
+		{
+			if (!readName(data, size, pos, NULL) || pos + 10 > size)
+			{
+				valid = false;
+				break;
+			}
+			uint16_t type = readShort(data + pos);
+			uint32_t ttl = readLong(data + pos + 4);
+			size_t length = readShort(data + pos + 8);
+			size_t rdata = pos + 10;
+			pos = rdata + length;
+			if (pos > size)
+			{
+				valid = false;
+				break;
+			}
+			if (type == TYPE_PTR)
+			{
+				std::string name;
+				size_t at = rdata;
+				if (!readName(data, size, at, &name))
+					continue;
+				answer.names.push_back(name);
+			}
+			else if (type == TYPE_A && length == 4)
+			{
+				uint32_t address;
+				std::memcpy(&address, data + rdata, 4);
+				answer.addresses.push_back(address);
+			}
+			else
+				continue;
+			if (!answer.ok || ttl < answer.ttl)
+				answer.ttl = ttl;
+			answer.ok = true;
+		}
+		if (!valid)
+		{
+			answer.ok = false;
+			answer.names.clear();
+			answer.addresses.clear();
+		}
+		return true;
+	}
+}
+
+// an expired entry is dropped on the way
+bool Resolver::cached(uint32_t address, std::string &hostname)
+{
+	std::map<uint32_t, CacheList::iterator>::iterator it = _cache.find(address);
+	if (it != _cache.end() && it->second->expires <= time(NULL))
+	{
+		_lru.erase(it->second);
+		_cache.erase(it);
+		it = _cache.end();
+	}
+	if (it == _cache.end())
+	{
+		Metrics::add(C_DNS_CACHE_MISSES);
+		return false;
+	}
+	_lru.splice(_lru.begin(), _lru, it->second);
+	hostname = it->second->hostname;
+	Metrics::add(C_DNS_CACHE_HITS);
+	return true;
+}
+
+void Resolver::store(uint32_t address, const std::string &hostname, uint32_t ttl)
+{
+	if (_capacity == 0)
+		return;
+	if (ttl > MAX_TTL)
+		ttl = MAX_TTL;
+	std::map<uint32_t, CacheList::iterator>::iterator it = _cache.find(address);
+	if (it != _cache.end())
+	{
+		_lru.erase(it->second);
+		_cache.erase(it);
+	}
+	else if (_cache.size() >= _capacity)
+	{
+		_cache.erase(_lru.back().address);
+		_lru.pop_back();
+	}
+	CacheEntry entry;
+	entry.address = address;
+	entry.hostname = hostname;
+	entry.expires = time(NULL) + ttl;
+	_lru.push_front(entry);
+	_cache[address] = _lru.begin();
+}
+
+// letters, digits, '-' and '.', no empty label: nothing that could break a prefix or a reply
+bool Resolver::isValidHostname(const std::string &name)
+{
+	if (name.empty() || name.size() > HOSTNAME_MAX || name[0] == '.' || name[name.size() - 1] == '.')
+		return false;
+	for (size_t i = 0; i < name.size(); ++i)
+	{
+		char c = name[i];
+		bool alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+		if (!alnum && c != '-' && c != '.')
+			return false;
+		if (c == '.' && name[i + 1] == '.')
+			return false;
+	}
+	return true;
+}
+
+bool Resolver::sameName(const std::string &a, const std::string &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+		if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+			return false;
+	return true;
+}
+
+// 4.3.2.1.in-addr.arpa
+std::string Resolver::reverseName(uint32_t address)
+{
+	const unsigned char *octets = reinterpret_cast<const unsigned char *>(&address);
+	std::ostringstream name;
+	name << static_cast<int>(octets[3]) << '.' << static_cast<int>(octets[2]) << '.'
+		<< static_cast<int>(octets[1]) << '.' << static_cast<int>(octets[0]) << ".in-addr.arpa";
+	return name.str();
+}
@@ -1,15 +1,19 @@
 #include "Server.hpp"
+#include "Handoff.hpp"
 #include "Channel.hpp"
-#include <iostream>		// for std::cout, std::cerr
+#include "MemoryStats.hpp"
+#include "Metrics.hpp"
+#include "AllocProfile.hpp"
+#include "Log.hpp"
+#include <iostream>		// for std::cout (printStats)
 #include <stdexcept>	// for std::runtime_error, std::invalid_argument
 #include <cstring>		// for std::memset, std::strerror, strncmp
 #include <cerrno>		// for errno, EINTR
-#include <fcntl.h>		// for fcntl, O_NONBLOCK, F_SETFL
-#include <netinet/in.h> // for sockaddr_in, INADDR_ANY, htons
-#include <arpa/inet.h>	// for getsockname
 #include <cctype>		// for std::isdigit
 #include <sstream>		// for std::istringstream
 
+static const size_t	ACCEPT_BATCH = 64;							// connections taken per listener wakeup at most
+
 // |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
 // |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
 // 															PRIVATE:
@@ -20,69 +24,19 @@
 // private methods:
 // ====================================================================
 
-// create the listening socket
-void Server::createSocket()
-{
-	_listenFd = socket(AF_INET, SOCK_STREAM, 0); // AF_INET - IPv4, SOCK_STREAM - TCP, 0 - default
-	std::cout << "Socket FD: " << _listenFd << std::endl;
-	if (_listenFd == -1)
-		throw std::runtime_error("socket() failed");
-}
-
-// set socket to non-blocking mode
-void Server::setNonBlocking(int fd)
-{
-	// load existing file descriptor flags
-	int flags = fcntl(fd, F_GETFL, 0); // F_GETFL - get file descriptor flags
-	if (flags == -1)
-		throw std::runtime_error("fcntl(F_GETFL) failed");
-
-	// set non-blocking mode flag
-	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) // F_SETFL - set file descriptor flags
-		throw std::runtime_error("fcntl(F_SETFL) failed");
-}
-
-// set socket options
-void Server::setSocketOptions()
-{
-	int opt = 1;
-	// SOL_SOCKET - socket level, SO_REUSEADDR - allow reuse of local addresses
-	if (setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
-		throw std::runtime_error("setsockopt() failed");
-}
-
-// bind the listening socket
-void Server::bindSocket()
-{
-	struct sockaddr_in addr;
-	std::memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(_port);
-
-	if (bind(_listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
-	{
-		int bind_errno = errno;
-		close(_listenFd);
-		throw std::runtime_error(std::string("bind() failed: ") + strerror(bind_errno));
-	}
-
-	// check actual port used by socket
-	socklen_t addrlen = sizeof(addr);
-	if (getsockname(_listenFd, (struct sockaddr *)&addr, &addrlen) == -1)
-		throw std::runtime_error("getsockname() failed");
-
-	int actual_port = ntohs(addr.sin_port); // convert port number from network byte order to host byte order
-	std::cout << "Using specified port: " << actual_port << std::endl;
-	_port = actual_port;
-}
-
 // start listening for connections
 void Server::startListening()
 {
-	if (listen(_listenFd, 10) == -1)
-		throw std::runtime_error("listen() failed");
+	_listenFd = _transport->listen(_port, static_cast<int>(_config.getInt("listen_backlog", SOMAXCONN)));
+	LOG(LEVEL_DEBUG, SUB_SERVER) << "Socket FD: " << _listenFd;
+	LOG(LEVEL_INFO, SUB_SERVER) << "Using specified port: " << _port;
+	watchListener();
+	LOG(LEVEL_INFO, SUB_SERVER) << "Socket setup complete on port " << _port;
+}
 
+// the listening socket and the console come first in the poll set
+void Server::watchListener()
+{
 	struct pollfd listen_pfd;
 	listen_pfd.fd = _listenFd;
 	listen_pfd.events = POLLIN;
@@ -92,58 +46,99 @@ void Server::startListening()
 	stdin_pfd.fd = STDIN_FILENO;
 	stdin_pfd.events = POLLIN;
 	_pfds.push_back(stdin_pfd);
-
-	std::cout << "Socket setup complete on port " << _port << std::endl;
 }
 
 void Server::setupSocket()
 {
-	createSocket();
-	setNonBlocking(_listenFd);
-	setSocketOptions();
-	bindSocket();
 	startListening();
 }
 
-void Server::handleNewConnection()
+// a burst of connections is taken in one wakeup, but at most ACCEPT_BATCH so the other clients are not kept waiting
+void Server::handleNewConnection(int listenFd)
 {
-	struct sockaddr_in clientAddr;
-	socklen_t addrlen = sizeof(clientAddr);
-	int clientFd = accept(_listenFd, (struct sockaddr *)&clientAddr, &addrlen);
-	if (clientFd == -1)
+	size_t accepted = 0;
+	while (accepted < ACCEPT_BATCH)
 	{
-		std::cerr << "accept() failed" << std::endl;
-		return;
-	}
+		std::string host;
+		int clientFd = _transport->accept(listenFd, host);
+		if (clientFd == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG(LEVEL_ERROR, SUB_NET) << "accept() failed: " << std::strerror(errno);
+			break;
+		}
+		++accepted;
 
-	if (fcntl(clientFd, F_SETFL, O_NONBLOCK) == -1)
-	{
-		close(clientFd);
-		std::cerr << "fcntl() failed on client" << std::endl;
-		return;
-	}
-	
-	Client *newClient = new Client(clientFd, inet_ntoa(clientAddr.sin_addr));
+		Client *newClient = _clientManager.createClient(clientFd, host);
+		_capture.open(clientFd);
 
-	std::cout << "New client connected (fd=" << clientFd << ")" << std::endl;
-	addClient(newClient, clientFd);
+		LOG(LEVEL_INFO, SUB_NET) << "New client connected (fd=" << clientFd << ")";
+		addClient(newClient, clientFd);
+		lookupHostname(newClient);
+	}
+	Metrics::record(H_ACCEPT_BATCH, accepted);
 }
 
 void Server::handleStdinInput()
 {
 	char buf[16];
-	int bytes_read = read(STDIN_FILENO, buf, sizeof(buf) - 1);
+	int bytes_read = _transport->readConsole(buf, sizeof(buf) - 1);
 
 	if (bytes_read > 0)
 	{
 		buf[bytes_read] = '\0';
 		if (strncmp(buf, "quit", 4) == 0)
 		{
-			std::cout << "Server shutting down..." << std::endl;
+			LOG(LEVEL_INFO, SUB_SERVER) << "Server shutting down...";
+			printStats();
 			_running = false;
 		}
+		else if (strncmp(buf, "stats", 5) == 0)
+			printStats();
+		else if (strncmp(buf, "upgrade", 7) == 0)
+			_upgradeRequested = true;
 	}
 }
+
+// print pool usage and process memory, used to check that churn does not fragment the heap
+void Server::printStats() const
+{
+	PoolStats clients = _clientManager.getHotStats();
+	PoolStats identities = _clientManager.getColdStats();
+	ClientFootprint footprint = _clientManager.getFootprint();
+	PoolStats channels = _channelManager.getPoolStats();
+	ArenaStats arena = _arena.stats();
+	MemoryStats memory = MemoryStats::read();
+
+	std::cout << "[stats] clients: live=" << clients.live << " peak=" << clients.peakLive
+			<< " created=" << clients.created << " reused=" << clients.reused
+			<< " slabs=" << clients.slabs << "+" << identities.slabs
+			<< " (" << (clients.bytesReserved + identities.bytesReserved) / 1024 << " KB)" << std::endl;
+	if (footprint.clients > 0)
+		std::cout << "[stats] bytes/client: hot=" << footprint.hotBytes / footprint.clients
+				<< " cold=" << footprint.coldBytes / footprint.clients
+				<< " heap=" << footprint.heapBytes / footprint.clients << std::endl;
+	std::cout << "[stats] channels: live=" << channels.live << " peak=" << channels.peakLive
+			<< " created=" << channels.created << " reused=" << channels.reused
+			<< " slabs=" << channels.slabs << " (" << channels.bytesReserved / 1024 << " KB)" << std::endl;
+	std::cout << "[stats] interned: nicks=" << footprint.nickTableBytes / 1024
+			<< " KB channel-names=" << _channelManager.getNameTableBytes() / 1024 << " KB" << std::endl;
+	std::cout << "[stats] arena: allocations=" << arena.allocations << " bytes=" << arena.bytes
+			<< " large=" << arena.largeAllocations << " blocks=" << arena.blocks
+			<< " peak-tick=" << arena.peakTickBytes << " B ticks=" << arena.resets << std::endl;
+	std::cout << "[stats] memory: rss=" << memory.rss / 1024 << " KB heap=" << memory.heapArena / 1024
+			<< " KB in-use=" << memory.heapInUse / 1024 << " KB free=" << memory.heapFree / 1024
+			<< " KB mmap=" << memory.heapMmapped / 1024 << " KB fragmentation=" << memory.fragmentation() << "%" << std::endl;
+	if (!AllocProfile::enabled())
+		return;
+	AllocStats allocations[ALLOC_TAG_COUNT];
+	AllocProfile::snapshot(allocations);
+	for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+		if (allocations[i].allocations > 0)
+			std::cout << "[stats] allocations " << AllocProfile::name(i) << ": count=" << allocations[i].allocations
+					<< " bytes=" << allocations[i].bytes << " live=" << allocations[i].liveBytes
+					<< " peak-live=" << allocations[i].peakLiveBytes << std::endl;
+}
 void Server::handleWhoCommand(int clientFd, const std::string &message)
 {
 	Client *requester = findClientByFd(clientFd);
@@ -152,21 +147,21 @@ void Server::handleWhoCommand(int clientFd, const std::string &message)
 	if (!requester->isRegistered())
 	{
 		std::string response = ":server 451 " + requester->getNickname() + " :You have not registered\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return ;
 	}
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 2)
 	{
 		std::string response = ":server 461 " + requester->getNickname() + " WHO :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return ;
 	}
 	std::string channelName = tokens[1];
 	if (!_channelManager.channelExists(channelName))
 	{
 		std::string response = ":server 403 " + requester->getNickname() + " " + channelName + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return ;
 	}
 	Channel *channel = _channelManager.getChannel(channelName);
@@ -179,10 +174,20 @@ void Server::handleWhoCommand(int clientFd, const std::string &message)
 							member->getHostname() + " server " +
 							member->getNickname() + " H :0 " +
 							member->getRealname() + "\r\n";
-		send(clientFd, reply.c_str(), reply.length(), 0);
+		sendToClient(clientFd, reply);
+	}
+	const std::map<RemoteUser *, bool> &remote = channel->getRemoteMembers();
+	for (std::map<RemoteUser *, bool>::const_iterator it = remote.begin(); it != remote.end(); ++it)
+	{
+		const RemoteUser *member = it->first;
+		std::ostringstream reply;
+		reply << ":server 352 " << requester->getNickname() << " " << channelName << " " << member->username << " "
+			<< member->hostname << " " << member->server << " " << member->nickname << " H :" << member->hops << " "
+			<< member->realname << "\r\n";
+		sendToClient(clientFd, reply.str());
 	}
 	std::string endReply = ":server 315 " + requester->getNickname() + " " + channelName + " :End of WHO list\r\n";
-	send(clientFd, endReply.c_str(), endReply.length(), 0);
+	sendToClient(clientFd, endReply);
 }
 
 // ====================================================================
@@ -197,7 +202,7 @@ void Server::handleJoinCommand(int clientFd, const std::string &message)
 		return;
 	}
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 2)
 	{
 		sendError(clientFd, "461", "JOIN :Not enough parameters");
@@ -231,41 +236,44 @@ Channel* Server::getOrCreateChannel(const std::string &channelName)
 	if (!_channelManager.channelExists(channelName))
 	{
 		Channel *channel = _channelManager.createChannel(channelName);
-		std::cout << "Created new channel: " << channelName << std::endl;
+		_channelStore.append(STATE_CREATE, channel->getName());
+		LOG(LEVEL_INFO, SUB_CHANNEL) << "Created new channel: " << channelName;
 		return channel;
 	}
 	else
 	{
 		Channel *channel = _channelManager.getChannel(channelName);
-		std::cout << "Found existing channel: " << channelName << std::endl;
+		LOG(LEVEL_DEBUG, SUB_CHANNEL) << "Found existing channel: " << channelName;
 		return channel;
 	}
 }
 
-bool Server::validateJoinConditions(Client *client, Channel *channel, const std::vector<std::string> &tokens)
+bool Server::validateJoinConditions(Client *client, Channel *channel, const ArenaTokens &tokens)
 {
 	int clientFd = client->getFd();
 	std::string channelName = channel->getName();
 
 	if (channel->hasMember(clientFd))
 	{
-		std::cout << "Client already in channel" << std::endl;
+		LOG(LEVEL_DEBUG, SUB_CHANNEL) << "Client already in channel";
 		return false;
 	}
 
 	// Sprawdź invite-only z możliwością ominięcia przez hasło
-	if (channel->hasMode('i') && !channel->isInvited(clientFd))
+	ClientHandle handle = getClientHandle(client);
+
+	if (channel->hasMode('i') && !channel->isInvited(handle))
 	{
 		bool hasCorrectPassword = (channel->getKey() != "" && tokens.size() >= 3 && tokens[2] == channel->getKey());
 		if (!hasCorrectPassword) {
 			sendError(clientFd, "473", client->getNickname() + " " + channelName + " :Cannot join channel (+i)");
 			return false;
 		}
-		std::cout << "Client " << client->getNickname() << " joined with correct password (bypassing +i)" << std::endl;
+		LOG(LEVEL_DEBUG, SUB_CHANNEL) << "Client " << client->getNickname() << " joined with correct password (bypassing +i)";
 	}
 
 	// Sprawdź hasło (jeśli nie ominął przez +i z hasłem)
-	if (!channel->isInvited(clientFd) && channel->getKey() != "") {
+	if (!channel->isInvited(handle) && channel->getKey() != "") {
 		if (tokens.size() < 3 || tokens[2] != channel->getKey()) {
 			sendError(clientFd, "475", client->getNickname() + " " + channelName + " :Cannot join channel (+k)");
 			return false;
@@ -283,15 +291,19 @@ bool Server::validateJoinConditions(Client *client, Channel *channel, const std:
 
 void Server::joinClientToChannel(Client *client, Channel *channel, const std::string &channelName)
 {
-	int clientFd = client->getFd();
+	ClientHandle handle = getClientHandle(client);
 
+	settleOffloaded(channel->getHandle());
 	channel->addMember(client);
-	if (channel->isInvited(clientFd))
-		channel->removeInvitation(clientFd);
+	if (channel->isInvited(handle))
+		channel->removeInvitation(handle);
+	if (channel->isOperator(client->getFd()))
+		_channelStore.append(STATE_OP, channel->getName(), client->getNickname());
 
 	// Wyślij JOIN do wszystkich w kanale
 	std::string joinMsg = client->getPrefix() + " JOIN " + channelName + "\r\n";
 	channel->broadcast(joinMsg);
+	announceJoin(client, channel);
 
 	// Wyślij informacje o topicie
 	sendTopicInfo(client, channel, channelName);
@@ -299,8 +311,8 @@ void Server::joinClientToChannel(Client *client, Channel *channel, const std::st
 	// Wyślij listę użytkowników
 	sendNamesList(client, channel, channelName);
 
-	std::cout << "Client " << client->getNickname() << " joined channel " << channelName << std::endl;
-	std::cout << "Channel " << channelName << " now has " << channel->getMemberCount() << " members" << std::endl;
+	LOG(LEVEL_DEBUG, SUB_CHANNEL) << "Client " << client->getNickname() << " joined channel " << channelName;
+	LOG(LEVEL_DEBUG, SUB_CHANNEL) << "Channel " << channelName << " now has " << channel->getMemberCount() << " members";
 }
 
 void Server::sendTopicInfo(Client *client, Channel *channel, const std::string &channelName)
@@ -313,7 +325,7 @@ void Server::sendTopicInfo(Client *client, Channel *channel, const std::string &
 	else
 	{
 		std::string noTopicMsg = "331 " + client->getNickname() + " " + channelName + " :No topic is set\r\n";
-		send(client->getFd(), noTopicMsg.c_str(), noTopicMsg.length(), 0);
+		client->sendMessage(noTopicMsg);
 	}
 }
 
@@ -328,30 +340,33 @@ void Server::sendNamesList(Client *client, Channel *channel, const std::string &
 			names += "@";
 		names += it->second->getNickname();
 	}
+	const std::map<RemoteUser *, bool> &remote = channel->getRemoteMembers();
+	for (std::map<RemoteUser *, bool>::const_iterator it = remote.begin(); it != remote.end(); ++it)
+		names += std::string(names.empty() ? "" : " ") + (it->second ? "@" : "") + it->first->nickname;
 
 	std::string namesReply = "353 " + client->getNickname() + " = " + channelName + " :" + names + "\r\n";
 	std::string endNames = "366 " + client->getNickname() + " " + channelName + " :End of /NAMES list\r\n";
 	
-	send(client->getFd(), namesReply.c_str(), namesReply.length(), 0);
-	send(client->getFd(), endNames.c_str(), endNames.length(), 0);
+	client->sendMessage(namesReply);
+	client->sendMessage(endNames);
 }
 
 void Server::sendError(int clientFd, const std::string &code, const std::string &message)
 {
 	std::string response = ":server " + code + " " + message + "\r\n";
-	send(clientFd, response.c_str(), response.length(), 0);
+	sendToClient(clientFd, response);
 }
 // ====================================================================
 
 // Main event loop. As long as the server is running, this loop controls network traffic.
 void Server::eventLoop()
 {
-	std::cout << "Server listening. Type 'quit' to stop." << std::endl;
+	LOG(LEVEL_INFO, SUB_SERVER) << "Server listening. Type 'quit' to stop, 'upgrade' to hand over to the current binary.";
 
 	while (_running)
 	{
 		// poll with timeout 1000 ms
-		int ret = poll(&_pfds[0], _pfds.size(), 1000);
+		int ret = _transport->poll(&_pfds[0], _pfds.size(), pollTimeout(1000));
 		if (ret == -1)
 		{
 			if (errno == EINTR)
@@ -359,20 +374,63 @@ void Server::eventLoop()
 			throw std::runtime_error("poll() failed");
 		}
 
+		Metrics::add(C_TICKS);
+		uint64_t tickStart = Metrics::nowMicros();
+		uint64_t messagesBefore = Metrics::counter(C_MESSAGES_IN);
+		_watchdog.tickStarted(tickStart, ret, _pfds.size());
+
 		// handle events (if any) in _pfds
 		for (int i = static_cast<int>(_pfds.size()) - 1; i >= 0; --i)
 		{
-			if (_pfds[i].revents & POLLIN)
+			if (_pfds[i].revents && _pfds[i].fd != -1
+				&& (_pfds[i].fd == _metrics.getListenFd() || _metrics.isConnection(_pfds[i].fd)))
 			{
-				if (_pfds[i].fd == _listenFd)
-					handleNewConnection();
+				handleMetricsEvent(i);
+				continue;
+			}
+			if (_pfds[i].revents & POLLOUT)
+				handleClientWritable(i);
+			if (_pfds[i].fd != -1 && (_pfds[i].revents & POLLIN))
+			{
+				if (_pfds[i].fd == _listenFd || _listeners.count(_pfds[i].fd))
+					handleNewConnection(_pfds[i].fd);
 				else if (_pfds[i].fd == STDIN_FILENO)
 					handleStdinInput();
+				else if (_pfds[i].fd == _workers.wakeFd())
+					handleWorkerCompletions();
+				else if (_pfds[i].fd == _resolver.getFd())
+					handleDnsAnswers();
 				else
 					handleClientEvent(i);
 			}
 		}
+		runTimers();
+		if (Metrics::counter(C_MESSAGES_IN) != messagesBefore)
+			Metrics::record(H_COMMANDS_PER_TICK, Metrics::counter(C_MESSAGES_IN) - messagesBefore);
+		maintainLinks();
+		closeIdleScrapers();
+		if (_channelStore.graceOver())
+			_channelStore.expireRestored(_channelManager);
+		_channelStore.commit();
+		if (_channelStore.snapshotDue())
+			_channelStore.snapshot(_channelManager);
+		_watchdog.phase("flush", _clientManager.pendingFlushes());
+		flushOutput();
+		if (!_sendQExceeded.empty())
+		{
+			dropSendQExceeded();
+			flushOutput();
+		}
+		_watchdog.phase("cleanup", 0);
 		cleanupDisconnectedClients();
+		_capture.flush();
+		if (_upgradeRequested)
+			upgrade();
+		_arena.reset();
+		uint64_t tickEnd = Metrics::nowMicros();
+		_watchdog.tickFinished(tickEnd);
+		if (ret > 0)
+			Metrics::record(H_TICK_MICROS, tickEnd - tickStart);
 	}
 }
 
@@ -383,14 +441,14 @@ void Server::handleKickCommand(int clientFd, const std::string &message)
 	if (!client) return;
 	if (!client->isRegistered()) {
 		std::string response = ":server 451 " + client->getNickname() + " :You have not registered\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 3) {
 		std::string response = ":server 461 " + client->getNickname() + " KICK :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -405,38 +463,51 @@ void Server::handleKickCommand(int clientFd, const std::string &message)
 
 	if (!_channelManager.channelExists(channelName)) {
 		std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	Channel *channel = _channelManager.getChannel(channelName);
 
 	if (!channel->hasMember(clientFd)) {
 		std::string response = ":server 442 " + client->getNickname() + " " + channelName + " :You're not on that channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	if (!channel->isOperator(clientFd)) {
 		std::string response = ":server 482 " + client->getNickname() + " " + channelName + " :You're not channel operator\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
+	settleOffloaded(channel->getHandle());
 	Client *targetClient = findClientByNickname(target);
+	RemoteUser *remoteTarget = targetClient ? NULL : _network.findUser(target);
+	if (remoteTarget && channel->hasRemoteMember(remoteTarget)) {
+		channel->broadcast(client->getPrefix() + " KICK " + channelName + " " + target + " :" + reason + "\r\n");
+		channel->removeRemoteMember(remoteTarget);
+		propagate(client->getPrefix() + " KICK " + channelName + " " + target + " :" + reason + "\r\n");
+		removeIfEmpty(channel);
+		return;
+	}
 	if (!targetClient) {
 		std::string response = ":server 401 " + client->getNickname() + " " + target + " :No such nick\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	if (!channel->hasMember(targetClient->getFd())) {
 		std::string response = ":server 441 " + client->getNickname() + " " + target + " " + channelName + " :They aren't on that channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	std::string kickMsg = ":" + client->getPrefix() + " KICK " + channelName + " " + target + " :" + reason + "\r\n";
+	std::string kickMsg = client->getPrefix() + " KICK " + channelName + " " + target + " :" + reason + "\r\n";
 
 	channel->broadcast(kickMsg);
+	propagate(kickMsg);
+	journalLeave(channel, targetClient);
 	channel->removeMember(targetClient->getFd());
+	if (channel->getMemberCount() == 0)
+		_channelManager.removeChannel(channel);
 }
 
 // handle invite command; how to use: /invite user #channel
@@ -446,14 +517,14 @@ void Server::handleInviteCommand(int clientFd, const std::string &message)
 	if (!client) return;
 	if (!client->isRegistered()) {
 		std::string response = ":server 451 " + client->getNickname() + " :You have not registered\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 3) {
 		std::string response = ":server 461 " + client->getNickname() + " INVITE :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -462,37 +533,37 @@ void Server::handleInviteCommand(int clientFd, const std::string &message)
 
 	if (!_channelManager.channelExists(channelName)) {
 		std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	Channel *channel = _channelManager.getChannel(channelName);
 
 	if (!channel->hasMember(clientFd)) {
 		std::string response = ":server 442 " + client->getNickname() + " " + channelName + " :You're not on that channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	if (!channel->isOperator(clientFd) && channel->hasMode('i')) {
 		std::string response = ":server 482 " + client->getNickname() + " " + channelName + " :You're not channel operator\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	Client *targetClient = findClientByNickname(target);
 	if (!targetClient) {
 		std::string response = ":server 401 " + client->getNickname() + " " + target + " :No such nick\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	if (channel->hasMember(targetClient->getFd())) {
 		std::string response = ":server 443 " + client->getNickname() + " " + target + " " + channelName + " :is already on channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
-	channel->addInvitation(targetClient->getFd());
+	channel->addInvitation(getClientHandle(targetClient));
 
 	std::string confirmMsg = ":server 341 " + client->getNickname() + " " + target + " " + channelName + "\r\n";
-	send(clientFd, confirmMsg.c_str(), confirmMsg.length(), 0);
+	sendToClient(clientFd, confirmMsg);
 	std::string inviteMsg = client->getPrefix() + " INVITE " + target + " :" + channelName + "\r\n";
 	targetClient->sendMessage(inviteMsg);
 }
@@ -504,14 +575,14 @@ void Server::handleTopicCommand(int clientFd, const std::string &message)
 	if (!client) return;
 	if (!client->isRegistered()) {
 		std::string response = ":server 451 " + client->getNickname() + " :You have not registered\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 2) {
 		std::string response = ":server 461 " + client->getNickname() + " TOPIC :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -520,7 +591,7 @@ void Server::handleTopicCommand(int clientFd, const std::string &message)
 	Channel *channel;
 	if (!_channelManager.channelExists(channelName)) {
 		std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 	channel = _channelManager.getChannel(channelName);
@@ -532,7 +603,7 @@ void Server::handleTopicCommand(int clientFd, const std::string &message)
 			response = ":server 331 " + client->getNickname() + " " + channelName + " :No topic is set\r\n";
 		else
 			response = ":server 332 " + client->getNickname() + " " + channelName + " :" + topic + "\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -540,22 +611,22 @@ void Server::handleTopicCommand(int clientFd, const std::string &message)
 
 	if (channel->hasMode('t') && !channel->isOperator(clientFd)) {
 		std::string response = ":server 482 " + client->getNickname() + " " + channelName + " :You're not channel operator\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	channel->setTopic(newTopic);
+	_channelStore.append(STATE_TOPIC, channel->getName(), newTopic);
 	std::string topicMsg = client->getPrefix() + " TOPIC " + channelName + " :" + newTopic + "\r\n";
 	channel->broadcast(topicMsg);
+	propagate(topicMsg);
 }
 
 // add client
 void Server::addClient(Client *client, int clientFd)
 {
-	if (client) {
-		_clients.push_back(client);
-		std::cout << "Client added to list (total: " << _clients.size() << ")" << std::endl;
-	}
+	if (client)
+		LOG(LEVEL_DEBUG, SUB_CLIENT) << "Client added to list (total: " << _clientManager.size() << ")";
 	struct pollfd pfd;
 	pfd.fd = clientFd;
 	pfd.events = POLLIN;
@@ -569,29 +640,42 @@ void Server::handleNickCommand(int clientFd, const std::string &message)
 	if (!client)
 		return;
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 2)
 	{
 		std::string response = ":server 431 :No nickname given\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	std::string newNick = tokens[1];
+	std::string oldNick = client->getNickname();
+	std::string oldPrefix = client->getPrefix();
+
+	// claim the nickname (fails if another client, here or on a linked server, already uses it)
+	if (_network.findUser(newNick) || !_clientManager.setNickname(client, newNick))
+	{
+		std::string response = ":server 433 " + newNick + " :Nickname is already in use\r\n";
+		sendToClient(clientFd, response);
+		return;
+	}
 
-	// check if nickname is already in use
-	for (size_t i = 0; i < _clients.size(); ++i)
+	// saved operators are nicknames, follow the rename
+	const std::vector<ChannelHandle> &channels = client->getChannels();
+	for (size_t i = 0; i < channels.size() && _channelStore.enabled(); ++i)
 	{
-		if (_clients[i]->getFd() != clientFd && _clients[i]->getNickname() == newNick)
+		Channel *channel = _channelManager.getChannel(channels[i]);
+		if (channel && channel->isOperator(clientFd))
 		{
-			std::string response = ":server 433 " + newNick + " :Nickname is already in use\r\n";
-			send(clientFd, response.c_str(), response.length(), 0);
-			return;
+			_channelStore.append(STATE_DEOP, channel->getName(), oldNick);
+			_channelStore.append(STATE_OP, channel->getName(), newNick);
 		}
 	}
 
-	client->setNickname(newNick);
-	std::cout << "Client " << clientFd << " set nickname to: " << newNick << std::endl;
+	if (client->isRegistered() && newNick != oldNick)
+		propagate(oldPrefix + " NICK " + newNick + "\r\n");
+
+	LOG(LEVEL_DEBUG, SUB_CLIENT) << "Client " << clientFd << " set nickname to: " << newNick;
 
 	// check if registration should be completed
 	if (!client->isRegistered())
@@ -601,10 +685,7 @@ void Server::handleNickCommand(int clientFd, const std::string &message)
 }
 
 Client* Server::findClientByNickname(std::string const &nickname) const {
-	for (size_t i = 0; i < this->_clients.size(); ++i)
-		if (this->_clients[i]->getNickname() == nickname)
-			return this->_clients[i];
-	return NULL;
+	return _clientManager.getByNickname(nickname);
 }
 
 // handle user command
@@ -614,17 +695,17 @@ void Server::handleUserCommand(int clientFd, const std::string &message)
 	if (!client)
 		return;
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 5)
 	{
 		std::string response = ":server 461 USER :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
 	client->setUsername(tokens[1]);
 	client->setRealname(message.substr(message.find(tokens[4])));
-	std::cout << "Client " << clientFd << " set username to: " << tokens[1] << std::endl;
+	LOG(LEVEL_DEBUG, SUB_CLIENT) << "Client " << clientFd << " set username to: " << tokens[1];
 
 	// check if registration should be completed
 	if (!client->isRegistered())
@@ -640,11 +721,11 @@ void Server::handlePassCommand(int clientFd, const std::string &message)
 	if (!client)
 		return;
 
-	std::vector<std::string> tokens = ft_split(message, ' ');
+	ArenaTokens tokens = ft_split(message, ' ');
 	if (tokens.size() < 2)
 	{
 		std::string response = ":server 461 PASS :Not enough parameters\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
+		sendToClient(clientFd, response);
 		return;
 	}
 
@@ -652,28 +733,28 @@ void Server::handlePassCommand(int clientFd, const std::string &message)
 	if (providedPassword == _password)
 	{
 		client->setPasswordVerified(true);
-		std::cout << "Client " << clientFd << " provided correct password" << std::endl;
+		LOG(LEVEL_DEBUG, SUB_CLIENT) << "Client " << clientFd << " provided correct password";
 	}
+	else if (_authFailureDelayMs > 0)
+		startTask(new AuthFailureTask(this, false), client);
 	else
-	{
-		std::string response = ":server 464 :Password incorrect\r\n";
-		send(clientFd, response.c_str(), response.length(), 0);
-		close(clientFd);
-		// Usuń klienta z listy
-		for (size_t i = 0; i < _clients.size(); ++i)
-		{
-			if (_clients[i]->getFd() == clientFd)
-			{
-				delete _clients[i];
-				_clients.erase(_clients.begin() + i);
-				break;
-			}
-		}
-		for (size_t i = 0; i < _pfds.size(); ++i) {
-			if (_pfds[i].fd == clientFd) {
-				_pfds.erase(_pfds.begin() + i);
-				break;
-			}
+		rejectPassword(client);
+}
+
+void Server::rejectPassword(Client *client)
+{
+	int clientFd = client->getFd();
+	std::string response = ":server 464 :Password incorrect\r\n";
+	client->sendMessage(response);
+	client->flush(*_transport);
+	_transport->close(clientFd);
+	_capture.close(clientFd);
+	// Usuń klienta z listy
+	retireClient(client);
+	for (size_t i = 0; i < _pfds.size(); ++i) {
+		if (_pfds[i].fd == clientFd) {
+			_pfds.erase(_pfds.begin() + i);
+			break;
 		}
 	}
 }
@@ -696,6 +777,8 @@ void Server::completeRegistration(Client *client)
 		return;
 
 	client->setRegistered(true);
+	propagate(introduction(client->getNickname(), 0, client->getUsername(), client->getHostname(), _network.name(),
+		client->getRealname()));
 
 	client->sendMessage(":server 001 " + client->getNickname() +
 		" :Welcome to the Internet Relay Network " + client->getPrefix());
@@ -708,34 +791,39 @@ void Server::completeRegistration(Client *client)
 
 	joindefaultChannel(client->getFd());
 
-	std::cout << "Client " << client->getFd() << " (" << client->getNickname()
-			<< ") successfully registered" << std::endl;
+	LOG(LEVEL_INFO, SUB_CLIENT) << "Client " << client->getFd() << " (" << client->getNickname()
+			<< ") successfully registered";
 }
 
-// find client by fd
+// find client by fd (the pool rejects the handle if the client is already gone)
 Client *Server::findClientByFd(int clientFd)
 {
-	for (size_t i = 0; i < _clients.size(); ++i)
-	{
-		if (_clients[i]->getFd() == clientFd)
-		{
-			return _clients[i];
-		}
-	}
-	return NULL;
+	return _clientManager.getByFd(clientFd);
 }
 
-// split string
-std::vector<std::string> Server::ft_split(const std::string &str, char delimiter)
+// get generation-checked handle of a client
+ClientHandle Server::getClientHandle(const Client *client) const
 {
-	std::vector<std::string> tokens;
-	std::string token;
-	std::istringstream tokenStream(str);
+	return _clientManager.getHandle(client);
+}
 
-	while (std::getline(tokenStream, token, delimiter))
+// split string (the vector lives in the arena, short tokens stay in std::string's inline buffer)
+ArenaTokens Server::ft_split(const std::string &str, char delimiter)
+{
+	ArenaTokens tokens((ArenaAllocator<std::string>(_arena)));
+	size_t start = 0;
+
+	while (start < str.size())
 	{
-		if (!token.empty())
-			tokens.push_back(token);
+		size_t end = str.find(delimiter, start);
+		if (end == std::string::npos)
+			end = str.size();
+		if (end > start)
+		{
+			tokens.push_back(std::string());
+			tokens.back().assign(str, start, end - start);
+		}
+		start = end + 1;
 	}
 	return tokens;
 }
@@ -754,25 +842,35 @@ std::vector<std::string> Server::ft_split(const std::string &str, char delimiter
 //		(_pdfs()		- vector is default initialized to empty)
 //		_listenFd = -1	- socket not created yet
 Server::Server(int port, const std::string &password)
-	: _port(port), _password(password), _listenFd(-1), _pfds(), _running(true) {}
+	: _transport(&_sockets), _port(port), _password(password), _listenFd(-1), _pfds(), _running(true),
+	  _upgradeRequested(false), _adopting(false), _offloadBytes(0), _authFailureDelayMs(0), _dnsTimeoutMs(0) {}
+
+// constructor with another transport (the simulator's loopback)
+Server::Server(int port, const std::string &password, Transport &transport)
+	: _transport(&transport), _port(port), _password(password), _listenFd(-1), _pfds(), _running(true),
+	  _upgradeRequested(false), _adopting(false), _offloadBytes(0), _authFailureDelayMs(0), _dnsTimeoutMs(0) {}
 
 // destructor
 //		_pfds[0] = _listenFd (we don't need to close it separately)
 Server::~Server()
 {
+	dropOffloaded();
+	dropTasks();
+	closeResolver();
+	_shards.stop();
+	saveChannels();
+
 	// close all sockets (file descriptors)
 	for (size_t i = 0; i < _pfds.size(); ++i)
 	{
 		if (_pfds[i].fd != -1)
-			close(_pfds[i].fd);
+			_transport->close(_pfds[i].fd);
 	}
 
+	removeSockets();
+
 	// delete all clients
-	for (size_t i = 0; i < _clients.size(); ++i)
-	{
-		delete _clients[i];
-	}
-	_clients.clear();
+	_clientManager.clear();
 
 	_pfds.clear();
 }
@@ -846,9 +944,36 @@ void Server::setPortNumber(int p)
 // start server
 void Server::start()
 {
-	std::cout << "Server starting..." << std::endl;
-
-	setupSocket();
+	bool configured = _config.load(CONFIG_PATH);
+	setupLogging();
+	LOG(LEVEL_INFO, SUB_SERVER) << "Server starting...";
+	if (configured)
+		LOG(LEVEL_INFO, SUB_SERVER) << "Loaded " CONFIG_PATH " (" << _config.operatorCount() << " operators)";
+	Metrics::start();
+
+	// started by "upgrade" in an older process: sockets and state come from it
+	int handoff = Handoff::inherited();
+	_adopting = handoff != -1;
+	setupCapture(handoff != -1);
+	setupWatchdog();
+	setupShards();
+	setupChannelStore(handoff == -1);
+	if (handoff == -1)
+		setupSocket();
+	else
+		adoptState(handoff);
+	setupListeners();
+	setupLinks();
+	setupWorkers();
+	setupAuthDelay();
+	setupResolver();
+	setupMetricsEndpoint();
+	if (handoff != -1)
+	{
+		Handoff::acknowledge(handoff);
+		close(handoff);
+		_adopting = false;
+	}
 	eventLoop();
 }
 
@@ -856,28 +981,56 @@ void Server::start()
 // Finish program:
 // ====================================================================
 
+// operators are saved by nickname, so the last snapshot is taken while the clients still exist;
+// a process that failed to take over from an older one has a partial state and leaves the files alone
+void Server::saveChannels()
+{
+	if (!_channelStore.enabled() || _adopting)
+		return;
+	_channelStore.snapshot(_channelManager);
+	_channelStore.close();
+}
+
+// after an upgrade the new process owns them: the paths were forgotten then; before it, the old one still does
+void Server::removeSockets()
+{
+	if (_adopting)
+		_socketPaths.clear();
+	for (size_t i = 0; i < _socketPaths.size(); ++i)
+		unlink(_socketPaths[i].c_str());
+	_socketPaths.clear();
+}
+
 // stop server
 void Server::stop()
 {
 	_running = false;
 
+	dropOffloaded();
+	dropTasks();
+	closeResolver();
+	_shards.stop();
+	saveChannels();
+
 	// close all clients
-	for (size_t i = 0; i < _clients.size(); ++i)
+	const std::vector<Client*> &clients = _clientManager.getClients();
+	for (size_t i = 0; i < clients.size(); ++i)
 	{
-		if (_clients[i])
-		{
-			close(_clients[i]->getFd());
-			delete _clients[i];
-		}
+		if (clients[i])
+			_transport->close(clients[i]->getFd());
 	}
-	_clients.clear();
+	_clientManager.clear();
 
 	// close listening socket
 	if (_listenFd != -1)
 	{
-		close(_listenFd);
+		_transport->close(_listenFd);
 		_listenFd = -1;
 	}
+	for (std::map<int, ListenConfig>::iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+		_transport->close(it->first);
+	_listeners.clear();
+	removeSockets();
 
 	// clear pollfd vector (file descriptors)
 	_pfds.clear();
@@ -885,19 +1038,19 @@ void Server::stop()
 
 // finish program and clean resources in case of out of memory
 void Server::shutdownGracefully() {
-	std::cout << "Closing all client connections..." << std::endl;
+	LOG(LEVEL_INFO, SUB_SERVER) << "Closing all client connections...";
 
-	for (size_t i = 0; i < _clients.size(); ++i) {
-		int fd = _clients[i]->getFd();
-		close(fd);
-		delete _clients[i];
+	const std::vector<Client*> &clients = _clientManager.getClients();
+	for (size_t i = 0; i < clients.size(); ++i) {
+		int fd = clients[i]->getFd();
+		_transport->close(fd);
 	}
-	_clients.clear();
+	_clientManager.clear();
 
 	for (size_t i = 0; i < _pfds.size(); ++i)
-		close(_pfds[i].fd);
+		_transport->close(_pfds[i].fd);
 
-	close(_listenFd);
+	_transport->close(_listenFd);
 
-	std::cout << "Server shut down cleanly." << std::endl;
+	LOG(LEVEL_INFO, SUB_SERVER) << "Server shut down cleanly.";
 }
@@ -0,0 +1,278 @@
+#include "SocketTransport.hpp"
+#include <stdexcept>	// for std::runtime_error
+#include <cstring>		// for std::memset, std::strerror
+#include <cerrno>		// for errno
+#include <unistd.h>		// for close, read, STDIN_FILENO
+#include <fcntl.h>		// for fcntl, O_NONBLOCK, F_SETFL
+#include <sys/socket.h>	// for socket, setsockopt, bind, listen, accept, recv, send
+#include <netinet/in.h>	// for sockaddr_in, INADDR_ANY, htons
+#include <arpa/inet.h>	// for getsockname, inet_ntop
+#include <netinet/tcp.h>	// for TCP_NODELAY
+#include <netdb.h>		// for getaddrinfo
+#include <sys/un.h>		// for sockaddr_un
+#include <sys/stat.h>	// for lstat, chmod, S_ISSOCK
+#include <sstream>		// for std::ostringstream
+
+// IPv4-mapped peers read as IPv4; an IPv6 address starting with ':' gets a '0' so it cannot end a prefix
+static std::string peerName(const struct sockaddr_storage &peer)
+{
+	char text[INET6_ADDRSTRLEN];
+	if (peer.ss_family == AF_INET)
+		return inet_ntop(AF_INET, &((const struct sockaddr_in *)&peer)->sin_addr, text, sizeof(text)) ? text : "";
+	if (peer.ss_family != AF_INET6)
+		return "localhost";
+	const struct in6_addr &address = ((const struct sockaddr_in6 *)&peer)->sin6_addr;
+	if (IN6_IS_ADDR_V4MAPPED(&address))
+		return inet_ntop(AF_INET, address.s6_addr + 12, text, sizeof(text)) ? text : "";
+	if (!inet_ntop(AF_INET6, &address, text, sizeof(text)))
+		return "";
+	return text[0] == ':' ? std::string("0") + text : text;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// set socket to non-blocking mode
+void SocketTransport::setNonBlocking(int fd)
+{
+	// load existing file descriptor flags
+	int flags = fcntl(fd, F_GETFL, 0); // F_GETFL - get file descriptor flags
+	if (flags == -1)
+		throw std::runtime_error("fcntl(F_GETFL) failed");
+
+	// set non-blocking mode flag
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) // F_SETFL - set file descriptor flags
+		throw std::runtime_error("fcntl(F_SETFL) failed");
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// a socket file left behind by a server that is gone (connect refused) is removed; a live one is not
+void SocketTransport::removeStaleSocket(const struct sockaddr_un &address)
+{
+	struct stat info;
+	if (lstat(address.sun_path, &info) == -1 || !S_ISSOCK(info.st_mode))
+		return;
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe == -1)
+		return;
+	if (connect(probe, (const struct sockaddr *)&address, sizeof(address)) == -1 && errno == ECONNREFUSED)
+		unlink(address.sun_path);
+	::close(probe);
+}
+
+// create, configure, bind and listen; the descriptor is closed again if any step fails
+int SocketTransport::listen(int &port, int backlog)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0); // AF_INET - IPv4, SOCK_STREAM - TCP, 0 - default
+	if (fd == -1)
+		throw std::runtime_error("socket() failed");
+
+	try
+	{
+		setNonBlocking(fd);
+
+		int opt = 1;
+		// SOL_SOCKET - socket level, SO_REUSEADDR - allow reuse of local addresses
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+			throw std::runtime_error("setsockopt() failed");
+
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = INADDR_ANY;
+		addr.sin_port = htons(port);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+			throw std::runtime_error(std::string("bind() failed: ") + strerror(errno));
+
+		// check actual port used by socket
+		socklen_t addrlen = sizeof(addr);
+		if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) == -1)
+			throw std::runtime_error("getsockname() failed");
+		port = ntohs(addr.sin_port); // convert port number from network byte order to host byte order
+
+		if (::listen(fd, backlog) == -1)
+			throw std::runtime_error("listen() failed");
+	}
+	catch (...)
+	{
+		::close(fd);
+		throw;
+	}
+	return fd;
+}
+
+/*
+	Sockets are created non-blocking; options set on the listener (TCP_NODELAY,
+	buffer sizes) are inherited by the accepted connections. A Unix socket
+	path is replaced only if nothing answers on it any more; removing it
+	again is the server's business (not after an upgrade handed it on).
+*/
+int SocketTransport::listen(const ListenConfig &endpoint)
+{
+	struct sockaddr_storage address;
+	socklen_t length;
+	std::memset(&address, 0, sizeof(address));
+	if (endpoint.family == AF_UNIX)
+	{
+		struct sockaddr_un *local = (struct sockaddr_un *)&address;
+		if (endpoint.host.size() >= sizeof(local->sun_path))
+			throw std::runtime_error("socket path too long: " + endpoint.host);
+		local->sun_family = AF_UNIX;
+		endpoint.host.copy(local->sun_path, endpoint.host.size());
+		length = sizeof(struct sockaddr_un);
+		removeStaleSocket(*local);
+	}
+	else if (endpoint.family == AF_INET6)
+	{
+		struct sockaddr_in6 *ip = (struct sockaddr_in6 *)&address;
+		ip->sin6_family = AF_INET6;
+		ip->sin6_port = htons(endpoint.port);
+		if (inet_pton(AF_INET6, endpoint.host.c_str(), &ip->sin6_addr) != 1)
+			throw std::runtime_error("invalid IPv6 address: " + endpoint.host);
+		length = sizeof(struct sockaddr_in6);
+	}
+	else
+	{
+		struct sockaddr_in *ip = (struct sockaddr_in *)&address;
+		ip->sin_family = AF_INET;
+		ip->sin_port = htons(endpoint.port);
+		if (inet_pton(AF_INET, endpoint.host.c_str(), &ip->sin_addr) != 1)
+			throw std::runtime_error("invalid IPv4 address: " + endpoint.host);
+		length = sizeof(struct sockaddr_in);
+	}
+
+	int fd = socket(endpoint.family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd == -1)
+		throw std::runtime_error(std::string("socket() failed: ") + strerror(errno));
+	bool bound = false;
+	try
+	{
+		int one = 1;
+		int v6only = endpoint.v6only;
+		if (endpoint.family != AF_UNIX && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1)
+			throw std::runtime_error("setsockopt(SO_REUSEADDR) failed");
+		// Linux defaults to dual-stack, but the sysctl may say otherwise
+		if (endpoint.family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) == -1)
+			throw std::runtime_error("setsockopt(IPV6_V6ONLY) failed");
+		if (endpoint.noDelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+			throw std::runtime_error("setsockopt(TCP_NODELAY) failed");
+		if (endpoint.deferAccept > 0 && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+				&endpoint.deferAccept, sizeof(endpoint.deferAccept)) == -1)
+			throw std::runtime_error("setsockopt(TCP_DEFER_ACCEPT) failed");
+		if (endpoint.receiveBuffer > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+				&endpoint.receiveBuffer, sizeof(endpoint.receiveBuffer)) == -1)
+			throw std::runtime_error("setsockopt(SO_RCVBUF) failed");
+		if (endpoint.sendBuffer > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+				&endpoint.sendBuffer, sizeof(endpoint.sendBuffer)) == -1)
+			throw std::runtime_error("setsockopt(SO_SNDBUF) failed");
+
+		if (bind(fd, (struct sockaddr *)&address, length) == -1)
+			throw std::runtime_error(std::string("bind() failed: ") + strerror(errno));
+		bound = true;
+		if (endpoint.family == AF_UNIX && endpoint.mode >= 0 && chmod(endpoint.host.c_str(), endpoint.mode) == -1)
+			throw std::runtime_error(std::string("chmod() failed: ") + strerror(errno));
+		if (::listen(fd, endpoint.backlog) == -1)
+			throw std::runtime_error(std::string("listen() failed: ") + strerror(errno));
+	}
+	catch (...)
+	{
+		if (bound && endpoint.family == AF_UNIX)
+			unlink(endpoint.host.c_str());
+		::close(fd);
+		throw;
+	}
+	return fd;
+}
+
+// accept4() sets O_NONBLOCK in the same call
+int SocketTransport::accept(int listenFd, std::string &host)
+{
+	struct sockaddr_storage peer;
+	socklen_t length = sizeof(peer);
+	int fd = accept4(listenFd, (struct sockaddr *)&peer, &length, SOCK_NONBLOCK);
+	if (fd == -1)
+		return -1;
+	if (_tls.isSecure(listenFd) && !_tls.attach(fd))
+	{
+		::close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	host = peerName(peer);
+	return fd;
+}
+
+// resolving a name blocks; linked servers are normally given by address
+int SocketTransport::dial(const std::string &host, int port)
+{
+	struct addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	std::ostringstream service;
+	service << port;
+	struct addrinfo *address = NULL;
+	if (getaddrinfo(host.c_str(), service.str().c_str(), &hints, &address) != 0 || !address)
+		return -1;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd != -1 && fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+	{
+		::close(fd);
+		fd = -1;
+	}
+	if (fd != -1)
+	{
+		// server traffic is many small lines relayed as they come
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (connect(fd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS)
+		{
+			::close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(address);
+	return fd;
+}
+
+ssize_t SocketTransport::recv(int fd, char *buf, size_t length)
+{
+	if (_tls.isConnection(fd))
+		return _tls.recv(fd, buf, length);
+	return ::recv(fd, buf, length, 0);
+}
+
+// a peer closing its socket must not raise SIGPIPE
+ssize_t SocketTransport::send(int fd, const char *data, size_t length)
+{
+	if (_tls.isConnection(fd))
+		return _tls.send(fd, data, length);
+	return ::send(fd, data, length, MSG_NOSIGNAL);
+}
+
+void SocketTransport::close(int fd)
+{
+	_tls.close(fd);
+	::close(fd);
+}
+
+int SocketTransport::poll(pollfd *fds, size_t count, int timeoutMs)
+{
+	timeoutMs = _tls.adjustPoll(fds, count, timeoutMs);
+	int ready = ::poll(fds, count, timeoutMs);
+	return _tls.settlePoll(fds, ready);
+}
+
+ssize_t SocketTransport::readConsole(char *buf, size_t length)
+{
+	return ::read(STDIN_FILENO, buf, length);
+}
@@ -0,0 +1,557 @@
+#include "Server.hpp"
+#include "Metrics.hpp"
+#include "AllocProfile.hpp"
+#include "MemoryStats.hpp"
+#include "Log.hpp"
+#include <sstream>		// for std::ostringstream
+#include <iomanip>		// for std::setw, std::setfill
+#include <stdexcept>	// for std::runtime_error
+
+static const long	MAX_CHANNEL_SHARDS = 64;				// channel_shards is capped here
+static const long	MAX_WORKER_THREADS = 64;				// worker_threads is capped here
+
+// ====================================================================
+// operator commands:
+// ====================================================================
+
+// OPER <name> <password>
+void Server::handleOperCommand(int clientFd, const ArenaTokens &tokens)
+{
+	Client *client = findClientByFd(clientFd);
+	if (!client)
+		return;
+	if (tokens.size() < 3)
+	{
+		sendError(clientFd, "461", client->getNickname() + " OPER :Not enough parameters");
+		return;
+	}
+	if (!_config.checkOperator(tokens[1], tokens[2]))
+	{
+		if (_authFailureDelayMs > 0)
+			startTask(new AuthFailureTask(this, true), client);
+		else
+			sendError(clientFd, "464", client->getNickname() + " :Password incorrect");
+		return;
+	}
+	client->setOper(true);
+	sendError(clientFd, "381", client->getNickname() + " :You are now an IRC operator");
+	LOG(LEVEL_INFO, SUB_CLIENT) << "Client " << client->getNickname() << " is now an operator (" << tokens[1] << ")";
+}
+
+// refresh gauges that are cheaper to compute on demand than to track on every change
+void Server::updateGauges()
+{
+	long blocked = 0;
+	for (size_t i = 0; i < _pfds.size(); ++i)
+		if (_pfds[i].events & POLLOUT)
+			++blocked;
+	Metrics::set(G_CLIENTS, static_cast<long>(_clientManager.size()));
+	Metrics::set(G_CHANNELS, static_cast<long>(_channelManager.getChannelCount()));
+	Metrics::set(G_BLOCKED_CLIENTS, blocked);
+	Metrics::set(G_QUEUED_BYTES, static_cast<long>(_clientManager.getQueuedBytes()));
+	Metrics::set(G_LINKS, static_cast<long>(_network.links().size()));
+	Metrics::set(G_REMOTE_USERS, static_cast<long>(_network.users().size()));
+	Metrics::set(G_POOL_THREADS, static_cast<long>(_workers.threads()));
+	Metrics::set(G_POOL_IN_FLIGHT, static_cast<long>(_workers.inFlight()));
+	Metrics::set(G_POOL_UTILIZATION, _workers.enabled() ? _workers.utilization() : 0);
+	uint64_t lookups = Metrics::counter(C_DNS_CACHE_HITS) + Metrics::counter(C_DNS_CACHE_MISSES);
+	Metrics::set(G_DNS_CACHE_ENTRIES, static_cast<long>(_resolver.cacheSize()));
+	Metrics::set(G_DNS_CACHE_HIT_RATE, lookups == 0 ? 0 : static_cast<long>(Metrics::counter(C_DNS_CACHE_HITS) * 100 / lookups));
+}
+
+// log_file <path> (default stderr), log_level <level>, log_level_<subsystem> <level>
+void Server::setupLogging()
+{
+	LogLevel level;
+	if (Log::parseLevel(_config.get("log_level", "info"), level))
+		Log::setLevel(level);
+	for (int i = 0; i < SUB_COUNT; ++i)
+	{
+		LogSubsystem subsystem = static_cast<LogSubsystem>(i);
+		if (Log::parseLevel(_config.get(std::string("log_level_") + Log::name(subsystem), ""), level))
+			Log::setLevel(subsystem, level);
+	}
+	std::string path = _config.get("log_file", "");
+	if (!Log::start(path))
+	{
+		Log::start("");
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot open log file " << path << ", logging to stderr";
+	}
+}
+
+// capture_file <path> records every inbound line for bench/replay (mode 0600, without passwords);
+// resume appends to the trace an older process wrote before an upgrade
+void Server::setupCapture(bool resume)
+{
+	std::string path = _config.get("capture_file", "");
+	if (path.empty())
+		return;
+	if (_capture.start(path, resume))
+		LOG(LEVEL_INFO, SUB_SERVER) << "Capturing inbound traffic to " << path;
+	else
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot open capture file " << path << ", capture disabled";
+}
+
+// watchdog_ms <ms> (default 250, 0 disables), stall_log <path> (default: the server log)
+void Server::setupWatchdog()
+{
+	long threshold = _config.getInt("watchdog_ms", 250);
+	if (threshold <= 0)
+		return;
+	std::string path = _config.get("stall_log", "");
+	if (_watchdog.start(threshold, path))
+		LOG(LEVEL_INFO, SUB_SERVER) << "Watchdog reports ticks over " << threshold << " ms";
+	else
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot start the watchdog (stall_log " << path << "), stalls are not reported";
+}
+
+// channel_shards <n> (default 0: off) fans channel messages out on n shards, the event loop being one of them
+void Server::setupShards()
+{
+	long count = _config.getInt("channel_shards", 0);
+	if (count <= 0)
+		return;
+	if (_transport != &_sockets)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "channel_shards needs kernel sockets, ignored";
+		return;
+	}
+	if (count > MAX_CHANNEL_SHARDS)
+		count = MAX_CHANNEL_SHARDS;
+	if (_shards.start(count, *_transport))
+		LOG(LEVEL_INFO, SUB_SERVER) << "Channel messages fanned out on " << count << " shards";
+	else
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot start the channel shard threads, fan-out stays on the event loop";
+}
+
+// worker_threads <n> (default 0: filter on the event loop), worker_offload_bytes <n> (default 256): shorter text stays inline
+void Server::setupWorkers()
+{
+	long threads = _config.getInt("worker_threads", 0);
+	if (threads <= 0)
+		return;
+	if (_transport != &_sockets)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "worker_threads needs kernel sockets, ignored";
+		return;
+	}
+	if (threads > MAX_WORKER_THREADS)
+		threads = MAX_WORKER_THREADS;
+	long offload = _config.getInt("worker_offload_bytes", 256);
+	_offloadBytes = offload > 0 ? static_cast<size_t>(offload) : 0;
+	if (!_workers.start(threads))
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot start the worker threads, messages are filtered on the event loop";
+		return;
+	}
+	struct pollfd pfd;
+	pfd.fd = _workers.wakeFd();
+	pfd.events = POLLIN;
+	_pfds.push_back(pfd);
+	LOG(LEVEL_INFO, SUB_SERVER) << "Channel text from " << _offloadBytes << " bytes filtered on " << threads << " worker threads";
+}
+
+// auth_failure_delay_ms <ms> (default 0: at once) holds back the answer to a wrong PASS or OPER password
+void Server::setupAuthDelay()
+{
+	_authFailureDelayMs = _config.getInt("auth_failure_delay_ms", 0);
+	if (_authFailureDelayMs < 0)
+		_authFailureDelayMs = 0;
+	if (_authFailureDelayMs > 0)
+		LOG(LEVEL_INFO, SUB_SERVER) << "Wrong passwords answered after " << _authFailureDelayMs << " ms";
+}
+
+// dns_server <ipv4>[:port] (default: off) resolves the hostnames of new connections, dns_timeout_ms <ms>
+// (default 2000) bounds how long their registration waits, dns_cache_size <n> (default 4096) results are kept
+void Server::setupResolver()
+{
+	std::string server = _config.get("dns_server", "");
+	if (server.empty())
+		return;
+	if (_transport != &_sockets)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "dns_server needs kernel sockets, ignored";
+		return;
+	}
+	_dnsTimeoutMs = _config.getInt("dns_timeout_ms", 2000);
+	if (_dnsTimeoutMs <= 0)
+		_dnsTimeoutMs = 2000;
+	long cacheSize = _config.getInt("dns_cache_size", 4096);
+	if (!_resolver.start(server, cacheSize > 0 ? static_cast<size_t>(cacheSize) : 0))
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot use dns_server " << server << ", hostnames stay addresses";
+		return;
+	}
+	struct pollfd pfd;
+	pfd.fd = _resolver.getFd();
+	pfd.events = POLLIN;
+	_pfds.push_back(pfd);
+	LOG(LEVEL_INFO, SUB_SERVER) << "Hostnames resolved by " << server << " (timeout " << _dnsTimeoutMs << " ms)";
+}
+
+void Server::closeResolver()
+{
+	for (size_t i = _pfds.size(); _resolver.enabled() && i-- > 0; )
+		if (_pfds[i].fd == _resolver.getFd())
+			_pfds.erase(_pfds.begin() + i);
+	_resolver.stop();
+}
+
+// tls_cert <pem chain> and tls_key <pem> (default: the tls_cert file) for the TLS listeners; tls_tickets on|off
+// (default on), tls_session_cache <n> (default 20000) sessions, tls_ktls on|off (default on: when kernel and OpenSSL can)
+bool Server::setupTls()
+{
+	TlsSettings settings;
+	settings.certificate = _config.get("tls_cert", "");
+	settings.privateKey = _config.get("tls_key", settings.certificate);
+	settings.tickets = _config.get("tls_tickets", "on") != "off";
+	settings.sessionCache = _config.getInt("tls_session_cache", settings.sessionCache);
+	settings.kernel = _config.get("tls_ktls", "on") != "off";
+	std::string error;
+	if (!_sockets.tls().configure(settings, error))
+	{
+		LOG(LEVEL_ERROR, SUB_SERVER) << "TLS disabled: " << error;
+		return false;
+	}
+	LOG(LEVEL_INFO, SUB_SERVER) << "TLS ready" << (settings.tickets ? " (session tickets)" : "")
+		<< (settings.kernel ? ", kTLS when available" : "");
+	return true;
+}
+
+/*
+	listen <endpoint> [backlog=<n>] [v6only] [nodelay] [defer_accept=<s>] [rcvbuf=<bytes>] [sndbuf=<bytes>]
+	[mode=<octal>] [tls] lines open listeners besides the command line port, tls_port <port> is short for
+	"listen 0.0.0.0:<port> tls". Listeners an upgrade handed over are kept if still configured.
+	A listen line that does not parse stops the start, like a port that cannot be bound.
+*/
+void Server::setupListeners()
+{
+	const std::vector<std::string> &invalid = _config.getInvalidListeners();
+	for (size_t i = 0; i < invalid.size(); ++i)
+		LOG(LEVEL_ERROR, SUB_SERVER) << CONFIG_PATH " " << invalid[i] << ": invalid listen endpoint or option";
+	if (!invalid.empty())
+		throw std::runtime_error("invalid listen line in " CONFIG_PATH);
+
+	std::vector<ListenConfig> endpoints = _config.getListeners();
+	long tlsPort = _config.getInt("tls_port", 0);
+	if (tlsPort > 0 && tlsPort <= 65535)
+	{
+		ListenConfig endpoint;
+		std::ostringstream name;
+		name << "0.0.0.0:" << tlsPort;
+		endpoint.endpoint = name.str();
+		endpoint.host = "0.0.0.0";
+		endpoint.port = static_cast<int>(tlsPort);
+		endpoint.tls = true;
+		endpoints.push_back(endpoint);
+	}
+	std::map<std::string, int> adopted;
+	for (std::map<int, ListenConfig>::iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+		adopted[it->second.endpoint] = it->first;
+	_listeners.clear();
+	if (!endpoints.empty() && _transport != &_sockets)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "listen needs kernel sockets, ignored";
+		endpoints.clear();
+	}
+
+	bool tls = false;
+	for (size_t i = 0; i < endpoints.size() && !tls; ++i)
+		tls = endpoints[i].tls;
+	if (tls)
+		tls = setupTls();
+	for (size_t i = 0; i < endpoints.size(); ++i)
+	{
+		const ListenConfig &endpoint = endpoints[i];
+		if (endpoint.tls && !tls)
+			continue;
+		int fd;
+		std::map<std::string, int>::iterator it = adopted.find(endpoint.endpoint);
+		if (it != adopted.end())
+		{
+			fd = it->second;
+			adopted.erase(it);
+		}
+		else
+		{
+			try
+			{
+				fd = _sockets.listen(endpoint);
+			}
+			catch (const std::exception &e)
+			{
+				LOG(LEVEL_ERROR, SUB_SERVER) << "cannot listen on " << endpoint.endpoint << ": " << e.what();
+				continue;
+			}
+		}
+		if (endpoint.tls)
+			_sockets.tls().secure(fd);
+		if (endpoint.family == AF_UNIX)
+			_socketPaths.push_back(endpoint.host);
+		_listeners[fd] = endpoint;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		_pfds.push_back(pfd);
+		LOG(LEVEL_INFO, SUB_SERVER) << "Listening on " << endpoint.endpoint << (endpoint.tls ? " (TLS)" : "")
+			<< " (backlog " << endpoint.backlog << ")";
+	}
+	for (std::map<std::string, int>::iterator it = adopted.begin(); it != adopted.end(); ++it)
+	{
+		LOG(LEVEL_INFO, SUB_SERVER) << "Closing " << it->first << ", no longer configured";
+		_transport->close(it->second);
+	}
+}
+
+// state_dir <dir> keeps channels across restarts, state_fsync always|interval|never (default interval),
+// state_fsync_ms <ms> (default 1000), state_snapshot_seconds <s> (default 300, 0: only at shutdown),
+// state_operator_grace <s> (default 600): how long restored operators wait to rejoin (as OPER) for +o
+void Server::setupChannelStore(bool restoreChannels)
+{
+	std::string directory = _config.get("state_dir", "");
+	if (directory.empty())
+		return;
+	StateFsync fsync = STATE_FSYNC_INTERVAL;
+	std::string policy = _config.get("state_fsync", "interval");
+	if (!ChannelStore::parseFsync(policy, fsync))
+		LOG(LEVEL_WARN, SUB_SERVER) << "unknown state_fsync " << policy << ", using interval";
+	if (!_channelStore.open(directory, fsync, _config.getInt("state_fsync_ms", 1000), _config.getInt("state_snapshot_seconds", 300),
+			_config.getInt("state_operator_grace", STATE_OPERATOR_GRACE_SECONDS)))
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "cannot open the channel log in " << directory << ", channels are not saved";
+		return;
+	}
+	if (!restoreChannels)
+		return;
+	size_t restored = _channelStore.restore(_channelManager);
+	LOG(LEVEL_INFO, SUB_SERVER) << "Restored " << restored << " channels from " << directory << " (fsync " << policy << ")";
+}
+
+// metrics_socket <path> or metrics_port <port> in the config enables the scrape endpoint
+void Server::setupMetricsEndpoint()
+{
+	std::string path = _config.get("metrics_socket", "");
+	long port = _config.getInt("metrics_port", 0);
+	int fd;
+
+	if (!path.empty())
+		fd = _metrics.listenUnix(path);
+	else if (port > 0 && port <= 65535)
+		fd = _metrics.listenTcp(static_cast<int>(port));
+	else
+		return;
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	_pfds.push_back(pfd);
+	if (path.empty())
+		LOG(LEVEL_INFO, SUB_SERVER) << "Metrics endpoint listening on 127.0.0.1:" << port;
+	else
+		LOG(LEVEL_INFO, SUB_SERVER) << "Metrics endpoint listening on " << path;
+}
+
+// scrapers are served from the same loop; gauges are refreshed before their request is answered
+void Server::handleMetricsEvent(int i)
+{
+	if (_pfds[i].fd == _metrics.getListenFd())
+	{
+		int fd = _metrics.acceptConnection();
+		if (fd == -1)
+			return;
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		_pfds.push_back(pfd);
+		return;
+	}
+	if (_pfds[i].revents & POLLIN)
+		updateGauges();
+	_metrics.handleEvent(_pfds[i]);
+}
+
+// the pollfds of closed scrape connections go at the end of the tick
+void Server::closeIdleScrapers()
+{
+	std::vector<int> closed;
+	_metrics.closeIdle(Metrics::nowMicros(), closed);
+	for (size_t c = 0; c < closed.size(); ++c)
+		for (size_t i = 0; i < _pfds.size(); ++i)
+			if (_pfds[i].fd == closed[c])
+				_pfds[i].fd = -1;
+}
+
+/*
+	STATS <letter> (operator only), free-form lines use RPL_STATSDEBUG (249):
+		u - uptime						t - traffic counters and rates
+		m - per-command usage (212)		g - gauges
+		h - histograms (percentiles)	z - pools, arena and memory
+		l - per-command latency in ns (time in processSingleCommand)
+		a - per-command heap allocations (make allocprof builds only)
+		w - watchdog: stalls per command and the worst stall
+		n - server links and the servers behind them
+*/
+void Server::handleStatsCommand(int clientFd, const ArenaTokens &tokens)
+{
+	Client *client = findClientByFd(clientFd);
+	if (!client)
+		return;
+	const std::string &nick = client->getNickname();
+	if (tokens.size() < 2 || tokens[1].empty())
+	{
+		sendError(clientFd, "461", nick + " STATS :Not enough parameters");
+		return;
+	}
+	if (!client->isOper())
+	{
+		sendError(clientFd, "481", nick + " :Permission Denied- You're not an IRC operator");
+		return;
+	}
+
+	char letter = tokens[1][0];
+	time_t uptime = Metrics::uptime();
+	std::ostringstream out;
+	std::string debug = ":server 249 " + nick + " :";
+
+	updateGauges();
+	switch (letter)
+	{
+		case 'u':
+			out << ":server 242 " << nick << " :Server Up " << uptime / 86400 << " days "
+				<< (uptime / 3600) % 24 << ":" << std::setfill('0') << std::setw(2) << (uptime / 60) % 60
+				<< ":" << std::setw(2) << uptime % 60 << std::setfill(' ') << "\r\n";
+			break;
+		case 'm':
+			for (int i = 0; i < COMMAND_COUNT; ++i)
+			{
+				CommandId id = static_cast<CommandId>(i);
+				if (Metrics::commandCount(id) > 0)
+					out << ":server 212 " << nick << " " << Metrics::name(id) << " "
+						<< Metrics::commandCount(id) << " " << Metrics::commandBytes(id) << "\r\n";
+			}
+			break;
+		case 't':
+			for (int i = 0; i < COUNTER_COUNT; ++i)
+			{
+				CounterId id = static_cast<CounterId>(i);
+				out << debug << Metrics::name(id) << " " << Metrics::counter(id);
+				if (uptime > 0)
+					out << " (" << Metrics::counter(id) / uptime << "/s)";
+				out << "\r\n";
+			}
+			out << debug << "log_dropped " << Log::dropped() << "\r\n";
+			if (_capture.enabled())
+				out << debug << "capture_records " << _capture.records() << " capture_dropped " << _capture.dropped() << "\r\n";
+			if (_channelStore.enabled())
+				out << debug << "state_records " << _channelStore.records() << " state_syncs " << _channelStore.syncs()
+					<< " state_snapshots " << _channelStore.snapshots() << "\r\n";
+			break;
+		case 'g':
+			for (int i = 0; i < GAUGE_COUNT; ++i)
+				out << debug << Metrics::name(static_cast<GaugeId>(i)) << " "
+					<< Metrics::gauge(static_cast<GaugeId>(i)) << "\r\n";
+			break;
+		case 'h':
+			for (int i = 0; i < HISTOGRAM_COUNT; ++i)
+			{
+				const Histogram &h = Metrics::histogram(static_cast<HistogramId>(i));
+				out << debug << Metrics::name(static_cast<HistogramId>(i)) << " count=" << h.count()
+					<< " p50=" << h.percentile(0.50) << " p99=" << h.percentile(0.99)
+					<< " p999=" << h.percentile(0.999) << " max=" << h.max() << "\r\n";
+			}
+			break;
+		case 'l':
+			for (int i = 0; i < COMMAND_COUNT; ++i)
+			{
+				const Histogram &h = Metrics::commandLatency(static_cast<CommandId>(i));
+				if (h.count() == 0)
+					continue;
+				out << debug << Metrics::name(static_cast<CommandId>(i)) << " count=" << h.count()
+					<< " p50=" << h.percentile(0.50) << " p99=" << h.percentile(0.99)
+					<< " p999=" << h.percentile(0.999) << " max=" << h.max() << "\r\n";
+			}
+			break;
+		case 'a':
+		{
+			if (!AllocProfile::enabled())
+			{
+				out << debug << "allocation profiling not compiled in (make allocprof)\r\n";
+				break;
+			}
+			AllocStats stats[ALLOC_TAG_COUNT];
+			AllocProfile::snapshot(stats);
+			for (int i = 0; i < ALLOC_TAG_COUNT; ++i)
+			{
+				if (stats[i].allocations == 0)
+					continue;
+				out << debug << AllocProfile::name(i) << " allocs=" << stats[i].allocations
+					<< " bytes=" << stats[i].bytes << " live=" << stats[i].liveBytes
+					<< " peak=" << stats[i].peakLiveBytes;
+				if (i < COMMAND_COUNT && Metrics::commandCount(static_cast<CommandId>(i)) > 0)
+					out << " per-line=" << static_cast<double>(stats[i].allocations) / Metrics::commandCount(static_cast<CommandId>(i));
+				out << "\r\n";
+			}
+			break;
+		}
+		case 'w':
+		{
+			const StallReport &worst = _watchdog.worst();
+			out << debug << "watchdog threshold=" << _watchdog.thresholdMillis() << "ms stalls="
+				<< Metrics::counter(C_STALLS) << "\r\n";
+			if (worst.micros > 0)
+			{
+				out << debug << "worst " << worst.micros / 1000 << "ms in ";
+				if (worst.command >= 0)
+					out << Metrics::name(static_cast<CommandId>(worst.command)) << " nick="
+						<< (worst.nickname[0] ? worst.nickname : "*") << " target=" << (worst.target[0] ? worst.target : "*");
+				else
+					out << worst.phase;
+				out << " tick=" << worst.tick << " lines=" << worst.lines << " outbox=" << worst.outbox << "\r\n";
+			}
+			for (int i = 0; i < COMMAND_COUNT; ++i)
+			{
+				CommandId id = static_cast<CommandId>(i);
+				if (Metrics::commandStalls(id) > 0)
+					out << debug << Metrics::name(id) << " stalls=" << Metrics::commandStalls(id)
+						<< " max=" << Metrics::commandStallMax(id) / 1000 << "ms\r\n";
+			}
+			break;
+		}
+		case 'n':
+		{
+			out << debug << "server " << _network.name() << " links=" << _network.links().size()
+				<< " servers=" << _network.servers().size() << " remote_users=" << _network.users().size() << "\r\n";
+			for (std::map<std::string, RemoteServer>::const_iterator it = _network.servers().begin();
+				it != _network.servers().end(); ++it)
+			{
+				Client *link = findClientByFd(it->second.link);
+				out << debug << it->first << " hops=" << it->second.hops << " via=" << _network.peerOf(it->second.link);
+				if (it->second.hops == 1 && link)
+					out << " queued=" << link->getQueuedBytes();
+				out << "\r\n";
+			}
+			break;
+		}
+		case 'z':
+		{
+			PoolStats clients = _clientManager.getHotStats();
+			PoolStats channels = _channelManager.getPoolStats();
+			ArenaStats arena = _arena.stats();
+			MemoryStats memory = MemoryStats::read();
+			out << debug << "clients live=" << clients.live << " peak=" << clients.peakLive
+				<< " slabs=" << clients.slabs << "\r\n"
+				<< debug << "channels live=" << channels.live << " peak=" << channels.peakLive
+				<< " slabs=" << channels.slabs << "\r\n"
+				<< debug << "arena blocks=" << arena.blocks << " peak-tick=" << arena.peakTickBytes << "\r\n"
+				<< debug << "memory rss=" << memory.rss / 1024 << "KB in-use=" << memory.heapInUse / 1024
+				<< "KB free=" << memory.heapFree / 1024 << "KB\r\n";
+			break;
+		}
+		default:
+			break;
+	}
+	out << ":server 219 " << nick << " " << letter << " :End of STATS report\r\n";
+	client->sendMessage(out.str());
+}
@@ -0,0 +1,241 @@
+#include "Server.hpp"
+#include "Metrics.hpp"
+#include "Clock.hpp"
+#include "Log.hpp"
+#include <arpa/inet.h>	// for inet_pton
+
+// ====================================================================
+// command tasks:
+// ====================================================================
+
+// the client's later lines wait in its receive buffer until this one is done
+void Server::startTask(CommandTask *task, Client *client)
+{
+	task->client = getClientHandle(client);
+	task->fd = client->getFd();
+	if (task->resume() == TASK_DONE)
+	{
+		delete task;
+		return;
+	}
+	client->setSuspended(true);
+	_tasks.insert(task);
+}
+
+// a task whose client is gone is dropped; a finished one lets the held back lines run
+void Server::resumeTask(CommandTask *task)
+{
+	// resumed before its sleep ended (what it waited for came first)
+	if (task->wakeAt != 0)
+	{
+		std::pair<std::multimap<uint64_t, CommandTask*>::iterator, std::multimap<uint64_t, CommandTask*>::iterator>
+			range = _timers.equal_range(task->wakeAt);
+		for (std::multimap<uint64_t, CommandTask*>::iterator it = range.first; it != range.second; ++it)
+			if (it->second == task)
+			{
+				_timers.erase(it);
+				break;
+			}
+		task->wakeAt = 0;
+	}
+	Client *client = _clientManager.get(task->client);
+	if (client && _clientManager.isAlive(client) && task->resume() == TASK_SUSPENDED)
+		return;
+	_tasks.erase(task);
+	delete task;
+	if (!client || !_clientManager.isAlive(client))
+		return;
+	client->setSuspended(false);
+	// the first waiting line started when its first byte arrived, not now
+	uint64_t now = Clock::now();
+	processBufferedLines(client, now, client->hasBufferedInput() ? client->getLineStart() : now);
+}
+
+void Server::sleepTask(CommandTask *task, long ms)
+{
+	task->wakeAt = Metrics::nowMicros() + static_cast<uint64_t>(ms) * 1000;
+	_timers.insert(std::make_pair(task->wakeAt, task));
+}
+
+// after the events of a tick, so the lines they release are flushed with them
+void Server::runTimers()
+{
+	uint64_t now = Metrics::nowMicros();
+	while (!_timers.empty() && _timers.begin()->first <= now)
+	{
+		CommandTask *task = _timers.begin()->second;
+		_timers.erase(_timers.begin());
+		task->wakeAt = 0;
+		resumeTask(task);
+	}
+}
+
+int Server::pollTimeout(int ms) const
+{
+	if (_timers.empty())
+		return ms;
+	uint64_t now = Metrics::nowMicros();
+	uint64_t wakeAt = _timers.begin()->first;
+	if (wakeAt <= now)
+		return 0;
+	uint64_t left = (wakeAt - now + 999) / 1000;
+	return left < static_cast<uint64_t>(ms) ? static_cast<int>(left) : ms;
+}
+
+void Server::dropTasks()
+{
+	for (std::set<CommandTask*>::iterator it = _tasks.begin(); it != _tasks.end(); ++it)
+		delete *it;
+	_tasks.clear();
+	_timers.clear();
+}
+
+// ====================================================================
+// tasks:
+// ====================================================================
+
+// runs on only while the client is connected; its later lines wait meanwhile
+TaskState Server::AuthFailureTask::resume()
+{
+	TASK_BEGIN();
+	server->sleepTask(this, server->_authFailureDelayMs);
+	TASK_AWAIT();
+	if (oper)
+	{
+		Client *self = server->_clientManager.get(client);
+		server->sendError(fd, "464", self->getNickname() + " :Password incorrect");
+	}
+	else
+		server->rejectPassword(server->_clientManager.get(client));
+	TASK_END();
+}
+
+// ====================================================================
+// hostname lookup:
+// ====================================================================
+
+void Server::lookupHostname(Client *client)
+{
+	uint32_t address;
+	if (!_resolver.enabled() || inet_pton(AF_INET, client->getHostname().c_str(), &address) != 1)
+		return;
+	startTask(new HostLookupTask(this, address), client);
+}
+
+// answers nobody waits for any more (timed out) are dropped, so are those to another question (forged)
+void Server::handleDnsAnswers()
+{
+	DnsAnswer answer;
+	while (_resolver.receive(answer))
+	{
+		std::map<uint16_t, HostLookupTask*>::iterator it = _lookups.find(answer.id);
+		if (it == _lookups.end())
+			continue;
+		HostLookupTask *task = it->second;
+		if (answer.type != task->questionType || !Resolver::sameName(answer.question, task->question))
+		{
+			LOG(LEVEL_WARN, SUB_NET) << "DNS answer " << answer.id << " does not match its query, ignored";
+			continue;
+		}
+		_lookups.erase(it);
+		task->pending = 0;
+		task->answer = answer;
+		resumeTask(task);
+	}
+}
+
+// an empty hostname keeps the address
+void Server::finishLookup(HostLookupTask *task, const std::string &hostname, bool cached)
+{
+	if (!cached)
+		Metrics::record(H_DNS_LOOKUP_MICROS, Metrics::nowMicros() - task->started);
+	if (hostname.empty())
+	{
+		sendToClient(task->fd, ":server NOTICE * :*** Couldn't look up your hostname\r\n");
+		return;
+	}
+	_clientManager.get(task->client)->setHostname(hostname);
+	sendToClient(task->fd, cached ? ":server NOTICE * :*** Found your hostname (cached)\r\n"
+		: ":server NOTICE * :*** Found your hostname\r\n");
+}
+
+Server::HostLookupTask::~HostLookupTask()
+{
+	if (pending != 0)
+		server->_lookups.erase(pending);
+}
+
+// both queries share one deadline; an id already waited for counts as not sent
+bool Server::HostLookupTask::ask(uint16_t id, const std::string &name, uint16_t type)
+{
+	if (id == 0 || server->_lookups.count(id))
+		return false;
+	pending = id;
+	question = name;
+	questionType = type;
+	server->_lookups[id] = this;
+	uint64_t now = Metrics::nowMicros();
+	server->sleepTask(this, now < deadline ? static_cast<long>((deadline - now + 999) / 1000) : 0);
+	return true;
+}
+
+/*
+	PTR for the address, then A for the name it gave: the name is only used
+	if it leads back to the address, so nobody gets to pick their hostname
+	with their own reverse zone. Success and failure are cached; a timeout
+	is not, the server may just be slow.
+*/
+TaskState Server::HostLookupTask::resume()
+{
+	TASK_BEGIN();
+	server->sendToClient(fd, ":server NOTICE * :*** Looking up your hostname...\r\n");
+	if (server->_resolver.cached(address, hostname))
+	{
+		server->finishLookup(this, hostname, true);
+		return TASK_DONE;
+	}
+	started = Metrics::nowMicros();
+	deadline = started + static_cast<uint64_t>(server->_dnsTimeoutMs) * 1000;
+	if (!ask(server->_resolver.queryPtr(address), Resolver::reverseName(address), Resolver::TYPE_PTR))
+	{
+		server->finishLookup(this, "", false);
+		return TASK_DONE;
+	}
+	TASK_AWAIT();
+	if (pending != 0)
+	{
+		Metrics::add(C_DNS_TIMEOUTS);
+		server->finishLookup(this, "", false);
+		return TASK_DONE;
+	}
+	if (!answer.ok || answer.names.empty() || !Resolver::isValidHostname(answer.names[0]))
+	{
+		server->_resolver.store(address, "", Resolver::NEGATIVE_TTL);
+		server->finishLookup(this, "", false);
+		return TASK_DONE;
+	}
+	hostname = answer.names[0];
+	ttl = answer.ttl;
+	if (!ask(server->_resolver.queryA(hostname), hostname, Resolver::TYPE_A))
+	{
+		server->finishLookup(this, "", false);
+		return TASK_DONE;
+	}
+	TASK_AWAIT();
+	if (pending != 0)
+	{
+		Metrics::add(C_DNS_TIMEOUTS);
+		server->finishLookup(this, "", false);
+		return TASK_DONE;
+	}
+	for (size_t i = 0; answer.ok && i < answer.addresses.size(); ++i)
+		if (answer.addresses[i] == address)
+		{
+			server->_resolver.store(address, hostname, answer.ttl < ttl ? answer.ttl : ttl);
+			server->finishLookup(this, hostname, false);
+			return TASK_DONE;
+		}
+	server->_resolver.store(address, "", Resolver::NEGATIVE_TTL);
+	server->finishLookup(this, "", false);
+	TASK_END();
+}
@@ -0,0 +1,289 @@
+#include "Tls.hpp"
+#include "Metrics.hpp"
+#include <openssl/err.h>
+#include <sys/socket.h>	// for send, MSG_NOSIGNAL
+#include <csignal>		// for signal, SIGPIPE
+#include <cerrno>		// for errno, EAGAIN, EPROTO, ECONNRESET
+#include <climits>		// for INT_MAX
+
+// oldest queued OpenSSL error as text
+static std::string lastError(const std::string &what)
+{
+	char text[256];
+	unsigned long code = ERR_get_error();
+	ERR_clear_error();
+	if (code == 0)
+		return what;
+	ERR_error_string_n(code, text, sizeof(text));
+	return what + ": " + text;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+Tls::Connection *Tls::find(int fd) const
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= _connections.size())
+		return NULL;
+	return _connections[fd];
+}
+
+// 1 once the handshake is done, otherwise what recv() returns for it
+ssize_t Tls::handshake(Connection &connection)
+{
+	ERR_clear_error();
+	int result = SSL_do_handshake(connection.ssl);
+	if (result != 1)
+		return failed(connection, result);
+	connection.handshaking = false;
+	connection.wantWrite = false;
+	connection.kernelSend = BIO_get_ktls_send(SSL_get_wbio(connection.ssl));
+	Metrics::add(C_TLS_HANDSHAKES);
+	if (SSL_session_reused(connection.ssl))
+		Metrics::add(C_TLS_RESUMED);
+	if (connection.kernelSend)
+		Metrics::add(C_TLS_KTLS);
+	Metrics::record(H_TLS_HANDSHAKE_MICROS, Metrics::nowMicros() - connection.accepted);
+	return 1;
+}
+
+// would block: -1/EAGAIN; closed by the peer: 0; anything else: -1 with errno set
+ssize_t Tls::failed(Connection &connection, int result)
+{
+	int error = SSL_get_error(connection.ssl, result);
+	connection.wantWrite = error == SSL_ERROR_WANT_WRITE;
+	if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	if (connection.handshaking)
+		Metrics::add(C_TLS_FAILURES);
+	ERR_clear_error();
+	if (error == SSL_ERROR_ZERO_RETURN)
+		return 0;
+	connection.fatal = true;
+	if (error != SSL_ERROR_SYSCALL || errno == 0)
+		errno = error == SSL_ERROR_SYSCALL ? ECONNRESET : EPROTO;
+	return -1;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+Tls::Tls() : _context(NULL), _open(0) {}
+
+// destructor
+Tls::~Tls()
+{
+	for (size_t fd = 0; fd < _connections.size(); ++fd)
+		if (_connections[fd])
+			close(static_cast<int>(fd));
+	if (_context)
+		SSL_CTX_free(_context);
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+/*
+	One ticket per handshake is enough for a client that reconnects; the
+	session cache serves resumption when tickets are turned off. OpenSSL
+	writes to the socket with write(), so a peer that resets its connection
+	must not raise SIGPIPE in the whole process any more.
+*/
+bool Tls::configure(const TlsSettings &settings, std::string &error)
+{
+	SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+	if (!context)
+	{
+		error = lastError("SSL_CTX_new");
+		return false;
+	}
+	SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+	SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+		| SSL_MODE_RELEASE_BUFFERS);
+	uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF;
+	if (!settings.tickets)
+		options |= SSL_OP_NO_TICKET;
+	if (settings.kernel)
+		options |= SSL_OP_ENABLE_KTLS;
+	SSL_CTX_set_options(context, options);
+	SSL_CTX_set_session_id_context(context, reinterpret_cast<const unsigned char *>("ircserv"), 7);
+	SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(context, settings.sessionCache > 0 ? settings.sessionCache : 1);
+	SSL_CTX_set_num_tickets(context, 1);
+
+	if (SSL_CTX_use_certificate_chain_file(context, settings.certificate.c_str()) != 1)
+		error = lastError("cannot load " + settings.certificate);
+	else if (SSL_CTX_use_PrivateKey_file(context, settings.privateKey.c_str(), SSL_FILETYPE_PEM) != 1)
+		error = lastError("cannot load " + settings.privateKey);
+	else if (SSL_CTX_check_private_key(context) != 1)
+		error = lastError(settings.privateKey + " does not match the certificate");
+	else
+	{
+		if (_context)
+			SSL_CTX_free(_context);
+		_context = context;
+		signal(SIGPIPE, SIG_IGN);
+		return true;
+	}
+	SSL_CTX_free(context);
+	return false;
+}
+
+void Tls::secure(int listenFd)
+{
+	_listeners.insert(listenFd);
+}
+
+bool Tls::attach(int fd)
+{
+	SSL *ssl = SSL_new(_context);
+	if (!ssl || SSL_set_fd(ssl, fd) != 1)
+	{
+		if (ssl)
+			SSL_free(ssl);
+		ERR_clear_error();
+		return false;
+	}
+	SSL_set_accept_state(ssl);
+	if (static_cast<size_t>(fd) >= _connections.size())
+		_connections.resize(fd + 1, NULL);
+	Connection *connection = new Connection;
+	connection->ssl = ssl;
+	connection->handshaking = true;
+	connection->wantWrite = false;
+	connection->kernelSend = false;
+	connection->fatal = false;
+	connection->accepted = Metrics::nowMicros();
+	_connections[fd] = connection;
+	++_open;
+	return true;
+}
+
+ssize_t Tls::recv(int fd, char *buf, size_t length)
+{
+	Connection &connection = *find(fd);
+	if (connection.handshaking)
+	{
+		ssize_t done = handshake(connection);
+		if (done != 1)
+			return done;
+	}
+	ERR_clear_error();
+	int result = SSL_read(connection.ssl, buf, length > INT_MAX ? INT_MAX : static_cast<int>(length));
+	if (result <= 0)
+		return failed(connection, result);
+	connection.wantWrite = false;
+	return result;
+}
+
+// nothing of the server's goes out before the handshake is done
+ssize_t Tls::send(int fd, const char *data, size_t length)
+{
+	Connection &connection = *find(fd);
+	if (connection.handshaking)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	ssize_t sent;
+	if (connection.kernelSend)
+		sent = ::send(fd, data, length, MSG_NOSIGNAL);
+	else
+	{
+		ERR_clear_error();
+		int result = SSL_write(connection.ssl, data, length > INT_MAX ? INT_MAX : static_cast<int>(length));
+		if (result <= 0)
+			return failed(connection, result);
+		connection.wantWrite = false;
+		sent = result;
+	}
+	if (sent > 0)
+		Metrics::add(C_TLS_BYTES_ENCRYPTED, sent);
+	return sent;
+}
+
+// no close_notify after a fatal error (OpenSSL forbids it) or before the handshake
+void Tls::close(int fd)
+{
+	if (_listeners.erase(fd))
+		return;
+	Connection *connection = find(fd);
+	if (!connection)
+		return;
+	if (!connection->fatal && !connection->handshaking)
+		SSL_shutdown(connection->ssl);
+	SSL_free(connection->ssl);
+	ERR_clear_error();
+	delete connection;
+	_connections[fd] = NULL;
+	--_open;
+}
+
+/*
+	A handshake only waits for the direction OpenSSL asked for, never for
+	the server's POLLOUT (its output waits anyway); a connection with
+	decrypted or unprocessed bytes inside OpenSSL makes poll() return at once.
+*/
+int Tls::adjustPoll(pollfd *fds, size_t count, int timeoutMs)
+{
+	_adjusted.clear();
+	if (_open == 0)
+		return timeoutMs;
+	for (size_t i = 0; i < count; ++i)
+	{
+		Connection *connection = find(fds[i].fd);
+		if (!connection)
+			continue;
+		Adjusted adjusted = { i, fds[i].events, connection->handshaking, false };
+		if (connection->handshaking)
+			fds[i].events = POLLIN;
+		if (connection->wantWrite)
+			fds[i].events |= POLLOUT;
+		if (!connection->handshaking && SSL_has_pending(connection->ssl))
+		{
+			adjusted.buffered = true;
+			timeoutMs = 0;
+		}
+		if (fds[i].events != adjusted.events || adjusted.buffered)
+			_adjusted.push_back(adjusted);
+	}
+	return timeoutMs;
+}
+
+// POLLOUT the server did not ask for means "call recv() again"
+int Tls::settlePoll(pollfd *fds, int ready)
+{
+	for (size_t i = 0; i < _adjusted.size(); ++i)
+	{
+		const Adjusted &adjusted = _adjusted[i];
+		pollfd &pfd = fds[adjusted.index];
+		pfd.events = adjusted.events;
+		if (ready < 0)
+			continue;
+		short revents = pfd.revents;
+		if ((revents & POLLOUT) && (adjusted.handshaking || !(adjusted.events & POLLOUT)))
+			revents = (revents & ~POLLOUT) | POLLIN;
+		if (adjusted.buffered)
+			revents |= POLLIN;
+		if (revents && !pfd.revents)
+			++ready;
+		pfd.revents = revents;
+	}
+	_adjusted.clear();
+	return ready;
+}
@@ -0,0 +1,304 @@
+#include "Server.hpp"
+#include "Handoff.hpp"
+#include "Log.hpp"
+#include "Clock.hpp"
+#include <csignal>		// for kill, SIGKILL
+#include <sys/wait.h>	// for waitpid
+
+// state layout, bump when it changes (old and new binary must agree)
+static const uint32_t	HANDOFF_VERSION = 4;
+static const int		HANDOFF_TIMEOUT_MS = 10000;			// new process must adopt within this
+
+// client flags in the state
+static const uint8_t	PASSWORD_VERIFIED = 1;
+static const uint8_t	REGISTERED = 2;
+static const uint8_t	OPER = 4;
+
+// channel modes in the state
+static const uint8_t	MODE_INVITE = 1;
+static const uint8_t	MODE_TOPIC = 2;
+
+// ====================================================================
+// hot upgrade:
+// ====================================================================
+
+/*
+	Console "upgrade", at the end of a tick (replies flushed, disconnects
+	cleaned up). The new process binds its own metrics listener and appends
+	to the channel log, so both are released first and taken back if the
+	upgrade fails. Unread input stays in the kernel socket buffers and is
+	read by the new process; nothing is closed until it has acknowledged.
+*/
+void Server::upgrade()
+{
+	_upgradeRequested = false;
+	if (_transport != &_sockets)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "upgrade needs kernel sockets, ignored";
+		return;
+	}
+	for (std::map<int, ListenConfig>::const_iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+		if (it->second.tls)
+		{
+			LOG(LEVEL_WARN, SUB_SERVER) << "upgrade cannot hand over TLS sessions, ignored";
+			return;
+		}
+	if (!_network.links().empty())
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << "upgrade cannot hand over server links, ignored";
+		return;
+	}
+	// a waiting command has state on this side only: try again once it is done
+	if (!_tasks.empty())
+	{
+		_upgradeRequested = true;
+		return;
+	}
+	std::string binary = Handoff::currentBinary();
+	if (binary.empty())
+	{
+		LOG(LEVEL_ERROR, SUB_SERVER) << "upgrade: cannot find the server binary";
+		return;
+	}
+
+	uint64_t started = Metrics::nowMicros();
+	// messages still being filtered go out from here, the new process never sees them
+	if (_workers.inFlight() > 0)
+	{
+		finishOffloaded();
+		flushOutput();
+	}
+	std::string state;
+	std::vector<int> fds;
+	serializeState(state, fds);
+	closeMetricsEndpoint();
+	saveChannels();
+	_capture.stop();
+
+	std::vector<std::string> args;
+	std::ostringstream port;
+	port << _port;
+	args.push_back(port.str());
+	args.push_back(_password);
+	int channel = -1;
+	pid_t child = Handoff::spawn(binary, args, channel);
+	bool adopted = child != -1 && Handoff::send(channel, state, fds) && Handoff::waitAcknowledged(channel, HANDOFF_TIMEOUT_MS);
+	if (channel != -1)
+		close(channel);
+
+	if (adopted)
+	{
+		LOG(LEVEL_INFO, SUB_SERVER) << "Upgraded to " << binary << " (pid " << child << "): "
+			<< _clientManager.size() << " clients, " << _channelManager.getChannelCount() << " channels, "
+			<< state.size() << " bytes of state in " << (Metrics::nowMicros() - started) / 1000 << " ms";
+		_running = false;
+		_socketPaths.clear();
+		return;
+	}
+
+	LOG(LEVEL_ERROR, SUB_SERVER) << "upgrade to " << binary << " failed, still serving";
+	if (child != -1)
+	{
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+	}
+	setupCapture(true);
+	setupChannelStore(false);
+	setupMetricsEndpoint();
+}
+
+/*
+	The next capture connection id (the new process appends to the trace),
+	the other listeners by endpoint (their fds follow the first listener's),
+	clients in connection order (their fds follow the listeners'), then
+	channels with members and invitations as client indexes: fd numbers and
+	pool handles are different in the new process. Last, how much longer
+	restored operators wait.
+*/
+void Server::serializeState(std::string &state, std::vector<int> &fds)
+{
+	HandoffWriter out(state);
+	out.u32(HANDOFF_VERSION);
+	out.u32(_capture.nextConnection());
+	fds.push_back(_listenFd);
+	out.u32(static_cast<uint32_t>(_listeners.size()));
+	for (std::map<int, ListenConfig>::const_iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+	{
+		fds.push_back(it->first);
+		out.str(it->second.endpoint);
+	}
+
+	const std::vector<Client*> &clients = _clientManager.getClients();
+	std::map<int, uint32_t> indexOf;
+	std::vector<const Client*> handed;
+	for (size_t i = 0; i < clients.size(); ++i)
+		if (clients[i])
+		{
+			indexOf[clients[i]->getFd()] = static_cast<uint32_t>(handed.size());
+			handed.push_back(clients[i]);
+		}
+	out.u32(static_cast<uint32_t>(handed.size()));
+	for (size_t i = 0; i < handed.size(); ++i)
+	{
+		const Client *client = handed[i];
+		fds.push_back(client->getFd());
+		out.str(client->getHostname());
+		out.str(client->getNickname());
+		out.str(client->getUsername());
+		out.str(client->getRealname());
+		out.u8((client->isPasswordVerified() ? PASSWORD_VERIFIED : 0) | (client->isRegistered() ? REGISTERED : 0)
+			| (client->isOper() ? OPER : 0));
+		out.str(client->getReceiveBuffer());
+		out.str(client->getSendBuffer());
+	}
+
+	std::vector<std::string> names = _channelManager.getChannelNames();
+	out.u32(static_cast<uint32_t>(names.size()));
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		const Channel *channel = _channelManager.getChannel(names[i]);
+		out.str(names[i]);
+		out.str(channel->getTopic());
+		out.str(channel->getKey());
+		out.u32(static_cast<uint32_t>(channel->getUserLimit()));
+		out.u8((channel->hasMode('i') ? MODE_INVITE : 0) | (channel->hasMode('t') ? MODE_TOPIC : 0));
+
+		const std::map<int, Client *> &members = channel->getMembers();
+		out.u32(static_cast<uint32_t>(members.size()));
+		for (std::map<int, Client *>::const_iterator it = members.begin(); it != members.end(); ++it)
+		{
+			out.u32(indexOf[it->first]);
+			out.u8(channel->isOperator(it->first) ? 1 : 0);
+		}
+
+		std::vector<uint32_t> invited;
+		const std::set<ClientHandle> &invitations = channel->getInvitations();
+		for (std::set<ClientHandle>::const_iterator it = invitations.begin(); it != invitations.end(); ++it)
+		{
+			const Client *client = _clientManager.get(*it);
+			if (client)
+				invited.push_back(indexOf[client->getFd()]);
+		}
+		out.u32(static_cast<uint32_t>(invited.size()));
+		for (size_t j = 0; j < invited.size(); ++j)
+			out.u32(invited[j]);
+
+		const std::set<std::string> &restored = channel->getRestoredOperators();
+		out.u32(static_cast<uint32_t>(restored.size()));
+		for (std::set<std::string>::const_iterator it = restored.begin(); it != restored.end(); ++it)
+			out.str(*it);
+	}
+	out.u32(_channelStore.graceLeftMillis());
+}
+
+// a failure here exits without acknowledging, the old process then keeps serving
+void Server::adoptState(int channel)
+{
+	std::string state;
+	std::vector<int> fds;
+	if (!Handoff::receive(channel, state, fds) || fds.empty())
+		throw std::runtime_error("upgrade: handoff from the old process failed");
+	HandoffReader in(state);
+	if (in.u32() != HANDOFF_VERSION)
+		throw std::runtime_error("upgrade: state version mismatch");
+	_capture.continueConnections(in.u32());
+
+	_listenFd = fds[0];
+	watchListener();
+	// polled once setupListeners() has matched them with the config
+	uint32_t listeners = in.u32();
+	if (listeners > fds.size() - 1)
+		throw std::runtime_error("upgrade: listener count does not match the sockets");
+	for (uint32_t i = 0; i < listeners; ++i)
+		_listeners[fds[1 + i]].endpoint = in.str();
+
+	uint32_t count = in.u32();
+	if (count != fds.size() - 1 - listeners)
+		throw std::runtime_error("upgrade: client count does not match the sockets");
+	std::vector<Client*> adopted;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		int fd = fds[1 + listeners + i];
+		std::string host = in.str();
+		std::string nickname = in.str();
+		std::string username = in.str();
+		std::string realname = in.str();
+		uint8_t flags = in.u8();
+		std::string received = in.str();
+		std::string queued = in.str();
+
+		Client *client = _clientManager.createClient(fd, host);
+		if (!nickname.empty())
+			_clientManager.setNickname(client, nickname);
+		client->setUsername(username);
+		client->setRealname(realname);
+		client->setPasswordVerified(flags & PASSWORD_VERIFIED);
+		client->setRegistered(flags & REGISTERED);
+		client->setOper(flags & OPER);
+		client->appendBuffer(received.data(), received.size());
+		client->setLineStart(Clock::now());
+		if (!queued.empty())
+			client->sendMessage(queued.data(), queued.size());
+		_capture.open(fd);
+		addClient(client, fd);
+		adopted.push_back(client);
+	}
+
+	uint32_t channels = in.u32();
+	uint32_t waiting = 0;
+	for (uint32_t i = 0; i < channels && in.ok(); ++i)
+	{
+		Channel *channel = _channelManager.createChannel(in.str());
+		channel->setTopic(in.str());
+		channel->setKey(in.str());
+		channel->setUserLimit(static_cast<int>(in.u32()));
+		uint8_t modes = in.u8();
+		if (modes & MODE_INVITE)
+			channel->setMode('i');
+		if (modes & MODE_TOPIC)
+			channel->setMode('t');
+
+		uint32_t members = in.u32();
+		for (uint32_t j = 0; j < members && in.ok(); ++j)
+		{
+			uint32_t index = in.u32();
+			bool op = in.u8() != 0;
+			if (index >= adopted.size())
+				continue;
+			channel->addMember(adopted[index]);
+			if (op)
+				channel->addOperator(adopted[index]->getFd());
+			else
+				channel->removeOperator(adopted[index]->getFd());
+		}
+		uint32_t invitations = in.u32();
+		for (uint32_t j = 0; j < invitations && in.ok(); ++j)
+		{
+			uint32_t index = in.u32();
+			if (index < adopted.size())
+				channel->addInvitation(getClientHandle(adopted[index]));
+		}
+		uint32_t restored = in.u32();
+		for (uint32_t j = 0; j < restored && in.ok(); ++j)
+			channel->addRestoredOperator(in.str());
+		waiting += restored;
+	}
+	uint32_t graceLeft = in.u32();
+	if (waiting > 0)
+		_channelStore.resumeGrace(graceLeft);
+	if (!in.ok())
+		throw std::runtime_error("upgrade: truncated state");
+
+	// output the old process could not write yet
+	flushOutput();
+	LOG(LEVEL_INFO, SUB_SERVER) << "Upgrade: adopted " << count << " clients and " << channels
+		<< " channels on port " << _port;
+}
+
+void Server::closeMetricsEndpoint()
+{
+	for (size_t i = _pfds.size(); i-- > 0; )
+		if (_pfds[i].fd != -1 && (_pfds[i].fd == _metrics.getListenFd() || _metrics.isConnection(_pfds[i].fd)))
+			_pfds.erase(_pfds.begin() + i);
+	_metrics.close();
+}
@@ -0,0 +1,284 @@
+#include "Watchdog.hpp"
+#include "Log.hpp"
+#include <sstream>		// for std::ostringstream
+#include <cstring>		// for std::memset, std::memcpy
+#include <ctime>		// for clock_gettime, localtime_r, strftime
+#include <cerrno>		// for ETIMEDOUT
+#include <fcntl.h>		// for open
+#include <unistd.h>		// for write, close
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+static void copyName(char *out, size_t size, const std::string *name)
+{
+	size_t length = 0;
+	if (name)
+	{
+		length = name->size() < size - 1 ? name->size() : size - 1;
+		std::memcpy(out, name->data(), length);
+	}
+	out[length] = '\0';
+}
+
+// sequence lock writer: odd while the fields change
+void Watchdog::beginWrite()
+{
+	__atomic_store_n(&_sequence, _sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void Watchdog::endWrite()
+{
+	__atomic_store_n(&_sequence, _sequence + 1, __ATOMIC_RELEASE);
+}
+
+void Watchdog::publish(const char *phase, int command, int fd, const std::string *nickname,
+						const std::string *target, uint32_t outbox)
+{
+	beginWrite();
+	_activity.phase = phase;
+	_activity.command = command;
+	_activity.fd = fd;
+	copyName(_activity.nickname, sizeof(_activity.nickname), nickname);
+	copyName(_activity.target, sizeof(_activity.target), target);
+	_activity.lines = _lines;
+	_activity.outbox = outbox;
+	endWrite();
+}
+
+// sequence lock reader: retry while the loop is writing; false if it never got a clean copy
+bool Watchdog::readActivity(StallReport &out, uint64_t &busySince) const
+{
+	for (int attempt = 0; attempt < 100; ++attempt)
+	{
+		uint32_t before = __atomic_load_n(&_sequence, __ATOMIC_ACQUIRE);
+		if (before & 1)
+			continue;
+		std::memcpy(&out, &_activity, sizeof(out));
+		busySince = __atomic_load_n(&_busySince, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&_sequence, __ATOMIC_RELAXED) == before)
+			return true;
+	}
+	return false;
+}
+
+void Watchdog::report(const char *what, const StallReport &stall)
+{
+	std::ostringstream line;
+	line << what << ": " << stall.micros / 1000 << " ms in ";
+	if (stall.command >= 0)
+		line << Metrics::name(static_cast<CommandId>(stall.command)) << " fd=" << stall.fd
+			<< " nick=" << (stall.nickname[0] ? stall.nickname : "*")
+			<< " target=" << (stall.target[0] ? stall.target : "*");
+	else
+		line << stall.phase;
+	line << " tick=" << stall.tick << " ready=" << stall.ready << " lines=" << stall.lines
+		<< " outbox=" << stall.outbox << " connections=" << stall.connections;
+
+	if (_logFd == -1)
+	{
+		LOG(LEVEL_WARN, SUB_SERVER) << line.str();
+		return;
+	}
+	char stamp[32];
+	struct timespec now;
+	struct tm tm;
+	clock_gettime(CLOCK_REALTIME, &now);
+	localtime_r(&now.tv_sec, &tm);
+	stamp[strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S ", &tm)] = '\0';
+	std::string text = stamp + line.str() + "\n";
+	if (write(_logFd, text.data(), text.size()) < 0)
+		LOG(LEVEL_WARN, SUB_SERVER) << line.str();
+}
+
+// wake every quarter threshold; flag each stalled tick once
+void Watchdog::watch()
+{
+	uint64_t interval = _thresholdMicros / 4;
+	pthread_mutex_lock(&_mutex);
+	while (!_stopping)
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		uint64_t nanos = deadline.tv_nsec + interval * 1000;
+		deadline.tv_sec += nanos / 1000000000;
+		deadline.tv_nsec = nanos % 1000000000;
+		if (pthread_cond_timedwait(&_wake, &_mutex, &deadline) != ETIMEDOUT)
+			continue;
+
+		// since, tick and the activity come from one snapshot, so a tick boundary cannot mix them
+		StallReport activity;
+		uint64_t since;
+		if (!readActivity(activity, since) || since == 0
+			|| activity.tick == __atomic_load_n(&_reportedTick, __ATOMIC_RELAXED))
+			continue;
+		uint64_t now = Metrics::nowMicros();
+		if (now < since || now - since < _thresholdMicros)
+			continue;
+
+		_detected = activity;
+		_detected.micros = now - since;
+		__atomic_store_n(&_reportedTick, _detected.tick, __ATOMIC_RELEASE);
+		report("stall", _detected);
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+void *Watchdog::threadMain(void *watchdog)
+{
+	static_cast<Watchdog *>(watchdog)->watch();
+	return NULL;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+Watchdog::Watchdog()
+	: _sequence(0), _busySince(0), _tick(0), _reportedTick(0), _lines(0), _thresholdMicros(0), _logFd(-1),
+	_stopping(false)
+{
+	std::memset(&_activity, 0, sizeof(_activity));
+	std::memset(&_detected, 0, sizeof(_detected));
+	std::memset(&_worst, 0, sizeof(_worst));
+	_activity.command = -1;
+	_activity.phase = "events";
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&_wake, &attributes);
+	pthread_condattr_destroy(&attributes);
+}
+
+// destructor
+Watchdog::~Watchdog()
+{
+	stop();
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_mutex);
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+bool Watchdog::start(uint64_t thresholdMillis, const std::string &logPath)
+{
+	if (enabled() || thresholdMillis == 0)
+		return true;
+	if (!logPath.empty())
+	{
+		_logFd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (_logFd == -1)
+			return false;
+	}
+	_thresholdMicros = thresholdMillis * 1000;
+	_stopping = false;
+	if (pthread_create(&_thread, NULL, threadMain, this) != 0)
+	{
+		_thresholdMicros = 0;
+		if (_logFd != -1)
+			close(_logFd);
+		_logFd = -1;
+		return false;
+	}
+	return true;
+}
+
+void Watchdog::stop()
+{
+	if (!enabled())
+		return;
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_signal(&_wake);
+	pthread_mutex_unlock(&_mutex);
+	pthread_join(_thread, NULL);
+	_thresholdMicros = 0;
+	if (_logFd != -1)
+		close(_logFd);
+	_logFd = -1;
+}
+
+// ====================================================================
+// event loop side:
+// ====================================================================
+
+void Watchdog::tickStarted(uint64_t nowMicros, uint32_t ready, uint32_t connections)
+{
+	if (!enabled())
+		return;
+	_lines = 0;
+	beginWrite();
+	_activity.tick = ++_tick;
+	_activity.phase = "events";
+	_activity.command = -1;
+	_activity.fd = -1;
+	_activity.nickname[0] = '\0';
+	_activity.target[0] = '\0';
+	_activity.ready = ready;
+	_activity.lines = 0;
+	_activity.outbox = 0;
+	_activity.connections = connections;
+	__atomic_store_n(&_busySince, nowMicros ? nowMicros : 1, __ATOMIC_RELAXED);
+	endWrite();
+}
+
+// a tick the watchdog flagged is accounted here, with its final duration
+void Watchdog::tickFinished(uint64_t nowMicros)
+{
+	if (!enabled())
+		return;
+	uint64_t since = _busySince;
+	beginWrite();
+	__atomic_store_n(&_busySince, 0, __ATOMIC_RELAXED);
+	endWrite();
+	if (__atomic_load_n(&_reportedTick, __ATOMIC_ACQUIRE) != _tick)
+		return;
+
+	StallReport stall = _detected;
+	stall.micros = nowMicros > since ? nowMicros - since : 0;
+	Metrics::add(C_STALLS);
+	Metrics::record(H_STALL_MICROS, stall.micros);
+	if (stall.command >= 0)
+		Metrics::countStall(static_cast<CommandId>(stall.command), stall.micros);
+	if (stall.micros > _worst.micros)
+		_worst = stall;
+	report("stall over", stall);
+}
+
+void Watchdog::commandStarted(CommandId command, int fd, const std::string &nickname, const std::string &target,
+								uint32_t outbox)
+{
+	if (!enabled())
+		return;
+	++_lines;
+	publish("command", command, fd, &nickname, &target, outbox);
+}
+
+void Watchdog::commandFinished()
+{
+	if (!enabled())
+		return;
+	publish("events", -1, -1, NULL, NULL, _activity.outbox);
+}
+
+void Watchdog::phase(const char *name, uint32_t outbox)
+{
+	if (!enabled())
+		return;
+	publish(name, -1, -1, NULL, NULL, outbox);
+}
@@ -0,0 +1,217 @@
+#include "WorkerPool.hpp"
+#include "Metrics.hpp"
+#include <fcntl.h>		// for fcntl, O_NONBLOCK, FD_CLOEXEC
+#include <unistd.h>		// for pipe, read, write, close
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PRIVATE:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// oldest item of the own deque (queue order), else the newest of the next busy worker
+WorkItem *WorkerPool::take(Worker &worker)
+{
+	WorkItem *item = NULL;
+	pthread_mutex_lock(&worker.lock);
+	if (!worker.queue.empty())
+	{
+		item = worker.queue.front();
+		worker.queue.pop_front();
+	}
+	pthread_mutex_unlock(&worker.lock);
+	for (size_t i = 1; !item && i < _workers.size(); ++i)
+	{
+		Worker &victim = *_workers[(worker.index + i) % _workers.size()];
+		pthread_mutex_lock(&victim.lock);
+		if (!victim.queue.empty())
+		{
+			item = victim.queue.back();
+			victim.queue.pop_back();
+			item->stolen = true;
+		}
+		pthread_mutex_unlock(&victim.lock);
+	}
+	if (item)
+		__atomic_sub_fetch(&_queued, 1, __ATOMIC_ACQ_REL);
+	return item;
+}
+
+// the wake byte is only written when the loop has consumed the previous one
+void WorkerPool::serve(Worker &worker)
+{
+	for (;;)
+	{
+		WorkItem *item = take(worker);
+		if (!item)
+		{
+			pthread_mutex_lock(&_mutex);
+			while (__atomic_load_n(&_queued, __ATOMIC_ACQUIRE) == 0 && !_stopping)
+				pthread_cond_wait(&_work, &_mutex);
+			bool stopping = _stopping;
+			pthread_mutex_unlock(&_mutex);
+			if (stopping)
+				return;
+			continue;
+		}
+		item->started = Metrics::nowMicros();
+		item->run();
+		item->ended = Metrics::nowMicros();
+		_finished.push(item);
+		if (__atomic_exchange_n(&_signalled, 1, __ATOMIC_ACQ_REL) == 0)
+		{
+			char byte = 0;
+			if (write(_wake[1], &byte, 1) < 0)
+				__atomic_store_n(&_signalled, 0, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+void *WorkerPool::threadMain(void *worker)
+{
+	Worker *self = static_cast<Worker *>(worker);
+	self->pool->serve(*self);
+	return NULL;
+}
+
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// 															PUBLIC:
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// |||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+
+// ====================================================================
+// Orthodox Canonical Form elements:
+// ====================================================================
+
+// constructor
+WorkerPool::WorkerPool()
+	: _signalled(0), _queued(0), _next(0), _inFlight(0), _busyMicros(0), _reportedBusy(0), _reportedAt(0),
+	_stopping(false)
+{
+	_wake[0] = -1;
+	_wake[1] = -1;
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_work, NULL);
+}
+
+// destructor
+WorkerPool::~WorkerPool()
+{
+	stop();
+	pthread_cond_destroy(&_work);
+	pthread_mutex_destroy(&_mutex);
+}
+
+// ====================================================================
+// methods:
+// ====================================================================
+
+bool WorkerPool::start(size_t threads)
+{
+	if (enabled() || threads == 0)
+		return true;
+	if (pipe(_wake) == -1)
+		return false;
+	for (int i = 0; i < 2; ++i)
+	{
+		fcntl(_wake[i], F_SETFL, O_NONBLOCK);
+		fcntl(_wake[i], F_SETFD, FD_CLOEXEC);
+	}
+	_stopping = false;
+	for (size_t i = 0; i < threads; ++i)
+	{
+		Worker *worker = new Worker;
+		worker->pool = this;
+		worker->index = i;
+		_workers.push_back(worker);
+	}
+	for (size_t i = 0; i < threads; ++i)
+		if (pthread_create(&_workers[i]->thread, NULL, threadMain, _workers[i]) != 0)
+		{
+			for (size_t j = i; j < threads; ++j)
+				delete _workers[j];
+			_workers.resize(i);
+			stop();
+			return false;
+		}
+	_reportedAt = Metrics::nowMicros();
+	return true;
+}
+
+void WorkerPool::stop()
+{
+	if (_wake[0] == -1)
+		return;
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_broadcast(&_work);
+	pthread_mutex_unlock(&_mutex);
+	for (size_t i = 0; i < _workers.size(); ++i)
+	{
+		pthread_join(_workers[i]->thread, NULL);
+		delete _workers[i];
+	}
+	_workers.clear();
+	close(_wake[0]);
+	close(_wake[1]);
+	_wake[0] = -1;
+	_wake[1] = -1;
+	_queued = 0;
+	_inFlight = 0;
+	_signalled = 0;
+	while (_finished.pop())
+		;
+}
+
+void WorkerPool::submit(WorkItem *item)
+{
+	item->queued = Metrics::nowMicros();
+	item->stolen = false;
+	Worker &worker = *_workers[_next++ % _workers.size()];
+	pthread_mutex_lock(&worker.lock);
+	worker.queue.push_back(item);
+	pthread_mutex_unlock(&worker.lock);
+	__atomic_add_fetch(&_queued, 1, __ATOMIC_ACQ_REL);
+	++_inFlight;
+
+	pthread_mutex_lock(&_mutex);
+	pthread_cond_signal(&_work);
+	pthread_mutex_unlock(&_mutex);
+}
+
+// after this, a worker that finishes an item writes a new byte
+void WorkerPool::clearWake()
+{
+	char buf[64];
+	while (read(_wake[0], buf, sizeof(buf)) > 0)
+		;
+	__atomic_store_n(&_signalled, 0, __ATOMIC_SEQ_CST);
+}
+
+WorkItem *WorkerPool::finished()
+{
+	WorkItem *item = static_cast<WorkItem *>(_finished.pop());
+	if (!item)
+		return NULL;
+	--_inFlight;
+	uint64_t ran = item->ended - item->started;
+	_busyMicros += ran;
+	Metrics::add(C_POOL_JOBS);
+	Metrics::add(C_POOL_BUSY_MICROS, ran);
+	if (item->stolen)
+		Metrics::add(C_POOL_STEALS);
+	Metrics::record(H_POOL_WAIT_MICROS, item->started - item->queued);
+	Metrics::record(H_POOL_RUN_MICROS, ran);
+	return item;
+}
+
+long WorkerPool::utilization()
+{
+	uint64_t now = Metrics::nowMicros();
+	uint64_t capacity = (now - _reportedAt) * _workers.size();
+	long percent = capacity == 0 ? 0 : static_cast<long>((_busyMicros - _reportedBusy) * 100 / capacity);
+	_reportedBusy = _busyMicros;
+	_reportedAt = now;
+	return percent;
+}
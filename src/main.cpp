@@ -1,8 +1,10 @@
 #include "Server.hpp"
+#include "Log.hpp"
 #include <iostream>
 #include <string>
 #include <cstdlib>			// for std::exit, std::atoi
 #include <stdexcept> 		// std::runtime_error, std::exception
+#include <csignal>			// for std::signal, SIGPIPE
 
 // handler for failed allocations
 void noMemoryHandler() {
@@ -31,23 +33,29 @@ int main(int argc, char *argv[])
 	// set handler for failed allocations
 	std::set_new_handler(noMemoryHandler);
 
+	// a peer closing its socket must not kill the server on the next send()
+	std::signal(SIGPIPE, SIG_IGN);
+
 	// start server
+	int status = 0;
 	try {
 		Server server(port, password);
 		server.start();
 	}
 	catch (const std::runtime_error &e) {
 		std::cerr << "Runtime error: " << e.what() << std::endl;
-		return 1;
+		status = 1;
 	}
 	catch (const std::exception &e) {
 		std::cerr << "Unexpected exception: " << e.what() << std::endl;
-		return 1;
+		status = 1;
 	}
 	catch (...) {
 		std::cerr << "Unknown error occurred while starting the server." << std::endl;
-		return 1;
+		status = 1;
 	}
-	
-	return 0;
+
+	// write out what is still queued and stop the log writer thread
+	Log::stop();
+	return status;
 }